@@ -0,0 +1,109 @@
+#include "common/Arena.h"
+#include "common/Logging.h"
+
+#include <algorithm>
+#include <new>
+
+#include <stdlib.h>
+
+using namespace std;
+
+
+namespace sdb {
+
+const size_t Arena::kDefaultChunkSize;
+const size_t Arena::kMaxChunkSize;
+
+Arena::Arena(size_t chunkSize, size_t align, MemoryProvider* provider)
+  : head_(nullptr),
+    provider_(provider),
+    align_(align),
+    nextSize_(max<size_t>(chunkSize, 64)),
+    memoryUsage_(0) {
+  if (align == 0 || (align & (align - 1)) != 0) {
+    LOG(FATAL) << "Arena alignment is not a power of two: " << align;
+  }
+
+  head_ = newChunk(nextSize_);
+  current_.store(head_);
+  grow();
+}
+
+Arena::~Arena() {
+  auto chunk = head_;
+  while (chunk) {
+    auto next = chunk->next;
+    if (provider_) {
+      // the region lives in the chunk it unmaps
+      auto region = chunk->region;
+      provider_->unmap(region);
+    } else {
+      free(chunk);
+    }
+    chunk = next;
+  }
+}
+
+void Arena::reset() {
+  for (auto chunk = head_; chunk; chunk = chunk->next) {
+    chunk->used.store(0, memory_order_relaxed);
+  }
+  current_.store(head_);
+}
+
+void* Arena::allocateSlow(size_t nbytes, size_t align) {
+  lock_guard<mutex> l(mt_);
+
+  // another thread may have moved on while this one waited
+  auto chunk = current_.load(memory_order_relaxed);
+  auto p = tryAllocate(chunk, nbytes, align);
+  if (p) {
+    return p;
+  }
+
+  // enough for @nbytes however the chunk happens to be aligned
+  size_t need = nbytes + align;
+
+  // chunks after the current one are empty since reset(); one that is
+  // too small stays in the chain for the next round
+  auto next = chunk->next;
+  if (!next || next->size < need) {
+    next = newChunk(max(nextSize_, need));
+    next->next = chunk->next;
+    chunk->next = next;
+    grow();
+  }
+
+  // take the slice before other threads can see the chunk
+  p = tryAllocate(next, nbytes, align);
+  current_.store(next, memory_order_release);
+  return p;
+}
+
+void Arena::grow() {
+  nextSize_ = max(nextSize_, min(nextSize_ * 2, kMaxChunkSize));
+}
+
+Arena::Chunk* Arena::newChunk(size_t size) {
+  Chunk* chunk = nullptr;
+  MemoryProvider::Region region{nullptr, sizeof(Chunk) + size, 0};
+  if (provider_) {
+    // the rest of the last huge page is usable too
+    region = provider_->map(sizeof(Chunk) + size);
+    chunk = (Chunk*)region.addr;
+  } else {
+    chunk = (Chunk*)malloc(sizeof(Chunk) + size);
+    if (!chunk) {
+      LOG(FATAL) << "Fails to allocate an arena chunk of " << size;
+    }
+  }
+
+  chunk->next = nullptr;
+  chunk->size = region.size - sizeof(Chunk);
+  new (&chunk->used) atomic<size_t>(0);
+  chunk->region = region;
+  memoryUsage_.fetch_add(region.size);
+  return chunk;
+}
+
+}
@@ -0,0 +1,209 @@
+#ifndef COMMON_ARENA_H
+#define COMMON_ARENA_H
+
+#include "common/MemoryProvider.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+
+#if __cplusplus >= 201703L
+#include <memory_resource>
+#endif
+
+
+namespace sdb {
+
+// An arena hands out memory by bumping a pointer through a chain of
+// chunks, and frees all of it at once when it is destructed.
+//
+// allocate() may be called from any number of threads: it takes an
+// aligned slice of the current chunk with a single compare-and-swap, and
+// only a thread that finds the chunk full takes a lock to chain the next
+// one. Chunks grow geometrically, from @chunkSize up to kMaxChunkSize,
+// and a request too large for the next chunk gets one of its own size.
+//
+// reset() makes all chunks available again without freeing them, so an
+// arena reused for similar work stops calling malloc after the first
+// round.
+//
+// Chunks come from malloc, or from a MemoryProvider if one is given, in
+// which case each chunk is rounded up to whole huge pages.
+class Arena {
+ public:
+
+  static const size_t kDefaultChunkSize = 4096;
+
+  // chunks stop growing at this size
+  static const size_t kMaxChunkSize = 1024 * 1024;
+
+  // Allocations are aligned to @align bytes, a power of two, unless a
+  // call asks for more. @provider, if any, must outlive the arena
+  explicit Arena(size_t chunkSize = kDefaultChunkSize, size_t align = 8,
+                 MemoryProvider* provider = nullptr);
+
+  ~Arena();
+
+  Arena(const Arena&) = delete;
+
+  Arena& operator=(const Arena&) = delete;
+
+  // return @nbytes aligned to the alignment of the arena
+  void* allocate(size_t nbytes) {
+    return allocate(nbytes, align_);
+  }
+
+  // return @nbytes aligned to @align, a power of two
+  void* allocate(size_t nbytes, size_t align);
+
+  // Make all memory available to allocate() again, without returning
+  // any to malloc. Nothing allocated before may be used afterwards, and
+  // no other thread may allocate at the same time
+  void reset();
+
+  size_t alignment() const { return align_; }
+
+  // bytes held in chunks, used or not
+  size_t memoryUsage() const { return memoryUsage_.load(); }
+
+ private:
+
+  struct Chunk {
+    Chunk* next;
+    size_t size;
+    std::atomic<size_t> used;
+
+    // where the chunk was mapped, if it came from a MemoryProvider
+    MemoryProvider::Region region;
+
+    char* data() { return (char*)(this + 1); }
+  };
+
+  std::atomic<Chunk*> current_;
+
+  Chunk* head_;
+
+  MemoryProvider* provider_;
+
+  // guards moving to the next chunk
+  std::mutex mt_;
+
+  size_t align_;
+
+  // size of the next chunk to allocate
+  size_t nextSize_;
+
+  std::atomic<size_t> memoryUsage_;
+
+  // take @nbytes aligned to @align from @chunk, nullptr if it is full
+  static void* tryAllocate(Chunk* chunk, size_t nbytes, size_t align);
+
+  void* allocateSlow(size_t nbytes, size_t align);
+
+  Chunk* newChunk(size_t size);
+
+  // double the size of the next chunk, up to kMaxChunkSize
+  void grow();
+};
+
+inline void* Arena::tryAllocate(Chunk* chunk, size_t nbytes, size_t align) {
+  auto base = (uintptr_t)chunk->data();
+  size_t used = chunk->used.load(std::memory_order_relaxed);
+  for (;;) {
+    size_t beg =
+      ((base + used + align - 1) & ~(uintptr_t)(align - 1)) - base;
+    size_t end = beg + nbytes;
+    if (end > chunk->size) {
+      return nullptr;
+    }
+    if (chunk->used.compare_exchange_weak(
+          used, end, std::memory_order_relaxed)) {
+      return (void*)(base + beg);
+    }
+  }
+}
+
+inline void* Arena::allocate(size_t nbytes, size_t align) {
+  auto p = tryAllocate(current_.load(std::memory_order_acquire),
+                       nbytes, align);
+  return p ? p : allocateSlow(nbytes, align);
+}
+
+
+// STL allocator that takes memory from an Arena, which must outlive the
+// containers using it. deallocate() is a no-op, memory comes back when
+// the arena is reset or destructed
+template <class T>
+class ArenaAllocator {
+ public:
+
+  typedef T value_type;
+
+  explicit ArenaAllocator(Arena* arena) : arena_(arena) {}
+
+  template <class U>
+  ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena()) {}
+
+  T* allocate(size_t n) {
+    size_t align = arena_->alignment();
+    return (T*)arena_->allocate(
+      n * sizeof(T), (alignof(T) > align) ? alignof(T) : align);
+  }
+
+  void deallocate(T* p, size_t n) {}
+
+  Arena* arena() const { return arena_; }
+
+ private:
+
+  Arena* arena_;
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.arena() == b.arena();
+}
+
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.arena() != b.arena();
+}
+
+
+#if __cplusplus >= 201703L
+
+// Lets std::pmr containers allocate from an Arena, which must outlive
+// them, e.g.
+//
+//   Arena arena;
+//   ArenaResource resource(&arena);
+//   std::pmr::vector<int> vec(&resource);
+class ArenaResource : public std::pmr::memory_resource {
+ public:
+
+  explicit ArenaResource(Arena* arena) : arena_(arena) {}
+
+  Arena* arena() const { return arena_; }
+
+ private:
+
+  Arena* arena_;
+
+  void* do_allocate(size_t bytes, size_t align) override {
+    return arena_->allocate(bytes, align);
+  }
+
+  void do_deallocate(void* p, size_t bytes, size_t align) override {}
+
+  bool do_is_equal(
+    const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+};
+
+#endif
+
+}
+
+#endif // COMMON_ARENA_H
@@ -0,0 +1,257 @@
+#include "common/BufferPool.h"
+#include "common/MemoryProvider.h"
+#include "common/Logging.h"
+
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+
+#include <stdlib.h>
+
+using namespace std;
+
+
+namespace sdb {
+
+// overlays a free buffer
+struct FreeBuffer {
+  FreeBuffer* next;
+  FreeBuffer* nextBatch;
+  int64_t count;
+};
+
+struct BufferDepot {
+  mutex mt;
+  FreeBuffer* batches;
+  int64_t bytes;
+
+  // the unused part of the last region mapped for this class
+  char* regionBegin;
+  char* regionEnd;
+
+  BufferDepot()
+    : batches(nullptr), bytes(0), regionBegin(nullptr), regionEnd(nullptr) {
+  }
+};
+
+struct BufferPoolState {
+  BufferDepot depots[BufferPool::kNumClasses];
+  atomic<int64_t> hits;
+  atomic<int64_t> misses;
+  atomic<int64_t> bytesRetained;
+  atomic<MemoryProvider*> provider;
+
+  BufferPoolState()
+    : hits(0), misses(0), bytesRetained(0), provider(nullptr) {}
+};
+
+struct BufferCache {
+  FreeBuffer* heads[BufferPool::kNumClasses];
+  int64_t counts[BufferPool::kNumClasses];
+
+  // not published to BufferPoolState yet
+  int64_t hits;
+  int64_t retained;
+
+  BufferCache() : hits(0), retained(0) {
+    fill(heads, heads + BufferPool::kNumClasses, nullptr);
+    fill(counts, counts + BufferPool::kNumClasses, 0);
+  }
+
+  ~BufferCache();
+};
+
+
+// never destructed, so that thread caches can be flushed at any time
+static BufferPoolState& state() {
+  static BufferPoolState* s = new BufferPoolState;
+  return *s;
+}
+
+static BufferCache& cache() {
+  static thread_local BufferCache c;
+  return c;
+}
+
+// number of buffers moved between a thread cache and the depot at once
+static int64_t batchSize(int cls) {
+  return max<int64_t>(1, 64 * 1024 / BufferPool::classSize(cls));
+}
+
+static void publish(BufferCache& c) {
+  auto& s = state();
+  s.hits.fetch_add(c.hits);
+  s.bytesRetained.fetch_add(c.retained);
+  c.hits = 0;
+  c.retained = 0;
+}
+
+// move a batch of class @cls from the depot to @c, false if there is none
+static bool refill(BufferCache& c, int cls) {
+  auto& d = state().depots[cls];
+
+  {
+    lock_guard<mutex> l(d.mt);
+    auto batch = d.batches;
+    if (!batch) {
+      return false;
+    }
+
+    d.batches = batch->nextBatch;
+    d.bytes -= batch->count * BufferPool::classSize(cls);
+    c.heads[cls] = batch;
+    c.counts[cls] = batch->count;
+  }
+
+  publish(c);
+  return true;
+}
+
+// move up to @num buffers of class @cls from @c to the depot as one
+// batch, or free them if the depot is full
+static void flush(BufferCache& c, int cls, int64_t num) {
+  auto batch = c.heads[cls];
+  auto tail = batch;
+  int64_t n = 1;
+  while (n < num && tail->next) {
+    tail = tail->next;
+    ++n;
+  }
+
+  c.heads[cls] = tail->next;
+  c.counts[cls] -= n;
+  tail->next = nullptr;
+  batch->count = n;
+
+  auto bytes = n * BufferPool::classSize(cls);
+  auto& d = state().depots[cls];
+  bool kept = false;
+  {
+    lock_guard<mutex> l(d.mt);
+    if (d.bytes + bytes <= BufferPool::kMaxDepotBytes ||
+        state().provider.load(memory_order_acquire)) {
+      batch->nextBatch = d.batches;
+      d.batches = batch;
+      d.bytes += bytes;
+      kept = true;
+    }
+  }
+
+  if (!kept) {
+    while (batch) {
+      auto next = batch->next;
+      free(batch);
+      batch = next;
+    }
+    c.retained -= bytes;
+  }
+
+  publish(c);
+}
+
+static void flushAll(BufferCache& c) {
+  for (int cls = 0; cls < BufferPool::kNumClasses; ++cls) {
+    while (c.heads[cls]) {
+      flush(c, cls, batchSize(cls));
+    }
+  }
+  publish(c);
+}
+
+BufferCache::~BufferCache() {
+  flushAll(*this);
+}
+
+// a new buffer of class @cls, carved from a region of @provider
+static void* carve(MemoryProvider* provider, int cls) {
+  auto size = BufferPool::classSize(cls);
+  auto& d = state().depots[cls];
+  lock_guard<mutex> l(d.mt);
+  if (d.regionEnd - d.regionBegin < size) {
+    // class sizes divide the huge page size, so a region is used up
+    // exactly
+    auto region = provider->map(size);
+    d.regionBegin = (char*)region.addr;
+    d.regionEnd = d.regionBegin + region.size;
+  }
+
+  auto p = d.regionBegin;
+  d.regionBegin += size;
+  return p;
+}
+
+int BufferPool::sizeClass(size_t size) {
+  if (size <= kMinClassSize) {
+    return 0;
+  }
+  if (size > kMaxClassSize) {
+    return -1;
+  }
+
+  // log2 of the next power of two, minus log2(kMinClassSize)
+  return 64 - __builtin_clzll(size - 1) - 9;
+}
+
+void* BufferPool::allocate(size_t size) {
+  int cls = sizeClass(size);
+  auto& c = cache();
+
+  if (cls < 0 || (!c.heads[cls] && !refill(c, cls))) {
+    state().misses.fetch_add(1);
+    auto provider = state().provider.load(memory_order_acquire);
+    if (cls >= 0 && provider) {
+      return carve(provider, cls);
+    }
+
+    auto p = malloc(cls < 0 ? size : classSize(cls));
+    if (!p) {
+      LOG(FATAL) << "Fails to allocate a buffer of " << size;
+    }
+    return p;
+  }
+
+  auto b = c.heads[cls];
+  c.heads[cls] = b->next;
+  --c.counts[cls];
+  ++c.hits;
+  c.retained -= classSize(cls);
+  return b;
+}
+
+void BufferPool::deallocate(void* p, size_t size) {
+  int cls = sizeClass(size);
+  if (cls < 0) {
+    free(p);
+    return;
+  }
+
+  auto& c = cache();
+  auto b = (FreeBuffer*)p;
+  b->next = c.heads[cls];
+  c.heads[cls] = b;
+  c.retained += classSize(cls);
+
+  auto batch = batchSize(cls);
+  if (++c.counts[cls] >= 2 * batch) {
+    flush(c, cls, batch);
+  }
+}
+
+BufferPool::Stats BufferPool::getStats() {
+  auto& s = state();
+  Stats ret;
+  ret.hits = s.hits.load();
+  ret.misses = s.misses.load();
+  ret.bytesRetained = s.bytesRetained.load();
+  return ret;
+}
+
+void BufferPool::flushThreadCache() {
+  flushAll(cache());
+}
+
+void BufferPool::setMemoryProvider(MemoryProvider* provider) {
+  state().provider.store(provider, memory_order_release);
+}
+
+}
@@ -0,0 +1,78 @@
+#ifndef COMMON_BUFFERPOOL_H
+#define COMMON_BUFFERPOOL_H
+
+#include <cstdint>
+#include <cstddef>
+
+
+namespace sdb {
+
+class MemoryProvider;
+
+// A pool of IO buffers in power-of-two size classes, from
+// kMinClassSize to kMaxClassSize bytes.
+//
+// It works like BlockPool, one size class at a time: each thread keeps
+// a free list per class that needs no lock, full lists move batches to
+// a global depot, and threads running dry take batches back from it. A
+// buffer may be freed on any thread. Unlike BlockPool, the depot keeps
+// at most kMaxDepotBytes per class and frees the rest, so a burst of
+// large messages does not pin its memory forever.
+//
+// Requests above kMaxClassSize go to malloc directly.
+//
+// Once a MemoryProvider is set, new buffers are carved from regions it
+// maps instead of malloc'ed one by one. Those can not be freed alone, so
+// from then on the depot keeps every buffer it is given.
+class BufferPool {
+ public:
+
+  static const size_t kMinClassSize = 512;
+
+  static const size_t kMaxClassSize = 1024 * 1024;
+
+  static const int kNumClasses = 12;
+
+  // bytes of free buffers the depot keeps per class
+  static const size_t kMaxDepotBytes = 16 * 1024 * 1024;
+
+  struct Stats {
+    // allocations served from a free list
+    int64_t hits;
+
+    // allocations that went to malloc
+    int64_t misses;
+
+    // bytes of free buffers held by thread caches and the depot
+    int64_t bytesRetained;
+  };
+
+ public:
+
+  // return a buffer of at least @size bytes
+  static void* allocate(size_t size);
+
+  // free @p, which was allocated with the same @size
+  static void deallocate(void* p, size_t size);
+
+  // size class of @size, -1 if it is too large for the pool
+  static int sizeClass(size_t size);
+
+  static size_t classSize(int cls) { return kMinClassSize << cls; }
+
+  // Thread caches publish their counts a batch at a time, so hits and
+  // retained bytes may lag behind by a batch per thread
+  static Stats getStats();
+
+  // hand the calling thread's free buffers to the depot, which frees
+  // what it can not keep
+  static void flushThreadCache();
+
+  // take new buffers from @provider from now on. It must never be
+  // destructed, and it can not be replaced or unset afterwards
+  static void setMemoryProvider(MemoryProvider* provider);
+};
+
+}
+
+#endif // COMMON_BUFFERPOOL_H
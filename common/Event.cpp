@@ -1,10 +1,17 @@
 #include "common/Event.h"
 #include "common/ThreadPool.h"
+#include "common/TimerWheel.h"
+#include "common/Slab.h"
 #include "common/Logging.h"
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
+#include <string.h>
+#include <errno.h>
 #include <vector>
 #include <chrono>
 
@@ -16,6 +23,14 @@ using namespace std::chrono;
 
 namespace sdb {
 
+// the event loop running on current thread, if any
+static thread_local EventLoop* tlsLoop = nullptr;
+
+static int64_t nowInMs() {
+  auto now = steady_clock::now();
+  return duration_cast<milliseconds>(now.time_since_epoch()).count();
+}
+
 void setAlarm(int fd, int64_t abs) {
   int64_t secs = abs / 1000;
   struct itimerspec val;
@@ -30,44 +45,6 @@ void setAlarm(int fd, int64_t abs) {
 }
 
 
-class FunctionEvent : virtual public SynchronizedEvent {
- public:
-
-  explicit FunctionEvent(function<void()>&& callback)
-    : callback_(move(callback)) {}
-
-  ~FunctionEvent() override {}
-
-  void process() override {
-    callback_();
-    delete this;
-  }
-
- private:
-
-  function<void()> callback_;
-};
-
-
-class FunctionAlarmEvent : virtual public AlarmEvent {
- public:
-
-  explicit FunctionAlarmEvent(function<void()>&& callback)
-    : callback_(move(callback)) {}
-
-  ~FunctionAlarmEvent() override {}
-
-  void handleTimeout() override {
-    callback_();
-    delete this;
-  }
-
- private:
-
-  function<void()> callback_;
-};
-
-
 uint64_t AlarmEvent::getID() const {
   auto x = (uint64_t)this;
   return (x * 4398042316799ULL + 274876858367ULL);
@@ -114,17 +91,58 @@ void SynchronizedEvent::consumeWrites() {
 }
 
 
-// A wrapper of Linux timerfd API
+// A timer scheduled through EventManager. It is referenced by its
+// handles, and by its TimerEvent until it fires or is cancelled.
+struct TimerRecord : public TimerNode {
+  enum {
+    state_pending = 0,
+    state_fired,
+    state_cancelled,
+  };
+
+  Task fn;
+
+  TimerEvent* owner;
+
+  std::atomic<int> state;
+
+  std::atomic<int> refs;
+
+  TimerRecord(int64_t ts, Task&& cb)
+    : fn(move(cb)), owner(nullptr), state(state_pending), refs(1) {
+    expiry = ts;
+  }
+
+  void addRef() {
+    refs.fetch_add(1, memory_order_relaxed);
+  }
+
+  void release() {
+    if (refs.fetch_sub(1, memory_order_acq_rel) == 1) {
+      delete this;
+    }
+  }
+
+  SDB_POOLED(TimerRecord)
+};
+
+
+// A wrapper of Linux timerfd API. Timers are kept in a TimerWheel that
+// is only touched from the event loop of the timer, other threads hand
+// their timers over through the loop's task queue.
 class TimerEvent : public Event {
  public:
 
   TimerEvent(EventLoop* ep, ThreadPool* tp)
   : fd_(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
     ep_(ep),
-    tp_(tp) {
+    tp_(tp),
+    wheel_(nowInMs()),
+    armed_(-1) {
 
     if (ep_ && fd_ >= 0) {
-      ep_->addEvent(this, EventLoop::handle_read);
+      ep_->addEvent(
+        this, EventLoop::handle_read | EventLoop::handle_priority);
     }
   }
 
@@ -135,10 +153,13 @@ class TimerEvent : public Event {
     if (fd_ >= 0) {
       close(fd_);
     }
-    for (auto& v : hmap_) {
-      for (auto p : v.second) {
-        delete p;
-      }
+
+    auto p = wheel_.clear();
+    while (p) {
+      auto rec = static_cast<TimerRecord*>(p);
+      p = p->next;
+      rec->fn.reset();
+      rec->release();
     }
   }
 
@@ -152,36 +173,27 @@ class TimerEvent : public Event {
     char buf[maxRead];
     while (read(fd_, buf, maxRead) > 0);
 
-    auto now = steady_clock::now();
-    int64_t ms = duration_cast<milliseconds>(now.time_since_epoch()).count();
-    vector<AlarmEvent*> tss;
+    // the timerfd is disarmed once it sets off
+    armed_ = -1;
 
-    {
-      lock_guard<mutex> l(mt_);
-      auto it = hmap_.begin();
-      while (it != hmap_.end()) {
-        if (it->first > ms) {
-          break;
-        }
-
-        tss.insert(tss.end(), it->second.begin(), it->second.end());
-        ++it;
-      }
+    auto p = wheel_.advance(nowInMs());
+    while (p) {
+      auto rec = static_cast<TimerRecord*>(p);
+      p = p->next;
 
-      auto beg = hmap_.begin();
-      if (it != beg) {
-        hmap_.erase(beg, it);
+      int expected = TimerRecord::state_pending;
+      if (rec->state.compare_exchange_strong(
+            expected, TimerRecord::state_fired)) {
+        rec->fn();
       }
 
-      if (it != hmap_.end()) {
-        setAlarm(fd_, it->first);
-      } else {
-        setAlarm(fd_, 0);
-      }
+      rec->fn.reset();
+      rec->release();
     }
 
-    for (auto p : tss) {
-      p->handleTimeout();
+    auto next = wheel_.nextExpiry();
+    if (next >= 0) {
+      arm(next);
     }
   }
 
@@ -192,16 +204,26 @@ class TimerEvent : public Event {
   }
 
 
-  void addTimeout(int64_t absTimeInMs, AlarmEvent* runnable) {
-    int64_t lower = numeric_limits<int64_t>::max();
-    lock_guard<mutex> l(mt_);
-    auto it = hmap_.begin();
-    if (it != hmap_.end()) {
-      lower = it->first;
+  // queue @rec and take over its reference
+  void addTimeout(TimerRecord* rec) {
+    rec->owner = this;
+    if (ep_->inLoopThread()) {
+      insert(rec);
+    } else {
+      ep_->submit([this, rec]() { insert(rec); });
     }
-    hmap_[absTimeInMs].push_back(runnable);
-    if (absTimeInMs < lower) {
-      setAlarm(fd_, absTimeInMs);
+  }
+
+  // remove a cancelled @rec from the wheel
+  void cancel(TimerRecord* rec) {
+    if (ep_->inLoopThread()) {
+      unlink(rec);
+    } else {
+      rec->addRef();
+      ep_->submit([this, rec]() {
+        unlink(rec);
+        rec->release();
+      });
     }
   }
 
@@ -217,112 +239,332 @@ class TimerEvent : public Event {
 
   ThreadPool* tp_;
 
-  std::map<int64_t, std::vector<AlarmEvent*>> hmap_;
+  TimerWheel wheel_;
+
+  // time the timerfd is set to, or -1 if it is not armed
+  int64_t armed_;
 
-  std::mutex mt_;
+
+  void insert(TimerRecord* rec) {
+    if (rec->state.load() != TimerRecord::state_pending) {
+      // cancelled before it got here
+      rec->fn.reset();
+      rec->release();
+      return;
+    }
+
+    wheel_.add(rec);
+    if (armed_ < 0 || rec->expiry < armed_) {
+      arm(rec->expiry);
+    }
+  }
+
+  void unlink(TimerRecord* rec) {
+    // otherwise it is not queued yet, or about to be dropped by
+    // handleRead(), and the reference is released there
+    if (rec->linked()) {
+      wheel_.remove(rec);
+      rec->fn.reset();
+      rec->release();
+    }
+  }
+
+  void arm(int64_t ts) {
+    if (ts != armed_) {
+      setAlarm(fd_, ts);
+      armed_ = ts;
+    }
+  }
 
 };
 
 
-EventLoop::EventLoop(int maxEvents) : maxEvents_(maxEvents) {
-  fd_ = epoll_create(maxEvents_);
-  quit_ = false;
+TimerHandle::TimerHandle(const TimerHandle& other) : rec_(other.rec_) {
+  if (rec_) {
+    rec_->addRef();
+  }
+}
+
+TimerHandle::~TimerHandle() {
+  if (rec_) {
+    rec_->release();
+  }
+}
+
+bool TimerHandle::cancel() {
+  if (!rec_) {
+    return false;
+  }
+
+  int expected = TimerRecord::state_pending;
+  if (!rec_->state.compare_exchange_strong(
+        expected, TimerRecord::state_cancelled)) {
+    return false;
+  }
+
+  rec_->owner->cancel(rec_);
+  return true;
+}
+
+bool TimerHandle::pending() const {
+  return rec_ && rec_->state.load() == TimerRecord::state_pending;
+}
+
+
+EventLoop::EventLoop(int maxEvents, int backend)
+  : poller_(Poller::create(backend, maxEvents)),
+    wakeFd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+    maxEvents_(maxEvents),
+    spinUs_(0),
+    quit_(false),
+    notified_(false) {
+  if (wakeFd_ < 0) {
+    LOG(FATAL) << "Fails to create event loop " << strerror(errno);
+  }
+
+  // the loop itself stands for wakeFd_ in the event data
+  if (!poller_->add(wakeFd_, EPOLLIN, (uint64_t)this)) {
+    LOG(FATAL) << "Fails to register wakeup fd " << strerror(errno);
+  }
 }
 
 EventLoop::~EventLoop() {
-  if (fd_ >= 0) {
-    close(fd_);
+  // release the poller first, a pending io_uring poll holds wakeFd_
+  poller_.reset();
+  if (wakeFd_ >= 0) {
+    close(wakeFd_);
   }
 }
 
-bool EventLoop::addEvent(Event* handler, int opt) {
-  struct epoll_event event;
-  event.events = 0;
-  if (opt & handle_read) {
-    event.events |= EPOLLIN;
+// Event objects are at least pointer aligned, the lowest bit of the
+// event data marks events registered with handle_priority, the next one
+// marks completions (PollEvent::kCompletionTag)
+static const uint64_t kPriorityTag = 1;
+
+static uint32_t toEpollEvents(int opt) {
+  uint32_t events = 0;
+  if (opt & EventLoop::handle_read) {
+    events |= EPOLLIN;
+  }
+  if (opt & EventLoop::handle_write) {
+    events |= EPOLLOUT;
+  }
+  if (opt & EventLoop::handle_error) {
+    events |= EPOLLERR;
   }
-  if (opt & handle_write) {
-    event.events |= EPOLLOUT;
+  if (opt & EventLoop::handle_edge) {
+    events |= EPOLLET;
   }
-  if (opt & handle_error) {
-    event.events |= EPOLLERR;
+  if (opt & EventLoop::handle_oneshot) {
+    events |= EPOLLONESHOT;
   }
-  event.data.ptr = (void*)handler;
-  return (0 == epoll_ctl(fd_, EPOLL_CTL_ADD, handler->getFD(), &event));
+  return events;
 }
 
-bool EventLoop::updateEvent(Event* handler, int opt) {
-  struct epoll_event event;
-  event.events = 0;
-  if (opt & handle_read) {
-    event.events |= EPOLLIN;
+uint64_t EventLoop::eventData(Event* handler, int opt) {
+  auto data = (uint64_t)handler;
+  if (opt & handle_priority) {
+    data |= kPriorityTag;
   }
-  if (opt & handle_write) {
-    event.events |= EPOLLOUT;
+  return data;
+}
+
+bool EventLoop::addEvent(Event* handler, int opt) {
+  int fd = handler->getFD();
+  auto events = toEpollEvents(opt);
+  auto data = eventData(handler, opt);
+
+  if (!poller_->isThreadSafe() && !inLoopThread()) {
+    submit([this, fd, events, data]() {
+      if (!poller_->add(fd, events, data)) {
+        LOG(ERROR) << "Fails to add event for fd " << fd;
+      }
+    });
+    return true;
   }
-  if (opt & handle_error) {
-    event.events |= EPOLLERR;
+  return poller_->add(fd, events, data);
+}
+
+bool EventLoop::updateEvent(Event* handler, int opt) {
+  int fd = handler->getFD();
+  auto events = toEpollEvents(opt);
+  auto data = eventData(handler, opt);
+
+  if (!poller_->isThreadSafe() && !inLoopThread()) {
+    submit([this, fd, events, data]() {
+      if (!poller_->update(fd, events, data)) {
+        LOG(ERROR) << "Fails to update event for fd " << fd;
+      }
+    });
+    return true;
   }
-  event.data.ptr = (void*)handler;
-  return (0 == epoll_ctl(fd_, EPOLL_CTL_MOD, handler->getFD(), &event));
+  return poller_->update(fd, events, data);
 }
 
 bool EventLoop::removeEvent(Event* handler) {
-  struct epoll_event event;
-  event.events = 0;
-  event.data.ptr = (void*)handler;
-  return (0 == epoll_ctl(fd_, EPOLL_CTL_DEL, handler->getFD(), &event));
+  int fd = handler->getFD();
+
+  if (!poller_->isThreadSafe() && !inLoopThread()) {
+    submit([this, fd]() { poller_->remove(fd); });
+    return true;
+  }
+  return poller_->remove(fd);
 }
 
 void EventLoop::loop() {
-  vector<struct epoll_event> events(maxEvents_);
+  auto prevLoop = tlsLoop;
+  tlsLoop = this;
+
+  vector<PollEvent> events(maxEvents_);
+  auto lastActive = steady_clock::now();
+  bool spinning = false;
+
   while (!quit_) {
-    int num = epoll_wait(fd_, &events[0], maxEvents_, -1);
-    for (int i = 0; i < num; ++i) {
-      auto& e = events[i];
+    int timeout = -1;
+
+    if (spinUs_ > 0) {
+      auto now = steady_clock::now();
+      if (duration_cast<microseconds>(now - lastActive).count() < spinUs_) {
+        // while spinning producers need not signal wakeFd_, the queue
+        // is checked on every iteration
+        spinning = true;
+        timeout = 0;
+        notified_.store(true);
+        if (runTasks(kTaskBatchSize) > 0) {
+          lastActive = now;
+        }
+      } else if (spinning) {
+        // stop spinning, make sure no task sneaked in before producers
+        // got to see notified_ cleared
+        spinning = false;
+        notified_.exchange(false);
+        if (runTasks(kTaskBatchSize) > 0) {
+          lastActive = now;
+          continue;
+        }
+      }
+    }
+
+    int num = poller_->wait(&events[0], maxEvents_, timeout);
+    if (num <= 0) {
+      continue;
+    }
+    if (spinUs_ > 0) {
+      lastActive = steady_clock::now();
+    }
 
-      if (e.events & EPOLLIN) {
-        auto p = (Event*)e.data.ptr;
-        p->handleRead();
+    // run queued tasks first, then priority events like timers, and
+    // then the other events
+    for (int i = 0; i < num; ++i) {
+      if (events[i].data == (uint64_t)this) {
+        handleWakeup();
       }
-      if (e.events & EPOLLOUT) {
-        auto p = (Event*)e.data.ptr;
-        p->handleWrite();
+    }
+
+    for (int i = 0; i < num; ++i) {
+      auto data = events[i].data;
+      if (data & kPriorityTag) {
+        dispatch(events[i].events, (Event*)(data & ~kPriorityTag));
       }
-      if (e.events & ~(EPOLLIN | EPOLLOUT)) {
-        auto p = (Event*)e.data.ptr;
-        p->handleError();
+    }
+
+    for (int i = 0; i < num; ++i) {
+      auto data = events[i].data;
+      if (data & PollEvent::kCompletionTag) {
+        auto done = (IoCompletion*)(data & ~PollEvent::kCompletionTag);
+        done->handleCompletion(events[i].res, events[i].flags);
+      } else if (!(data & kPriorityTag) && data != (uint64_t)this) {
+        dispatch(events[i].events, (Event*)data);
       }
     }
+
+    poller_->afterDispatch();
+  }
+
+  tlsLoop = prevLoop;
+}
+
+void EventLoop::dispatch(uint32_t events, Event* p) {
+  if (events & EPOLLIN) {
+    p->handleRead();
+  }
+  if (events & EPOLLOUT) {
+    p->handleWrite();
+  }
+  if (events & ~(EPOLLIN | EPOLLOUT)) {
+    p->handleError();
   }
 }
 
 int EventLoop::getFD() const {
-  return fd_;
+  return poller_->getFD();
+}
+
+bool EventLoop::inLoopThread() const {
+  return tlsLoop == this;
 }
 
-void EventLoop::submit(function<void()>&& cob) {
-  auto p = new FunctionEvent(move(cob));
-  p->notify_one();
-  addEvent(p, handle_read);
+void EventLoop::submit(Task&& cob) {
+  tasks_.push(move(cob));
+  wakeup();
+}
+
+void EventLoop::wakeup() {
+  if (!notified_.exchange(true)) {
+    uint64_t one = 1;
+    if (0 > write(wakeFd_, &one, sizeof(one))) {
+      LOG(FATAL) << "fails to write to " << wakeFd_;
+    }
+  }
+}
+
+void EventLoop::handleWakeup() {
+  uint64_t val = 0;
+  if (0 > read(wakeFd_, &val, sizeof(val)) && errno != EAGAIN) {
+    LOG(FATAL) << "fails to read from " << wakeFd_;
+  }
+
+  // producers that come after this point signal wakeFd_ again, and
+  // the exchange makes pushes done before it visible to us
+  notified_.exchange(false);
+
+  if (runTasks(kTaskBatchSize) == kTaskBatchSize) {
+    // give other events a chance before running the rest
+    wakeup();
+  }
+}
+
+int EventLoop::runTasks(int maxTasks) {
+  Task task;
+  int i = 0;
+  for (; i < maxTasks; ++i) {
+    if (!tasks_.pop(task)) {
+      break;
+    }
+
+    task();
+    task.reset();
+  }
+
+  return i;
 }
 
 void EventLoop::quitLoopSoon() {
-  quit_ = true;
-  submit([]() {});
+  submit([this]() { quit_ = true; });
 }
 
 
 EventManager::
-EventManager(int numLoops, int numTimers)
+EventManager(int numLoops, int numTimers, int backend)
   : tp_(new ThreadPool(numLoops)),
     timerTp_(new ThreadPool(numTimers)),
-    idx_(0) {
+    idx_(0),
+    drained_(false) {
 
   const int maxEvents = 8192;
 
   for (int i = 0; i < numLoops; ++i) {
-    auto loop = new EventLoop(maxEvents);
+    auto loop = new EventLoop(maxEvents, backend);
     epolls_.push_back(loop);
     tp_->submit([loop]() { loop->loop(); });
   }
@@ -339,6 +581,9 @@ EventManager(int numLoops, int numTimers)
 }
 
 EventManager::~EventManager() {
+  // the pools join their threads, which run the loops until they quit
+  drain();
+
   for (auto p : timers_) {
     delete p;
   }
@@ -347,15 +592,31 @@ EventManager::~EventManager() {
   delete tp_;
 }
 
-void EventManager::submit(function<void()>&& callback) {
+void EventManager::submit(Task&& callback) {
   auto eventLoop = pickEventLoop();
   eventLoop->submit(move(callback));
 }
 
-void EventManager::submit(int64_t absTimeoutInMs, function<void()>&& callback) {
-  auto event = new FunctionAlarmEvent(move(callback));
-  int n = event->getID() % timers_.size();
-  timers_[n]->addTimeout(absTimeoutInMs, event);
+TimerHandle EventManager::submit(int64_t absTimeoutInMs, Task&& callback) {
+  auto rec = new TimerRecord(absTimeoutInMs, move(callback));
+
+  TimerEvent* timer = nullptr;
+  for (auto t : timers_) {
+    if (t->getEventLoop()->inLoopThread()) {
+      timer = t;
+      break;
+    }
+  }
+
+  if (!timer) {
+    auto x = (uint64_t)rec * 4398042316799ULL + 274876858367ULL;
+    timer = timers_[x % timers_.size()];
+  }
+
+  // one reference for the timer, one for the handle
+  rec->addRef();
+  timer->addTimeout(rec);
+  return TimerHandle(rec);
 }
 
 EventLoop* EventManager::pickEventLoop() {
@@ -363,7 +624,27 @@ EventLoop* EventManager::pickEventLoop() {
   return epolls_[n];
 }
 
+bool EventManager::pinEventLoop(int idx, int cpu) {
+  auto pin = [cpu]() {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return 0 == pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  };
+
+  // waiting on the loop from its own thread would never return
+  if (epolls_[idx]->inLoopThread()) {
+    return pin();
+  }
+  return epolls_[idx]->async(pin).get();
+}
+
 void EventManager::drain() {
+  if (drained_) {
+    return;
+  }
+  drained_ = true;
+
   for (auto& p : epolls_) {
     p->quitLoopSoon();
   }
@@ -1,12 +1,18 @@
 #ifndef COMMON_EVENT_H
 #define COMMON_EVENT_H
 
+#include "common/Task.h"
+#include "common/Future.h"
+#include "common/MpscQueue.h"
+#include "common/Poller.h"
+
 #include <vector>
 #include <map>
 #include <string>
 #include <functional>
 #include <mutex>
-#include <future>
+#include <atomic>
+#include <memory>
 
 
 namespace sdb {
@@ -17,6 +23,8 @@ class ThreadPool;
 
 class TimerEvent;
 
+struct TimerRecord;
+
 
 // Base class to handle non-blocking (or async) events
 // Users of this framework should override
@@ -94,6 +102,48 @@ class AlarmEvent : virtual public Event {
 };
 
 
+// A handle to a timer scheduled in an EventManager, used to cancel it.
+// Handles are cheap to copy. The timer is released once it has fired
+// or been cancelled and no handle refers to it.
+class TimerHandle {
+ public:
+
+  TimerHandle() : rec_(nullptr) {}
+
+  // adopt a reference of @rec
+  explicit TimerHandle(TimerRecord* rec) : rec_(rec) {}
+
+  TimerHandle(const TimerHandle& other);
+
+  TimerHandle(TimerHandle&& other) noexcept : rec_(other.rec_) {
+    other.rec_ = nullptr;
+  }
+
+  TimerHandle& operator=(TimerHandle other) noexcept {
+    std::swap(rec_, other.rec_);
+    return *this;
+  }
+
+  ~TimerHandle();
+
+
+  bool valid() const { return rec_ != nullptr; }
+
+  // Cancel the timer if it has not fired yet. Return true if this call
+  // cancelled it. The callback is destroyed in the timer's event loop,
+  // so a Future waiting on it gets a broken promise.
+  bool cancel();
+
+  // true if the timer has neither fired nor been cancelled
+  bool pending() const;
+
+ private:
+
+  TimerRecord* rec_;
+
+};
+
+
 /// A worker thread to process pending events
 class EventLoop {
  public:
@@ -112,15 +162,31 @@ class EventLoop {
 
     // If there is an error event, @handleError should be called
     handle_error = 4,
+
+    // Edge triggered. A notification only comes when the state of the
+    // descriptor changes, so handlers must read (or write) until EAGAIN
+    // before returning, otherwise what is left is never reported again
+    handle_edge = 8,
+
+    // Disable the event after one notification, e.g. to hand it off to
+    // a thread pool. Call @updateEvent() to enable it again
+    handle_oneshot = 16,
+
+    // Dispatch before other events of the same iteration, for timers
+    handle_priority = 32,
   };
 
  public:
 
-  explicit EventLoop(int maxEvents);
+  // @backend is one of Poller::backend_*. backend_uring falls back to
+  // epoll if the kernel does not support io_uring, see @getBackend()
+  explicit EventLoop(int maxEvents, int backend = Poller::backend_epoll);
 
   ~EventLoop();
 
 
+  // With backend_uring, calls made outside the loop thread are queued
+  // to the loop and return true; failures are logged.
   bool addEvent(Event* handler, int opt);
 
   bool updateEvent(Event* handler, int opt);
@@ -128,26 +194,55 @@ class EventLoop {
   /// For file descriptor based events, closing the descriptor will
   /// automatically removing the event from event thread.
   /// So this method may not be used very often.
+  /// With backend_uring, a pending poll holds a reference to the file,
+  /// so descriptors must be removed before they are closed.
   bool removeEvent(Event* handler);
 
-  // submit an async task to run in the event loop
-  void submit(std::function<void()>&& fn);
+  int getBackend() const { return poller_->getBackend(); }
+
+  // Completion based I/O, only supported by backend_uring (they return
+  // false on epoll). They must be called on the loop thread. @done is
+  // called on the loop thread and must outlive the request.
+  bool submitIo(const IoRequest& req, IoCompletion* done) {
+    return poller_->submitIo(req, done);
+  }
+
+  // register buffers for IoRequest::io_fixed_buffer
+  bool registerBuffers(const struct iovec* iov, int num) {
+    return poller_->registerBuffers(iov, num);
+  }
+
+  // register descriptors for IoRequest::io_fixed_file
+  bool registerFiles(const int* fds, int num) {
+    return poller_->registerFiles(fds, num);
+  }
+
+  // hand @num buffers of @size bytes from @base to the kernel as group
+  // @group, with ids from @firstId, for IoRequest::io_buffer_select.
+  // A consumed buffer must be provided again once it has been processed
+  bool provideBuffers(void* base, int size, int num, int group, int firstId) {
+    return poller_->provideBuffers(base, size, num, group, firstId);
+  }
+
+  // number of syscalls the loop made to wait for and manage events
+  int64_t getNumSyscalls() const { return poller_->getNumSyscalls(); }
+
+  // submit an async task to run in the event loop. Tasks are queued in
+  // a lock-free queue and run in the order they are submitted
+  void submit(Task&& fn);
 
   // intended usage:
-  //   future<int> fut = loop.async([]() -> int { return 5; });
+  //   Future<int> fut = loop.async([]() -> int { return 5; });
   //   int ret = fut.get();
   template <class Fn>
-  auto async(Fn&& callback) -> std::future<decltype(callback())> {
+  auto async(Fn&& callback) -> Future<decltype(callback())> {
     typedef decltype(callback()) return_type;
 
-    auto pr = new std::promise<return_type>();
-    auto fut = pr->get_future();
+    Promise<return_type> pr;
+    auto fut = pr.getFuture();
 
-    submit([pr, callback]() {
-      auto ret = callback();
-      pr->set_value(ret);
-      delete pr;
-    });
+    submit([pr = std::move(pr), callback = std::forward<Fn>(callback)]()
+           mutable { fulfill(pr, callback); });
 
     return fut;
   }
@@ -157,17 +252,55 @@ class EventLoop {
   // get file descriptor corresponding to this event thread
   int getFD() const;
 
+  // true if the caller is running inside loop() of this object
+  bool inLoopThread() const;
+
   // issue a quit loop request, but do not wait for it
   void quitLoopSoon();
 
+  // Keep polling without blocking for @spinUs microseconds after the
+  // last task or event before blocking in the poller. This trades a
+  // busy CPU for lower latency, 0 (the default) disables spinning.
+  // Must be called before @loop()
+  void setBusyPoll(int64_t spinUs) { spinUs_ = spinUs; }
+
 
  private:
 
-  int fd_;
+  // max number of tasks to run before polling events again
+  static const int kTaskBatchSize = 256;
+
+  std::unique_ptr<Poller> poller_;
+
+  // eventfd to wake up the loop when tasks are queued
+  int wakeFd_;
 
   const int maxEvents_;
 
-  bool quit_;
+  int64_t spinUs_;
+
+  std::atomic<bool> quit_;
+
+  // true if wakeFd_ has been signaled since the loop last cleared it,
+  // so that only one write is issued for a burst of submissions
+  std::atomic<bool> notified_;
+
+  MpscQueue<Task> tasks_;
+
+
+  void wakeup();
+
+  // drain wakeFd_ and run a batch of queued tasks
+  void handleWakeup();
+
+  // run at most @maxTasks queued tasks, return the number of tasks run
+  int runTasks(int maxTasks);
+
+  // call the handlers of @handler for epoll @events
+  void dispatch(uint32_t events, Event* handler);
+
+  // data registered with the poller for @handler
+  static uint64_t eventData(Event* handler, int opt);
 
 };
 
@@ -175,60 +308,72 @@ class EventLoop {
 class EventManager {
  public:
 
-  EventManager(int numThreads, int numTimers);
+  // @backend applies to the event loops, timers always run on epoll
+  EventManager(
+    int numThreads, int numTimers, int backend = Poller::backend_epoll);
 
+  // quits the loops first unless drain() did
   ~EventManager();
 
 
   // let event manage to pick an event loop and submit the callback.
-  void submit(std::function<void()>&& callback);
+  void submit(Task&& callback);
 
-  // let event manager to pick a timer and schedule the task
-  void submit(int64_t absTimeoutInMs, std::function<void()>&& callback);
+  // let event manager to pick a timer and schedule the task. Callers
+  // running on a timer loop keep the timer on their own loop, so that it
+  // is queued directly instead of going through the loop's task queue
+  TimerHandle submit(int64_t absTimeoutInMs, Task&& callback);
 
   // let event manager to pick an event loop and submit the task
   // intended usage:
-  //   future<int> fut = eventManager.async([]() -> int { return 5; });
+  //   Future<int> fut = eventManager.async([]() -> int { return 5; });
   //   int ret = fut.get();
   template <class Fn>
-  auto async(Fn&& callback) -> std::future<decltype(callback())> {
+  auto async(Fn&& callback) -> Future<decltype(callback())> {
     typedef decltype(callback()) return_type;
 
-    auto pr = new std::promise<return_type>();
-    auto fut = pr->get_future();
+    Promise<return_type> pr;
+    auto fut = pr.getFuture();
 
-    submit([pr, callback]() {
-      auto ret = callback();
-      pr->set_value(ret);
-      delete pr;
-    });
+    submit([pr = std::move(pr), callback = std::forward<Fn>(callback)]()
+           mutable { fulfill(pr, callback); });
 
     return fut;
   }
 
-  // let event manager to pick an timer and shcedule the task
+  // let event manager to pick an timer and shcedule the task. If
+  // @handle is given, it is set to a handle to cancel the timer
   // intended usage:
-  //   future<int> fut = eventManager.schedule(absTime, []() { return 5; });
+  //   Future<int> fut = eventManager.schedule(absTime, []() { return 5; });
   //   int ret = fut.get();
   template <class Fn>
-  auto schedule(int64_t ts, Fn&& cb) -> std::future<decltype(cb())> {
+  auto schedule(int64_t ts, Fn&& cb, TimerHandle* handle = nullptr)
+    -> Future<decltype(cb())> {
     typedef decltype(cb()) return_type;
 
-    auto pr = new std::promise<return_type>();
-    auto fut = pr->get_future();
+    Promise<return_type> pr;
+    auto fut = pr.getFuture();
 
-    submit(ts, [cb, pr]() {
-      auto ret = cb();
-      pr->set_value(ret);
-      delete pr;
-    });
+    auto h = submit(ts, [pr = std::move(pr), cb = std::forward<Fn>(cb)]()
+                    mutable { fulfill(pr, cb); });
+    if (handle) {
+      *handle = std::move(h);
+    }
 
     return fut;
   }
 
   EventLoop* pickEventLoop();
 
-  // suspend all nonblocking threads
+  int getNumLoops() const { return epolls_.size(); }
+
+  EventLoop* getEventLoop(int idx) const { return epolls_[idx]; }
+
+  // pin the thread of loop @idx to @cpu, return false if it fails. May
+  // be called from any thread, the loop's own included
+  bool pinEventLoop(int idx, int cpu);
+
+  // suspend all nonblocking threads, a no-op once drained
   void drain();
 
  private:
@@ -245,6 +390,8 @@ class EventManager {
 
   int idx_;
 
+  bool drained_;
+
 };
 
 }
@@ -1,12 +1,11 @@
 #ifndef COMMON_FASTALLOC_H
 #define COMMON_FASTALLOC_H
 
+#include "common/Arena.h"
 #include "common/Logging.h"
 
 #include <cstdint>
 #include <atomic>
-#include <mutex>
-#include <vector>
 
 #include <stdlib.h>
 
@@ -17,14 +16,17 @@ template <class T> struct shared_alloc_impl;
 
 // A fast allocator for STL containers
 //
-// This allocator pre-allocates a chunk of size B bytes. Subsequent
-// allocation request will use the remainings of this chunk first.
-// If there is no or too little bytes available in the chunk, standard
-// allocation (by calling malloc) is used.
+// Copies of an allocator, including those rebound to other types, share
+// one Arena whose first chunk has B bytes. Allocations bump a pointer
+// through the chunks without taking a lock; a full chunk is followed by
+// one twice as large.
 //
 // The allocator will NOT deallocate any space that has been allocated,
 // until that the entire allocator is out of scope. At that time, all
 // allocated memory will be reclaimed.
+//
+// With a MemoryProvider, chunks are mapped on huge pages local to the
+// NUMA node of the thread that allocates them.
 template <class T, class I = uint64_t, int B = 4096>
 class FastAlloc {
  public:
@@ -41,11 +43,19 @@ class FastAlloc {
   // minimal requirement of STL allocator
   template <class U> struct rebind { typedef FastAlloc<U, I, B> other; };
 
-  explicit FastAlloc(size_t nbytes = B);
+  // @provider, if any, must outlive all copies of the allocator
+  explicit FastAlloc(
+    size_t nbytes = B, sdb::MemoryProvider* provider = nullptr);
+
+  FastAlloc(const FastAlloc& other);
 
   // minimal requirement of STL allocator
   template <class U> FastAlloc(const FastAlloc<U, I, B>& other);
 
+  FastAlloc& operator=(const FastAlloc& other);
+
+  ~FastAlloc();
+
   // minimal requirement of STL allocator
   T* allocate(size_t n);
 
@@ -71,38 +81,15 @@ bool operator!=(const FastAlloc<T, I, B>& a, const FastAlloc<U, I, B>& b) {
 
 
 template <class T> struct shared_alloc_impl {
-  T* begin;
-  T* end;
-  std::mutex mt;
+  sdb::Arena arena;
   std::atomic<int> rc;
-  std::vector<char*> overflows;
-
-  explicit shared_alloc_impl(size_t nbytes) {
-    auto num = (nbytes + sizeof(T) - 1) / sizeof(T);
-    begin = (T*)malloc(num * sizeof(T));
-    end = begin + num;
-    overflows.push_back((char*)begin);
-  }
 
-  ~shared_alloc_impl() {
-    for (auto p : overflows) {
-      free(p);
-    }
+  shared_alloc_impl(size_t nbytes, sdb::MemoryProvider* provider)
+    : arena(nbytes, alignof(T), provider), rc(1) {
   }
 
   char* allocate(size_t nbytes) {
-    lock_guard<mutex> l(mt);
-    auto num = (nbytes + sizeof(T) - 1) / sizeof(T);
-    auto next = begin + num;
-    if (next < end) {
-      auto ret = (char*)begin;
-      begin = next;
-      return ret;
-    } else {
-      auto ret = (char*)malloc(nbytes);
-      overflows.push_back(ret);
-      return ret;
-    }
+    return (char*)arena.allocate(nbytes);
   }
 
   // when an allocator refers to this implementaion, the allocator should
@@ -125,8 +112,14 @@ template <class T> struct shared_alloc_impl {
 };
 
 template <class T, class I, int B>
-FastAlloc<T, I, B>::FastAlloc(size_t nbytes)
-  : impl_(new shared_alloc_impl<I>(nbytes)) {
+FastAlloc<T, I, B>::FastAlloc(size_t nbytes, sdb::MemoryProvider* provider)
+  : impl_(new shared_alloc_impl<I>(nbytes, provider)) {
+}
+
+template <class T, class I, int B>
+FastAlloc<T, I, B>::FastAlloc(const FastAlloc& other)
+  : impl_(other.impl_) {
+  impl_->lock();
 }
 
 template <class T, class I, int B>
@@ -136,6 +129,19 @@ FastAlloc<T, I, B>::FastAlloc(const FastAlloc<U, I, B>& other)
   impl_->lock();
 }
 
+template <class T, class I, int B>
+FastAlloc<T, I, B>& FastAlloc<T, I, B>::operator=(const FastAlloc& other) {
+  other.impl_->lock();
+  impl_->unlock();
+  impl_ = other.impl_;
+  return *this;
+}
+
+template <class T, class I, int B>
+FastAlloc<T, I, B>::~FastAlloc() {
+  impl_->unlock();
+}
+
 template <class T, class I, int B>
 T* FastAlloc<T, I, B>::allocate(size_t n) {
   return (T*)impl_->allocate(n * sizeof(T));
@@ -0,0 +1,311 @@
+#ifndef COMMON_FUTURE_H
+#define COMMON_FUTURE_H
+
+#include "common/Slab.h"
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <utility>
+#include <type_traits>
+
+
+namespace sdb {
+
+template <class T> class Future;
+
+template <class T> class Promise;
+
+
+// State shared by a Promise and its Future. It is allocated from a
+// thread-caching BlockPool, so creating a Promise does not hit malloc
+// in steady state.
+class FutureStateBase {
+ public:
+
+  enum {
+    // a value or an exception has been set
+    state_ready = 1,
+
+    // the promise was destroyed without setting anything
+    state_broken = 2,
+
+    // a consumer is (or is about to be) blocked on cond
+    state_waiting = 4,
+
+    // a value or an exception is being or has been set
+    state_satisfied = 8,
+  };
+
+  FutureStateBase() : flags_(0), refs_(2) {}
+
+  // a value or an exception has been set, or the promise was broken
+  bool isReady() const {
+    return flags_.load(std::memory_order_acquire) &
+      (state_ready | state_broken);
+  }
+
+  // block until the state is ready or broken
+  void wait();
+
+  // check the outcome after wait(), rethrows a stored exception
+  void check();
+
+  void setException(std::exception_ptr e) {
+    satisfy();
+    exception_ = e;
+    publish(state_ready);
+  }
+
+ protected:
+
+  // claim the right to set the outcome, throws future_error if a value
+  // or an exception was set before
+  void satisfy();
+
+  void publish(int flag);
+
+  // return true if this is the last reference
+  bool unref() { return refs_.fetch_sub(1) == 1; }
+
+
+  std::atomic<int> flags_;
+
+  std::atomic<int> refs_;
+
+  std::mutex mt_;
+
+  std::condition_variable cond_;
+
+  std::exception_ptr exception_;
+
+  template <class T> friend class Future;
+
+  template <class T> friend class Promise;
+};
+
+
+inline void FutureStateBase::wait() {
+  if (flags_.load(std::memory_order_acquire) & (state_ready | state_broken)) {
+    return;
+  }
+
+  std::unique_lock<std::mutex> l(mt_);
+  flags_.fetch_or(state_waiting);
+  while (!(flags_.load() & (state_ready | state_broken))) {
+    cond_.wait(l);
+  }
+}
+
+inline void FutureStateBase::check() {
+  if (!(flags_.load(std::memory_order_acquire) & state_ready)) {
+    throw std::future_error(std::future_errc::broken_promise);
+  }
+  if (exception_) {
+    std::rethrow_exception(exception_);
+  }
+}
+
+inline void FutureStateBase::satisfy() {
+  if (flags_.fetch_or(state_satisfied) & state_satisfied) {
+    throw std::future_error(std::future_errc::promise_already_satisfied);
+  }
+}
+
+inline void FutureStateBase::publish(int flag) {
+  if (flags_.fetch_or(flag) & state_waiting) {
+    std::lock_guard<std::mutex> l(mt_);
+    cond_.notify_all();
+  }
+}
+
+
+template <class T>
+class FutureState : public FutureStateBase {
+ public:
+
+  ~FutureState() {
+    if (hasValue_) {
+      ((T*)&value_)->~T();
+    }
+  }
+
+  SDB_POOLED_WITH_TAG(FutureState, void)
+
+  template <class V> void setValue(V&& val) {
+    satisfy();
+    new (&value_) T(std::forward<V>(val));
+    hasValue_ = true;
+    publish(state_ready);
+  }
+
+  T& value() { return *(T*)&value_; }
+
+  void release() {
+    if (unref()) {
+      delete this;
+    }
+  }
+
+ private:
+
+  typename std::aligned_storage<sizeof(T), alignof(T)>::type value_;
+
+  bool hasValue_ = false;
+};
+
+template <>
+class FutureState<void> : public FutureStateBase {
+ public:
+
+  SDB_POOLED_WITH_TAG(FutureState, void)
+
+  void setValue() {
+    satisfy();
+    publish(state_ready);
+  }
+
+  void release() {
+    if (unref()) {
+      delete this;
+    }
+  }
+};
+
+
+// A lightweight replacement of std::future. A Future is move-only and
+// can be retrieved from its Promise only once.
+template <class T>
+class Future {
+ public:
+
+  Future() : s_(nullptr) {}
+
+  Future(Future&& other) noexcept : s_(other.s_) { other.s_ = nullptr; }
+
+  Future& operator=(Future&& other) noexcept {
+    std::swap(s_, other.s_);
+    return *this;
+  }
+
+  ~Future() {
+    if (s_) {
+      s_->release();
+    }
+  }
+
+  bool valid() const { return s_ != nullptr; }
+
+  // return true if get() will not block, i.e. it returns the value or
+  // throws, future_error if the promise was broken
+  bool isReady() const { return s_->isReady(); }
+
+  // block until the promise is fulfilled or broken
+  void wait() const { s_->wait(); }
+
+  // block waiting for the value. Rethrows the exception set on the
+  // promise, or throws future_error if the promise was broken
+  T get() {
+    s_->wait();
+    s_->check();
+    return std::move(s_->value());
+  }
+
+ private:
+
+  explicit Future(FutureState<T>* s) : s_(s) {}
+
+  FutureState<T>* s_;
+
+  friend class Promise<T>;
+};
+
+template <>
+inline void Future<void>::get() {
+  s_->wait();
+  s_->check();
+}
+
+
+// A lightweight replacement of std::promise
+template <class T>
+class Promise {
+ public:
+
+  Promise() : s_(new FutureState<T>()), retrieved_(false) {}
+
+  Promise(Promise&& other) noexcept
+    : s_(other.s_), retrieved_(other.retrieved_) {
+    other.s_ = nullptr;
+  }
+
+  Promise& operator=(Promise&& other) noexcept {
+    std::swap(s_, other.s_);
+    std::swap(retrieved_, other.retrieved_);
+    return *this;
+  }
+
+  ~Promise() {
+    if (!s_) {
+      return;
+    }
+    if (!(s_->flags_.load() & FutureStateBase::state_ready)) {
+      s_->publish(FutureStateBase::state_broken);
+    }
+    if (!retrieved_) {
+      // nobody will ever hold the future side
+      s_->unref();
+    }
+    s_->release();
+  }
+
+  Future<T> getFuture() {
+    if (retrieved_) {
+      throw std::future_error(std::future_errc::future_already_retrieved);
+    }
+    retrieved_ = true;
+    return Future<T>(s_);
+  }
+
+  // throws future_error if a value or an exception was set before
+  template <class... V> void setValue(V&&... val) {
+    s_->setValue(std::forward<V>(val)...);
+  }
+
+  void setException(std::exception_ptr e) { s_->setException(e); }
+
+ private:
+
+  FutureState<T>* s_;
+
+  bool retrieved_;
+};
+
+
+// run @fn and fulfill @pr with its outcome
+template <class R, class Fn>
+typename std::enable_if<!std::is_void<R>::value>::type
+fulfill(Promise<R>& pr, Fn& fn) {
+  try {
+    pr.setValue(fn());
+  } catch (...) {
+    pr.setException(std::current_exception());
+  }
+}
+
+template <class R, class Fn>
+typename std::enable_if<std::is_void<R>::value>::type
+fulfill(Promise<R>& pr, Fn& fn) {
+  try {
+    fn();
+    pr.setValue();
+  } catch (...) {
+    pr.setException(std::current_exception());
+  }
+}
+
+} // sdb
+
+#endif // COMMON_FUTURE_H
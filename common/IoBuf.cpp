@@ -0,0 +1,230 @@
+#include "common/IoBuf.h"
+#include "common/Logging.h"
+
+#include <limits>
+
+using namespace std;
+
+
+namespace sdb {
+
+IoBuf::IoBuf(int segmentSize)
+  : segmentSize_(segmentSize), size_(0), readFrom_(0) {
+}
+
+IoBuf::IoBuf(IoBuf& another)
+  : segmentSize_(another.segmentSize_), size_(another.size_), readFrom_(0) {
+  for (auto& seg : another.segments_) {
+    segments_.emplace_back(seg);
+  }
+}
+
+IoBuf::IoBuf(IoBuf&& another)
+  : segmentSize_(another.segmentSize_),
+    size_(another.size_),
+    segments_(move(another.segments_)),
+    readFrom_(0) {
+  another.size_ = 0;
+  another.segments_.clear();
+}
+
+IoBuf& IoBuf::operator=(IoBuf&& another) {
+  segmentSize_ = another.segmentSize_;
+  size_ = another.size_;
+  segments_ = move(another.segments_);
+  another.size_ = 0;
+  another.segments_.clear();
+  return *this;
+}
+
+IoRange& IoBuf::writableTail() {
+  if (segments_.empty() || !segments_.back().unique() ||
+      segments_.back().tailroom() == 0) {
+    segments_.emplace_back(segmentSize_);
+  }
+  return segments_.back();
+}
+
+void IoBuf::append(const char* beg, const char* end) {
+  while (beg < end) {
+    auto& tail = writableTail();
+    auto n = min<int64_t>(end - beg, tail.tailroom());
+    tail.append(beg, beg + n);
+    beg += n;
+    size_ += n;
+  }
+}
+
+void IoBuf::append(IoBuf&& another) {
+  for (auto& seg : another.segments_) {
+    segments_.push_back(move(seg));
+  }
+  size_ += another.size_;
+
+  another.segments_.clear();
+  another.size_ = 0;
+}
+
+void IoBuf::append(IoRange&& range) {
+  size_ += range.end() - range.begin();
+  segments_.push_back(move(range));
+}
+
+void IoBuf::prepend(const char* beg, const char* end) {
+  int64_t n = end - beg;
+  if (n == 0) {
+    return;
+  }
+
+  if (!segments_.empty() && segments_.front().unique() &&
+      segments_.front().headroom() >= n) {
+    segments_.front().prepend(beg, end);
+  } else {
+    // written at the end of a new segment, so that the next header fits
+    // in front of it
+    int bufSize = max<int64_t>(segmentSize_, n);
+    IoRange seg(bufSize);
+    segments_.emplace_front(io_write_t(), seg, bufSize - n);
+    segments_.front().append(beg, end);
+  }
+
+  size_ += n;
+}
+
+int64_t IoBuf::skip(int64_t numBytes) {
+  int64_t done = 0;
+  while (done < numBytes && !segments_.empty()) {
+    auto& front = segments_.front();
+    int64_t len = front.end() - front.begin();
+    if (len > numBytes - done) {
+      front.skip(numBytes - done);
+      done = numBytes;
+      break;
+    }
+
+    done += len;
+    segments_.pop_front();
+  }
+
+  size_ -= done;
+  return done;
+}
+
+IoBuf IoBuf::split(int64_t numBytes) {
+  IoBuf ret(segmentSize_);
+  int64_t done = 0;
+
+  while (done < numBytes && !segments_.empty()) {
+    auto& front = segments_.front();
+    int64_t len = front.end() - front.begin();
+    if (len > numBytes - done) {
+      int k = numBytes - done;
+      int pos = front.headroom();
+      ret.segments_.emplace_back(io_read_t(), front, pos, pos + k);
+      front.skip(k);
+      done = numBytes;
+      break;
+    }
+
+    done += len;
+    ret.segments_.push_back(move(front));
+    segments_.pop_front();
+  }
+
+  ret.size_ = done;
+  size_ -= done;
+  return ret;
+}
+
+IoRange IoBuf::popFront() {
+  IoRange ret(move(segments_.front()));
+  segments_.pop_front();
+  size_ -= ret.end() - ret.begin();
+  return ret;
+}
+
+Range IoBuf::coalesce() {
+  int numUsed = 0;
+  for (auto& seg : segments_) {
+    if (seg.begin() != seg.end()) {
+      ++numUsed;
+    }
+  }
+
+  if (numUsed > 1) {
+    if (size_ > numeric_limits<int>::max()) {
+      LOG(FATAL) << "Can not coalesce " << size_ << " bytes";
+    }
+
+    IoRange whole((int)size_);
+    for (auto& seg : segments_) {
+      whole.append(seg.begin(), seg.end());
+    }
+    segments_.clear();
+    segments_.push_back(move(whole));
+  }
+
+  for (auto& seg : segments_) {
+    if (seg.begin() != seg.end()) {
+      return seg.getRange();
+    }
+  }
+  return Range(nullptr, nullptr);
+}
+
+string IoBuf::toString() const {
+  string ret;
+  ret.reserve(size_);
+  for (auto& seg : segments_) {
+    ret.append(seg.begin(), seg.end());
+  }
+  return ret;
+}
+
+int IoBuf::fillIov(struct iovec* iov, int maxIov) const {
+  int num = 0;
+  for (auto it = segments_.begin(); it != segments_.end() && num < maxIov;
+       ++it) {
+    if (it->begin() != it->end()) {
+      iov[num].iov_base = (void*)it->begin();
+      iov[num].iov_len = it->end() - it->begin();
+      ++num;
+    }
+  }
+  return num;
+}
+
+int IoBuf::prepareRead(struct iovec* iov, int maxIov, int64_t numBytes) {
+  writableTail();
+  readFrom_ = segments_.size() - 1;
+
+  int64_t room = segments_.back().tailroom();
+  while (room < numBytes && (int)(segments_.size() - readFrom_) < maxIov) {
+    segments_.emplace_back(segmentSize_);
+    room += segmentSize_;
+  }
+
+  int num = 0;
+  for (auto i = readFrom_; i < segments_.size(); ++i, ++num) {
+    iov[num].iov_base = segments_[i].end();
+    iov[num].iov_len = segments_[i].tailroom();
+  }
+  return num;
+}
+
+void IoBuf::commit(int64_t numBytes) {
+  for (auto i = readFrom_; numBytes > 0 && i < segments_.size(); ++i) {
+    auto n = min<int64_t>(numBytes, segments_[i].tailroom());
+    segments_[i].commit(n);
+    numBytes -= n;
+    size_ += n;
+  }
+
+  // segments the read did not reach
+  while (segments_.size() > readFrom_ + 1 &&
+         segments_.back().begin() == segments_.back().end()) {
+    segments_.pop_back();
+  }
+}
+
+}
@@ -0,0 +1,125 @@
+#ifndef COMMON_IOBUF_H
+#define COMMON_IOBUF_H
+
+#include "common/Range.h"
+
+#include <sys/uio.h>
+#include <deque>
+#include <string>
+#include <cstdint>
+
+
+namespace sdb {
+
+// A chain of IoRange segments holding one logical byte sequence.
+//
+// Unlike IoRange, an IoBuf never reallocates: appending fills the tail
+// segment and then starts a new fixed-size one, so bytes that are
+// already in the chain are never copied while it grows. Segments are
+// reference counted, copying a chain or splitting off a prefix shares
+// them, and only a segment nobody else refers to is written to.
+//
+// Lengths are 64 bits; a single segment is still limited to what an
+// IoRange can hold.
+class IoBuf {
+ public:
+
+  enum {
+    default_segment_size = 16 * 1024,
+  };
+
+ public:
+
+  explicit IoBuf(int segmentSize = default_segment_size);
+
+  // share the segments of @another
+  explicit IoBuf(IoBuf& another);
+
+  IoBuf(IoBuf&& another);
+
+  IoBuf& operator=(IoBuf&& another);
+
+
+  // number of bytes in the chain
+  int64_t size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  int getNumSegments() const { return segments_.size(); }
+
+
+  // copy @beg..@end to the end of the chain
+  void append(const char* beg, const char* end);
+
+  void append(const basic_range<char>& range) {
+    append(range.begin(), range.end());
+  }
+
+  void append(const std::string& str) {
+    append(str.c_str(), str.c_str() + str.size());
+  }
+
+  // take over the segments of @another, nothing is copied
+  void append(IoBuf&& another);
+
+  // take over @range as a segment of its own, nothing is copied
+  void append(IoRange&& range);
+
+  // copy @beg..@end to the front of the chain, e.g. a header whose
+  // content is known only after the body is written
+  void prepend(const char* beg, const char* end);
+
+  void prepend(const basic_range<char>& range) {
+    prepend(range.begin(), range.end());
+  }
+
+
+  // remove the first @numBytes bytes, return the number of bytes
+  // actually removed
+  int64_t skip(int64_t numBytes);
+
+  // remove the first @numBytes bytes and return them as a new chain.
+  // A segment cut in the middle is shared by both chains
+  IoBuf split(int64_t numBytes);
+
+  // remove and return the first segment, which must exist
+  IoRange popFront();
+
+  // Make the content one contiguous range and return it. Copies only if
+  // the chain has more than one segment
+  basic_range<char> coalesce();
+
+  std::string toString() const;
+
+
+  // Fill @iov with up to @maxIov segments for writev(2), return the
+  // number of entries used
+  int fillIov(struct iovec* iov, int maxIov) const;
+
+  // Make room for at least @numBytes after the end of the chain and fill
+  // @iov with it for readv(2). Return the number of entries used
+  int prepareRead(struct iovec* iov, int maxIov, int64_t numBytes);
+
+  // account for @numBytes written to the iovecs of @prepareRead(), the
+  // chain must not change in between
+  void commit(int64_t numBytes);
+
+ private:
+
+  int segmentSize_;
+
+  int64_t size_;
+
+  std::deque<IoRange> segments_;
+
+  // first segment handed out by @prepareRead()
+  size_t readFrom_;
+
+  // tail segment to write to, a new one if the current can not be used
+  IoRange& writableTail();
+
+};
+
+}
+
+#endif // COMMON_IOBUF_H
@@ -0,0 +1,143 @@
+#include "common/MemoryProvider.h"
+#include "common/Logging.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+
+namespace sdb {
+
+// from linux/mempolicy.h, so that libnuma is not needed
+static const int kMpolPreferred = 1;
+
+// bits in the node mask passed to mbind
+static const int kMaxNodes = 1024;
+
+const size_t MemoryProvider::kHugePageSize;
+
+MemoryProvider::MemoryProvider(int options)
+  : options_(options),
+    bytesMapped_(0),
+    bytesHugetlb_(0),
+    bytesTransparent_(0),
+    bytesLocal_(0),
+    numFallbacks_(0) {
+}
+
+MemoryProvider::Region MemoryProvider::map(size_t size) {
+  Region region{nullptr, 0, 0};
+  region.size = (size + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+  if (region.size == 0) {
+    region.size = kHugePageSize;
+  }
+
+  if (options_ & page_hugetlb) {
+    auto p = mmap(nullptr, region.size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+      region.addr = p;
+      region.flags |= page_hugetlb;
+    } else {
+      numFallbacks_.fetch_add(1);
+    }
+  }
+
+  if (!region.addr) {
+    region.addr = mapAligned(region.size);
+    if (!region.addr) {
+      LOG(FATAL) << "Fails to map a region of " << region.size;
+    }
+
+    if (options_ & page_transparent) {
+      if (0 == madvise(region.addr, region.size, MADV_HUGEPAGE)) {
+        region.flags |= page_transparent;
+      } else {
+        numFallbacks_.fetch_add(1);
+      }
+    }
+  }
+
+  // before the pages are touched, so they are allocated on the node
+  int node = (options_ & numa_local) ? currentNode() : -1;
+  if (node >= 0 && node < kMaxNodes) {
+    unsigned long mask[kMaxNodes / 64] = {0};
+    mask[node / 64] = 1UL << (node % 64);
+    if (0 == syscall(SYS_mbind, region.addr, region.size, kMpolPreferred,
+                     mask, kMaxNodes + 1, 0)) {
+      region.flags |= numa_local;
+    } else {
+      numFallbacks_.fetch_add(1);
+    }
+  } else if (options_ & numa_local) {
+    numFallbacks_.fetch_add(1);
+  }
+
+  account(region, 1);
+  return region;
+}
+
+void MemoryProvider::unmap(const Region& region) {
+  if (0 > munmap(region.addr, region.size)) {
+    LOG(FATAL) << "Fails to unmap a region of " << region.size;
+  }
+  account(region, -1);
+}
+
+MemoryProvider::Stats MemoryProvider::getStats() const {
+  Stats ret;
+  ret.bytesMapped = bytesMapped_.load();
+  ret.bytesHugetlb = bytesHugetlb_.load();
+  ret.bytesTransparent = bytesTransparent_.load();
+  ret.bytesLocal = bytesLocal_.load();
+  ret.numFallbacks = numFallbacks_.load();
+  return ret;
+}
+
+int MemoryProvider::currentNode() {
+  unsigned cpu = 0;
+  unsigned node = 0;
+  if (0 > syscall(SYS_getcpu, &cpu, &node, nullptr)) {
+    return -1;
+  }
+  return (int)node;
+}
+
+void* MemoryProvider::mapAligned(size_t size) {
+  // map one more huge page and trim both ends to the alignment
+  size_t len = size + kHugePageSize;
+  auto p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    return nullptr;
+  }
+
+  auto beg = (uintptr_t)p;
+  auto aligned = (beg + kHugePageSize - 1) & ~(uintptr_t)(kHugePageSize - 1);
+  if (aligned > beg) {
+    munmap(p, aligned - beg);
+  }
+  auto end = beg + len;
+  if (end > aligned + size) {
+    munmap((void*)(aligned + size), end - aligned - size);
+  }
+  return (void*)aligned;
+}
+
+void MemoryProvider::account(const Region& region, int sign) {
+  int64_t bytes = sign * (int64_t)region.size;
+  bytesMapped_.fetch_add(bytes);
+  if (region.flags & page_hugetlb) {
+    bytesHugetlb_.fetch_add(bytes);
+  }
+  if (region.flags & page_transparent) {
+    bytesTransparent_.fetch_add(bytes);
+  }
+  if (region.flags & numa_local) {
+    bytesLocal_.fetch_add(bytes);
+  }
+}
+
+}
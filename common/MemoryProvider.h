@@ -0,0 +1,93 @@
+#ifndef COMMON_MEMORYPROVIDER_H
+#define COMMON_MEMORYPROVIDER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+
+namespace sdb {
+
+// Hands out large regions of memory straight from mmap, for arenas and
+// pools that carve them up themselves.
+//
+// Regions are whole, aligned huge pages. Depending on @options, a region
+// is first asked for from the reserved huge pages (MAP_HUGETLB), then on
+// normal pages the kernel is advised to back with transparent huge pages
+// (MADV_HUGEPAGE), and either way it is bound to the NUMA node of the
+// calling thread. Each step falls back quietly when the system does not
+// support it, so the worst case is plain anonymous memory.
+class MemoryProvider {
+ public:
+
+  enum {
+    page_hugetlb = 1,
+    page_transparent = 2,
+    numa_local = 4,
+    page_all = page_hugetlb | page_transparent | numa_local,
+  };
+
+  static const size_t kHugePageSize = 2 * 1024 * 1024;
+
+  struct Region {
+    void* addr;
+    size_t size;
+
+    // options above that took effect for this region
+    int flags;
+  };
+
+  // bytes of regions currently mapped
+  struct Stats {
+    int64_t bytesMapped;
+    int64_t bytesHugetlb;
+    int64_t bytesTransparent;
+    int64_t bytesLocal;
+
+    // number of steps that failed and fell back
+    int64_t numFallbacks;
+  };
+
+  explicit MemoryProvider(int options = page_all);
+
+  MemoryProvider(const MemoryProvider&) = delete;
+
+  MemoryProvider& operator=(const MemoryProvider&) = delete;
+
+  // map at least @size bytes, rounded up to kHugePageSize
+  Region map(size_t size);
+
+  // unmap a region returned by map()
+  void unmap(const Region& region);
+
+  int options() const { return options_; }
+
+  Stats getStats() const;
+
+  // NUMA node of the calling thread, -1 if unknown
+  static int currentNode();
+
+ private:
+
+  const int options_;
+
+  std::atomic<int64_t> bytesMapped_;
+
+  std::atomic<int64_t> bytesHugetlb_;
+
+  std::atomic<int64_t> bytesTransparent_;
+
+  std::atomic<int64_t> bytesLocal_;
+
+  std::atomic<int64_t> numFallbacks_;
+
+
+  // map @size bytes aligned to kHugePageSize on normal pages
+  static void* mapAligned(size_t size);
+
+  void account(const Region& region, int sign);
+};
+
+}
+
+#endif // COMMON_MEMORYPROVIDER_H
@@ -0,0 +1,148 @@
+#ifndef COMMON_MPSCQUEUE_H
+#define COMMON_MPSCQUEUE_H
+
+#include "common/Slab.h"
+
+#include <atomic>
+#include <utility>
+
+
+namespace sdb {
+
+// A lock-free multi-producer single-consumer FIFO queue (Vyukov's
+// intrusive queue with a stub node).
+//
+// push() may be called from any thread, it never blocks and never
+// fails. pop() may only be called from one consumer thread at a time.
+// Queue nodes come from a BlockPool, so pushing does not hit malloc in
+// steady state.
+//
+// While a producer is in the middle of a push, pop() may transiently
+// report an empty queue even though later items are present. Callers
+// are expected to be woken up again by that producer.
+template <class T>
+class MpscQueue {
+ public:
+
+  MpscQueue();
+
+  ~MpscQueue();
+
+  MpscQueue(const MpscQueue&) = delete;
+
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+
+  void push(T&& val);
+
+  // Return false if the queue is empty
+  bool pop(T& val);
+
+ private:
+
+  struct Link {
+    std::atomic<Link*> next;
+  };
+
+  struct Node : public Link {
+    T value;
+
+    explicit Node(T&& v) : value(std::move(v)) {
+      this->next.store(nullptr, std::memory_order_relaxed);
+    }
+
+    SDB_POOLED_WITH_TAG(Node, void)
+  };
+
+
+  // producers side
+  std::atomic<Link*> tail_;
+
+  // keep producers and the consumer on different cache lines
+  char pad_[64];
+
+  // consumer side
+  Link* head_;
+
+  Link stub_;
+
+
+  void pushLink(Link* l);
+
+  // move the value out of @l and delete the node
+  void take(Link* l, T& val);
+};
+
+
+template <class T>
+MpscQueue<T>::MpscQueue() : tail_(&stub_), head_(&stub_) {
+  stub_.next.store(nullptr, std::memory_order_relaxed);
+}
+
+template <class T>
+MpscQueue<T>::~MpscQueue() {
+  T val;
+  while (pop(val)) {
+  }
+}
+
+template <class T>
+void MpscQueue<T>::push(T&& val) {
+  pushLink(new Node(std::move(val)));
+}
+
+template <class T>
+void MpscQueue<T>::pushLink(Link* l) {
+  l->next.store(nullptr, std::memory_order_relaxed);
+  auto prev = tail_.exchange(l, std::memory_order_acq_rel);
+  prev->next.store(l, std::memory_order_release);
+}
+
+template <class T>
+bool MpscQueue<T>::pop(T& val) {
+  auto head = head_;
+  auto next = head->next.load(std::memory_order_acquire);
+
+  if (head == &stub_) {
+    if (!next) {
+      return false;
+    }
+    head_ = next;
+    head = next;
+    next = next->next.load(std::memory_order_acquire);
+  }
+
+  if (next) {
+    head_ = next;
+    take(head, val);
+    return true;
+  }
+
+  if (head != tail_.load(std::memory_order_acquire)) {
+    // a producer has swapped the tail but not linked its node yet
+    return false;
+  }
+
+  // head is the last node, put the stub behind it so that it can go
+  pushLink(&stub_);
+
+  next = head->next.load(std::memory_order_acquire);
+  if (next) {
+    head_ = next;
+    take(head, val);
+    return true;
+  }
+
+  return false;
+}
+
+template <class T>
+void MpscQueue<T>::take(Link* l, T& val) {
+  auto node = static_cast<Node*>(l);
+  val = std::move(node->value);
+  delete node;
+}
+
+} // sdb
+
+#endif // COMMON_MPSCQUEUE_H
@@ -0,0 +1,83 @@
+#include "common/Poller.h"
+#include "common/UringPoller.h"
+#include "common/Logging.h"
+
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+
+namespace sdb {
+
+Poller* Poller::create(int backend, int maxEvents) {
+  if (backend == backend_uring) {
+    auto p = UringPoller::create(maxEvents);
+    if (p) {
+      return p;
+    }
+    LOG(WARNING) << "io_uring is not available, falling back to epoll";
+  }
+
+  return new EpollPoller(maxEvents);
+}
+
+
+EpollPoller::EpollPoller(int maxEvents)
+  : fd_(epoll_create1(EPOLL_CLOEXEC)),
+    maxEvents_(maxEvents),
+    events_(new struct epoll_event[maxEvents]) {
+  if (fd_ < 0) {
+    LOG(FATAL) << "Fails to create epoll " << strerror(errno);
+  }
+}
+
+EpollPoller::~EpollPoller() {
+  delete[] events_;
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+bool EpollPoller::add(int fd, uint32_t events, uint64_t data) {
+  struct epoll_event event;
+  event.events = events;
+  event.data.u64 = data;
+  ++numSyscalls_;
+  return (0 == epoll_ctl(fd_, EPOLL_CTL_ADD, fd, &event));
+}
+
+bool EpollPoller::update(int fd, uint32_t events, uint64_t data) {
+  struct epoll_event event;
+  event.events = events;
+  event.data.u64 = data;
+  ++numSyscalls_;
+  return (0 == epoll_ctl(fd_, EPOLL_CTL_MOD, fd, &event));
+}
+
+bool EpollPoller::remove(int fd) {
+  struct epoll_event event;
+  event.events = 0;
+  event.data.u64 = 0;
+  ++numSyscalls_;
+  return (0 == epoll_ctl(fd_, EPOLL_CTL_DEL, fd, &event));
+}
+
+int EpollPoller::wait(PollEvent* events, int max, int timeoutMs) {
+  if (max > maxEvents_) {
+    max = maxEvents_;
+  }
+
+  ++numSyscalls_;
+  int num = epoll_wait(fd_, events_, max, timeoutMs);
+  for (int i = 0; i < num; ++i) {
+    events[i].data = events_[i].data.u64;
+    events[i].events = events_[i].events;
+    events[i].res = 0;
+    events[i].flags = 0;
+  }
+
+  return num < 0 ? 0 : num;
+}
+
+}
@@ -0,0 +1,209 @@
+#ifndef COMMON_POLLER_H
+#define COMMON_POLLER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct epoll_event;
+struct iovec;
+
+
+namespace sdb {
+
+// Receives the result of a completion based I/O request, see
+// EventLoop::submitIo(). Objects must stay alive until their last
+// completion has been delivered.
+class IoCompletion {
+ public:
+
+  virtual ~IoCompletion() {}
+
+  // @res is what the syscall would return, or -errno on failure.
+  // @flags are the IORING_CQE_F_* bits of the completion: a multishot
+  // request sets IORING_CQE_F_MORE as long as more completions follow,
+  // and a request using a provided buffer sets IORING_CQE_F_BUFFER with
+  // the buffer id in the upper 16 bits
+  virtual void handleCompletion(int res, uint32_t flags) = 0;
+};
+
+
+// A completion based I/O request
+struct IoRequest {
+  // operations
+  enum {
+    io_recv = 0,
+    io_send,
+    io_accept,
+    io_read,
+    io_write,
+
+    // completes with -ETIME after @offset milliseconds
+    io_timeout,
+  };
+
+  // options
+  enum {
+    // @fd is an index of the files given to registerFiles()
+    io_fixed_file = 1,
+
+    // @buf lies in the buffer @bufIndex given to registerBuffers()
+    io_fixed_buffer = 2,
+
+    // keep completing until cancelled or failed, for io_accept and
+    // io_recv. A multishot recv needs io_buffer_select
+    io_multishot = 4,
+
+    // let the kernel pick a buffer of group @bufIndex, see
+    // provideBuffers(). @buf and @len are ignored
+    io_buffer_select = 8,
+  };
+
+  int op;
+
+  int fd;
+
+  void* buf;
+
+  uint32_t len;
+
+  // file offset for io_read and io_write, milliseconds for io_timeout
+  int64_t offset;
+
+  int opt;
+
+  // registered buffer index or provided buffer group
+  int bufIndex;
+
+  IoRequest(int o, int f, void* b = nullptr, uint32_t l = 0)
+    : op(o), fd(f), buf(b), len(l), offset(0), opt(0), bufIndex(0) {}
+};
+
+
+// A readiness event or a completion reported by a Poller
+struct PollEvent {
+  // what was registered with the descriptor, or the IoCompletion
+  // pointer tagged with kCompletionTag
+  uint64_t data;
+
+  // epoll event bits of a readiness event
+  uint32_t events;
+
+  // result and flags of a completion
+  int32_t res;
+
+  uint32_t flags;
+
+  static const uint64_t kCompletionTag = 2;
+};
+
+
+// The kernel interface an EventLoop waits on. Registered descriptors
+// use epoll event bits (EPOLLIN, EPOLLET, ...) whatever the backend.
+class Poller {
+ public:
+
+  enum {
+    // readiness through epoll
+    backend_epoll = 0,
+
+    // readiness and completions through io_uring
+    backend_uring,
+  };
+
+ public:
+
+  // Create a poller of @backend, falling back to epoll if the kernel
+  // does not support it
+  static Poller* create(int backend, int maxEvents);
+
+  virtual ~Poller() {}
+
+
+  virtual int getBackend() const = 0;
+
+  virtual int getFD() const = 0;
+
+  // false if add(), update() and remove() must be called on the thread
+  // that calls wait()
+  virtual bool isThreadSafe() const = 0;
+
+  virtual bool add(int fd, uint32_t events, uint64_t data) = 0;
+
+  virtual bool update(int fd, uint32_t events, uint64_t data) = 0;
+
+  virtual bool remove(int fd) = 0;
+
+  // wait up to @timeoutMs (-1 forever) and return at most @max events
+  virtual int wait(PollEvent* events, int max, int timeoutMs) = 0;
+
+  // called when the events returned by wait() have been handled
+  virtual void afterDispatch() {}
+
+  // number of syscalls made to wait for and to (un)register events
+  int64_t getNumSyscalls() const { return numSyscalls_; }
+
+
+  // Completion based I/O, only supported by backend_uring. These must
+  // be called on the thread that calls wait()
+
+  virtual bool submitIo(const IoRequest& req, IoCompletion* done) {
+    return false;
+  }
+
+  virtual bool registerBuffers(const struct iovec* iov, int num) {
+    return false;
+  }
+
+  virtual bool registerFiles(const int* fds, int num) {
+    return false;
+  }
+
+  virtual bool provideBuffers(
+    void* base, int size, int num, int group, int firstId) {
+    return false;
+  }
+
+ protected:
+
+  Poller() : numSyscalls_(0) {}
+
+  int64_t numSyscalls_;
+
+};
+
+
+class EpollPoller : public Poller {
+ public:
+
+  explicit EpollPoller(int maxEvents);
+
+  ~EpollPoller() override;
+
+
+  int getBackend() const override { return backend_epoll; }
+
+  int getFD() const override { return fd_; }
+
+  bool isThreadSafe() const override { return true; }
+
+  bool add(int fd, uint32_t events, uint64_t data) override;
+
+  bool update(int fd, uint32_t events, uint64_t data) override;
+
+  bool remove(int fd) override;
+
+  int wait(PollEvent* events, int max, int timeoutMs) override;
+
+ private:
+
+  int fd_;
+
+  const int maxEvents_;
+
+  struct epoll_event* events_;
+
+};
+
+}
+
+#endif // COMMON_POLLER_H
@@ -1,8 +1,14 @@
 #include "common/Range.h"
+#include "common/BufferPool.h"
+#include "common/Slab.h"
 
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 using namespace std;
 
 
@@ -10,20 +16,316 @@ namespace sdb {
 
 const int kDefBufferSize = 32768;
 
+
+typedef const char* (*FindFunc)(const char*, int64_t, const char*, int64_t);
+
+// for the tail after a SIMD loop, too short to pay off memmem's setup
+static const char* findShort(
+  const char* hay, int64_t n, const char* needle, int64_t m) {
+  if (m > n) {
+    return hay + n;
+  }
+
+  auto last = hay + n - m + 1;
+  for (auto p = hay; (p = (const char*)memchr(p, needle[0], last - p));
+       ++p) {
+    if (memcmp(p + 1, needle + 1, m - 1) == 0) {
+      return p;
+    }
+  }
+  return hay + n;
+}
+
+#if defined(__x86_64__)
+
+// Both SIMD versions compare a block of candidate positions against the
+// first and the last byte of the needle at once, and only check the
+// positions where both match. Needles are at least 2 bytes.
+
+static const char* findSse2(
+  const char* hay, int64_t n, const char* needle, int64_t m) {
+  auto first = _mm_set1_epi8(needle[0]);
+  auto last = _mm_set1_epi8(needle[m - 1]);
+
+  int64_t i = 0;
+  for (; i + m - 1 + 16 <= n; i += 16) {
+    auto bf = _mm_loadu_si128((const __m128i*)(hay + i));
+    auto bl = _mm_loadu_si128((const __m128i*)(hay + i + m - 1));
+    uint32_t mask = _mm_movemask_epi8(
+      _mm_and_si128(_mm_cmpeq_epi8(first, bf), _mm_cmpeq_epi8(last, bl)));
+
+    while (mask) {
+      int bit = __builtin_ctz(mask);
+      if (memcmp(hay + i + bit + 1, needle + 1, m - 2) == 0) {
+        return hay + i + bit;
+      }
+      mask &= mask - 1;
+    }
+  }
+
+  return findShort(hay + i, n - i, needle, m);
+}
+
+__attribute__((target("avx2")))
+static const char* findAvx2(
+  const char* hay, int64_t n, const char* needle, int64_t m) {
+  auto first = _mm256_set1_epi8(needle[0]);
+  auto last = _mm256_set1_epi8(needle[m - 1]);
+
+  int64_t i = 0;
+  for (; i + m - 1 + 32 <= n; i += 32) {
+    auto bf = _mm256_loadu_si256((const __m256i*)(hay + i));
+    auto bl = _mm256_loadu_si256((const __m256i*)(hay + i + m - 1));
+    uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(
+      _mm256_cmpeq_epi8(first, bf), _mm256_cmpeq_epi8(last, bl)));
+
+    while (mask) {
+      int bit = __builtin_ctz(mask);
+      if (memcmp(hay + i + bit + 1, needle + 1, m - 2) == 0) {
+        _mm256_zeroupper();
+        return hay + i + bit;
+      }
+      mask &= mask - 1;
+    }
+  }
+  _mm256_zeroupper();
+
+  return findShort(hay + i, n - i, needle, m);
+}
+
+static FindFunc pickFind() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") ? findAvx2 : findSse2;
+}
+
+#else
+
+static const char* findScalar(
+  const char* hay, int64_t n, const char* needle, int64_t m) {
+  auto p = (const char*)memmem(hay, n, needle, m);
+  return p ? p : hay + n;
+}
+
+static FindFunc pickFind() {
+  return findScalar;
+}
+
+#endif
+
+const char* findBytes(
+  const char* hay, int64_t n, const char* needle, int64_t m) {
+  static const FindFunc find = pickFind();
+
+  if (m == 0) {
+    return hay;
+  }
+  if (m > n) {
+    return hay + n;
+  }
+  if (m == 1) {
+    auto p = (const char*)memchr(hay, needle[0], n);
+    return p ? p : hay + n;
+  }
+
+  return find(hay, n, needle, m);
+}
+
+
+// A multiply-mix hash in the style of wyhash: 16 bytes per step, each
+// folded in with one 64x64->128 bit multiplication
+
+static const uint64_t kHashP0 = 0xa0761d6478bd642full;
+static const uint64_t kHashP1 = 0xe7037ed1a0b428dbull;
+static const uint64_t kHashP2 = 0x8ebc6af09c88c6e3ull;
+
+static inline uint64_t hashMix(uint64_t a, uint64_t b) {
+  __uint128_t r = (__uint128_t)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t read64(const char* p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+static inline uint64_t read32(const char* p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+uint64_t hashBytes(const void* data, int64_t n, uint64_t seed) {
+  auto p = (const char*)data;
+  seed ^= hashMix(seed ^ kHashP0, kHashP1);
+
+  uint64_t a = 0;
+  uint64_t b = 0;
+  if (n <= 16) {
+    if (n >= 4) {
+      // two overlapping pairs of 4-byte reads cover 4 to 16 bytes
+      int64_t mid = (n >> 3) << 2;
+      a = (read32(p) << 32) | read32(p + mid);
+      b = (read32(p + n - 4) << 32) | read32(p + n - 4 - mid);
+    } else if (n > 0) {
+      a = ((uint64_t)(unsigned char)p[0] << 16) |
+        ((uint64_t)(unsigned char)p[n >> 1] << 8) |
+        (unsigned char)p[n - 1];
+    }
+  } else {
+    int64_t i = n;
+    if (i > 48) {
+      uint64_t s1 = seed;
+      uint64_t s2 = seed;
+      do {
+        seed = hashMix(read64(p) ^ kHashP1, read64(p + 8) ^ seed);
+        s1 = hashMix(read64(p + 16) ^ kHashP2, read64(p + 24) ^ s1);
+        s2 = hashMix(read64(p + 32) ^ kHashP0, read64(p + 40) ^ s2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= s1 ^ s2;
+    }
+
+    while (i > 16) {
+      seed = hashMix(read64(p) ^ kHashP1, read64(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+
+    a = read64(p + i - 16);
+    b = read64(p + i - 8);
+  }
+
+  return hashMix(kHashP1 ^ n, hashMix(a ^ kHashP1, b ^ seed));
+}
+
+
+// Reversing the bytes of each value is one byte shuffle per vector
+
+typedef void (*SwapFunc)(char*, const char*, int64_t, int);
+
+template <class U>
+static void swapValues(char* dst, const char* src, int64_t num) {
+  for (int64_t i = 0; i < num; ++i) {
+    U v;
+    memcpy(&v, src + i * sizeof(U), sizeof(U));
+    v = sizeof(U) == 2 ? __builtin_bswap16(v)
+      : sizeof(U) == 4 ? __builtin_bswap32(v)
+      : __builtin_bswap64(v);
+    memcpy(dst + i * sizeof(U), &v, sizeof(U));
+  }
+}
+
+static void swapScalar(char* dst, const char* src, int64_t num, int width) {
+  if (width == 2) {
+    swapValues<uint16_t>(dst, src, num);
+  } else if (width == 4) {
+    swapValues<uint32_t>(dst, src, num);
+  } else {
+    swapValues<uint64_t>(dst, src, num);
+  }
+}
+
+#if defined(__x86_64__)
+
+// shuffle control reversing every @width bytes of 16
+static const char* swapControl(int width) {
+  static const char controls[3][16] = {
+    {1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14},
+    {3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12},
+    {7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8},
+  };
+  return controls[width == 2 ? 0 : width == 4 ? 1 : 2];
+}
+
+__attribute__((target("ssse3")))
+static void swapSsse3(char* dst, const char* src, int64_t num, int width) {
+  auto control = _mm_loadu_si128((const __m128i*)swapControl(width));
+  int64_t n = num * width;
+
+  int64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    auto v = _mm_loadu_si128((const __m128i*)(src + i));
+    _mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(v, control));
+  }
+
+  swapScalar(dst + i, src + i, (n - i) / width, width);
+}
+
+__attribute__((target("avx2")))
+static void swapAvx2(char* dst, const char* src, int64_t num, int width) {
+  auto control = _mm256_broadcastsi128_si256(
+    _mm_loadu_si128((const __m128i*)swapControl(width)));
+  int64_t n = num * width;
+
+  int64_t i = 0;
+  for (; i + 64 <= n; i += 64) {
+    auto a = _mm256_loadu_si256((const __m256i*)(src + i));
+    auto b = _mm256_loadu_si256((const __m256i*)(src + i + 32));
+    _mm256_storeu_si256((__m256i*)(dst + i), _mm256_shuffle_epi8(a, control));
+    _mm256_storeu_si256(
+      (__m256i*)(dst + i + 32), _mm256_shuffle_epi8(b, control));
+  }
+  // the compiler leaves the upper halves dirty before the call below,
+  // which makes any SSE code after it stall
+  _mm256_zeroupper();
+
+  swapScalar(dst + i, src + i, (n - i) / width, width);
+}
+
+static SwapFunc pickSwap() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return swapAvx2;
+  }
+  return __builtin_cpu_supports("ssse3") ? swapSsse3 : swapScalar;
+}
+
+#else
+
+static SwapFunc pickSwap() {
+  return swapScalar;
+}
+
+#endif
+
+void swapBytes(char* dst, const char* src, int64_t num, int width) {
+  static const SwapFunc swap = pickSwap();
+  swap(dst, src, num, width);
+}
+
+
 IoRange::shared_buf::shared_buf()
-  : buf((char*)malloc(kDefBufferSize)), size(kDefBufferSize), refCount(0) {
+  : buf((char*)BufferPool::allocate(kDefBufferSize)),
+    size(kDefBufferSize),
+    refCount(1) {
+}
+
+IoRange::shared_buf::shared_buf(int bufSize)
+  : buf((char*)BufferPool::allocate(bufSize)),
+    size(bufSize),
+    refCount(1) {
 }
 
 IoRange::shared_buf::~shared_buf() {
-  free(buf);
+  BufferPool::deallocate(buf, size);
+}
+
+void* IoRange::shared_buf::operator new(size_t size) {
+  return ObjectPool<shared_buf>::allocate();
 }
 
-void IoRange::shared_buf::resize(const Range& range) {
-  size = size * 2;
-  auto ptr = (char*)malloc(size);
+void IoRange::shared_buf::operator delete(void* p) {
+  ObjectPool<shared_buf>::deallocate(p);
+}
+
+void IoRange::shared_buf::resize(const Range& range, int newSize) {
+  auto ptr = (char*)BufferPool::allocate(newSize);
   memcpy(ptr, range.begin(), range.size());
   swap(ptr, buf);
-  free(ptr);
+  BufferPool::deallocate(ptr, size);
+  size = newSize;
 }
 
 
@@ -33,6 +335,12 @@ IoRange::IoRange()
     endPos_(0) {
 }
 
+IoRange::IoRange(int bufSize)
+  : b_(new shared_buf(bufSize)),
+    startPos_(0),
+    endPos_(0) {
+}
+
 IoRange::IoRange(IoRange& another)
   : b_(another.b_),
     startPos_(another.startPos_),
@@ -40,6 +348,13 @@ IoRange::IoRange(IoRange& another)
   b_->refCount.fetch_add(1);
 }
 
+IoRange::IoRange(IoRange&& another)
+  : b_(another.b_),
+    startPos_(another.startPos_),
+    endPos_(another.endPos_) {
+  another.b_ = nullptr;
+}
+
 IoRange::IoRange(io_write_t, IoRange& another, int startPos)
   : b_(another.b_),
     startPos_(startPos),
@@ -55,6 +370,9 @@ IoRange::IoRange(io_read_t, IoRange& another, int startPos, int endPos)
 }
 
 IoRange::~IoRange() {
+  if (!b_) {
+    return;
+  }
   auto ret = b_->refCount.fetch_sub(1);
   if (ret == 1) {
     delete b_;
@@ -67,11 +385,44 @@ void IoRange::append(const char* beg, const char* end) {
     memcpy(&b_->buf[endPos_], beg, inc);
     endPos_ += inc;
   } else {
-    b_->resize(getRange());
+    reserve(inc);
     append(beg, end);
   }
 }
 
+void IoRange::prepend(const char* beg, const char* end) {
+  auto inc = end - beg;
+  startPos_ -= inc;
+  memcpy(&b_->buf[startPos_], beg, inc);
+}
+
+void IoRange::reserve(int numBytes) {
+  if (tailroom() >= numBytes) {
+    return;
+  }
+
+  // double as often as needed, but copy only once
+  int newSize = std::max(b_->size, 1);
+  while (newSize - endPos_ < numBytes) {
+    newSize *= 2;
+  }
+
+  if (unique()) {
+    b_->resize(Range(b_->buf, b_->buf + endPos_), newSize);
+    return;
+  }
+
+  // Copy on write. The others keep the old buffer, which may be pinned,
+  // e.g. by a zero copy send the kernel has not finished yet. Positions
+  // stay valid, the bytes in range keep their offsets
+  auto b = new shared_buf(newSize);
+  memcpy(b->buf + startPos_, b_->buf + startPos_, endPos_ - startPos_);
+  if (b_->refCount.fetch_sub(1) == 1) {
+    delete b_;
+  }
+  b_ = b;
+}
+
 int IoRange::skip(int numBytes) {
   auto total = endPos_ - startPos_;
   if (total >= numBytes) {
@@ -6,9 +6,97 @@
 #include <atomic>
 #include <cstdint>
 #include <algorithm>
+#include <functional>
+
+#include <endian.h>
+#include <string.h>
 
 namespace sdb {
 
+// Byte kernels behind basic_range<char>. Bytes compare as unsigned, the
+// order of memcmp() and std::string
+
+// <0, 0 or >0 as @a..@a+@na sorts before, equal to or after @b..@b+@nb
+inline int compareBytes(const char* a, int64_t na, const char* b, int64_t nb) {
+  int64_t n = (na < nb) ? na : nb;
+
+  // memcmp() wins once there is enough to vectorize
+  if (n >= 64) {
+    int ret = memcmp(a, b, n);
+    return ret ? ret : (na < nb) ? -1 : (na > nb);
+  }
+
+  // short keys a word at a time
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t x, y;
+    memcpy(&x, a + i, 8);
+    memcpy(&y, b + i, 8);
+    if (x != y) {
+      return (be64toh(x) < be64toh(y)) ? -1 : 1;
+    }
+  }
+
+  for (; i < n; ++i) {
+    if (a[i] != b[i]) {
+      return ((unsigned char)a[i] < (unsigned char)b[i]) ? -1 : 1;
+    }
+  }
+
+  return (na < nb) ? -1 : (na > nb);
+}
+
+// first occurrence of @needle..@needle+@m in @hay..@hay+@n, or @hay+@n.
+// Uses AVX2 when the cpu has it, SSE2 otherwise
+const char* findBytes(
+  const char* hay, int64_t n, const char* needle, int64_t m);
+
+// fast non-cryptographic 64-bit hash of @n bytes at @p
+uint64_t hashBytes(const void* p, int64_t n, uint64_t seed = 0);
+
+// Copy @num values of @width bytes, 2, 4 or 8, from @src to @dst and
+// reverse the bytes of each, e.g. from host to network order. @dst may
+// be @src. Uses AVX2 or SSSE3 when the cpu has them
+void swapBytes(char* dst, const char* src, int64_t num, int width);
+
+
+template <class T>
+bool rangeEqual(const T* a, const T* b, int64_t n) {
+  return std::equal(a, a + n, b);
+}
+
+inline bool rangeEqual(const char* a, const char* b, int64_t n) {
+  // empty ranges may be null
+  if (n == 0) {
+    return true;
+  }
+  return memcmp(a, b, n) == 0;
+}
+
+template <class T>
+int rangeCompare(const T* a, int64_t na, const T* b, int64_t nb) {
+  auto it = std::mismatch(a, a + std::min(na, nb), b);
+  if (it.first != a + std::min(na, nb)) {
+    return (*it.first < *it.second) ? -1 : 1;
+  }
+  return (na < nb) ? -1 : (na > nb);
+}
+
+inline int rangeCompare(const char* a, int64_t na, const char* b, int64_t nb) {
+  return compareBytes(a, na, b, nb);
+}
+
+template <class T>
+const T* rangeFind(const T* hay, int64_t n, const T* needle, int64_t m) {
+  return std::search(hay, hay + n, needle, needle + m);
+}
+
+inline const char* rangeFind(
+  const char* hay, int64_t n, const char* needle, int64_t m) {
+  return findBytes(hay, n, needle, m);
+}
+
+
 // A general range of pointers that can be used to denote a piece
 // of memory. It is possible to use this class to represent an array
 // of POD types. But usually, we use this to represent an array of
@@ -20,6 +108,8 @@ template <class T>
 class basic_range {
  public:
 
+  basic_range() : beg_(nullptr), end_(nullptr) {}
+
   basic_range(T* beg, T* end) : beg_(beg), end_(end) {}
 
   basic_range(const basic_range<T>& another)
@@ -64,23 +154,21 @@ class basic_range {
 
   const T& operator[](int64_t idx) const { return beg_[idx]; }
 
-  // find another range (substring), return the start pointer
+  // find another range (substring), return the start pointer, or end()
+  // if it is not found
   T* find(const basic_range<T>& another) {
-    return std::search(beg_, end_, another.beg_, another.end_);
+    return (T*)rangeFind(beg_, size(), another.beg_, another.size());
   }
 
-  // find another range (substring), return the start pointer
+  // find another range (substring), return the start pointer, or end()
+  // if it is not found
   const T* find(const basic_range<T>& another) const {
-    return std::search(beg_, end_, another.beg_, another.end_);
+    return rangeFind(beg_, size(), another.beg_, another.size());
   }
 
   bool operator==(const basic_range<T>& another) const {
-    if (size() != another.size()) {
-      return false;
-    } else {
-      auto it = std::mismatch(begin(), end(), another.begin());
-      return (it.first == end());
-    }
+    return size() == another.size() &&
+      rangeEqual(beg_, another.beg_, size());
   }
 
   bool operator!=(const basic_range<T>& another) const {
@@ -88,12 +176,20 @@ class basic_range {
   }
 
   bool operator<(const basic_range<T>& another) const {
-    return std::lexicographical_compare(
-      begin(), end(), another.begin(), another.end());
+    return compare(another) < 0;
+  }
+
+  // <0, 0 or >0 as this range sorts before, equal to or after @another
+  int compare(const basic_range<T>& another) const {
+    return rangeCompare(beg_, size(), another.beg_, another.size());
+  }
+
+  uint64_t hash(uint64_t seed = 0) const {
+    return hashBytes(beg_, size() * sizeof(T), seed);
   }
 
   // remove @nBytes from the beginning of the range
-  void pop_front(int nBytes) {
+  void pop_front(int64_t nBytes) {
     beg_ += nBytes;
     if (beg_ > end_) {
       beg_ = end_;
@@ -101,7 +197,7 @@ class basic_range {
   }
 
   // remove @nBytes from the end of the range
-  void pop_back(int nBytes) {
+  void pop_back(int64_t nBytes) {
     end_ -= nBytes;
     if (beg_ > end_) {
       end_ = beg_;
@@ -130,6 +226,8 @@ struct io_read_t {};
 // A class to manage an IO buffer.
 // Multiple IoRanges can refer to the same underlying buffer.
 // The buffer will be reclaimed only if all references to it are gone.
+// Buffers come from BufferPool, so creating an IoRange per message does
+// not hit malloc in the steady state.
 // A typical usage of this class include:
 //  (a) create a buffer;
 //  (b) write (append) something to the buffer
@@ -143,9 +241,15 @@ class IoRange {
     std::atomic<int> refCount;
 
     shared_buf();
+    explicit shared_buf(int bufSize);
     ~shared_buf();
 
-    void resize(const basic_range<char>& range);
+    // move @range to a new buffer of @newSize bytes
+    void resize(const basic_range<char>& range, int newSize);
+
+    static void* operator new(size_t size);
+
+    static void operator delete(void* p);
   };
 
  public:
@@ -153,9 +257,15 @@ class IoRange {
   // create a new IoRange, initialize a new shared buffer for write
   IoRange();
 
+  // create a new IoRange on a buffer of @bufSize bytes
+  explicit IoRange(int bufSize);
+
   // create a copy of original io range
   explicit IoRange(IoRange& another);
 
+  // take over the buffer of @another, which must not be used afterwards
+  IoRange(IoRange&& another);
+
   // construct a range on top of another for write
   IoRange(io_write_t, IoRange& another, int startPos = 0);
 
@@ -193,6 +303,28 @@ class IoRange {
 
   const char* end() const { return &b_->buf[endPos_]; }
 
+  // number of bytes before begin() that are not part of the range
+  int headroom() const { return startPos_; }
+
+  // true if no other IoRange refers to the buffer
+  bool unique() const { return b_->refCount.load() == 1; }
+
+  // write @beg..@end right before begin(), which must have headroom
+  // for it
+  void prepend(const char* beg, const char* end);
+
+  // number of bytes that can be written after end() without growing
+  // the buffer
+  int tailroom() const { return b_->size - endPos_; }
+
+  // Make sure that at least @numBytes can be written after end(). A
+  // buffer shared with other IoRanges is not moved under them, this one
+  // gets a copy
+  void reserve(int numBytes);
+
+  // account for @numBytes written directly after end(), e.g. by read(2)
+  void commit(int numBytes) { endPos_ += numBytes; }
+
   // skip @numBytes from read buffer, return the number of bytes
   // actually skipped
   int skip(int numBytes);
@@ -222,4 +354,14 @@ typedef basic_range<char> Range;
 
 } // sdb
 
+namespace std {
+
+template <class T> struct hash<sdb::basic_range<T>> {
+  size_t operator()(const sdb::basic_range<T>& range) const {
+    return range.hash();
+  }
+};
+
+} // std
+
 #endif // COMMON_RANGE_H
@@ -0,0 +1,105 @@
+#include "common/Record.h"
+
+using namespace std;
+
+
+namespace sdb {
+
+bool parseRecordTable(Range& fields, Range& table) {
+  if (fields.size() < 4) {
+    return false;
+  }
+  Range count(fields.end() - 4, fields.end());
+  uint32_t num = 0;
+  if (!FixedWire::parseInt(count, num) || (fields.size() - 4) / 8 < num) {
+    return false;
+  }
+  fields.pop_back(4);
+  table = Range(fields.end() - num * 8, fields.end());
+  fields.pop_back(num * 8);
+  return true;
+}
+
+bool skipRecord(Range& range) {
+  Range rest = range;
+  int32_t len = 0;
+  if (!VarintWire::parseLength(rest, len) || rest.size() < len) {
+    return false;
+  }
+  rest.pop_front(len);
+  range = rest;
+  return true;
+}
+
+bool skipRecordField(Range& range, int wireType) {
+  switch (wireType) {
+    case record_varint: {
+      uint64_t val = 0;
+      return decodeVarint(range, val);
+    }
+    case record_fixed64:
+      return FixedWire::skipInt<uint64_t>(range);
+    case record_fixed32:
+      return FixedWire::skipInt<uint32_t>(range);
+    case record_bytes: {
+      Range bytes;
+      return parseRecordBytes(range, bytes);
+    }
+    default:
+      return false;
+  }
+}
+
+bool RecordReader::find(uint32_t id, int& wireType, Range& value) const {
+  Range rest = fields_;
+  if (hasTable()) {
+    if (!findInTable(id, rest)) {
+      return false;
+    }
+  }
+
+  while (rest.size() > 0) {
+    uint32_t key = 0;
+    if (!parseRecordKey(rest, key, wireType)) {
+      return false;
+    }
+    if (key == id) {
+      value = rest;
+      return true;
+    }
+    // the table points right at the field
+    if (hasTable() || !skipRecordField(rest, wireType)) {
+      return false;
+    }
+  }
+  return false;
+}
+
+bool RecordReader::findInTable(uint32_t id, Range& field) const {
+  Range table = table_;
+  Range fields = fields_;
+  int64_t lo = 0;
+  int64_t hi = table.size() / 8;
+  while (lo < hi) {
+    int64_t mid = (lo + hi) / 2;
+    Range entry(table.begin() + mid * 8, table.begin() + mid * 8 + 8);
+    uint32_t entryId = 0;
+    uint32_t offset = 0;
+    FixedWire::parseInt(entry, entryId);
+    FixedWire::parseInt(entry, offset);
+
+    if (entryId < id) {
+      lo = mid + 1;
+    } else if (entryId > id) {
+      hi = mid;
+    } else if (offset >= fields.size()) {
+      return false;
+    } else {
+      field = Range(fields.begin() + offset, fields.end());
+      return true;
+    }
+  }
+  return false;
+}
+
+}
@@ -0,0 +1,542 @@
+#ifndef COMMON_RECORD_H
+#define COMMON_RECORD_H
+
+#include "common/Serializer.h"
+#include "common/Varint.h"
+#include "common/Range.h"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <cstdint>
+
+
+namespace sdb {
+
+// Records are a tagged, self describing encoding of a struct, so that
+// readers and writers with different versions of it can talk to each
+// other during a rolling upgrade. Every field is written with its id and
+// a wire type that says how to skip it:
+//
+//   record := varint(size of the rest) flags field* [offset table]
+//   field  := varint(id << 3 | wire type) value
+//
+// Integers, bools and chars are varints (zigzag if signed), so that a
+// field can be widened, e.g. from int32_t to int64_t. Doubles and floats
+// are fixed width, and anything else is length delimited, encoded by
+// Serializer on the wire the record is written with: VarintWire, or
+// FixedWire for the fixed width wires, which the flags tell the reader.
+// A reader skips fields it does not know and leaves fields that are not
+// in the record as they were. A known field with another wire type than
+// expected fails the parse.
+//
+// A record may end with a table of (id, offset) pairs sorted by id, so
+// that RecordReader finds a field without walking the ones before it:
+//
+//   offset table := (fixed32 id, fixed32 offset)* fixed32 count
+//
+// with offsets counted from the first field. Use SDB_RECORD below to
+// make a struct a record.
+
+// wire types of fields
+enum {
+  record_varint = 0,
+  record_fixed64 = 1,
+  record_bytes = 2,
+  record_fixed32 = 5,
+};
+
+// bits of the flags byte
+enum {
+  record_has_table = 1,
+  record_varint_payload = 2,
+};
+
+const uint32_t kMaxRecordFieldId = (1U << 29) - 1;
+
+inline uint64_t recordKey(uint32_t id, int wireType) {
+  return (uint64_t)id << 3 | wireType;
+}
+
+// Take the key of a field from the front of @fields
+inline bool parseRecordKey(Range& fields, uint32_t& id, int& wireType) {
+  uint64_t key = 0;
+  if (!decodeVarint(fields, key) || (key >> 3) > kMaxRecordFieldId) {
+    return false;
+  }
+  id = key >> 3;
+  wireType = key & 7;
+  return true;
+}
+
+// split the offset table from the end of @fields
+bool parseRecordTable(Range& fields, Range& table);
+
+// Take a record from the front of @range. @fields is set to its fields,
+// @table to its offset table, which is empty if it has none
+inline bool parseRecord(
+  Range& range, Range& fields, Range& table, int& flags) {
+  Range rest = range;
+  int32_t len = 0;
+  if (!VarintWire::parseLength(rest, len) || len < 1 || rest.size() < len) {
+    return false;
+  }
+
+  flags = (unsigned char)*rest.begin();
+  fields = Range(rest.begin() + 1, rest.begin() + len);
+  table = Range();
+  if ((flags & record_has_table) && !parseRecordTable(fields, table)) {
+    return false;
+  }
+  range = Range(rest.begin() + len, rest.end());
+  return true;
+}
+
+// remove a record from the front of @range without looking at its fields
+bool skipRecord(Range& range);
+
+// remove the value of a field of @wireType from the front of @range
+bool skipRecordField(Range& range, int wireType);
+
+// take the value of a length delimited field from the front of @range
+inline bool parseRecordBytes(Range& range, Range& bytes) {
+  Range rest = range;
+  int32_t len = 0;
+  if (!VarintWire::parseLength(rest, len) || rest.size() < len) {
+    return false;
+  }
+  bytes = Range(rest.begin(), rest.begin() + len);
+  rest.pop_front(len);
+  range = rest;
+  return true;
+}
+
+
+// the wire length delimited values of a record written on Wire use
+template <class Wire> struct RecordPayloadWire {
+  typedef typename std::conditional<
+    Wire::fixed_width, FixedWire, VarintWire>::type type;
+};
+
+template <class T> struct RecordWireType {
+  static const int value = std::is_integral<T>::value ? record_varint
+    : std::is_same<T, double>::value ? record_fixed64
+    : std::is_same<T, float>::value ? record_fixed32 : record_bytes;
+};
+
+// How a field of type T is encoded, with Wire the payload wire.
+// sizeOf() is the size of the value itself, wireSize() adds what goes in
+// front of it
+template <class T, class Wire, int WireType = RecordWireType<T>::value>
+struct RecordField;
+
+template <class T, class Wire> struct RecordField<T, Wire, record_varint> {
+  static const int wire_type = record_varint;
+
+  static int sizeOf(const T& val) {
+    return VarintWire::sizeOfInt(val);
+  }
+
+  static int wireSize(int size) {
+    return size;
+  }
+
+  template <class Buf>
+  static void append(Buf& buf, const T& val, int size) {
+    VarintWire::appendInt(buf, val);
+  }
+
+  static bool parse(Range& range, T& val) {
+    return VarintWire::parseInt(range, val);
+  }
+};
+
+// doubles and floats
+template <class T, int WireType> struct RecordFixedField {
+  static const int wire_type = WireType;
+
+  static int sizeOf(const T& val) {
+    return sizeof(T);
+  }
+
+  static int wireSize(int size) {
+    return size;
+  }
+
+  template <class Buf>
+  static void append(Buf& buf, const T& val, int size) {
+    Serializer<T, FixedWire>().append(buf, val);
+  }
+
+  static bool parse(Range& range, T& val) {
+    return Deserializer<T, FixedWire>().parse(range, val);
+  }
+};
+
+template <class T, class Wire> struct RecordField<T, Wire, record_fixed64>
+  : RecordFixedField<T, record_fixed64> {};
+
+template <class T, class Wire> struct RecordField<T, Wire, record_fixed32>
+  : RecordFixedField<T, record_fixed32> {};
+
+template <class T, class Wire> struct RecordField<T, Wire, record_bytes> {
+  static const int wire_type = record_bytes;
+
+  static int sizeOf(const T& val) {
+    return Serializer<T, Wire>().sizeOf(val);
+  }
+
+  static int wireSize(int size) {
+    return VarintWire::sizeOfLength(size) + size;
+  }
+
+  template <class Buf>
+  static void append(Buf& buf, const T& val, int size) {
+    VarintWire::appendLength(buf, size);
+    Serializer<T, Wire>().append(buf, val);
+  }
+
+  // the value must use up all of its bytes
+  static bool parse(Range& range, T& val) {
+    Range bytes;
+    if (!parseRecordBytes(range, bytes)) {
+      return false;
+    }
+    return Deserializer<T, Wire>().parse(bytes, val) &&
+      bytes.size() == 0;
+  }
+};
+
+// strings are their bytes, without a second length in front
+template <class S> struct RecordStringField {
+  static const int wire_type = record_bytes;
+
+  static int sizeOf(const S& val) {
+    return val.size();
+  }
+
+  static int wireSize(int size) {
+    return VarintWire::sizeOfLength(size) + size;
+  }
+
+  template <class Buf>
+  static void append(Buf& buf, const S& val, int size) {
+    VarintWire::appendLength(buf, size);
+    buf.append(val);
+  }
+
+  static bool parse(Range& range, S& val) {
+    Range bytes;
+    if (!parseRecordBytes(range, bytes)) {
+      return false;
+    }
+    val = S(bytes.begin(), bytes.end());
+    return true;
+  }
+};
+
+template <class Wire> struct RecordField<std::string, Wire, record_bytes>
+  : RecordStringField<std::string> {};
+
+template <class Wire> struct RecordField<Range, Wire, record_bytes>
+  : RecordStringField<Range> {};
+
+// Parse the value of a field of type T into @val, if the key in front of
+// it says @wireType. @flags are those of the record
+template <class T>
+bool parseRecordField(Range& range, int wireType, int flags, T& val) {
+  if (wireType != RecordWireType<T>::value) {
+    return false;
+  }
+  return (flags & record_varint_payload)
+    ? RecordField<T, VarintWire>::parse(range, val)
+    : RecordField<T, FixedWire>::parse(range, val);
+}
+
+// If field @id of type T is the next one in @fields, parse it into @val
+// and return 1. Return 0, with @fields untouched, if another field comes
+// next, and -1 if the field is malformed
+template <class T>
+int parseRecordFieldIfNext(Range& fields, uint32_t id, int flags, T& val) {
+  const int wireType = RecordWireType<T>::value;
+  uint64_t expected = recordKey(id, wireType);
+  Range rest = fields;
+  if (expected < 0x80) {
+    // a key of one byte, the ids of most fields
+    if (rest.size() == 0 || (unsigned char)*rest.begin() != expected) {
+      return 0;
+    }
+    rest.pop_front(1);
+  } else {
+    uint64_t key = 0;
+    if (!decodeVarint(rest, key) || key != expected) {
+      return 0;
+    }
+  }
+
+  if (!parseRecordField(rest, wireType, flags, val)) {
+    return -1;
+  }
+  fields = rest;
+  return 1;
+}
+
+
+// Writes a record of at most N fields on Wire. Sizes of all fields are
+// added first, in the order they are written, so that the record length
+// and the offset table are known before the first byte goes out and no
+// field is sized twice:
+//
+//   RecordWriter<2, VarintWire> writer(false);
+//   writer.addSize(1, id);
+//   writer.addSize(2, name);
+//   writer.begin(buf);
+//   writer.append(buf, 1, id);
+//   writer.append(buf, 2, name);
+//   writer.finish(buf);
+template <int N, class Wire>
+class RecordWriter {
+ public:
+
+  typedef typename RecordPayloadWire<Wire>::type payload_wire;
+
+  explicit RecordWriter(bool withTable)
+    : withTable_(withTable), num_(0), next_(0), fieldsSize_(0) {}
+
+  template <class T> void addSize(uint32_t id, const T& val) {
+    typedef RecordField<T, payload_wire> Field;
+    int size = Field::sizeOf(val);
+    entries_[num_] = std::make_pair(id, fieldsSize_);
+    sizes_[num_++] = size;
+    fieldsSize_ += varintSize(recordKey(id, Field::wire_type)) +
+      Field::wireSize(size);
+  }
+
+  // encoded size of the whole record
+  int size() const {
+    int body = bodySize();
+    return VarintWire::sizeOfLength(body) + body;
+  }
+
+  template <class Buf> void begin(Buf& buf) const {
+    VarintWire::appendLength(buf, bodySize());
+    char flags = (withTable_ ? record_has_table : 0) |
+      (std::is_same<payload_wire, VarintWire>::value
+       ? record_varint_payload : 0);
+    buf.append(&flags, &flags + 1);
+  }
+
+  template <class T, class Buf>
+  void append(Buf& buf, uint32_t id, const T& val) {
+    typedef RecordField<T, payload_wire> Field;
+    VarintWire::appendInt(buf, recordKey(id, Field::wire_type));
+    Field::append(buf, val, sizes_[next_++]);
+  }
+
+  template <class Buf> void finish(Buf& buf) {
+    if (!withTable_) {
+      return;
+    }
+
+    auto end = entries_ + num_;
+    if (!std::is_sorted(entries_, end)) {
+      std::sort(entries_, end);
+    }
+    for (auto p = entries_; p != end; ++p) {
+      FixedWire::appendInt(buf, p->first);
+      FixedWire::appendInt(buf, p->second);
+    }
+    FixedWire::appendInt(buf, (uint32_t)num_);
+  }
+
+ private:
+
+  bool withTable_;
+
+  int num_;
+
+  int next_;
+
+  uint32_t fieldsSize_;
+
+  // (id, offset) of each field
+  std::pair<uint32_t, uint32_t> entries_[N];
+
+  // size of the value of each field
+  int sizes_[N];
+
+  int bodySize() const {
+    return 1 + fieldsSize_ + (withTable_ ? num_ * 8 + 4 : 0);
+  }
+};
+
+
+// Finds fields of a record by id without parsing the others: with a
+// binary search of the offset table if the record has one, otherwise
+// by skipping over the fields before it. Points into the source, which
+// must outlive the reader
+class RecordReader {
+ public:
+
+  RecordReader() : flags_(0) {}
+
+  // take the record from the front of @range
+  bool parse(Range& range) {
+    return parseRecord(range, fields_, table_, flags_);
+  }
+
+  // Find the first field @id, and set @value to what follows its key
+  bool find(uint32_t id, int& wireType, Range& value) const;
+
+  // parse field @id into @val
+  template <class T> bool get(uint32_t id, T& val) const {
+    int wireType = 0;
+    Range value;
+    return find(id, wireType, value) &&
+      parseRecordField(value, wireType, flags_, val);
+  }
+
+  bool hasTable() const { return table_.size() > 0; }
+
+  // the encoded fields
+  const Range& fields() const { return fields_; }
+
+ private:
+
+  Range fields_;
+
+  Range table_;
+
+  int flags_;
+
+  bool findInTable(uint32_t id, Range& field) const;
+};
+
+template <class Wire> struct Deserializer<RecordReader, Wire> {
+  bool parse(Range& range, RecordReader& val) const {
+    return val.parse(range);
+  }
+
+  bool skip(Range& range) const {
+    return skipRecord(range);
+  }
+};
+
+}  // sdb
+
+
+// Generate Serializer and Deserializer specializations that encode a
+// struct as a record, from a list of (id, field) pairs. Ids are positive
+// and never reused for another field once a version is out; fields may
+// be added or removed freely. Use it at global scope, after the struct
+// is defined:
+//
+//   struct User { int64_t uid; std::string name; };
+//   SDB_RECORD(User, (1, uid), (2, name))
+//
+// Only containers and other length delimited fields depend on the
+// wire, see RecordPayloadWire. SDB_INDEXED_RECORD also
+// writes the offset table, for large records whose readers look at a
+// few fields with RecordReader. Up to 16 fields are supported.
+//
+// The parser takes fields in the order they are listed as long as the
+// record has them in that order, one compare of the key each, and looks
+// up the id of the rest: fields added, removed or reordered by another
+// version.
+#define SDB_RECORD(Type, ...) SDB_RECORD_IMPL(Type, false, __VA_ARGS__)
+
+#define SDB_INDEXED_RECORD(Type, ...) \
+  SDB_RECORD_IMPL(Type, true, __VA_ARGS__)
+
+#define SDB_RECORD_IMPL(Type, withTable, ...) \
+namespace sdb { \
+template <class Wire> struct Serializer<Type, Wire> { \
+  typedef RecordWriter<SDB_NUM_ARGS(__VA_ARGS__), Wire> Writer; \
+  template <class Buf> \
+  void append(Buf& buf, const Type& val) const { \
+    Writer writer(withTable); \
+    SDB_FOR_EACH(SDB_RECORD_FIELD_SIZE, SDB_NOTHING, val, __VA_ARGS__) \
+    writer.begin(buf); \
+    SDB_FOR_EACH(SDB_RECORD_FIELD_APPEND, SDB_NOTHING, val, __VA_ARGS__) \
+    writer.finish(buf); \
+  } \
+  int sizeOf(const Type& val) const { \
+    Writer writer(withTable); \
+    SDB_FOR_EACH(SDB_RECORD_FIELD_SIZE, SDB_NOTHING, val, __VA_ARGS__) \
+    return writer.size(); \
+  } \
+}; \
+template <class Wire> struct SerializeTo<Type, Wire> { \
+  void append(IoRange& ioRange, const Type& val) const { \
+    RecordWriter<SDB_NUM_ARGS(__VA_ARGS__), Wire> writer(withTable); \
+    SDB_FOR_EACH(SDB_RECORD_FIELD_SIZE, SDB_NOTHING, val, __VA_ARGS__) \
+    int size = writer.size(); \
+    ioRange.reserve(size); \
+    UncheckedWriter buf(ioRange.end()); \
+    writer.begin(buf); \
+    SDB_FOR_EACH(SDB_RECORD_FIELD_APPEND, SDB_NOTHING, val, __VA_ARGS__) \
+    writer.finish(buf); \
+    ioRange.commit(size); \
+  } \
+}; \
+template <class Wire> struct Deserializer<Type, Wire> { \
+  bool parse(Range& range, Type& val) const { \
+    Range fields, table; \
+    int flags = 0; \
+    if (!parseRecord(range, fields, table, flags)) { \
+      return false; \
+    } \
+    int next = 1; \
+    SDB_FOR_EACH(SDB_RECORD_FIELD_NEXT, SDB_NOTHING, val, __VA_ARGS__) \
+    while (fields.size() > 0) { \
+      uint32_t id = 0; \
+      int wireType = 0; \
+      if (!parseRecordKey(fields, id, wireType)) { \
+        return false; \
+      } \
+      bool ok; \
+      switch (id) { \
+        SDB_FOR_EACH(SDB_RECORD_FIELD_CASE, SDB_NOTHING, val, __VA_ARGS__) \
+        default: \
+          ok = skipRecordField(fields, wireType); \
+      } \
+      if (!ok) { \
+        return false; \
+      } \
+    } \
+    return true; \
+  } \
+  bool skip(Range& range) const { \
+    return skipRecord(range); \
+  } \
+}; \
+}
+
+// the helpers below take a field as an (id, field) pair, and run inside
+// the generated templates
+#define SDB_RECORD_ID(id, field) id
+
+#define SDB_RECORD_NAME(id, field) field
+
+#define SDB_RECORD_FIELD_SIZE(val, f) \
+  writer.addSize(SDB_RECORD_ID f, val.SDB_RECORD_NAME f);
+
+#define SDB_RECORD_FIELD_APPEND(val, f) \
+  writer.append(buf, SDB_RECORD_ID f, val.SDB_RECORD_NAME f);
+
+#define SDB_RECORD_FIELD_NEXT(val, f) \
+  if (next > 0) { \
+    next = parseRecordFieldIfNext( \
+      fields, SDB_RECORD_ID f, flags, val.SDB_RECORD_NAME f); \
+    if (next < 0) { \
+      return false; \
+    } \
+  }
+
+#define SDB_RECORD_FIELD_CASE(val, f) \
+  case SDB_RECORD_ID f: \
+    ok = parseRecordField( \
+      fields, wireType, flags, val.SDB_RECORD_NAME f); \
+    break;
+
+#endif // COMMON_RECORD_H
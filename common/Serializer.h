@@ -2,6 +2,7 @@
 #define COMMON_SERIALIZER_H
 
 #include "common/Range.h"
+#include "common/Varint.h"
 
 #include <string>
 #include <vector>
@@ -9,145 +10,482 @@
 #include <map>
 #include <tuple>
 #include <unordered_map>
+#include <type_traits>
+#include <utility>
+#include <limits>
 #include <cstdint>
 
+#include <string.h>
+
 namespace sdb {
 
-// Template classes to deserialize a string
-template <class T> struct Deserializer;
+// An output buffer for Serializer that writes to memory reserved up
+// front, without any bounds checks
+struct UncheckedWriter {
+  char* pos;
 
-// Specialization of Deserializer classes
-template <> struct Deserializer<char> {
-  bool parse(Range& range, char& val) const {
-    if (range.size() > 0) {
-      val = *range.begin();
-      range.pop_front(1);
-      return true;
-    } else {
+  explicit UncheckedWriter(char* p) : pos(p) {}
+
+  void append(const char* beg, const char* end) {
+    // empty strings and containers may have no data at all
+    if (beg == end) {
+      return;
+    }
+    memcpy(pos, beg, end - beg);
+    pos += end - beg;
+  }
+
+  void append(const Range& range) {
+    append(range.begin(), range.end());
+  }
+
+  void append(const std::string& str) {
+    append(str.c_str(), str.c_str() + str.size());
+  }
+};
+
+
+// Append @num values of @width bytes at @src to @buf, the bytes of each
+// reversed. Goes through a small buffer, except for the buffers below,
+// which are written to directly
+template <class Buf>
+void appendSwapped(Buf& buf, const char* src, int64_t num, int width) {
+  char tmp[4096];
+  const int64_t chunk = sizeof(tmp) / width;
+  for (int64_t i = 0; i < num; i += chunk) {
+    int64_t n = (num - i < chunk) ? num - i : chunk;
+    swapBytes(tmp, src + i * width, n, width);
+    buf.append(tmp, tmp + n * width);
+  }
+}
+
+inline void appendSwapped(
+  UncheckedWriter& writer, const char* src, int64_t num, int width) {
+  swapBytes(writer.pos, src, num, width);
+  writer.pos += num * width;
+}
+
+inline void appendSwapped(
+  IoRange& ioRange, const char* src, int64_t num, int width) {
+  ioRange.reserve(num * width);
+  swapBytes(ioRange.end(), src, num, width);
+  ioRange.commit(num * width);
+}
+
+
+// Wire policies decide how numbers and length prefixes are encoded;
+// every Serializer and Deserializer takes one, FixedWire by default.
+// Bytes and bools are the same on every wire. Floating point values
+// are encoded as float_wire says.
+
+// byte order conversion of a @Bytes wide integer, its own inverse
+template <int Bytes> struct BigEndian;
+
+template <> struct BigEndian<2> {
+  template <class I> static I convert(I val) { return htobe16(val); }
+};
+
+template <> struct BigEndian<4> {
+  template <class I> static I convert(I val) { return htobe32(val); }
+};
+
+template <> struct BigEndian<8> {
+  template <class I> static I convert(I val) { return htobe64(val); }
+};
+
+// Integers in fixed width big endian, lengths as a 4-byte int32_t. The
+// format of everything written before wire policies existed
+struct FixedWire {
+  static const bool fixed_width = true;
+
+  // whether numbers are stored as they are laid out in memory
+  static const bool native_layout =
+    __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+
+  typedef FixedWire float_wire;
+
+  template <class I> static int sizeOfInt(I val) {
+    return sizeof(I);
+  }
+
+  template <class Buf, class I> static void appendInt(Buf& buf, I val) {
+    I t = BigEndian<sizeof(I)>::convert(val);
+    buf.append((const char*)&t, (const char*)&t + sizeof(I));
+  }
+
+  template <class I> static bool parseInt(Range& range, I& val) {
+    if (range.size() < (int64_t)sizeof(I)) {
       return false;
     }
+    I t;
+    memcpy(&t, range.begin(), sizeof(I));
+    val = BigEndian<sizeof(I)>::convert(t);
+    range.pop_front(sizeof(I));
+    return true;
   }
 
-  bool skip(Range& range) const {
-    if (range.size() > 0) {
-      range.pop_front(1);
-      return true;
-    } else {
+  template <class I> static bool skipInt(Range& range) {
+    if (range.size() < (int64_t)sizeof(I)) {
       return false;
     }
+    range.pop_front(sizeof(I));
+    return true;
   }
-};
 
-template <> struct Deserializer<bool> {
-  bool parse(Range& range, bool& val) const {
-    if (range.size() > 0) {
-      val = (bool)*range.begin();
-      range.pop_front(1);
-      return true;
+  // Append the @num numbers at @p as one block, byte swapped a vector
+  // register at a time
+  template <class Buf, class T>
+  static void appendArray(Buf& buf, const T* p, int64_t num) {
+    if (sizeof(T) == 1 || native_layout) {
+      buf.append((const char*)p, (const char*)(p + num));
     } else {
-      return false;
+      appendSwapped(buf, (const char*)p, num, sizeof(T));
     }
   }
 
-  bool skip(Range& range) const {
-    if (range.size() > 0) {
-      range.pop_front(1);
+  // parse @num numbers into @out
+  template <class T>
+  static bool parseArray(Range& range, T* out, int64_t num) {
+    int64_t numBytes = num * sizeof(T);
+    if (range.size() < numBytes) {
+      return false;
+    }
+    // an empty vector has no data to copy to
+    if (numBytes == 0) {
       return true;
+    }
+    if (sizeof(T) == 1 || native_layout) {
+      memcpy(out, range.begin(), numBytes);
     } else {
-      return false;
+      swapBytes((char*)out, range.begin(), num, sizeof(T));
     }
+    range.pop_front(numBytes);
+    return true;
+  }
+
+  template <class Buf> static void appendLength(Buf& buf, int32_t len) {
+    appendInt(buf, len);
+  }
+
+  static int sizeOfLength(int32_t len) {
+    return 4;
+  }
+
+  static bool parseLength(Range& range, int32_t& len) {
+    return parseInt(range, len);
   }
 };
 
-template <> struct Deserializer<int16_t> {
-  bool parse(Range& range, int16_t& val) const {
-    if (range.size() > 1) {
-      val = be16toh(*(int16_t*)range.begin());
-      range.pop_front(2);
-      return true;
-    } else {
+// Numbers and lengths in fixed width and host byte order, so that
+// arrays of numbers are written and read with one copy, and VectorView
+// hands them out in place. Only for peers on the same architecture,
+// e.g. a local cache or spill files
+struct NativeWire {
+  static const bool fixed_width = true;
+
+  static const bool native_layout = true;
+
+  typedef NativeWire float_wire;
+
+  template <class I> static int sizeOfInt(I val) {
+    return sizeof(I);
+  }
+
+  template <class Buf, class I> static void appendInt(Buf& buf, I val) {
+    buf.append((const char*)&val, (const char*)&val + sizeof(I));
+  }
+
+  template <class I> static bool parseInt(Range& range, I& val) {
+    if (range.size() < (int64_t)sizeof(I)) {
       return false;
     }
+    memcpy(&val, range.begin(), sizeof(I));
+    range.pop_front(sizeof(I));
+    return true;
   }
 
-  bool skip(Range& range) const {
-    if (range.size() > 1) {
-      range.pop_front(2);
-      return true;
-    } else {
+  template <class I> static bool skipInt(Range& range) {
+    return FixedWire::skipInt<I>(range);
+  }
+
+  template <class Buf, class T>
+  static void appendArray(Buf& buf, const T* p, int64_t num) {
+    buf.append((const char*)p, (const char*)(p + num));
+  }
+
+  template <class T>
+  static bool parseArray(Range& range, T* out, int64_t num) {
+    int64_t numBytes = num * sizeof(T);
+    if (range.size() < numBytes) {
       return false;
     }
+    if (numBytes == 0) {
+      return true;
+    }
+    memcpy(out, range.begin(), numBytes);
+    range.pop_front(numBytes);
+    return true;
+  }
+
+  template <class Buf> static void appendLength(Buf& buf, int32_t len) {
+    appendInt(buf, len);
+  }
+
+  static int sizeOfLength(int32_t len) {
+    return 4;
+  }
+
+  static bool parseLength(Range& range, int32_t& len) {
+    return parseInt(range, len);
   }
 };
 
-template <> struct Deserializer<uint16_t> {
-  bool parse(Range& range, uint16_t& val) const {
-    if (range.size() > 1) {
-      val = be16toh(*(uint16_t*)range.begin());
-      range.pop_front(2);
-      return true;
-    } else {
+// Maps integers to the unsigned values a varint holds: zigzag for
+// signed types, as is for unsigned ones
+template <class I, bool Signed = std::is_signed<I>::value>
+struct VarintMapping {
+  static uint64_t encode(I val) {
+    return (uint64_t)val;
+  }
+
+  // false if @u does not fit into I
+  static bool decode(uint64_t u, I& val) {
+    if (u > (uint64_t)std::numeric_limits<I>::max()) {
       return false;
     }
+    val = (I)u;
+    return true;
   }
+};
 
-  bool skip(Range& range) const {
-    if (range.size() > 1) {
-      range.pop_front(2);
-      return true;
-    } else {
+template <class I> struct VarintMapping<I, true> {
+  static uint64_t encode(I val) {
+    return zigzagEncode(val);
+  }
+
+  static bool decode(uint64_t u, I& val) {
+    int64_t s = zigzagDecode(u);
+    if (s < std::numeric_limits<I>::min() ||
+        s > std::numeric_limits<I>::max()) {
       return false;
     }
+    val = (I)s;
+    return true;
   }
 };
 
-template <> struct Deserializer<int32_t> {
-  bool parse(Range& range, int32_t& val) const {
-    if (range.size() > 3) {
-      val = be32toh(*(int32_t*)range.begin());
-      range.pop_front(4);
-      return true;
-    } else {
+// Integers and lengths as LEB128 varints (see Varint.h), signed ones
+// zigzag mapped. Small values, which most counts and ids are, take a
+// byte or two instead of four or eight
+struct VarintWire {
+  static const bool fixed_width = false;
+
+  static const bool native_layout = false;
+
+  typedef FixedWire float_wire;
+
+  template <class I> static int sizeOfInt(I val) {
+    return varintSize(VarintMapping<I>::encode(val));
+  }
+
+  template <class Buf, class I> static void appendInt(Buf& buf, I val) {
+    char tmp[kMaxVarintSize];
+    buf.append(tmp, encodeVarint(tmp, VarintMapping<I>::encode(val)));
+  }
+
+  // memory is reserved already, encode in place
+  template <class I> static void appendInt(UncheckedWriter& writer, I val) {
+    writer.pos = encodeVarint(writer.pos, VarintMapping<I>::encode(val));
+  }
+
+  template <class I> static bool parseInt(Range& range, I& val) {
+    Range rest = range;
+    uint64_t u = 0;
+    if (!decodeVarint(rest, u) || !VarintMapping<I>::decode(u, val)) {
       return false;
     }
+    range = rest;
+    return true;
   }
 
-  bool skip(Range& range) const {
-    if (range.size() > 3) {
-      range.pop_front(4);
-      return true;
-    } else {
+  template <class I> static bool skipInt(Range& range) {
+    I val;
+    return parseInt(range, val);
+  }
+
+  // append the @num numbers at @p, only integers become varints
+  template <class Buf, class T>
+  static void appendArray(Buf& buf, const T* p, int64_t num) {
+    appendRun(buf, p, num, std::integral_constant<bool,
+      std::is_integral<T>::value && (sizeof(T) > 1)>());
+  }
+
+  // parse @num numbers into @out, 32 and 64-bit integers with the bulk
+  // decoder
+  template <class T>
+  static bool parseArray(Range& range, T* out, int64_t num) {
+    const int kind = !std::is_integral<T>::value || sizeof(T) == 1
+      ? run_fixed : sizeof(T) == 2 ? run_one_by_one : run_bulk;
+    return parseRun(range, out, num, std::integral_constant<int, kind>());
+  }
+
+  template <class Buf> static void appendLength(Buf& buf, int32_t len) {
+    appendInt(buf, (uint32_t)len);
+  }
+
+  static int sizeOfLength(int32_t len) {
+    return sizeOfInt((uint32_t)len);
+  }
+
+  // lengths beyond INT32_MAX fail to parse
+  static bool parseLength(Range& range, int32_t& len) {
+    uint32_t u = 0;
+    if (!parseInt(range, u) || (int32_t)u < 0) {
       return false;
     }
+    len = u;
+    return true;
   }
-};
 
-template <> struct Deserializer<uint32_t> {
-  bool parse(Range& range, uint32_t& val) const {
-    if (range.size() > 3) {
-      val = be32toh(*(uint32_t*)range.begin());
-      range.pop_front(4);
-      return true;
-    } else {
-      return false;
+ private:
+
+  enum {
+    run_fixed = 0,
+    run_one_by_one,
+    run_bulk,
+  };
+
+  template <class Buf, class T>
+  static void appendRun(Buf& buf, const T* p, int64_t num, std::true_type) {
+    for (int64_t i = 0; i < num; ++i) {
+      appendInt(buf, p[i]);
     }
   }
 
-  bool skip(Range& range) const {
-    if (range.size() > 3) {
-      range.pop_front(4);
-      return true;
-    } else {
+  template <class Buf, class T>
+  static void appendRun(Buf& buf, const T* p, int64_t num, std::false_type) {
+    FixedWire::appendArray(buf, p, num);
+  }
+
+  template <class I>
+  static bool parseRun(Range& range, I* out, int64_t num,
+                       std::integral_constant<int, run_bulk>) {
+    typedef typename std::make_unsigned<I>::type U;
+    Range rest = range;
+    if (decodeVarints(rest, (U*)out, num) != num) {
       return false;
     }
+    if (std::is_signed<I>::value) {
+      for (int64_t i = 0; i < num; ++i) {
+        out[i] = (I)zigzagDecode((U)out[i]);
+      }
+    }
+    range = rest;
+    return true;
+  }
+
+  template <class I>
+  static bool parseRun(Range& range, I* out, int64_t num,
+                       std::integral_constant<int, run_one_by_one>) {
+    for (int64_t i = 0; i < num; ++i) {
+      if (!parseInt(range, out[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  template <class T>
+  static bool parseRun(Range& range, T* out, int64_t num,
+                       std::integral_constant<int, run_fixed>) {
+    return FixedWire::parseArray(range, out, num);
   }
 };
 
-template <> struct Deserializer<int64_t> {
-  bool parse(Range& range, int64_t& val) const {
-    if (range.size() > 7) {
-      val = be64toh(*(int64_t*)range.begin());
-      range.pop_front(8);
+
+// Encoded size of T on the wire if every value of T encodes to the same
+// number of bytes, known at compile time, 0 otherwise
+template <class T, class Wire = FixedWire> struct FixedSize {
+  static const int value = 0;
+};
+
+template <class Wire> struct FixedSize<char, Wire> {
+  static const int value = 1;
+};
+
+template <class Wire> struct FixedSize<bool, Wire> {
+  static const int value = 1;
+};
+
+template <class Wire> struct FixedSize<double, Wire> {
+  static const int value = 8;
+};
+
+template <class Wire> struct FixedSize<float, Wire> {
+  static const int value = 4;
+};
+
+template <class Wire> struct FixedSize<int16_t, Wire> {
+  static const int value = Wire::fixed_width ? 2 : 0;
+};
+
+template <class Wire> struct FixedSize<uint16_t, Wire> {
+  static const int value = Wire::fixed_width ? 2 : 0;
+};
+
+template <class Wire> struct FixedSize<int32_t, Wire> {
+  static const int value = Wire::fixed_width ? 4 : 0;
+};
+
+template <class Wire> struct FixedSize<uint32_t, Wire> {
+  static const int value = Wire::fixed_width ? 4 : 0;
+};
+
+template <class Wire> struct FixedSize<int64_t, Wire> {
+  static const int value = Wire::fixed_width ? 8 : 0;
+};
+
+template <class Wire> struct FixedSize<uint64_t, Wire> {
+  static const int value = Wire::fixed_width ? 8 : 0;
+};
+
+// sum of Sizes if none of them is 0, 0 otherwise
+template <int... Sizes> struct FixedSizeSum {
+  static const int value = 0;
+};
+
+template <int S> struct FixedSizeSum<S> {
+  static const int value = S;
+};
+
+template <int S, int... Rest> struct FixedSizeSum<S, Rest...> {
+  static const int rest = FixedSizeSum<Rest...>::value;
+  static const int value = (S != 0 && rest != 0) ? S + rest : 0;
+};
+
+template <class F, class T, class Wire>
+struct FixedSize<std::pair<F, T>, Wire> {
+  static const int value = FixedSizeSum<
+    FixedSize<F, Wire>::value, FixedSize<T, Wire>::value>::value;
+};
+
+template <class... TypeArgs, class Wire>
+struct FixedSize<std::tuple<TypeArgs...>, Wire> {
+  static const int value =
+    FixedSizeSum<FixedSize<TypeArgs, Wire>::value...>::value;
+};
+
+
+// Template classes to deserialize a string. They parse a contiguous
+// Range, IoBuf::coalesce() provides one for a chained buffer
+template <class T, class Wire = FixedWire> struct Deserializer;
+
+// Specialization of Deserializer classes
+template <class Wire> struct Deserializer<char, Wire> {
+  bool parse(Range& range, char& val) const {
+    if (range.size() > 0) {
+      val = *range.begin();
+      range.pop_front(1);
       return true;
     } else {
       return false;
@@ -155,8 +493,8 @@ template <> struct Deserializer<int64_t> {
   }
 
   bool skip(Range& range) const {
-    if (range.size() > 7) {
-      range.pop_front(8);
+    if (range.size() > 0) {
+      range.pop_front(1);
       return true;
     } else {
       return false;
@@ -164,11 +502,11 @@ template <> struct Deserializer<int64_t> {
   }
 };
 
-template <> struct Deserializer<uint64_t> {
-  bool parse(Range& range, uint64_t& val) const {
-    if (range.size() > 7) {
-      val = be64toh(*(uint64_t*)range.begin());
-      range.pop_front(8);
+template <class Wire> struct Deserializer<bool, Wire> {
+  bool parse(Range& range, bool& val) const {
+    if (range.size() > 0) {
+      val = (bool)*range.begin();
+      range.pop_front(1);
       return true;
     } else {
       return false;
@@ -176,8 +514,8 @@ template <> struct Deserializer<uint64_t> {
   }
 
   bool skip(Range& range) const {
-    if (range.size() > 7) {
-      range.pop_front(8);
+    if (range.size() > 0) {
+      range.pop_front(1);
       return true;
     } else {
       return false;
@@ -185,46 +523,65 @@ template <> struct Deserializer<uint64_t> {
   }
 };
 
+// integers wider than a byte, encoded as the wire says
+template <class I, class Wire> struct IntDeserializer {
+  bool parse(Range& range, I& val) const {
+    return Wire::parseInt(range, val);
+  }
+
+  bool skip(Range& range) const {
+    return Wire::template skipInt<I>(range);
+  }
+};
+
+template <class Wire> struct Deserializer<int16_t, Wire>
+  : IntDeserializer<int16_t, Wire> {};
+
+template <class Wire> struct Deserializer<uint16_t, Wire>
+  : IntDeserializer<uint16_t, Wire> {};
+
+template <class Wire> struct Deserializer<int32_t, Wire>
+  : IntDeserializer<int32_t, Wire> {};
+
+template <class Wire> struct Deserializer<uint32_t, Wire>
+  : IntDeserializer<uint32_t, Wire> {};
+
+template <class Wire> struct Deserializer<int64_t, Wire>
+  : IntDeserializer<int64_t, Wire> {};
+
+template <class Wire> struct Deserializer<uint64_t, Wire>
+  : IntDeserializer<uint64_t, Wire> {};
+
 template <class T, class F>  T& bitwise_cast(F& val) {
   return *(T*)(&val);
 }
 
-template <> struct Deserializer<double> {
+template <class Wire> struct Deserializer<double, Wire> {
   bool parse(Range& range, double& val) const {
-    return Deserializer<int64_t>().parse(
+    return Wire::float_wire::parseInt(
       range, bitwise_cast<int64_t, double>(val));
   }
 
   bool skip(Range& range) const {
-    if (range.size() > 7) {
-      range.pop_front(8);
-      return true;
-    } else {
-      return false;
-    }
+    return Wire::float_wire::template skipInt<int64_t>(range);
   }
 };
 
-template <> struct Deserializer<float> {
+template <class Wire> struct Deserializer<float, Wire> {
   bool parse(Range& range, float& val) const {
-    return Deserializer<int32_t>().parse(
+    return Wire::float_wire::parseInt(
       range, bitwise_cast<int32_t, float>(val));
   }
 
   bool skip(Range& range) const {
-    if (range.size() > 3) {
-      range.pop_front(4);
-      return true;
-    } else {
-      return false;
-    }
+    return Wire::float_wire::template skipInt<int32_t>(range);
   }
 };
 
-template <> struct Deserializer<std::string> {
+template <class Wire> struct Deserializer<std::string, Wire> {
   bool parse(Range& range, std::string& val) const {
     int32_t len = 0;
-    if (!Deserializer<int32_t>().parse(range, len)) {
+    if (!Wire::parseLength(range, len)) {
       return false;
     }
     if (range.size() >= len) {
@@ -238,7 +595,7 @@ template <> struct Deserializer<std::string> {
 
   bool skip(Range& range) const {
     int32_t len = 0;
-    if (!Deserializer<int32_t>().parse(range, len)) {
+    if (!Wire::parseLength(range, len)) {
       return false;
     }
     if (range.size() >= len) {
@@ -250,10 +607,10 @@ template <> struct Deserializer<std::string> {
   }
 };
 
-template <> struct Deserializer<Range> {
+template <class Wire> struct Deserializer<Range, Wire> {
   bool parse(Range& range, Range& val) const {
     int32_t len = 0;
-    if (!Deserializer<int32_t>().parse(range, len)) {
+    if (!Wire::parseLength(range, len)) {
       return false;
     }
     if (range.size() >= len) {
@@ -267,7 +624,7 @@ template <> struct Deserializer<Range> {
 
   bool skip(Range& range) const {
     int32_t len = 0;
-    if (!Deserializer<int32_t>().parse(range, len)) {
+    if (!Wire::parseLength(range, len)) {
       return false;
     }
     if (range.size() >= len) {
@@ -279,10 +636,11 @@ template <> struct Deserializer<Range> {
   }
 };
 
-template <class F, class T> struct Deserializer<std::map<F, T>> {
+template <class F, class T, class Wire>
+struct Deserializer<std::map<F, T>, Wire> {
   bool parse(Range& range, std::map<F, T>& val) const {
     int32_t num = 0;
-    if (!Deserializer<int32_t>().parse(range, num)) {
+    if (!Wire::parseLength(range, num)) {
       return false;
     }
     if (num < 0) {
@@ -291,10 +649,10 @@ template <class F, class T> struct Deserializer<std::map<F, T>> {
 
     for (int i = 0; i < num; ++i) {
       std::pair<F, T> single;
-      if (!Deserializer<F>().parse(range, single.first)) {
+      if (!Deserializer<F, Wire>().parse(range, single.first)) {
         return false;
       }
-      if (!Deserializer<T>().parse(range, single.second)) {
+      if (!Deserializer<T, Wire>().parse(range, single.second)) {
         return false;
       }
       val.insert(single);
@@ -305,17 +663,17 @@ template <class F, class T> struct Deserializer<std::map<F, T>> {
 
   bool skip(Range& range) const {
     int32_t num = 0;
-    if (!Deserializer<int32_t>().parse(range, num)) {
+    if (!Wire::parseLength(range, num)) {
       return false;
     }
     if (num < 0) {
       return false;
     }
     for (int i = 0; i < num; ++i) {
-      if (!Deserializer<F>().skip(range)) {
+      if (!Deserializer<F, Wire>().skip(range)) {
         return false;
       }
-      if (!Deserializer<T>().skip(range)) {
+      if (!Deserializer<T, Wire>().skip(range)) {
         return false;
       }
     }
@@ -324,10 +682,11 @@ template <class F, class T> struct Deserializer<std::map<F, T>> {
   }
 };
 
-template <class F, class T> struct Deserializer<std::unordered_map<F, T>> {
+template <class F, class T, class Wire>
+struct Deserializer<std::unordered_map<F, T>, Wire> {
   bool parse(Range& range, std::unordered_map<F, T>& val) const {
     int32_t num = 0;
-    if (!Deserializer<int32_t>().parse(range, num)) {
+    if (!Wire::parseLength(range, num)) {
       return false;
     }
     if (num < 0) {
@@ -336,10 +695,10 @@ template <class F, class T> struct Deserializer<std::unordered_map<F, T>> {
 
     for (int i = 0; i < num; ++i) {
       std::pair<F, T> single;
-      if (!Deserializer<F>().parse(range, single.first)) {
+      if (!Deserializer<F, Wire>().parse(range, single.first)) {
         return false;
       }
-      if (!Deserializer<T>().parse(range, single.second)) {
+      if (!Deserializer<T, Wire>().parse(range, single.second)) {
         return false;
       }
       val.insert(single);
@@ -350,17 +709,17 @@ template <class F, class T> struct Deserializer<std::unordered_map<F, T>> {
 
   bool skip(Range& range) const {
     int32_t num = 0;
-    if (!Deserializer<int32_t>().parse(range, num)) {
+    if (!Wire::parseLength(range, num)) {
       return false;
     }
     if (num < 0) {
       return false;
     }
     for (int i = 0; i < num; ++i) {
-      if (!Deserializer<F>().skip(range)) {
+      if (!Deserializer<F, Wire>().skip(range)) {
         return false;
       }
-      if (!Deserializer<T>().skip(range)) {
+      if (!Deserializer<T, Wire>().skip(range)) {
         return false;
       }
     }
@@ -369,22 +728,23 @@ template <class F, class T> struct Deserializer<std::unordered_map<F, T>> {
   }
 };
 
-template <class F, class T> struct Deserializer<std::pair<F, T>> {
+template <class F, class T, class Wire>
+struct Deserializer<std::pair<F, T>, Wire> {
   bool parse(Range& range, std::pair<F, T>& val) const {
-    if (!Deserializer<F>().parse(range, val.first)) {
+    if (!Deserializer<F, Wire>().parse(range, val.first)) {
       return false;
     }
-    if (!Deserializer<T>().parse(range, val.second)) {
+    if (!Deserializer<T, Wire>().parse(range, val.second)) {
       return false;
     }
     return true;
   }
 
   bool skip(Range& range) const {
-    if (!Deserializer<F>().skip(range)) {
+    if (!Deserializer<F, Wire>().skip(range)) {
       return false;
     }
-    if (!Deserializer<T>().skip(range)) {
+    if (!Deserializer<T, Wire>().skip(range)) {
       return false;
     }
     return true;
@@ -392,7 +752,7 @@ template <class F, class T> struct Deserializer<std::pair<F, T>> {
 };
 
 // Helper class for Deserializer<tuple<...>>
-template <int N, class... TypeArgs>
+template <int N, class Wire, class... TypeArgs>
 struct DeserializerHelper {
 
   static const int idx = std::tuple_size<std::tuple<TypeArgs...>>::value - N;
@@ -401,24 +761,25 @@ struct DeserializerHelper {
   typedef typename std::tuple_element<idx, tuple_type>::type element_type;
 
   bool parse(Range& range, std::tuple<TypeArgs...>& val) const {
-    if (!Deserializer<element_type>().parse(range, std::get<idx>(val))) {
+    if (!Deserializer<element_type, Wire>().parse(
+          range, std::get<idx>(val))) {
       return false;
     }
 
-    return DeserializerHelper<N-1, TypeArgs...>().parse(range, val);
+    return DeserializerHelper<N-1, Wire, TypeArgs...>().parse(range, val);
   }
 
   bool skip(Range& range) const {
-    if (!Deserializer<element_type>().skip(range)) {
+    if (!Deserializer<element_type, Wire>().skip(range)) {
       return false;
     }
 
-    return DeserializerHelper<N-1, TypeArgs...>().skip(range);
+    return DeserializerHelper<N-1, Wire, TypeArgs...>().skip(range);
   }
 };
 
-template <class... TypeArgs>
-struct DeserializerHelper<1, TypeArgs...> {
+template <class Wire, class... TypeArgs>
+struct DeserializerHelper<1, Wire, TypeArgs...> {
 
   static const int idx = std::tuple_size<std::tuple<TypeArgs...>>::value - 1;
 
@@ -426,36 +787,62 @@ struct DeserializerHelper<1, TypeArgs...> {
   typedef typename std::tuple_element<idx, tuple_type>::type element_type;
 
   bool parse(Range& range, std::tuple<TypeArgs...>& val) const {
-    return Deserializer<element_type>().parse(range, std::get<idx>(val));
+    return Deserializer<element_type, Wire>().parse(
+      range, std::get<idx>(val));
   }
 
   bool skip(Range& range) const {
-    return Deserializer<element_type>().skip(range);
+    return Deserializer<element_type, Wire>().skip(range);
   }
 };
 
-template <class... TypeArgs>
-struct Deserializer<std::tuple<TypeArgs...>> {
+template <class... TypeArgs, class Wire>
+struct Deserializer<std::tuple<TypeArgs...>, Wire> {
+  typedef std::tuple<TypeArgs...> tuple_type;
+  typedef std::tuple_size<tuple_type> tuple_size_type;
+  typedef DeserializerHelper<tuple_size_type::value, Wire, TypeArgs...>
+    helper_t;
+
   bool parse(Range& range, std::tuple<TypeArgs...>& val) const {
-    typedef std::tuple<TypeArgs...> tuple_type;
-    typedef std::tuple_size<tuple_type> tuple_size_type;
-    typedef DeserializerHelper<tuple_size_type::value, TypeArgs...> helper_t;
     return helper_t().parse(range, val);
   }
 
   bool skip(Range& range) const {
-    typedef std::tuple<TypeArgs...> tuple_type;
-    typedef std::tuple_size<tuple_type> tuple_size_type;
-    typedef DeserializerHelper<tuple_size_type::value, TypeArgs...> helper_t;
     return helper_t().skip(range);
   }
 };
 
 
-template <class T> struct Deserializer<std::vector<T>> {
+// whether a vector of T is encoded as one array of numbers
+template <class T> struct IsNumber {
+  static const bool value =
+    std::is_arithmetic<T>::value && !std::is_same<T, bool>::value;
+};
+
+// Parses the elements of a vector one at a time, except for numbers,
+// which the wire decodes as one array
+template <class T, class Wire, bool Bulk = IsNumber<T>::value>
+struct ElementsParser {
+  bool parse(Range& range, std::vector<T>& val) const {
+    for (auto& item : val) {
+      if (!Deserializer<T, Wire>().parse(range, item)) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+template <class T, class Wire> struct ElementsParser<T, Wire, true> {
+  bool parse(Range& range, std::vector<T>& val) const {
+    return Wire::parseArray(range, val.data(), val.size());
+  }
+};
+
+template <class T, class Wire> struct Deserializer<std::vector<T>, Wire> {
   bool parse(Range& range, std::vector<T>& val) const {
     int32_t num = 0;
-    if (!Deserializer<int32_t>().parse(range, num)) {
+    if (!Wire::parseLength(range, num)) {
       return false;
     }
     if (num < 0) {
@@ -463,26 +850,29 @@ template <class T> struct Deserializer<std::vector<T>> {
     }
 
     val.resize(num);
-    for (auto& item : val) {
-      if (!Deserializer<T>().parse(range, item)) {
-        return false;
-      }
-    }
-
-    return true;
+    return ElementsParser<T, Wire>().parse(range, val);
   }
 
   bool skip(Range& range) const {
     int32_t num = 0;
-    if (!Deserializer<int32_t>().parse(range, num)) {
+    if (!Wire::parseLength(range, num)) {
       return false;
     }
     if (num < 0) {
       return false;
     }
 
+    const int64_t elemSize = FixedSize<T, Wire>::value;
+    if (elemSize) {
+      if (range.size() < num * elemSize) {
+        return false;
+      }
+      range.pop_front(num * elemSize);
+      return true;
+    }
+
     for (int i = 0; i < num; ++i) {
-      if (!Deserializer<T>().skip(range)) {
+      if (!Deserializer<T, Wire>().skip(range)) {
         return false;
       }
     }
@@ -491,10 +881,10 @@ template <class T> struct Deserializer<std::vector<T>> {
   }
 };
 
-template <class T> struct Deserializer<std::set<T>> {
+template <class T, class Wire> struct Deserializer<std::set<T>, Wire> {
   bool parse(Range& range, std::set<T>& val) const {
     int32_t num = 0;
-    if (!Deserializer<int32_t>().parse(range, num)) {
+    if (!Wire::parseLength(range, num)) {
       return false;
     }
     if (num < 0) {
@@ -503,7 +893,7 @@ template <class T> struct Deserializer<std::set<T>> {
 
     for (int i = 0; i < num; ++i) {
       T item;
-      if (!Deserializer<T>().parse(range, item)) {
+      if (!Deserializer<T, Wire>().parse(range, item)) {
         return false;
       }
 
@@ -515,7 +905,7 @@ template <class T> struct Deserializer<std::set<T>> {
 
   bool skip(Range& range) const {
     int32_t num = 0;
-    if (!Deserializer<int32_t>().parse(range, num)) {
+    if (!Wire::parseLength(range, num)) {
       return false;
     }
     if (num < 0) {
@@ -523,7 +913,7 @@ template <class T> struct Deserializer<std::set<T>> {
     }
 
     for (int i = 0; i < num; ++i) {
-      if (!Deserializer<T>().skip(range)) {
+      if (!Deserializer<T, Wire>().skip(range)) {
         return false;
       }
     }
@@ -534,14 +924,17 @@ template <class T> struct Deserializer<std::set<T>> {
 
 
 // Template class Serializer serializes a data structure T
-// into a string
-template <class T> struct Serializer;
+// into a string. The output buffer can be an IoRange or an IoBuf, or
+// anything else with IoRange's append() methods; a large message is
+// best built in an IoBuf, which never copies what it holds already
+template <class T, class Wire = FixedWire> struct Serializer;
 
 
 // Specializations of Serializer classes
-template <> struct Serializer<char> {
-  void append(IoRange& ioRange, const char& val) const {
-    ioRange.append(&val, &val + 1);
+template <class Wire> struct Serializer<char, Wire> {
+  template <class Buf>
+  void append(Buf& buf, const char& val) const {
+    buf.append(&val, &val + 1);
   }
 
   int sizeOf(const char& val) const {
@@ -549,9 +942,10 @@ template <> struct Serializer<char> {
   }
 };
 
-template <> struct Serializer<bool> {
-  void append(IoRange& ioRange, const bool& val) const {
-    Serializer<char>().append(ioRange, (const char&)val);
+template <class Wire> struct Serializer<bool, Wire> {
+  template <class Buf>
+  void append(Buf& buf, const bool& val) const {
+    Serializer<char, Wire>().append(buf, (const char&)val);
   }
 
   int sizeOf(const bool& val) const {
@@ -559,80 +953,45 @@ template <> struct Serializer<bool> {
   }
 };
 
-template <> struct Serializer<int16_t> {
-  void append(IoRange& ioRange, const int16_t& val) const {
-    int16_t t = htobe16(val);
-    ioRange.append((char*)&t, (char*)&t + 2);
+// integers wider than a byte, encoded as the wire says
+template <class I, class Wire> struct IntSerializer {
+  template <class Buf>
+  void append(Buf& buf, const I& val) const {
+    Wire::appendInt(buf, val);
   }
 
-  int sizeOf(const int16_t& val) const {
-    return 2;
+  int sizeOf(const I& val) const {
+    return Wire::sizeOfInt(val);
   }
 };
 
-template <> struct Serializer<uint16_t> {
-  void append(IoRange& ioRange, const uint16_t& val) const {
-    uint16_t t = htobe16(val);
-    ioRange.append((char*)&t, (char*)&t + 2);
-  }
+template <class Wire> struct Serializer<int16_t, Wire>
+  : IntSerializer<int16_t, Wire> {};
 
-  int sizeOf(const uint16_t& val) const {
-    return 2;
-  }
-};
+template <class Wire> struct Serializer<uint16_t, Wire>
+  : IntSerializer<uint16_t, Wire> {};
 
-template <> struct Serializer<int32_t> {
-  void append(IoRange& ioRange, const int32_t& val) const {
-    int32_t t = htobe32(val);
-    ioRange.append((char*)&t, (char*)&t + 4);
-  }
+template <class Wire> struct Serializer<int32_t, Wire>
+  : IntSerializer<int32_t, Wire> {};
 
-  int sizeOf(const int32_t& val) const {
-    return 4;
-  }
-};
+template <class Wire> struct Serializer<uint32_t, Wire>
+  : IntSerializer<uint32_t, Wire> {};
 
-template <> struct Serializer<uint32_t> {
-  void append(IoRange& ioRange, const uint32_t& val) const {
-    uint32_t t = htobe32(val);
-    ioRange.append((char*)&t, (char*)&t + 4);
-  }
+template <class Wire> struct Serializer<int64_t, Wire>
+  : IntSerializer<int64_t, Wire> {};
 
-  int sizeOf(const uint32_t& val) const {
-    return 4;
-  }
-};
-
-template <> struct Serializer<int64_t> {
-  void append(IoRange& ioRange, const int64_t& val) const {
-    int64_t t = htobe64(val);
-    ioRange.append((char*)&t, (char*)&t + 8);
-  }
-
-  int sizeOf(const int64_t& val) const {
-    return 8;
-  }
-};
-
-template <> struct Serializer<uint64_t> {
-  void append(IoRange& ioRange, const uint64_t& val) const {
-    uint64_t t = htobe64(val);
-    ioRange.append((char*)&t, (char*)&t + 8);
-  }
-
-  int sizeOf(const uint64_t& val) const {
-    return 8;
-  }
-};
+template <class Wire> struct Serializer<uint64_t, Wire>
+  : IntSerializer<uint64_t, Wire> {};
 
 template <class T, class F> const T& bitwise_const_cast(const F& val) {
   return *(const T*)(&val);
 }
 
-template <> struct Serializer<double> {
-  void append(IoRange& ioRange, const double& val) const {
-    Serializer<int64_t>().append(
-      ioRange, bitwise_const_cast<int64_t, double>(val));
+template <class Wire> struct Serializer<double, Wire> {
+  template <class Buf>
+  void append(Buf& buf, const double& val) const {
+    Wire::float_wire::appendInt(
+      buf, bitwise_const_cast<int64_t, double>(val));
   }
 
   int sizeOf(const double& val) const {
@@ -640,10 +999,11 @@ template <> struct Serializer<double> {
   }
 };
 
-template <> struct Serializer<float> {
-  void append(IoRange& ioRange, const float& val) const {
-    Serializer<int32_t>().append(
-      ioRange, bitwise_const_cast<int32_t, float>(val));
+template <class Wire> struct Serializer<float, Wire> {
+  template <class Buf>
+  void append(Buf& buf, const float& val) const {
+    Wire::float_wire::appendInt(
+      buf, bitwise_const_cast<int32_t, float>(val));
   }
 
   int sizeOf(const float& val) const {
@@ -651,128 +1011,172 @@ template <> struct Serializer<float> {
   }
 };
 
-template <> struct Serializer<std::string> {
-  void append(IoRange& ioRange, const std::string& val) const {
+template <class Wire> struct Serializer<std::string, Wire> {
+  template <class Buf>
+  void append(Buf& buf, const std::string& val) const {
     int32_t len = val.size();
-    Serializer<int32_t>().append(ioRange, len);
-    ioRange.append(val);
+    Wire::appendLength(buf, len);
+    buf.append(val);
   }
 
   int sizeOf(const std::string& val) const {
     int32_t len = val.size();
-    return Serializer<int32_t>().sizeOf(len) + len;
+    return Wire::sizeOfLength(len) + len;
   }
 };
 
-template <> struct Serializer<Range> {
-  void append(IoRange& ioRange, const Range& val) const {
+template <class Wire> struct Serializer<Range, Wire> {
+  template <class Buf>
+  void append(Buf& buf, const Range& val) const {
     int32_t len = val.size();
-    Serializer<int32_t>().append(ioRange, len);
-    ioRange.append(val);
+    Wire::appendLength(buf, len);
+    buf.append(val);
   }
 
   int sizeOf(const Range& val) const {
     int32_t len = val.size();
-    return Serializer<int32_t>().sizeOf(len) + len;
+    return Wire::sizeOfLength(len) + len;
   }
 };
 
-template <class F, class T> struct Serializer<std::map<F, T>> {
-  void append(IoRange& ioRange, const std::map<F, T>& val) const {
-    Serializer<int32_t>().append(ioRange, val.size());
+template <class F, class T, class Wire>
+struct Serializer<std::map<F, T>, Wire> {
+  template <class Buf>
+  void append(Buf& buf, const std::map<F, T>& val) const {
+    Wire::appendLength(buf, val.size());
 
     for (auto& p : val) {
-      Serializer<F>().append(ioRange, p.first);
-      Serializer<T>().append(ioRange, p.second);
+      Serializer<F, Wire>().append(buf, p.first);
+      Serializer<T, Wire>().append(buf, p.second);
     }
   }
 
-  int sizeOf(const std::map<F, T>& val) {
-    int total = Serializer<int32_t>().sizeOf(val.size());
+  int sizeOf(const std::map<F, T>& val) const {
+    int total = Wire::sizeOfLength(val.size());
+    const int entrySize = FixedSize<std::pair<F, T>, Wire>::value;
+    if (entrySize) {
+      return total + val.size() * entrySize;
+    }
+
     for (auto& p : val) {
-      total += Serializer<F>().sizeOf(p.first);
-      total += Serializer<T>().sizeOf(p.second);
+      total += Serializer<F, Wire>().sizeOf(p.first);
+      total += Serializer<T, Wire>().sizeOf(p.second);
     }
     return total;
   }
 };
 
-template <class F, class T> struct Serializer<std::unordered_map<F, T>> {
-  void append(IoRange& ioRange, const std::unordered_map<F, T>& val) const {
-    Serializer<int32_t>().append(ioRange, val.size());
+template <class F, class T, class Wire>
+struct Serializer<std::unordered_map<F, T>, Wire> {
+  template <class Buf>
+  void append(Buf& buf, const std::unordered_map<F, T>& val) const {
+    Wire::appendLength(buf, val.size());
 
     for (auto& p : val) {
-      Serializer<F>().append(ioRange, p.first);
-      Serializer<T>().append(ioRange, p.second);
+      Serializer<F, Wire>().append(buf, p.first);
+      Serializer<T, Wire>().append(buf, p.second);
     }
   }
 
-  int sizeOf(const std::unordered_map<F, T>& val) {
-    int total = Serializer<int32_t>().sizeOf(val.size());
+  int sizeOf(const std::unordered_map<F, T>& val) const {
+    int total = Wire::sizeOfLength(val.size());
+    const int entrySize = FixedSize<std::pair<F, T>, Wire>::value;
+    if (entrySize) {
+      return total + val.size() * entrySize;
+    }
+
     for (auto& p : val) {
-      total += Serializer<F>().sizeOf(p.first);
-      total += Serializer<T>().sizeOf(p.second);
+      total += Serializer<F, Wire>().sizeOf(p.first);
+      total += Serializer<T, Wire>().sizeOf(p.second);
     }
     return total;
   }
 };
 
-template <class F, class T> struct Serializer<std::pair<F, T>> {
-  void append(IoRange& ioRange, const std::pair<F, T>& val) const {
-    Serializer<F>().append(ioRange, val.first);
-    Serializer<T>().append(ioRange, val.second);
+template <class F, class T, class Wire>
+struct Serializer<std::pair<F, T>, Wire> {
+  template <class Buf>
+  void append(Buf& buf, const std::pair<F, T>& val) const {
+    Serializer<F, Wire>().append(buf, val.first);
+    Serializer<T, Wire>().append(buf, val.second);
   }
 
-  int sizeOf(const std::pair<F, T>& val) {
+  int sizeOf(const std::pair<F, T>& val) const {
     int total = 0;
-    total += Serializer<F>().sizeOf(val.first);
-    total += Serializer<T>().sizeOf(val.second);
+    total += Serializer<F, Wire>().sizeOf(val.first);
+    total += Serializer<T, Wire>().sizeOf(val.second);
     return total;
   }
 };
 
-template <class T> struct Serializer<std::set<T>> {
-  void append(IoRange& ioRange, const std::set<T>& val) const {
-    Serializer<int32_t>().append(ioRange, val.size());
+template <class T, class Wire> struct Serializer<std::set<T>, Wire> {
+  template <class Buf>
+  void append(Buf& buf, const std::set<T>& val) const {
+    Wire::appendLength(buf, val.size());
 
     for (auto& i : val) {
-      Serializer<T>().append(ioRange, i);
+      Serializer<T, Wire>().append(buf, i);
     }
   }
 
   int sizeOf(const std::set<T>& val) const {
     int total = 0;
 
-    total += Serializer<int32_t>().sizeOf(val.size());
+    total += Wire::sizeOfLength(val.size());
+    if (FixedSize<T, Wire>::value) {
+      return total + val.size() * FixedSize<T, Wire>::value;
+    }
+
     for (auto& i : val) {
-      total += Serializer<T>().sizeOf(i);
+      total += Serializer<T, Wire>().sizeOf(i);
     }
 
     return total;
   }
 };
 
-template <class T> struct Serializer<std::vector<T>> {
-  void append(IoRange& ioRange, const std::vector<T>& val) const {
-    Serializer<int32_t>().append(ioRange, val.size());
-
+// Appends the elements of a vector one at a time, except for numbers,
+// which the wire encodes as one array
+template <class T, class Wire, bool Bulk = IsNumber<T>::value>
+struct ElementsWriter {
+  template <class Buf>
+  void append(Buf& buf, const std::vector<T>& val) const {
     for (auto& i : val) {
-      Serializer<T>().append(ioRange, i);
+      Serializer<T, Wire>().append(buf, i);
     }
   }
+};
 
-  int sizeOf(const std::vector<T>& val) {
+template <class T, class Wire> struct ElementsWriter<T, Wire, true> {
+  template <class Buf>
+  void append(Buf& buf, const std::vector<T>& val) const {
+    Wire::appendArray(buf, val.data(), val.size());
+  }
+};
+
+template <class T, class Wire> struct Serializer<std::vector<T>, Wire> {
+  template <class Buf>
+  void append(Buf& buf, const std::vector<T>& val) const {
+    Wire::appendLength(buf, val.size());
+    ElementsWriter<T, Wire>().append(buf, val);
+  }
+
+  int sizeOf(const std::vector<T>& val) const {
     int total = 0;
-    total += Serializer<int32_t>().sizeOf(val.size());
+    total += Wire::sizeOfLength(val.size());
+    if (FixedSize<T, Wire>::value) {
+      return total + val.size() * FixedSize<T, Wire>::value;
+    }
+
     for (auto& i : val) {
-      total += Serializer<T>().sizeOf(i);
+      total += Serializer<T, Wire>().sizeOf(i);
     }
 
     return total;
   }
 };
 
-template <int N, class... TypeArgs>
+template <int N, class Wire, class... TypeArgs>
 struct SerializerHelper {
 
   typedef std::tuple<TypeArgs...> tuple_type;
@@ -782,20 +1186,21 @@ struct SerializerHelper {
 
   typedef typename std::tuple_element<idx, tuple_type>::type element_type;
 
-  void append(IoRange& ioRange, const tuple_type& val) const {
-    Serializer<element_type>().append(ioRange, std::get<idx>(val));
-    SerializerHelper<N-1, TypeArgs...>().append(ioRange, val);
+  template <class Buf>
+  void append(Buf& buf, const tuple_type& val) const {
+    Serializer<element_type, Wire>().append(buf, std::get<idx>(val));
+    SerializerHelper<N-1, Wire, TypeArgs...>().append(buf, val);
   }
 
   int sizeOf(const tuple_type& val) const {
-    int total = Serializer<element_type>().sizeOf(std::get<idx>(val));
-    total += SerializerHelper<N-1, TypeArgs...>().sizeOf(val);
+    int total = Serializer<element_type, Wire>().sizeOf(std::get<idx>(val));
+    total += SerializerHelper<N-1, Wire, TypeArgs...>().sizeOf(val);
     return total;
   }
 };
 
-template <class... TypeArgs>
-struct SerializerHelper<1, TypeArgs...> {
+template <class Wire, class... TypeArgs>
+struct SerializerHelper<1, Wire, TypeArgs...> {
 
   typedef std::tuple<TypeArgs...> tuple_type;
   typedef typename std::tuple_size<tuple_type> tuple_size_type;
@@ -804,29 +1209,165 @@ struct SerializerHelper<1, TypeArgs...> {
 
   typedef typename std::tuple_element<idx, tuple_type>::type element_type;
 
-  void append(IoRange& ioRange, const tuple_type& val) const {
-    Serializer<element_type>().append(ioRange, std::get<idx>(val));
+  template <class Buf>
+  void append(Buf& buf, const tuple_type& val) const {
+    Serializer<element_type, Wire>().append(buf, std::get<idx>(val));
   }
 
   int sizeOf(const tuple_type& val) const {
-    return Serializer<element_type>().sizeOf(std::get<idx>(val));
+    return Serializer<element_type, Wire>().sizeOf(std::get<idx>(val));
   }
 };
 
-template <class... TypeArgs>
-struct Serializer<std::tuple<TypeArgs...>> {
+template <class... TypeArgs, class Wire>
+struct Serializer<std::tuple<TypeArgs...>, Wire> {
 
   static const int tupleSize = std::tuple_size<std::tuple<TypeArgs...>>::value;
 
-  void append(IoRange& range, const std::tuple<TypeArgs...>& val) const {
-    SerializerHelper<tupleSize, TypeArgs...>().append(range, val);
+  template <class Buf>
+  void append(Buf& buf, const std::tuple<TypeArgs...>& val) const {
+    SerializerHelper<tupleSize, Wire, TypeArgs...>().append(buf, val);
   }
 
   int sizeOf(const std::tuple<TypeArgs...>& val) const {
-    return SerializerHelper<tupleSize, TypeArgs...>().sizeOf(val);
+    return SerializerHelper<tupleSize, Wire, TypeArgs...>().sizeOf(val);
+  }
+};
+
+
+// Implements serializeTo() for T. Specialized by types that would
+// otherwise compute the sizes of their parts twice, see Record.h
+template <class T, class Wire> struct SerializeTo {
+  void append(IoRange& ioRange, const T& val) const {
+    int size = FixedSize<T, Wire>::value ? FixedSize<T, Wire>::value
+                                         : Serializer<T, Wire>().sizeOf(val);
+    ioRange.reserve(size);
+
+    UncheckedWriter writer(ioRange.end());
+    Serializer<T, Wire>().append(writer, val);
+    ioRange.commit(size);
   }
 };
 
+// Append @val to @ioRange in one pass: compute the exact encoded size,
+// which is a constant for fixed size types, grow the buffer at most
+// once, then write without further checks. The wire is picked per call,
+// as in serializeTo<VarintWire>(ioRange, val)
+template <class Wire = FixedWire, class T>
+void serializeTo(IoRange& ioRange, const T& val) {
+  SerializeTo<T, Wire>().append(ioRange, val);
+}
+
 }  // sdb
 
+
+// Generate Serializer, Deserializer and FixedSize specializations for a
+// struct from the list of its fields, which are encoded in the order
+// given, on any wire. Use it at global scope, after the struct is
+// defined:
+//
+//   struct Point { int32_t x; int32_t y; std::string label; };
+//   SDB_SERIALIZABLE(Point, x, y, label)
+//
+// A struct whose fields all have a fixed size has one itself, so that
+// containers of it are sized without looking at their elements. Up to 16
+// fields are supported.
+#define SDB_SERIALIZABLE(Type, ...) \
+namespace sdb { \
+template <class Wire> struct FixedSize<Type, Wire> { \
+  static const int value = FixedSizeSum< \
+    SDB_FOR_EACH(SDB_FIELD_FIXED_SIZE, SDB_COMMA, Type, __VA_ARGS__)>::value; \
+}; \
+template <class Wire> struct Serializer<Type, Wire> { \
+  template <class Buf> \
+  void append(Buf& buf, const Type& val) const { \
+    SDB_FOR_EACH(SDB_FIELD_APPEND, SDB_NOTHING, val, __VA_ARGS__) \
+  } \
+  int sizeOf(const Type& val) const { \
+    return FixedSize<Type, Wire>::value ? FixedSize<Type, Wire>::value : (0 \
+      SDB_FOR_EACH(SDB_FIELD_SIZE_OF, SDB_NOTHING, val, __VA_ARGS__)); \
+  } \
+}; \
+template <class Wire> struct Deserializer<Type, Wire> { \
+  bool parse(Range& range, Type& val) const { \
+    return true \
+      SDB_FOR_EACH(SDB_FIELD_PARSE, SDB_NOTHING, val, __VA_ARGS__); \
+  } \
+  bool skip(Range& range) const { \
+    return true SDB_FOR_EACH( \
+      SDB_FIELD_SKIP, SDB_NOTHING, std::declval<Type&>(), __VA_ARGS__); \
+  } \
+}; \
+}
+
+// the helpers below run inside the generated templates, whose wire
+// policy parameter is named Wire
+#define SDB_FIELD_TYPE(val, field) \
+  typename std::decay<decltype(val.field)>::type
+
+#define SDB_FIELD_FIXED_SIZE(Type, field) \
+  FixedSize<SDB_FIELD_TYPE(std::declval<Type&>(), field), Wire>::value
+
+#define SDB_FIELD_APPEND(val, field) \
+  Serializer<SDB_FIELD_TYPE(val, field), Wire>().append(buf, val.field);
+
+#define SDB_FIELD_SIZE_OF(val, field) \
+  + Serializer<SDB_FIELD_TYPE(val, field), Wire>().sizeOf(val.field)
+
+#define SDB_FIELD_PARSE(val, field) \
+  && Deserializer<SDB_FIELD_TYPE(val, field), Wire>().parse(range, val.field)
+
+#define SDB_FIELD_SKIP(val, field) \
+  && Deserializer<SDB_FIELD_TYPE(val, field), Wire>().skip(range)
+
+#define SDB_COMMA() ,
+
+#define SDB_NOTHING()
+
+// SDB_FOR_EACH(m, sep, d, a, b, c) expands to
+// m(d, a) sep() m(d, b) sep() m(d, c)
+#define SDB_FOR_EACH(m, sep, d, ...) \
+  SDB_CONCAT(SDB_FOR_EACH_, SDB_NUM_ARGS(__VA_ARGS__))(m, sep, d, __VA_ARGS__)
+
+#define SDB_CONCAT(a, b) SDB_CONCAT_IMPL(a, b)
+#define SDB_CONCAT_IMPL(a, b) a##b
+
+#define SDB_NUM_ARGS(...) SDB_NUM_ARGS_IMPL(__VA_ARGS__, \
+  16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1)
+#define SDB_NUM_ARGS_IMPL( \
+  _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, \
+  N, ...) N
+
+#define SDB_FOR_EACH_1(m, sep, d, x) m(d, x)
+#define SDB_FOR_EACH_2(m, sep, d, x, ...) \
+  m(d, x) sep() SDB_FOR_EACH_1(m, sep, d, __VA_ARGS__)
+#define SDB_FOR_EACH_3(m, sep, d, x, ...) \
+  m(d, x) sep() SDB_FOR_EACH_2(m, sep, d, __VA_ARGS__)
+#define SDB_FOR_EACH_4(m, sep, d, x, ...) \
+  m(d, x) sep() SDB_FOR_EACH_3(m, sep, d, __VA_ARGS__)
+#define SDB_FOR_EACH_5(m, sep, d, x, ...) \
+  m(d, x) sep() SDB_FOR_EACH_4(m, sep, d, __VA_ARGS__)
+#define SDB_FOR_EACH_6(m, sep, d, x, ...) \
+  m(d, x) sep() SDB_FOR_EACH_5(m, sep, d, __VA_ARGS__)
+#define SDB_FOR_EACH_7(m, sep, d, x, ...) \
+  m(d, x) sep() SDB_FOR_EACH_6(m, sep, d, __VA_ARGS__)
+#define SDB_FOR_EACH_8(m, sep, d, x, ...) \
+  m(d, x) sep() SDB_FOR_EACH_7(m, sep, d, __VA_ARGS__)
+#define SDB_FOR_EACH_9(m, sep, d, x, ...) \
+  m(d, x) sep() SDB_FOR_EACH_8(m, sep, d, __VA_ARGS__)
+#define SDB_FOR_EACH_10(m, sep, d, x, ...) \
+  m(d, x) sep() SDB_FOR_EACH_9(m, sep, d, __VA_ARGS__)
+#define SDB_FOR_EACH_11(m, sep, d, x, ...) \
+  m(d, x) sep() SDB_FOR_EACH_10(m, sep, d, __VA_ARGS__)
+#define SDB_FOR_EACH_12(m, sep, d, x, ...) \
+  m(d, x) sep() SDB_FOR_EACH_11(m, sep, d, __VA_ARGS__)
+#define SDB_FOR_EACH_13(m, sep, d, x, ...) \
+  m(d, x) sep() SDB_FOR_EACH_12(m, sep, d, __VA_ARGS__)
+#define SDB_FOR_EACH_14(m, sep, d, x, ...) \
+  m(d, x) sep() SDB_FOR_EACH_13(m, sep, d, __VA_ARGS__)
+#define SDB_FOR_EACH_15(m, sep, d, x, ...) \
+  m(d, x) sep() SDB_FOR_EACH_14(m, sep, d, __VA_ARGS__)
+#define SDB_FOR_EACH_16(m, sep, d, x, ...) \
+  m(d, x) sep() SDB_FOR_EACH_15(m, sep, d, __VA_ARGS__)
+
 #endif // COMMON_SERIALIZER_H
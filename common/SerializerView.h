@@ -0,0 +1,372 @@
+#ifndef COMMON_SERIALIZERVIEW_H
+#define COMMON_SERIALIZERVIEW_H
+
+#include "common/Serializer.h"
+#include "common/Range.h"
+
+#include <tuple>
+#include <vector>
+#include <cstdint>
+
+
+namespace sdb {
+
+// Views are parsed in place of the containers they were serialized
+// from. A view only checks and remembers where its elements are in the
+// source Range, and decodes an element each time it is accessed, so a
+// handler that reads two fields of a large message does not copy or
+// allocate the rest. The source must outlive the view.
+//
+// Elements can be views themselves, e.g. VectorView<StringView>.
+// Serializing a view writes its bytes back without decoding them.
+
+// a string that points into the source, see Deserializer<Range>
+typedef Range StringView;
+
+
+// Reads the elements of an encoded container one after the other
+template <class T, class Wire>
+class ViewIterator {
+ public:
+
+  ViewIterator(const Range& rest, int64_t idx) : rest_(rest), idx_(idx) {}
+
+  T operator*() const {
+    Range range = rest_;
+    T val = T();
+    Deserializer<T, Wire>().parse(range, val);
+    return val;
+  }
+
+  ViewIterator& operator++() {
+    Deserializer<T, Wire>().skip(rest_);
+    ++idx_;
+    return *this;
+  }
+
+  bool operator==(const ViewIterator& another) const {
+    return idx_ == another.idx_;
+  }
+
+  bool operator!=(const ViewIterator& another) const {
+    return idx_ != another.idx_;
+  }
+
+ private:
+
+  Range rest_;
+
+  int64_t idx_;
+};
+
+
+// A view of a serialized std::vector<T> or std::set<T>
+template <class T, class Wire = FixedWire>
+class VectorView {
+ public:
+
+  typedef ViewIterator<T, Wire> const_iterator;
+
+  VectorView() : size_(0) {}
+
+  // Take the vector from the front of @range. Walks over the elements to
+  // find where they end, unless they have a fixed size
+  bool parse(Range& range) {
+    int32_t num = 0;
+    Range rest = range;
+    if (!Wire::parseLength(rest, num) || num < 0) {
+      return false;
+    }
+
+    auto beg = rest.begin();
+    const int64_t elemSize = FixedSize<T, Wire>::value;
+    if (elemSize) {
+      if (rest.size() < num * elemSize) {
+        return false;
+      }
+      rest.pop_front(num * elemSize);
+    } else {
+      for (int32_t i = 0; i < num; ++i) {
+        if (!Deserializer<T, Wire>().skip(rest)) {
+          return false;
+        }
+      }
+    }
+
+    data_ = Range(beg, rest.begin());
+    size_ = num;
+    offsets_.clear();
+    range = rest;
+    return true;
+  }
+
+  int64_t size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  // Decode element @idx. O(1) for fixed size elements; for the others
+  // the first call records where every element starts, so this is the
+  // only method that must not race with another call on the same view
+  T operator[](int64_t idx) const {
+    const int64_t elemSize = FixedSize<T, Wire>::value;
+    Range range = data_;
+    if (elemSize) {
+      range.pop_front(idx * elemSize);
+    } else {
+      if (offsets_.empty()) {
+        buildOffsets();
+      }
+      range.pop_front(offsets_[idx]);
+    }
+
+    T val = T();
+    Deserializer<T, Wire>().parse(range, val);
+    return val;
+  }
+
+  const_iterator begin() const { return const_iterator(data_, 0); }
+
+  const_iterator end() const { return const_iterator(data_, size_); }
+
+  // the encoded elements
+  const Range& data() const { return data_; }
+
+  // The elements where they are in the source, if the wire lays numbers
+  // out as memory does (NativeWire) and they are aligned, nullptr
+  // otherwise
+  const T* array() const {
+    if (!IsNumber<T>::value || !Wire::native_layout ||
+        (uintptr_t)data_.begin() % alignof(T) != 0) {
+      return nullptr;
+    }
+    return (const T*)data_.begin();
+  }
+
+ private:
+
+  Range data_;
+
+  int32_t size_;
+
+  // start of each element in @data_, built on demand
+  mutable std::vector<int32_t> offsets_;
+
+  void buildOffsets() const {
+    Range range = data_;
+    offsets_.reserve(size_);
+    for (int32_t i = 0; i < size_; ++i) {
+      offsets_.push_back(range.begin() - data_.begin());
+      Deserializer<T, Wire>().skip(range);
+    }
+  }
+};
+
+
+// A view of a serialized std::map<K, V> or std::unordered_map<K, V>
+template <class K, class V, class Wire = FixedWire>
+class MapView {
+ public:
+
+  typedef ViewIterator<std::pair<K, V>, Wire> const_iterator;
+
+  MapView() : size_(0) {}
+
+  // take the map from the front of @range
+  bool parse(Range& range) {
+    int32_t num = 0;
+    Range rest = range;
+    if (!Wire::parseLength(rest, num) || num < 0) {
+      return false;
+    }
+
+    auto beg = rest.begin();
+    for (int32_t i = 0; i < num; ++i) {
+      if (!Deserializer<std::pair<K, V>, Wire>().skip(rest)) {
+        return false;
+      }
+    }
+
+    data_ = Range(beg, rest.begin());
+    size_ = num;
+    range = rest;
+    return true;
+  }
+
+  int64_t size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  // Look @key up and decode its value into @val. Keys are compared one
+  // by one, and only the value that matches is decoded
+  bool find(const K& key, V& val) const {
+    Range range = data_;
+    for (int32_t i = 0; i < size_; ++i) {
+      K k = K();
+      Deserializer<K, Wire>().parse(range, k);
+      if (k == key) {
+        return Deserializer<V, Wire>().parse(range, val);
+      }
+      Deserializer<V, Wire>().skip(range);
+    }
+    return false;
+  }
+
+  const_iterator begin() const { return const_iterator(data_, 0); }
+
+  const_iterator end() const { return const_iterator(data_, size_); }
+
+  // the encoded entries
+  const Range& data() const { return data_; }
+
+ private:
+
+  Range data_;
+
+  int32_t size_;
+};
+
+
+// Helper class for TupleView, finds where each element starts
+template <int N, class Tuple, class Wire>
+struct TupleViewHelper {
+
+  static const int idx = std::tuple_size<Tuple>::value - N;
+
+  typedef typename std::tuple_element<idx, Tuple>::type element_type;
+
+  bool parse(Range& range, int32_t* offsets, const char* beg) const {
+    offsets[idx] = range.begin() - beg;
+    if (!Deserializer<element_type, Wire>().skip(range)) {
+      return false;
+    }
+    return TupleViewHelper<N-1, Tuple, Wire>().parse(range, offsets, beg);
+  }
+};
+
+template <class Tuple, class Wire>
+struct TupleViewHelper<0, Tuple, Wire> {
+  bool parse(Range& range, int32_t* offsets, const char* beg) const {
+    return true;
+  }
+};
+
+// A view of a serialized std::tuple, with Tuple the type of the tuple.
+// Elements are found at parse time and decoded by get<I>()
+template <class Tuple, class Wire = FixedWire>
+class TupleView {
+ public:
+
+  static const int tupleSize = std::tuple_size<Tuple>::value;
+
+  TupleView() : offsets_() {}
+
+  // take the tuple from the front of @range
+  bool parse(Range& range) {
+    Range rest = range;
+    auto beg = rest.begin();
+    if (!TupleViewHelper<tupleSize, Tuple, Wire>().parse(
+          rest, offsets_, beg)) {
+      return false;
+    }
+
+    data_ = Range(beg, rest.begin());
+    range = rest;
+    return true;
+  }
+
+  // decode element @I
+  template <int I>
+  typename std::tuple_element<I, Tuple>::type get() const {
+    Range range = data_;
+    range.pop_front(offsets_[I]);
+
+    typedef typename std::tuple_element<I, Tuple>::type element_type;
+    element_type val = element_type();
+    Deserializer<element_type, Wire>().parse(range, val);
+    return val;
+  }
+
+  // the encoded tuple
+  const Range& data() const { return data_; }
+
+ private:
+
+  Range data_;
+
+  int32_t offsets_[tupleSize];
+};
+
+
+template <class T, class Wire> struct Deserializer<VectorView<T, Wire>, Wire> {
+  bool parse(Range& range, VectorView<T, Wire>& val) const {
+    return val.parse(range);
+  }
+
+  bool skip(Range& range) const {
+    return Deserializer<std::vector<T>, Wire>().skip(range);
+  }
+};
+
+template <class K, class V, class Wire>
+struct Deserializer<MapView<K, V, Wire>, Wire> {
+  bool parse(Range& range, MapView<K, V, Wire>& val) const {
+    return val.parse(range);
+  }
+
+  bool skip(Range& range) const {
+    return Deserializer<std::map<K, V>, Wire>().skip(range);
+  }
+};
+
+template <class Tuple, class Wire>
+struct Deserializer<TupleView<Tuple, Wire>, Wire> {
+  bool parse(Range& range, TupleView<Tuple, Wire>& val) const {
+    return val.parse(range);
+  }
+
+  bool skip(Range& range) const {
+    return Deserializer<Tuple, Wire>().skip(range);
+  }
+};
+
+// views serialize as the containers they were parsed from
+template <class T, class Wire> struct Serializer<VectorView<T, Wire>, Wire> {
+  template <class Buf>
+  void append(Buf& buf, const VectorView<T, Wire>& val) const {
+    Wire::appendLength(buf, val.size());
+    buf.append(val.data());
+  }
+
+  int sizeOf(const VectorView<T, Wire>& val) const {
+    return Wire::sizeOfLength(val.size()) + val.data().size();
+  }
+};
+
+template <class K, class V, class Wire>
+struct Serializer<MapView<K, V, Wire>, Wire> {
+  template <class Buf>
+  void append(Buf& buf, const MapView<K, V, Wire>& val) const {
+    Wire::appendLength(buf, val.size());
+    buf.append(val.data());
+  }
+
+  int sizeOf(const MapView<K, V, Wire>& val) const {
+    return Wire::sizeOfLength(val.size()) + val.data().size();
+  }
+};
+
+template <class Tuple, class Wire>
+struct Serializer<TupleView<Tuple, Wire>, Wire> {
+  template <class Buf>
+  void append(Buf& buf, const TupleView<Tuple, Wire>& val) const {
+    buf.append(val.data());
+  }
+
+  int sizeOf(const TupleView<Tuple, Wire>& val) const {
+    return val.data().size();
+  }
+};
+
+}
+
+#endif // COMMON_SERIALIZERVIEW_H
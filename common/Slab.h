@@ -0,0 +1,337 @@
+#ifndef COMMON_SLAB_H
+#define COMMON_SLAB_H
+
+#include "common/Logging.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <utility>
+
+#include <stdlib.h>
+
+
+namespace sdb {
+
+// Counters of a BlockPool
+struct PoolStats {
+  size_t blockSize;
+
+  // blocks carved from slabs
+  int64_t numBlocks;
+
+  // blocks allocated and not yet freed
+  int64_t numLive;
+
+  // fraction of the blocks carved that are in use
+  double utilization() const {
+    return numBlocks ? (double)numLive / numBlocks : 0.0;
+  }
+};
+
+
+// A pool of fixed size memory blocks with per-thread caches.
+//
+// Each thread keeps a list of free blocks, so allocate() and deallocate()
+// normally touch neither a lock nor a shared cache line. A block may be
+// freed by a thread other than the one that allocated it, it simply joins
+// the cache of the freeing thread. When a cache grows too large, a batch
+// of blocks is moved to a global depot, where threads running low on
+// blocks pick it up again.
+//
+// Memory is carved from slabs that are never returned to the system.
+// All users of the same (Size, Tag) pair share one pool.
+//
+// stats() counts the blocks carved and the blocks in use. It adds up
+// the caches of all threads, so it is meant for monitoring, and is only
+// approximate while other threads allocate.
+template <size_t Size, class Tag = void>
+class BlockPool {
+ public:
+
+  // size of each block, rounded up so that blocks are 16-byte aligned
+  static const size_t kBlockSize = (Size < 32) ? 32 : (Size + 15) / 16 * 16;
+
+  // number of blocks moved between a thread cache and the depot at once
+  static const int kBatchSize = 32;
+
+  // number of blocks carved from each slab
+  static const int kSlabBlocks =
+    (65536 / kBlockSize > kBatchSize) ? 65536 / kBlockSize : kBatchSize;
+
+
+  static void* allocate();
+
+  static void deallocate(void* p);
+
+  // total number of blocks carved from slabs so far
+  static int64_t numBlocks() { return depot().numBlocks.load(); }
+
+  static PoolStats stats();
+
+ private:
+
+  // overlays a free block
+  struct Block {
+    Block* next;
+    Block* nextBatch;
+    int64_t count;
+  };
+
+  // number of free blocks in a thread cache, for stats(). Counters are
+  // kept apart from the caches and reused rather than freed, so that
+  // stats() never reads the memory of a thread that has exited, or one
+  // that only existed before a fork()
+  struct Counter {
+    std::atomic<int64_t> count;
+    Counter* next;
+    bool used;
+  };
+
+  struct Depot {
+    std::mutex mt;
+    Block* batches;
+
+    // number of blocks in batches
+    int64_t numFree;
+
+    Counter* counters;
+
+    // counts for a cache used after its thread destructed it, which
+    // stats() ignores
+    Counter detached;
+
+    std::atomic<int64_t> numBlocks;
+
+    Depot()
+      : batches(nullptr), numFree(0), counters(nullptr), numBlocks(0) {
+      detached.count.store(0);
+    }
+  };
+
+  struct Cache {
+    Block* head;
+    int64_t count;
+    Counter* counter;
+
+    Cache();
+
+    ~Cache();
+
+    void add(int64_t n) {
+      count += n;
+      counter->count.store(count, std::memory_order_relaxed);
+    }
+  };
+
+
+  // never destructed, so that thread caches can be flushed at any time
+  static Depot& depot() {
+    static Depot* d = new Depot;
+    return *d;
+  }
+
+  static Cache& cache() {
+    static thread_local Cache c;
+    return c;
+  }
+
+  // move a batch of blocks from the depot, or a new slab, to @c
+  static void refill(Cache& c);
+
+  // move up to @num blocks from @c to the depot as one batch
+  static void flush(Cache& c, int64_t num);
+};
+
+
+template <size_t Size, class Tag>
+void* BlockPool<Size, Tag>::allocate() {
+  auto& c = cache();
+  if (!c.head) {
+    refill(c);
+  }
+
+  auto b = c.head;
+  c.head = b->next;
+  c.add(-1);
+  return b;
+}
+
+template <size_t Size, class Tag>
+void BlockPool<Size, Tag>::deallocate(void* p) {
+  auto& c = cache();
+  auto b = (Block*)p;
+  b->next = c.head;
+  c.head = b;
+  c.add(1);
+  if (c.count >= 2 * kBatchSize) {
+    flush(c, kBatchSize);
+  }
+}
+
+template <size_t Size, class Tag>
+void BlockPool<Size, Tag>::refill(Cache& c) {
+  auto& d = depot();
+
+  {
+    std::lock_guard<std::mutex> l(d.mt);
+    auto batch = d.batches;
+    if (batch) {
+      d.batches = batch->nextBatch;
+      d.numFree -= batch->count;
+      c.head = batch;
+      c.add(batch->count);
+      return;
+    }
+  }
+
+  auto slab = (char*)malloc(kSlabBlocks * kBlockSize);
+  if (!slab) {
+    LOG(FATAL) << "Fails to allocate a slab of " << kSlabBlocks * kBlockSize;
+  }
+
+  for (int i = 0; i < kSlabBlocks; ++i) {
+    auto b = (Block*)(slab + i * kBlockSize);
+    b->next = (i + 1 < kSlabBlocks) ? (Block*)(slab + (i + 1) * kBlockSize)
+                                    : nullptr;
+  }
+
+  // counted before the cache, so that stats() never sees more free
+  // blocks than carved ones
+  d.numBlocks.fetch_add(kSlabBlocks);
+  c.head = (Block*)slab;
+  c.add(kSlabBlocks);
+}
+
+template <size_t Size, class Tag>
+void BlockPool<Size, Tag>::flush(Cache& c, int64_t num) {
+  auto batch = c.head;
+  auto tail = batch;
+  int64_t n = 1;
+  while (n < num && tail->next) {
+    tail = tail->next;
+    ++n;
+  }
+
+  c.head = tail->next;
+  tail->next = nullptr;
+  batch->count = n;
+
+  // the blocks move from the cache to the depot in one step for stats()
+  auto& d = depot();
+  std::lock_guard<std::mutex> l(d.mt);
+  c.add(-n);
+  batch->nextBatch = d.batches;
+  d.batches = batch;
+  d.numFree += n;
+}
+
+template <size_t Size, class Tag>
+PoolStats BlockPool<Size, Tag>::stats() {
+  auto& d = depot();
+  std::lock_guard<std::mutex> l(d.mt);
+  int64_t numFree = d.numFree;
+  for (auto c = d.counters; c; c = c->next) {
+    numFree += c->count.load(std::memory_order_relaxed);
+  }
+
+  int64_t num = d.numBlocks.load();
+  return PoolStats{kBlockSize, num, num - numFree};
+}
+
+template <size_t Size, class Tag>
+BlockPool<Size, Tag>::Cache::Cache() : head(nullptr), count(0) {
+  auto& d = depot();
+  std::lock_guard<std::mutex> l(d.mt);
+  for (counter = d.counters; counter; counter = counter->next) {
+    if (!counter->used) {
+      break;
+    }
+  }
+
+  // from malloc like the slabs, so that operator new is never called
+  if (!counter) {
+    counter = (Counter*)malloc(sizeof(Counter));
+    if (!counter) {
+      LOG(FATAL) << "Fails to allocate a pool counter";
+    }
+    new (&counter->count) std::atomic<int64_t>(0);
+    counter->next = d.counters;
+    d.counters = counter;
+  }
+  counter->used = true;
+}
+
+template <size_t Size, class Tag>
+BlockPool<Size, Tag>::Cache::~Cache() {
+  while (head) {
+    flush(*this, kBatchSize);
+  }
+
+  auto& d = depot();
+  std::lock_guard<std::mutex> l(d.mt);
+  counter->used = false;
+  counter = &d.detached;
+}
+
+// A typed front end of BlockPool. Each type gets a pool of its own by
+// default, so that stats() counts the objects of that type; types that
+// share @Tag and a block size share one pool.
+template <class T, class Tag = T>
+class ObjectPool {
+ public:
+
+  typedef BlockPool<sizeof(T), Tag> pool_type;
+
+  static_assert(alignof(T) <= 16, "pool blocks are 16-byte aligned");
+
+  static void* allocate() { return pool_type::allocate(); }
+
+  static void deallocate(void* p) { pool_type::deallocate(p); }
+
+  template <class... Args>
+  static T* create(Args&&... args) {
+    return new (allocate()) T(std::forward<Args>(args)...);
+  }
+
+  static void destroy(T* p) {
+    p->~T();
+    deallocate(p);
+  }
+
+  static PoolStats stats() { return pool_type::stats(); }
+};
+
+} // sdb
+
+
+// Put in the body of class @Type to allocate it from ObjectPool<Type>,
+// intended usage:
+//   struct Node {
+//     Node* next;
+//     SDB_POOLED(Node)
+//   };
+//
+// A derived class larger than @Type that inherits the operators gets its
+// memory from the global heap instead.
+#define SDB_POOLED(Type) SDB_POOLED_WITH_TAG(Type, Type)
+
+// same as SDB_POOLED, but with the pool of ObjectPool<Type, Tag>
+#define SDB_POOLED_WITH_TAG(Type, Tag) \
+  static void* operator new(size_t size) { \
+    if (size == sizeof(Type)) { \
+      return ::sdb::ObjectPool<Type, Tag>::allocate(); \
+    } \
+    return ::operator new(size); \
+  } \
+  static void operator delete(void* p, size_t size) { \
+    if (size == sizeof(Type)) { \
+      ::sdb::ObjectPool<Type, Tag>::deallocate(p); \
+    } else { \
+      ::operator delete(p); \
+    } \
+  }
+
+#endif // COMMON_SLAB_H
@@ -0,0 +1,169 @@
+#ifndef COMMON_TASK_H
+#define COMMON_TASK_H
+
+#include "common/Slab.h"
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+
+namespace sdb {
+
+// A move-only callable object with signature void().
+//
+// Unlike std::function, a Task can hold move-only closures, and closures
+// no larger than kInlineSize bytes are stored inside the Task itself, so
+// wrapping a typical lambda does not allocate. Larger closures are kept
+// in a BlockPool, up to kPooledSize bytes, and on the heap beyond that.
+class Task {
+ public:
+
+  static const size_t kInlineSize = 48;
+
+  static const size_t kPooledSize = 256;
+
+  Task() : ops_(nullptr) {}
+
+  template <class Fn,
+            class = typename std::enable_if<
+              !std::is_same<typename std::decay<Fn>::type, Task>::value
+            >::type>
+  Task(Fn&& fn) {
+    typedef typename std::decay<Fn>::type F;
+    init<F>(std::forward<Fn>(fn), std::integral_constant<bool, isInline<F>()>());
+  }
+
+  Task(Task&& other) noexcept : ops_(other.ops_) {
+    if (ops_) {
+      ops_->move(buf_, other.buf_);
+      other.ops_ = nullptr;
+    }
+  }
+
+  Task& operator=(Task&& other) noexcept {
+    if (this != &other) {
+      reset();
+      ops_ = other.ops_;
+      if (ops_) {
+        ops_->move(buf_, other.buf_);
+        other.ops_ = nullptr;
+      }
+    }
+    return *this;
+  }
+
+  Task(const Task&) = delete;
+
+  Task& operator=(const Task&) = delete;
+
+  ~Task() { reset(); }
+
+
+  void operator()() { ops_->invoke(buf_); }
+
+  explicit operator bool() const { return ops_ != nullptr; }
+
+  // destroy the closure held, if any
+  void reset() {
+    if (ops_) {
+      ops_->destroy(buf_);
+      ops_ = nullptr;
+    }
+  }
+
+ private:
+
+  struct Ops {
+    void (*invoke)(void* buf);
+    void (*move)(void* dst, void* src);
+    void (*destroy)(void* buf);
+  };
+
+  template <class F> static constexpr bool isInline() {
+    return sizeof(F) <= kInlineSize &&
+           alignof(F) <= 16 &&
+           std::is_nothrow_move_constructible<F>::value;
+  }
+
+  template <class F> static constexpr bool isPooled() {
+    return sizeof(F) <= kPooledSize && alignof(F) <= 16;
+  }
+
+  // closure is stored in buf_
+  template <class F> struct InlineOps {
+    static void invoke(void* buf) { (*(F*)buf)(); }
+
+    static void move(void* dst, void* src) {
+      new (dst) F(std::move(*(F*)src));
+      ((F*)src)->~F();
+    }
+
+    static void destroy(void* buf) { ((F*)buf)->~F(); }
+
+    static const Ops ops;
+  };
+
+  // buf_ holds a pointer to the closure
+  template <class F> struct HeapOps {
+    static void invoke(void* buf) { (**(F**)buf)(); }
+
+    static void move(void* dst, void* src) { *(F**)dst = *(F**)src; }
+
+    static void destroy(void* buf) {
+      release(*(F**)buf, std::integral_constant<bool, isPooled<F>()>());
+    }
+
+    static void release(F* f, std::true_type) {
+      ObjectPool<F, void>::destroy(f);
+    }
+
+    static void release(F* f, std::false_type) { delete f; }
+
+    static const Ops ops;
+  };
+
+  template <class F, class Fn> void init(Fn&& fn, std::true_type) {
+    new (buf_) F(std::forward<Fn>(fn));
+    ops_ = &InlineOps<F>::ops;
+  }
+
+  template <class F, class Fn> void init(Fn&& fn, std::false_type) {
+    *(F**)buf_ = create<F>(std::forward<Fn>(fn),
+                           std::integral_constant<bool, isPooled<F>()>());
+    ops_ = &HeapOps<F>::ops;
+  }
+
+  template <class F, class Fn> static F* create(Fn&& fn, std::true_type) {
+    return ObjectPool<F, void>::create(std::forward<Fn>(fn));
+  }
+
+  template <class F, class Fn> static F* create(Fn&& fn, std::false_type) {
+    return new F(std::forward<Fn>(fn));
+  }
+
+
+  const Ops* ops_;
+
+  alignas(16) char buf_[kInlineSize];
+};
+
+
+template <class F>
+const Task::Ops Task::InlineOps<F>::ops = {
+  &Task::InlineOps<F>::invoke,
+  &Task::InlineOps<F>::move,
+  &Task::InlineOps<F>::destroy,
+};
+
+template <class F>
+const Task::Ops Task::HeapOps<F>::ops = {
+  &Task::HeapOps<F>::invoke,
+  &Task::HeapOps<F>::move,
+  &Task::HeapOps<F>::destroy,
+};
+
+} // sdb
+
+#endif // COMMON_TASK_H
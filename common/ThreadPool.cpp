@@ -8,25 +8,82 @@ using namespace std;
 
 namespace sdb {
 
-ThreadPool::ThreadPool(int numWorkers) : numWorkers_(numWorkers) {
+// the stealing worker running on current thread, if any
+static thread_local void* tlsStealer = nullptr;
+
+
+ThreadPool::ThreadPool(int numWorkers, int mode)
+  : numWorkers_(numWorkers),
+    mode_(mode),
+    nextInbox_(0),
+    queued_(0),
+    unfinished_(0),
+    sleepers_(0),
+    stop_(false) {
   start();
 }
 
 ThreadPool::~ThreadPool() {
+  if (mode_ == mode_stealing) {
+    {
+      lock_guard<mutex> l(sleepMt_);
+      stop_ = true;
+    }
+    sleepCond_.notify_all();
+  } else {
+    vector<Worker*> workers;
+    {
+      lock_guard<mutex> l(mt_);
+      for (auto& w : freed_) {
+        workers.push_back(w.get());
+      }
+      for (auto& w : running_) {
+        workers.push_back(w.get());
+      }
+    }
+
+    for (auto w : workers) {
+      {
+        lock_guard<mutex> l(w->mt);
+        w->stop = true;
+      }
+      w->cond.notify_one();
+    }
+  }
+
+  for (auto& t : threads_) {
+    t.join();
+  }
 }
 
 bool ThreadPool::start() {
+  if (mode_ == mode_stealing) {
+    for (int i = 0; i < numWorkers_; ++i) {
+      stealers_.emplace_back(new Stealer(this, i));
+    }
+    for (auto& s : stealers_) {
+      auto stealer = s.get();
+      threads_.emplace_back([stealer]() { stealer->run(); });
+    }
+    return true;
+  }
+
   lock_guard<mutex> g(mt_);
   for (int i = 0; i < numWorkers_; ++i) {
     freed_.emplace_back(new Worker(this));
     auto worker = freed_.back().get();
-    new thread([worker]() { worker->run(); });
+    threads_.emplace_back([worker]() { worker->run(); });
   }
 
   return true;
 }
 
-void ThreadPool::submit(function<void()>&& c) {
+void ThreadPool::submit(Task&& c) {
+  if (mode_ == mode_stealing) {
+    submitStealing(move(c));
+    return;
+  }
+
   lock_guard<mutex> l(mt_);
   if (freed_.empty()) {
     pendings_.push_back(move(c));
@@ -47,6 +104,14 @@ void ThreadPool::submit(function<void()>&& c) {
 }
 
 void ThreadPool::drain() {
+  if (mode_ == mode_stealing) {
+    unique_lock<mutex> l(drainMt_);
+    while (unfinished_.load() > 0) {
+      drainCond_.wait(l);
+    }
+    return;
+  }
+
   unique_lock<mutex> l(mt_);
   while (!running_.empty()) {
     cond_.wait(l);
@@ -83,18 +148,101 @@ void ThreadPool::setFree(Worker* w) {
   cond_.notify_one();
 }
 
+void ThreadPool::submitStealing(Task&& c) {
+  auto node = new TaskNode{move(c), nullptr};
+  unfinished_.fetch_add(1);
+
+  auto self = (Stealer*)tlsStealer;
+  if (self && self->pool == this) {
+    self->deque.push(node);
+  } else {
+    auto idx = nextInbox_.fetch_add(1, memory_order_relaxed) % numWorkers_;
+    auto s = stealers_[idx].get();
+    lock_guard<mutex> l(s->inboxMt);
+    if (s->inboxTail) {
+      s->inboxTail->next = node;
+    } else {
+      s->inboxHead = node;
+    }
+    s->inboxTail = node;
+  }
+
+  // pairs with the sleepers_ increment in Stealer::run(), so that either
+  // the sleeper sees the new task or we see the sleeper
+  queued_.fetch_add(1);
+  if (sleepers_.load() > 0) {
+    wakeSleeper();
+  }
+}
+
+ThreadPool::TaskNode* ThreadPool::findTask(Stealer* self) {
+  TaskNode* node = nullptr;
+  if (self->deque.pop(node)) {
+    return node;
+  }
+
+  node = self->popInbox();
+  if (node) {
+    return node;
+  }
+
+  for (int i = 1; i < numWorkers_; ++i) {
+    auto victim = stealers_[(self->index + i) % numWorkers_].get();
+    if (victim->deque.steal(node)) {
+      return node;
+    }
+  }
+
+  for (int i = 1; i < numWorkers_; ++i) {
+    auto victim = stealers_[(self->index + i) % numWorkers_].get();
+    node = victim->popInbox();
+    if (node) {
+      return node;
+    }
+  }
+
+  return nullptr;
+}
+
+void ThreadPool::runTask(TaskNode* node) {
+  queued_.fetch_sub(1);
+
+  try {
+    node->fn();
+  } catch (std::exception& e) {
+    LOG(ERROR) << "pool worker caught exception " << e.what();
+  } catch (...) {
+    LOG(ERROR) << "pool worker caught unexpected exception!";
+  }
+
+  delete node;
+
+  if (unfinished_.fetch_sub(1) == 1) {
+    lock_guard<mutex> l(drainMt_);
+    drainCond_.notify_all();
+  }
+}
+
+void ThreadPool::wakeSleeper() {
+  lock_guard<mutex> l(sleepMt_);
+  sleepCond_.notify_one();
+}
+
 
 ThreadPool::Worker::Worker(ThreadPool* p)
-  : hasFunctor(false), pool(p) {
+  : hasFunctor(false), stop(false), pool(p) {
 }
 
 void ThreadPool::Worker::run() {
   while (true) {
-    function<void()> fn;
+    Task fn;
 
     {
       unique_lock<mutex> l(mt);
       if (!hasFunctor) {
+        if (stop) {
+          return;
+        }
         cond.wait(l);
         continue;
       }
@@ -113,8 +261,58 @@ void ThreadPool::Worker::run() {
                  << " caught unexpected exception!";
     }
 
+    // release the closure before picking up the next one
+    fn.reset();
     pool->setFree(this);
   }
 }
 
+
+ThreadPool::Stealer::Stealer(ThreadPool* p, int idx)
+  : pool(p), index(idx), inboxHead(nullptr), inboxTail(nullptr) {
+}
+
+ThreadPool::TaskNode* ThreadPool::Stealer::popInbox() {
+  lock_guard<mutex> l(inboxMt);
+  auto node = inboxHead;
+  if (node) {
+    inboxHead = node->next;
+    if (!inboxHead) {
+      inboxTail = nullptr;
+    }
+  }
+  return node;
+}
+
+void ThreadPool::Stealer::run() {
+  tlsStealer = this;
+
+  while (true) {
+    auto node = pool->findTask(this);
+    if (node) {
+      pool->runTask(node);
+      continue;
+    }
+
+    if (pool->queued_.load() > 0) {
+      // someone has a task that we just failed to grab, try again
+      this_thread::yield();
+      continue;
+    }
+
+    unique_lock<mutex> l(pool->sleepMt_);
+    pool->sleepers_.fetch_add(1);
+    while (!pool->stop_ && pool->queued_.load() == 0) {
+      pool->sleepCond_.wait(l);
+    }
+    pool->sleepers_.fetch_sub(1);
+
+    if (pool->stop_ && pool->queued_.load() == 0) {
+      break;
+    }
+  }
+
+  tlsStealer = nullptr;
+}
+
 }
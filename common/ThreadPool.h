@@ -1,57 +1,77 @@
 #ifndef COMMON_THREADFPOOL_H
 #define COMMON_THREADFPOOL_H
 
+#include "common/WorkStealingDeque.h"
+#include "common/Task.h"
+#include "common/Future.h"
+#include "common/Slab.h"
+
 #include <memory>
 #include <vector>
 #include <deque>
 #include <string>
 #include <mutex>
+#include <atomic>
+#include <thread>
 #include <condition_variable>
 #include <functional>
-#include <future>
 
 
 namespace sdb {
 
 
 class ThreadPool {
+ public:
+
+  // Scheduling modes of a thread pool
+  enum {
+    // All workers share a single queue protected by a mutex
+    mode_shared = 0,
+
+    // Each worker owns a lock-free deque. Tasks submitted from a worker
+    // go to its own deque, and idle workers steal from the others
+    mode_stealing,
+  };
+
  public:
 
   // Construct a ThreadPool object with max number of workers
-  explicit ThreadPool(int numWorkers);
+  explicit ThreadPool(int numWorkers, int mode = mode_shared);
 
+  // Wait for all workers to finish their tasks and exit
   ~ThreadPool();
 
 
-  void submit(std::function<void()>&& closure);
+  void submit(Task&& closure);
 
   // A typical usage is to submit a closure R():
-  //   future<R> fut = threadPool.async([]() { return R(); });
+  //   Future<R> fut = threadPool.async([]() { return R(); });
   //   R ret = fut.get();
   template <class Fn>
-  auto async(Fn&& closure) -> std::future<decltype(closure())> {
+  auto async(Fn&& closure) -> Future<decltype(closure())> {
     typedef decltype(closure()) R;
-    auto pr = new std::promise<R>();
-
-    submit([pr, closure]() {
-      R ret = closure();
-      pr->set_value(ret);
-      delete pr;
-    });
-    return pr->get_future();
+    Promise<R> pr;
+    auto fut = pr.getFuture();
+
+    submit([pr = std::move(pr), closure = std::forward<Fn>(closure)]()
+           mutable { fulfill(pr, closure); });
+    return fut;
   }
 
   // block waiting until all tasks finish.
   void drain();
 
+  int getMode() const { return mode_; }
+
 
  private:
 
   struct Worker {
     std::mutex mt;
     std::condition_variable cond;
-    std::function<void()> cb;
+    Task cb;
     bool hasFunctor;
+    bool stop;
     ThreadPool *pool;
 
     explicit Worker(ThreadPool* p);
@@ -59,9 +79,42 @@ class ThreadPool {
     void run();
   };
 
+  // a task queued in stealing mode
+  struct TaskNode {
+    Task fn;
+    TaskNode* next;
+
+    SDB_POOLED_WITH_TAG(TaskNode, void)
+  };
+
+  struct Stealer {
+    ThreadPool* pool;
+    int index;
+    WorkStealingDeque<TaskNode*> deque;
+
+    // tasks submitted from outside of the pool
+    std::mutex inboxMt;
+    TaskNode* inboxHead;
+    TaskNode* inboxTail;
+
+    Stealer(ThreadPool* p, int idx);
+
+    void run();
+
+    // pop a task from the inbox, return nullptr if empty
+    TaskNode* popInbox();
+  };
+
 
   int numWorkers_;
 
+  const int mode_;
+
+  std::vector<std::thread> threads_;
+
+
+  // members for shared mode
+
   std::mutex mt_;
 
   std::condition_variable cond_;
@@ -70,7 +123,34 @@ class ThreadPool {
 
   std::vector<std::unique_ptr<Worker> > running_;
 
-  std::deque<std::function<void()>> pendings_;
+  std::deque<Task> pendings_;
+
+
+  // members for stealing mode
+
+  std::vector<std::unique_ptr<Stealer>> stealers_;
+
+  // round robin index to distribute external submissions
+  std::atomic<uint32_t> nextInbox_;
+
+  // number of tasks that are queued but not yet picked up
+  std::atomic<int64_t> queued_;
+
+  // number of tasks that are submitted but not yet finished
+  std::atomic<int64_t> unfinished_;
+
+  // number of workers parked on sleepCond_
+  std::atomic<int> sleepers_;
+
+  std::atomic<bool> stop_;
+
+  std::mutex sleepMt_;
+
+  std::condition_variable sleepCond_;
+
+  std::mutex drainMt_;
+
+  std::condition_variable drainCond_;
 
 
   bool start();
@@ -78,6 +158,16 @@ class ThreadPool {
   // mark a worker as free state so that we can assign next task to it.
   void setFree(Worker* w);
 
+  void submitStealing(Task&& closure);
+
+  // find a task for worker @self, from its own deque, its inbox,
+  // and then the deques and inboxes of other workers
+  TaskNode* findTask(Stealer* self);
+
+  void runTask(TaskNode* node);
+
+  void wakeSleeper();
+
 };
 
 }
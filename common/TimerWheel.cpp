@@ -0,0 +1,206 @@
+#include "common/TimerWheel.h"
+
+#include <string.h>
+
+
+namespace sdb {
+
+// offset from @from to the first set bit in a cyclic bitmap of @n bits,
+// or -1 if no bit is set. @n is a multiple of 64
+static int firstSetFrom(const uint64_t* words, int n, int from) {
+  for (int i = 0; i < n; ) {
+    int pos = (from + i) % n;
+    int bit = pos & 63;
+    uint64_t x = words[pos >> 6] >> bit;
+    if (x) {
+      return i + __builtin_ctzll(x);
+    }
+    i += 64 - bit;
+  }
+  return -1;
+}
+
+
+TimerWheel::TimerWheel(int64_t nowInMs) : now_(nowInMs), size_(0) {
+  memset(slots_, 0, sizeof(slots_));
+  memset(bits_, 0, sizeof(bits_));
+}
+
+void TimerWheel::add(TimerNode* node) {
+  auto expiry = node->expiry;
+  auto delta = expiry - now_;
+
+  if (delta < root_size) {
+    // already due timers go to the slot processed next
+    if (delta < 0) {
+      expiry = now_;
+    }
+    link(node, 0, expiry & (root_size - 1));
+    return;
+  }
+
+  int level = 1;
+  while (level < num_levels - 1 &&
+         delta >= (1LL << (shift(level) + level_bits))) {
+    ++level;
+  }
+
+  auto range = 1LL << (shift(level) + level_bits);
+  if (delta >= range) {
+    // beyond the wheel, park it in the farthest slot
+    expiry = now_ + range - 1;
+  }
+
+  link(node, level, (expiry >> shift(level)) & (level_size - 1));
+}
+
+void TimerWheel::remove(TimerNode* node) {
+  if (!node->linked()) {
+    return;
+  }
+
+  auto slots = slotsOf(node->level);
+  if (node->prev) {
+    node->prev->next = node->next;
+  } else {
+    slots[node->slot] = node->next;
+  }
+  if (node->next) {
+    node->next->prev = node->prev;
+  }
+
+  if (!slots[node->slot]) {
+    bitsOf(node->level)[node->slot >> 6] &= ~(1ULL << (node->slot & 63));
+  }
+
+  node->next = node->prev = nullptr;
+  node->level = TimerNode::kUnlinked;
+  --size_;
+}
+
+TimerNode* TimerWheel::advance(int64_t nowInMs) {
+  TimerNode* fired = nullptr;
+  TimerNode** tail = &fired;
+
+  while (now_ <= nowInMs) {
+    if ((now_ & (root_size - 1)) == 0) {
+      cascade(1);
+    }
+
+    *tail = takeSlot(0, now_ & (root_size - 1));
+    while (*tail) {
+      tail = &(*tail)->next;
+    }
+
+    // jump over the ticks that have nothing to do
+    auto next = nextExpiry();
+    if (next < 0 || next > nowInMs) {
+      now_ = nowInMs + 1;
+    } else {
+      now_ = next > now_ ? next : now_ + 1;
+    }
+  }
+
+  return fired;
+}
+
+int64_t TimerWheel::nextExpiry() const {
+  if (!size_) {
+    return -1;
+  }
+
+  int64_t best = -1;
+  int off = firstSetFrom(bitsOf(0), root_size, now_ & (root_size - 1));
+  if (off >= 0) {
+    best = now_ + off;
+  }
+
+  // an upper slot has work when the tick reaches its start
+  for (int level = 1; level < num_levels; ++level) {
+    auto s = shift(level);
+    int64_t base = (now_ + (1LL << s) - 1) >> s;
+    if (best >= 0 && best <= (base << s)) {
+      break;
+    }
+
+    off = firstSetFrom(bitsOf(level), level_size, base & (level_size - 1));
+    if (off >= 0) {
+      int64_t ts = (base + off) << s;
+      if (best < 0 || ts < best) {
+        best = ts;
+      }
+    }
+  }
+
+  return best;
+}
+
+TimerNode* TimerWheel::clear() {
+  TimerNode* ret = nullptr;
+  TimerNode** tail = &ret;
+
+  for (int level = 0; level < num_levels; ++level) {
+    int n = level == 0 ? root_size : level_size;
+    for (int i = 0; i < n; ++i) {
+      *tail = takeSlot(level, i);
+      while (*tail) {
+        tail = &(*tail)->next;
+      }
+    }
+  }
+
+  return ret;
+}
+
+void TimerWheel::link(TimerNode* node, int level, int slot) {
+  auto& head = slotsOf(level)[slot];
+
+  node->level = level;
+  node->slot = slot;
+  node->prev = nullptr;
+  node->next = head;
+  if (head) {
+    head->prev = node;
+  }
+  head = node;
+
+  bitsOf(level)[slot >> 6] |= 1ULL << (slot & 63);
+  ++size_;
+}
+
+TimerNode* TimerWheel::takeSlot(int level, int slot) {
+  auto& head = slotsOf(level)[slot];
+  auto ret = head;
+  if (!ret) {
+    return nullptr;
+  }
+
+  head = nullptr;
+  bitsOf(level)[slot >> 6] &= ~(1ULL << (slot & 63));
+
+  for (auto p = ret; p; p = p->next) {
+    p->prev = nullptr;
+    p->level = TimerNode::kUnlinked;
+    --size_;
+  }
+
+  return ret;
+}
+
+void TimerWheel::cascade(int level) {
+  int slot = (now_ >> shift(level)) & (level_size - 1);
+
+  auto p = takeSlot(level, slot);
+  while (p) {
+    auto next = p->next;
+    add(p);
+    p = next;
+  }
+
+  // this level wrapped around, move on in the level above
+  if (slot == 0 && level + 1 < num_levels) {
+    cascade(level + 1);
+  }
+}
+
+}
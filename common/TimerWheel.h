@@ -0,0 +1,133 @@
+#ifndef COMMON_TIMERWHEEL_H
+#define COMMON_TIMERWHEEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+namespace sdb {
+
+// A timer queued in a TimerWheel. Users embed it in their own timer
+// records, the wheel only links it and never owns it.
+struct TimerNode {
+  // absolute expiration time in milliseconds
+  int64_t expiry;
+
+  TimerNode* next;
+
+  TimerNode* prev;
+
+  // position in the wheel, level is kUnlinked if not queued
+  uint8_t level;
+
+  uint8_t slot;
+
+  static const uint8_t kUnlinked = 0xff;
+
+  TimerNode()
+    : expiry(0), next(nullptr), prev(nullptr), level(kUnlinked), slot(0) {
+  }
+
+  bool linked() const { return level != kUnlinked; }
+};
+
+
+// A hierarchical timing wheel with a millisecond tick.
+//
+// The root level has 256 slots of 1ms, each upper level has 64 slots
+// covering a whole rotation of the level below, so 5 levels cover about
+// 49 days. Timers further out are parked in the last slot that fits and
+// placed again when that slot cascades.
+//
+// add() and remove() are O(1), timers are in intrusive lists. advance()
+// skips empty slots through occupancy bitmaps.
+//
+// The wheel is not thread safe, it is meant to be owned by one thread.
+class TimerWheel {
+ public:
+
+  explicit TimerWheel(int64_t nowInMs);
+
+  TimerWheel(const TimerWheel&) = delete;
+
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+
+  // queue @node to expire at node->expiry. Timers that are already due
+  // expire on the next call of advance()
+  void add(TimerNode* node);
+
+  // unlink a queued @node
+  void remove(TimerNode* node);
+
+  // unlink and return all timers expiring at or before @nowInMs,
+  // chained by their next pointers
+  TimerNode* advance(int64_t nowInMs);
+
+  // the earliest time at which advance() may have work to do, or -1 if
+  // the wheel is empty. It may be earlier than the first expiry when
+  // timers far away have to be moved to a lower level first
+  int64_t nextExpiry() const;
+
+  // unlink and return all queued timers, chained by their next pointers
+  TimerNode* clear();
+
+  size_t size() const { return size_; }
+
+ private:
+
+  enum {
+    num_levels = 5,
+
+    root_bits = 8,
+    root_size = 1 << root_bits,
+
+    level_bits = 6,
+    level_size = 1 << level_bits,
+
+    num_slots = root_size + (num_levels - 1) * level_size,
+
+    // root bitmap words followed by one word per upper level
+    num_words = root_size / 64 + num_levels - 1,
+  };
+
+  // next tick to be processed
+  int64_t now_;
+
+  size_t size_;
+
+  TimerNode* slots_[num_slots];
+
+  uint64_t bits_[num_words];
+
+
+  static int shift(int level) {
+    return level == 0 ? 0 : root_bits + (level - 1) * level_bits;
+  }
+
+  // slot array and bitmap of a level
+  TimerNode** slotsOf(int level) {
+    return level == 0 ? slots_ : slots_ + root_size + (level - 1) * level_size;
+  }
+
+  const uint64_t* bitsOf(int level) const {
+    return level == 0 ? bits_ : bits_ + root_size / 64 + level - 1;
+  }
+
+  uint64_t* bitsOf(int level) {
+    return level == 0 ? bits_ : bits_ + root_size / 64 + level - 1;
+  }
+
+  void link(TimerNode* node, int level, int slot);
+
+  // unlink and return the list of a slot
+  TimerNode* takeSlot(int level, int slot);
+
+  // move timers of the current slot at @level down to lower levels
+  void cascade(int level);
+
+};
+
+}
+
+#endif // COMMON_TIMERWHEEL_H
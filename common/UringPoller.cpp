@@ -0,0 +1,431 @@
+#include "common/UringPoller.h"
+#include "common/Logging.h"
+
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+using namespace std;
+
+
+namespace sdb {
+
+static_assert(sizeof(__kernel_timespec) == 16, "unexpected timespec");
+
+static int sysSetup(unsigned entries, struct io_uring_params* p) {
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sysEnter(int fd, unsigned toSubmit, unsigned minComplete,
+                    unsigned flags, const void* arg, size_t argSize) {
+  return (int)syscall(
+    __NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize);
+}
+
+static int sysRegister(int fd, unsigned op, const void* arg, unsigned num) {
+  return (int)syscall(__NR_io_uring_register, fd, op, arg, num);
+}
+
+template <class T>
+static T* at(void* base, uint32_t off) {
+  return (T*)((char*)base + off);
+}
+
+
+UringPoller* UringPoller::create(int entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CLAMP;
+
+  int fd = sysSetup(entries, &params);
+  if (fd < 0) {
+    return nullptr;
+  }
+
+  // multishot polls and the extended enter arguments came last (5.13)
+  const unsigned required =
+    IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG |
+    IORING_FEAT_SUBMIT_STABLE;
+  if ((params.features & required) != required) {
+    close(fd);
+    return nullptr;
+  }
+
+  auto p = new UringPoller(fd);
+  if (!p->setup(&params)) {
+    delete p;
+    return nullptr;
+  }
+
+  return p;
+}
+
+UringPoller::UringPoller(int fd)
+  : fd_(fd),
+    sqArray_(nullptr),
+    sqes_(nullptr),
+    cqes_(nullptr),
+    sqMap_(MAP_FAILED),
+    sqMapSize_(0),
+    cqMap_(MAP_FAILED),
+    cqMapSize_(0),
+    sqesSize_(0),
+    pending_(0),
+    nextGen_(0) {
+}
+
+UringPoller::~UringPoller() {
+  if (sqes_) {
+    munmap(sqes_, sqesSize_);
+  }
+  if (sqMap_ != MAP_FAILED) {
+    munmap(sqMap_, sqMapSize_);
+  }
+  close(fd_);
+}
+
+bool UringPoller::setup(const void* arg) {
+  auto params = (const struct io_uring_params*)arg;
+  auto& so = params->sq_off;
+  auto& co = params->cq_off;
+
+  sqMapSize_ = so.array + params->sq_entries * sizeof(unsigned);
+  cqMapSize_ = co.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+  if (cqMapSize_ > sqMapSize_) {
+    sqMapSize_ = cqMapSize_;
+  }
+
+  // both rings share one mapping
+  sqMap_ = mmap(nullptr, sqMapSize_, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+  if (sqMap_ == MAP_FAILED) {
+    return false;
+  }
+  cqMap_ = sqMap_;
+
+  sqesSize_ = params->sq_entries * sizeof(struct io_uring_sqe);
+  auto sqes = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return false;
+  }
+  sqes_ = (struct io_uring_sqe*)sqes;
+
+  sq_.head = at<unsigned>(sqMap_, so.head);
+  sq_.tail = at<unsigned>(sqMap_, so.tail);
+  sq_.mask = at<unsigned>(sqMap_, so.ring_mask);
+  sq_.entries = *at<unsigned>(sqMap_, so.ring_entries);
+  sqArray_ = at<unsigned>(sqMap_, so.array);
+
+  cq_.head = at<unsigned>(cqMap_, co.head);
+  cq_.tail = at<unsigned>(cqMap_, co.tail);
+  cq_.mask = at<unsigned>(cqMap_, co.ring_mask);
+  cq_.entries = *at<unsigned>(cqMap_, co.ring_entries);
+  cqes_ = at<struct io_uring_cqe>(cqMap_, co.cqes);
+
+  return true;
+}
+
+struct io_uring_sqe* UringPoller::getSqe() {
+  while (true) {
+    auto head = __atomic_load_n(sq_.head, __ATOMIC_ACQUIRE);
+    auto tail = *sq_.tail;
+
+    if (tail - head < sq_.entries) {
+      auto idx = tail & *sq_.mask;
+      auto sqe = &sqes_[idx];
+      memset(sqe, 0, sizeof(*sqe));
+      sqArray_[idx] = idx;
+      __atomic_store_n(sq_.tail, tail + 1, __ATOMIC_RELEASE);
+      ++pending_;
+      return sqe;
+    }
+
+    // the queue is full, hand it over to the kernel
+    if (enter(0, 0) < 0 && errno != EINTR && errno != EAGAIN &&
+        errno != EBUSY) {
+      LOG(FATAL) << "Fails to submit to io_uring " << strerror(errno);
+    }
+  }
+}
+
+int UringPoller::enter(unsigned minComplete, int timeoutMs) {
+  unsigned flags = 0;
+  if (minComplete > 0) {
+    flags |= IORING_ENTER_GETEVENTS;
+  }
+
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  const void* argp = nullptr;
+  size_t argSize = 0;
+
+  if (minComplete > 0 && timeoutMs > 0) {
+    ts.tv_sec = timeoutMs / 1000;
+    ts.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)&ts;
+    flags |= IORING_ENTER_EXT_ARG;
+    argp = &arg;
+    argSize = sizeof(arg);
+  }
+
+  ++numSyscalls_;
+  int ret = sysEnter(fd_, pending_, minComplete, flags, argp, argSize);
+  if (ret >= 0) {
+    pending_ -= ret;
+    if (pending_ == 0) {
+      timeouts_.clear();
+    }
+  }
+
+  return ret;
+}
+
+int UringPoller::wait(PollEvent* events, int max, int timeoutMs) {
+  auto head = *cq_.head;
+  auto tail = __atomic_load_n(cq_.tail, __ATOMIC_ACQUIRE);
+
+  if (pending_ > 0 || head == tail) {
+    unsigned minComplete = (head == tail && timeoutMs != 0) ? 1 : 0;
+    if (enter(minComplete, timeoutMs) < 0 && errno != EINTR &&
+        errno != ETIME && errno != EAGAIN && errno != EBUSY) {
+      LOG(FATAL) << "Fails to wait on io_uring " << strerror(errno);
+    }
+    tail = __atomic_load_n(cq_.tail, __ATOMIC_ACQUIRE);
+  }
+
+  int num = 0;
+  for (; head != tail && num < max; ++head) {
+    auto& cqe = cqes_[head & *cq_.mask];
+    auto data = (uint64_t)cqe.user_data;
+
+    switch (data & 3) {
+      case kind_completion: {
+        auto& e = events[num++];
+        e.data = data | PollEvent::kCompletionTag;
+        e.events = 0;
+        e.res = cqe.res;
+        e.flags = cqe.flags;
+        break;
+      }
+
+      case kind_poll: {
+        int fd = (int)((data & 0xffffffffULL) >> 2);
+        auto it = regs_.find(fd);
+        if (it == regs_.end() || it->second.gen != (uint32_t)(data >> 32)) {
+          // a poll of a removed or updated registration
+          break;
+        }
+
+        auto& reg = it->second;
+        bool more = cqe.flags & IORING_CQE_F_MORE;
+        if (cqe.res < 0) {
+          // e.g. the descriptor is gone, forget it as epoll would
+          if (!more) {
+            regs_.erase(it);
+          }
+          break;
+        }
+
+        if (!more && !(reg.events & EPOLLONESHOT)) {
+          // level triggered, or a multishot poll the kernel gave up
+          rearms_.emplace_back(fd, reg.gen);
+        }
+
+        if (cqe.res > 0) {
+          auto& e = events[num++];
+          e.data = reg.data;
+          e.events = cqe.res;
+          e.res = 0;
+          e.flags = 0;
+        }
+        break;
+      }
+
+      default:
+        break;
+    }
+  }
+
+  __atomic_store_n(cq_.head, head, __ATOMIC_RELEASE);
+  return num;
+}
+
+void UringPoller::afterDispatch() {
+  for (auto& p : rearms_) {
+    auto it = regs_.find(p.first);
+    if (it != regs_.end() && it->second.gen == p.second) {
+      queuePoll(p.first, it->second);
+    }
+  }
+  rearms_.clear();
+}
+
+bool UringPoller::add(int fd, uint32_t events, uint64_t data) {
+  if (regs_.count(fd)) {
+    errno = EEXIST;
+    return false;
+  }
+
+  auto& reg = regs_[fd];
+  reg.data = data;
+  reg.events = events;
+  reg.gen = ++nextGen_;
+  queuePoll(fd, reg);
+  return true;
+}
+
+bool UringPoller::update(int fd, uint32_t events, uint64_t data) {
+  auto it = regs_.find(fd);
+  if (it == regs_.end()) {
+    errno = ENOENT;
+    return false;
+  }
+
+  auto& reg = it->second;
+  queuePollRemove(fd, reg);
+  reg.data = data;
+  reg.events = events;
+  reg.gen = ++nextGen_;
+  queuePoll(fd, reg);
+  return true;
+}
+
+bool UringPoller::remove(int fd) {
+  auto it = regs_.find(fd);
+  if (it == regs_.end()) {
+    errno = ENOENT;
+    return false;
+  }
+
+  queuePollRemove(fd, it->second);
+  regs_.erase(it);
+  return true;
+}
+
+void UringPoller::queuePoll(int fd, const Registration& reg) {
+  auto sqe = getSqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = reg.events & ~(EPOLLET | EPOLLONESHOT);
+  if (reg.events & EPOLLET) {
+    sqe->len = IORING_POLL_ADD_MULTI;
+  }
+  sqe->user_data = pollData(fd, reg.gen);
+}
+
+void UringPoller::queuePollRemove(int fd, const Registration& reg) {
+  auto sqe = getSqe();
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = pollData(fd, reg.gen);
+  sqe->user_data = kind_ignore;
+}
+
+bool UringPoller::submitIo(const IoRequest& req, IoCompletion* done) {
+  auto sqe = getSqe();
+  sqe->fd = req.fd;
+  sqe->addr = (uint64_t)req.buf;
+  sqe->len = req.len;
+  sqe->user_data = (uint64_t)done | kind_completion;
+
+  bool fixedBuffer = req.opt & IoRequest::io_fixed_buffer;
+
+  switch (req.op) {
+    case IoRequest::io_recv:
+      sqe->opcode = IORING_OP_RECV;
+      if (req.opt & IoRequest::io_multishot) {
+        sqe->ioprio |= IORING_RECV_MULTISHOT;
+      }
+      break;
+
+    case IoRequest::io_send:
+      sqe->opcode = IORING_OP_SEND;
+      sqe->msg_flags = MSG_NOSIGNAL;
+      break;
+
+    case IoRequest::io_accept:
+      sqe->opcode = IORING_OP_ACCEPT;
+      sqe->addr = 0;
+      sqe->len = 0;
+      sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+      if (req.opt & IoRequest::io_multishot) {
+        sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+      }
+      break;
+
+    case IoRequest::io_read:
+      sqe->opcode = fixedBuffer ? IORING_OP_READ_FIXED : IORING_OP_READ;
+      sqe->off = req.offset;
+      break;
+
+    case IoRequest::io_write:
+      sqe->opcode = fixedBuffer ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+      sqe->off = req.offset;
+      break;
+
+    case IoRequest::io_timeout: {
+      // read by the kernel when the request is submitted
+      timeouts_.push_back(Timespec{req.offset / 1000,
+                                   (req.offset % 1000) * 1000000LL});
+      sqe->opcode = IORING_OP_TIMEOUT;
+      sqe->fd = -1;
+      sqe->addr = (uint64_t)&timeouts_.back();
+      sqe->len = 1;
+      break;
+    }
+
+    default:
+      // turn it into a no-op so that the entry is not wasted
+      sqe->opcode = IORING_OP_NOP;
+      sqe->user_data = kind_ignore;
+      return false;
+  }
+
+  if (req.opt & IoRequest::io_fixed_file) {
+    sqe->flags |= IOSQE_FIXED_FILE;
+  }
+  if (fixedBuffer) {
+    sqe->buf_index = req.bufIndex;
+  }
+  if (req.opt & IoRequest::io_buffer_select) {
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = req.bufIndex;
+    sqe->addr = 0;
+  }
+
+  return true;
+}
+
+bool UringPoller::registerBuffers(const struct iovec* iov, int num) {
+  ++numSyscalls_;
+  return 0 == sysRegister(fd_, IORING_REGISTER_BUFFERS, iov, num);
+}
+
+bool UringPoller::registerFiles(const int* fds, int num) {
+  ++numSyscalls_;
+  return 0 == sysRegister(fd_, IORING_REGISTER_FILES, fds, num);
+}
+
+bool UringPoller::provideBuffers(
+  void* base, int size, int num, int group, int firstId) {
+  auto sqe = getSqe();
+  sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+  sqe->fd = num;
+  sqe->addr = (uint64_t)base;
+  sqe->len = size;
+  sqe->off = firstId;
+  sqe->buf_group = group;
+  sqe->user_data = kind_ignore;
+  return true;
+}
+
+}
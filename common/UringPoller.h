@@ -0,0 +1,160 @@
+#ifndef COMMON_URINGPOLLER_H
+#define COMMON_URINGPOLLER_H
+
+#include "common/Poller.h"
+
+#include <unordered_map>
+#include <vector>
+#include <deque>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+
+namespace sdb {
+
+// A Poller on io_uring, talking to the kernel through raw syscalls.
+//
+// Readiness of registered descriptors is watched with poll requests:
+// a multishot poll for EPOLLET, a single poll for EPOLLONESHOT, and a
+// single poll that is queued again after dispatch for level triggered
+// descriptors. Requests are only handed to the kernel in wait(), so a
+// loop iteration costs one io_uring_enter however many descriptors
+// were served.
+//
+// Unlike epoll, a pending poll keeps the file open. Descriptors must be
+// removed before they are closed.
+//
+// Not thread safe, everything must be called from the loop thread.
+class UringPoller : public Poller {
+ public:
+
+  // return nullptr if io_uring is not available
+  static UringPoller* create(int entries);
+
+  ~UringPoller() override;
+
+
+  int getBackend() const override { return backend_uring; }
+
+  int getFD() const override { return fd_; }
+
+  bool isThreadSafe() const override { return false; }
+
+  bool add(int fd, uint32_t events, uint64_t data) override;
+
+  bool update(int fd, uint32_t events, uint64_t data) override;
+
+  bool remove(int fd) override;
+
+  int wait(PollEvent* events, int max, int timeoutMs) override;
+
+  void afterDispatch() override;
+
+
+  bool submitIo(const IoRequest& req, IoCompletion* done) override;
+
+  bool registerBuffers(const struct iovec* iov, int num) override;
+
+  bool registerFiles(const int* fds, int num) override;
+
+  bool provideBuffers(
+    void* base, int size, int num, int group, int firstId) override;
+
+ private:
+
+  // kind of a request, in the lowest bits of its user data
+  enum {
+    // an IoCompletion pointer
+    kind_completion = 0,
+
+    // a poll for a registered descriptor
+    kind_poll = 1,
+
+    // internal requests whose completion is dropped
+    kind_ignore = 2,
+  };
+
+  struct Registration {
+    uint64_t data;
+
+    uint32_t events;
+
+    // tells apart polls of an earlier registration of the same fd
+    uint32_t gen;
+  };
+
+  // same layout as __kernel_timespec
+  struct Timespec {
+    int64_t sec;
+    long long nsec;
+  };
+
+  struct Ring {
+    unsigned* head;
+    unsigned* tail;
+    unsigned* mask;
+    unsigned entries;
+  };
+
+
+  int fd_;
+
+  Ring sq_;
+
+  unsigned* sqArray_;
+
+  struct io_uring_sqe* sqes_;
+
+  Ring cq_;
+
+  struct io_uring_cqe* cqes_;
+
+  void* sqMap_;
+
+  size_t sqMapSize_;
+
+  void* cqMap_;
+
+  size_t cqMapSize_;
+
+  size_t sqesSize_;
+
+  // requests queued but not yet submitted to the kernel
+  unsigned pending_;
+
+  std::unordered_map<int, Registration> regs_;
+
+  uint32_t nextGen_;
+
+  // level triggered polls that fired, (fd, gen) pairs
+  std::vector<std::pair<int, uint32_t>> rearms_;
+
+  // timeouts read by the kernel on submission
+  std::deque<Timespec> timeouts_;
+
+
+  explicit UringPoller(int fd);
+
+  bool setup(const void* params);
+
+  // get a cleared entry to fill in, submitting queued ones if full
+  struct io_uring_sqe* getSqe();
+
+  // hand queued requests to the kernel and wait for @minComplete
+  // completions, for at most @timeoutMs if it is positive
+  int enter(unsigned minComplete, int timeoutMs);
+
+  void queuePoll(int fd, const Registration& reg);
+
+  void queuePollRemove(int fd, const Registration& reg);
+
+  static uint64_t pollData(int fd, uint32_t gen) {
+    return ((uint64_t)gen << 32) | ((uint64_t)fd << 2) | kind_poll;
+  }
+
+};
+
+}
+
+#endif // COMMON_URINGPOLLER_H
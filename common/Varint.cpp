@@ -0,0 +1,141 @@
+#include "common/Varint.h"
+
+#include <limits>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+
+namespace sdb {
+
+bool decodeVarintSlow(Range& range, uint64_t& val) {
+  auto p = (const unsigned char*)range.begin();
+  int n = (range.size() < kMaxVarintSize) ? range.size() : kMaxVarintSize;
+
+  uint64_t ret = 0;
+  for (int i = 0; i < n; ++i) {
+    ret |= (uint64_t)(p[i] & 0x7f) << (7 * i);
+    if (p[i] < 0x80) {
+      // the last byte only has room for the top bit
+      if (i == kMaxVarintSize - 1 && p[i] > 1) {
+        return false;
+      }
+      val = ret;
+      range.pop_front(i + 1);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+
+// bit k set if byte k of the 16 at @p is the last of a varint
+static inline uint32_t stopMask(const char* p) {
+#if defined(__x86_64__)
+  return ~_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)p)) & 0xffff;
+#else
+  uint64_t lo, hi;
+  memcpy(&lo, p, 8);
+  memcpy(&hi, p + 8, 8);
+  lo = (~lo & 0x8080808080808080ULL) >> 7;
+  hi = (~hi & 0x8080808080808080ULL) >> 7;
+  return (lo * 0x0102040810204080ULL) >> 56 |
+         ((hi * 0x0102040810204080ULL) >> 56) << 8;
+#endif
+}
+
+// Value of the @len byte varint at the start of @word, @len at most 8.
+// Three shift-and-mask steps squeeze the 7-bit groups together: 14 bits
+// per 16, 28 per 32 and 56 per 64
+static inline uint64_t decodeWord(uint64_t word, int len) {
+  uint64_t x = word & (~0ULL >> (64 - 8 * len));
+  x = ((x & 0x7f007f007f007f00ULL) >> 1) | (x & 0x007f007f007f007fULL);
+  x = ((x & 0x3fff00003fff0000ULL) >> 2) | (x & 0x00003fff00003fffULL);
+  x = ((x & 0x0fffffff00000000ULL) >> 4) | (x & 0x000000000fffffffULL);
+  return x;
+}
+
+#endif
+
+template <class T>
+static int64_t decodeRun(Range& range, T* out, int64_t num) {
+  const uint64_t maxVal = numeric_limits<T>::max();
+  auto p = range.begin();
+  auto end = range.end();
+  int64_t i = 0;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  // One mask load per 16 bytes finds where all varints in them end, so
+  // that decoding one does not wait for the length of the one before.
+  // Every load stays within the 24 bytes ahead of @p
+  while (i < num && end - p >= 24) {
+    uint32_t stops = stopMask(p);
+    if (stops == 0xffff && num - i >= 16) {
+      for (int k = 0; k < 16; ++k) {
+        out[i + k] = (unsigned char)p[k];
+      }
+      i += 16;
+      p += 16;
+      continue;
+    }
+
+    int start = 0;
+    bool bad = false;
+    for (; stops && i < num; stops &= stops - 1) {
+      int len = __builtin_ctz(stops) + 1 - start;
+      uint64_t val;
+      if (len <= 8) {
+        uint64_t word;
+        memcpy(&word, p + start, 8);
+        val = decodeWord(word, len);
+      } else {
+        Range rest(p + start, end);
+        bad = !decodeVarintSlow(rest, val);
+      }
+
+      if (bad || val > maxVal) {
+        bad = true;
+        break;
+      }
+      out[i++] = (T)val;
+      start += len;
+    }
+
+    p += start;
+    // no varint ends in 16 bytes, or one is bad: the loop below stops
+    if (bad || start == 0) {
+      break;
+    }
+  }
+#endif
+
+  Range rest(p, end);
+  for (; i < num; ++i) {
+    uint64_t val;
+    Range next = rest;
+    if (!decodeVarint(next, val) || val > maxVal) {
+      break;
+    }
+    out[i] = (T)val;
+    rest = next;
+  }
+
+  range = rest;
+  return i;
+}
+
+int64_t decodeVarints(Range& range, uint64_t* out, int64_t num) {
+  return decodeRun(range, out, num);
+}
+
+int64_t decodeVarints(Range& range, uint32_t* out, int64_t num) {
+  return decodeRun(range, out, num);
+}
+
+}
@@ -0,0 +1,78 @@
+#ifndef COMMON_VARINT_H
+#define COMMON_VARINT_H
+
+#include "common/Range.h"
+
+#include <cstdint>
+
+
+namespace sdb {
+
+// LEB128 variable length integers: 7 bits per byte, least significant
+// group first, the high bit of a byte set if more bytes follow. Values
+// below 128 take one byte, a 64-bit value at most kMaxVarintSize.
+//
+// Signed values are zigzag mapped first, so that small negative numbers
+// stay short: 0, -1, 1, -2, ... become 0, 1, 2, 3, ...
+
+const int kMaxVarintSize = 10;
+
+inline uint64_t zigzagEncode(int64_t val) {
+  return ((uint64_t)val << 1) ^ (uint64_t)(val >> 63);
+}
+
+inline int64_t zigzagDecode(uint64_t val) {
+  return (int64_t)((val >> 1) ^ -(val & 1));
+}
+
+// number of bytes @val encodes to
+inline int varintSize(uint64_t val) {
+  return (63 - __builtin_clzll(val | 1)) / 7 + 1;
+}
+
+// write @val at @p, which has room for kMaxVarintSize bytes, and return
+// the end of what is written
+inline char* encodeVarint(char* p, uint64_t val) {
+  while (val >= 0x80) {
+    *p++ = (char)(val | 0x80);
+    val >>= 7;
+  }
+  *p++ = (char)val;
+  return p;
+}
+
+// slow path of decodeVarint()
+bool decodeVarintSlow(Range& range, uint64_t& val);
+
+// Decode a varint from the front of @range and remove it. Fails without
+// touching @range if it is truncated or longer than kMaxVarintSize
+inline bool decodeVarint(Range& range, uint64_t& val) {
+  auto p = (const unsigned char*)range.begin();
+  if (range.size() > 0 && p[0] < 0x80) {
+    val = p[0];
+    range.pop_front(1);
+    return true;
+  }
+  // two bytes, the lengths of most records and their fields
+  if (range.size() > 1 && p[1] < 0x80) {
+    val = (p[0] & 0x7f) | ((uint64_t)p[1] << 7);
+    range.pop_front(2);
+    return true;
+  }
+  return decodeVarintSlow(range, val);
+}
+
+// Decode up to @num varints from the front of @range into @out and
+// remove them. Return the number decoded, which is less than @num only
+// if @range ends early or holds a bad varint, which is left in place.
+//
+// Runs of one byte values are widened 16 at a time, longer ones are
+// decoded from a single 8-byte load without a branch per byte
+int64_t decodeVarints(Range& range, uint64_t* out, int64_t num);
+
+// same as above, a value that does not fit 32 bits is a bad varint
+int64_t decodeVarints(Range& range, uint32_t* out, int64_t num);
+
+}
+
+#endif // COMMON_VARINT_H
@@ -0,0 +1,184 @@
+#ifndef COMMON_WORKSTEALINGDEQUE_H
+#define COMMON_WORKSTEALINGDEQUE_H
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+
+namespace sdb {
+
+// A lock-free Chase-Lev work stealing deque.
+//
+// The owner thread pushes and pops items at the bottom end of the deque,
+// other threads (thieves) steal items from the top end. The deque grows
+// on demand. Retired arrays are only reclaimed when the deque itself is
+// destructed, since a thief may still be reading from an old array.
+//
+// T must be trivially copyable, typically a pointer type.
+template <class T>
+class WorkStealingDeque {
+ public:
+
+  explicit WorkStealingDeque(int64_t capacity = 1024);
+
+  ~WorkStealingDeque();
+
+  WorkStealingDeque(const WorkStealingDeque&) = delete;
+
+  WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+
+  // push an item to the bottom. Only the owner may call this
+  void push(T item);
+
+  // pop an item from the bottom. Only the owner may call this.
+  // Return false if the deque is empty
+  bool pop(T& item);
+
+  // steal an item from the top. Any thread may call this.
+  // Return false if the deque is empty or the race is lost
+  bool steal(T& item);
+
+  // return an approximate number of items in the deque
+  int64_t size() const;
+
+  bool empty() const { return size() <= 0; }
+
+ private:
+
+  struct Array {
+    int64_t mask;
+    std::atomic<T>* items;
+
+    explicit Array(int64_t capacity)
+      : mask(capacity - 1), items(new std::atomic<T>[capacity]) {}
+
+    ~Array() { delete[] items; }
+
+    int64_t capacity() const { return mask + 1; }
+
+    T get(int64_t i) const {
+      return items[i & mask].load(std::memory_order_relaxed);
+    }
+
+    void put(int64_t i, T item) {
+      items[i & mask].store(item, std::memory_order_relaxed);
+    }
+  };
+
+  std::atomic<int64_t> top_;
+
+  // keep top_ and bottom_ on different cache lines
+  char pad_[64];
+
+  std::atomic<int64_t> bottom_;
+
+  std::atomic<Array*> array_;
+
+  // arrays replaced by grow(), only touched by the owner
+  std::vector<Array*> retired_;
+
+
+  Array* grow(Array* a, int64_t bottom, int64_t top);
+};
+
+
+template <class T>
+WorkStealingDeque<T>::WorkStealingDeque(int64_t capacity)
+  : top_(0), bottom_(0) {
+  int64_t cap = 2;
+  while (cap < capacity) {
+    cap <<= 1;
+  }
+  array_.store(new Array(cap), std::memory_order_relaxed);
+}
+
+template <class T>
+WorkStealingDeque<T>::~WorkStealingDeque() {
+  delete array_.load(std::memory_order_relaxed);
+  for (auto p : retired_) {
+    delete p;
+  }
+}
+
+template <class T>
+void WorkStealingDeque<T>::push(T item) {
+  auto b = bottom_.load(std::memory_order_relaxed);
+  auto t = top_.load(std::memory_order_acquire);
+  auto a = array_.load(std::memory_order_relaxed);
+
+  if (b - t > a->mask) {
+    a = grow(a, b, t);
+  }
+
+  a->put(b, item);
+  std::atomic_thread_fence(std::memory_order_release);
+  bottom_.store(b + 1, std::memory_order_relaxed);
+}
+
+template <class T>
+bool WorkStealingDeque<T>::pop(T& item) {
+  auto b = bottom_.load(std::memory_order_relaxed) - 1;
+  auto a = array_.load(std::memory_order_relaxed);
+  bottom_.store(b, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  auto t = top_.load(std::memory_order_relaxed);
+
+  if (t > b) {
+    // empty deque
+    bottom_.store(b + 1, std::memory_order_relaxed);
+    return false;
+  }
+
+  item = a->get(b);
+  if (t == b) {
+    // the last item, race against thieves
+    bool won = top_.compare_exchange_strong(
+      t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+    return won;
+  }
+
+  return true;
+}
+
+template <class T>
+bool WorkStealingDeque<T>::steal(T& item) {
+  auto t = top_.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  auto b = bottom_.load(std::memory_order_acquire);
+
+  if (t >= b) {
+    return false;
+  }
+
+  auto a = array_.load(std::memory_order_acquire);
+  item = a->get(t);
+  return top_.compare_exchange_strong(
+    t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+template <class T>
+int64_t WorkStealingDeque<T>::size() const {
+  auto b = bottom_.load(std::memory_order_relaxed);
+  auto t = top_.load(std::memory_order_relaxed);
+  return b - t;
+}
+
+template <class T>
+typename WorkStealingDeque<T>::Array*
+WorkStealingDeque<T>::grow(Array* a, int64_t bottom, int64_t top) {
+  auto na = new Array(a->capacity() * 2);
+  for (auto i = top; i < bottom; ++i) {
+    na->put(i, a->get(i));
+  }
+
+  retired_.push_back(a);
+  array_.store(na, std::memory_order_release);
+  return na;
+}
+
+} // sdb
+
+#endif // COMMON_WORKSTEALINGDEQUE_H
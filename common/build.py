@@ -6,7 +6,16 @@ cpp_library(
     "Dir.cpp",
     "ThreadPool.cpp",
     "Event.cpp",
+    "TimerWheel.cpp",
+    "Poller.cpp",
+    "UringPoller.cpp",
+    "BufferPool.cpp",
     "Range.cpp",
+    "Varint.cpp",
+    "Record.cpp",
+    "MemoryProvider.cpp",
+    "Arena.cpp",
+    "IoBuf.cpp",
     "UnitTest.cpp",
   ],
 )
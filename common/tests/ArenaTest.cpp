@@ -0,0 +1,141 @@
+#include "common/Arena.h"
+#include "common/Logging.h"
+#include "common/UnitTest.h"
+
+#include <map>
+#include <set>
+#include <thread>
+#include <vector>
+#include <string.h>
+
+using namespace sdb;
+using namespace std;
+
+
+TEST(Arena, testAlignment) {
+  Arena arena(4096, 16);
+  for (int i = 1; i < 100; ++i) {
+    auto p = (char*)arena.allocate(i);
+    ASSERT_EQ((uintptr_t)p % 16, 0);
+    memset(p, 'x', i);
+  }
+
+  // a stricter alignment for one call
+  auto p = arena.allocate(3, 256);
+  ASSERT_EQ((uintptr_t)p % 256, 0);
+
+  Arena bytes(4096, 1);
+  auto a = (char*)bytes.allocate(3);
+  auto b = (char*)bytes.allocate(5);
+  ASSERT_EQ(b - a, 3);
+}
+
+TEST(Arena, testChunks) {
+  Arena arena(1024);
+  size_t usage = arena.memoryUsage();
+  ASSERT_GE(usage, 1024);
+
+  // filling the first chunk chains one twice as large
+  set<char*> seen;
+  for (int i = 0; i < 200; ++i) {
+    auto p = (char*)arena.allocate(64);
+    memset(p, 'y', 64);
+    ASSERT_TRUE(seen.insert(p).second);
+  }
+  ASSERT_TRUE(arena.memoryUsage() > usage);
+  ASSERT_TRUE(arena.memoryUsage() < 64 * 200 * 3);
+
+  // larger than any chunk so far
+  auto big = (char*)arena.allocate(1 << 20);
+  memset(big, 'z', 1 << 20);
+  ASSERT_GE(arena.memoryUsage(), 1 << 20);
+}
+
+TEST(Arena, testReset) {
+  Arena arena(1024);
+  vector<char*> first;
+  for (int i = 0; i < 100; ++i) {
+    first.push_back((char*)arena.allocate(100));
+  }
+  size_t usage = arena.memoryUsage();
+
+  // the same work again takes no new chunk, and starts where it did
+  for (int round = 0; round < 3; ++round) {
+    arena.reset();
+    for (int i = 0; i < 100; ++i) {
+      auto p = (char*)arena.allocate(100);
+      ASSERT_TRUE(p == first[i]);
+    }
+    ASSERT_EQ(arena.memoryUsage(), usage);
+  }
+
+  // a large request after reset skips chunks that are too small
+  arena.reset();
+  auto big = (char*)arena.allocate(100000);
+  memset(big, 'x', 100000);
+  auto small = (char*)arena.allocate(8);
+  ASSERT_TRUE(small != nullptr);
+}
+
+TEST(Arena, testThreads) {
+  const int numThreads = 4;
+  const int num = 20000;
+  Arena arena(256);
+  vector<vector<int64_t*>> ptrs(numThreads);
+
+  vector<thread> threads;
+  for (int t = 0; t < numThreads; ++t) {
+    threads.emplace_back([&arena, &ptrs, t, num]() {
+      for (int i = 0; i < num; ++i) {
+        auto p = (int64_t*)arena.allocate(16);
+        p[0] = t;
+        p[1] = i;
+        ptrs[t].push_back(p);
+      }
+    });
+  }
+  for (auto& th : threads) {
+    th.join();
+  }
+
+  // no two threads got the same memory
+  for (int t = 0; t < numThreads; ++t) {
+    for (int i = 0; i < num; ++i) {
+      ASSERT_EQ(ptrs[t][i][0], t);
+      ASSERT_EQ(ptrs[t][i][1], i);
+    }
+  }
+}
+
+TEST(Arena, testAllocator) {
+  Arena arena;
+  {
+    ArenaAllocator<int> alloc(&arena);
+    map<int, int, less<int>, ArenaAllocator<pair<const int, int>>> m(
+      less<int>(), alloc);
+    for (int i = 0; i < 2048; ++i) {
+      m[i] = i * 2;
+    }
+    ASSERT_EQ(m.size(), 2048);
+    ASSERT_EQ(m[100], 200);
+
+    vector<double, ArenaAllocator<double>> vec(alloc);
+    vec.assign(1000, 0.5);
+    ASSERT_EQ((uintptr_t)vec.data() % alignof(double), 0);
+    ASSERT_TRUE(ArenaAllocator<double>(alloc) == vec.get_allocator());
+  }
+  ASSERT_GE(arena.memoryUsage(), 2048 * 32);
+}
+
+#if __cplusplus >= 201703L
+TEST(Arena, testResource) {
+  Arena arena;
+  ArenaResource resource(&arena);
+  std::pmr::vector<int> vec(&resource);
+  for (int i = 0; i < 1000; ++i) {
+    vec.push_back(i);
+  }
+  ASSERT_EQ(vec[999], 999);
+  ASSERT_TRUE(resource.is_equal(resource));
+}
+#endif
@@ -0,0 +1,178 @@
+#include "common/BufferPool.h"
+#include "common/Range.h"
+#include "common/Logging.h"
+#include "common/UnitTest.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string.h>
+#include <stdlib.h>
+
+using namespace sdb;
+using namespace std;
+using namespace std::chrono;
+
+// enable this if you want to print out perf info
+const bool printPerf = false;
+
+
+TEST(BufferPool, testSizeClass) {
+  ASSERT_EQ(BufferPool::sizeClass(1), 0);
+  ASSERT_EQ(BufferPool::sizeClass(512), 0);
+  ASSERT_EQ(BufferPool::sizeClass(513), 1);
+  ASSERT_EQ(BufferPool::sizeClass(32 * 1024), 6);
+  ASSERT_EQ(BufferPool::sizeClass(1024 * 1024), BufferPool::kNumClasses - 1);
+  ASSERT_EQ(BufferPool::sizeClass(1024 * 1024 + 1), -1);
+  ASSERT_EQ(BufferPool::classSize(6), 32 * 1024);
+}
+
+// tests run after others in the same process, so they look at how the
+// stats change rather than at their values
+static BufferPool::Stats statsBefore() {
+  BufferPool::flushThreadCache();
+  return BufferPool::getStats();
+}
+
+TEST(BufferPool, testReuse) {
+  FORK {
+    auto before = statsBefore();
+    auto p = BufferPool::allocate(1000);
+    memset(p, 'x', 1024);
+    BufferPool::deallocate(p, 1000);
+
+    // same class, served by the thread cache
+    auto q = BufferPool::allocate(700);
+    ASSERT_TRUE(p == q);
+    BufferPool::deallocate(q, 700);
+
+    // too large for the pool
+    auto big = BufferPool::allocate(4 * 1024 * 1024);
+    memset(big, 'y', 4 * 1024 * 1024);
+    BufferPool::deallocate(big, 4 * 1024 * 1024);
+
+    BufferPool::flushThreadCache();
+    auto stats = BufferPool::getStats();
+    ASSERT_GE(stats.hits - before.hits, 1);
+    ASSERT_GE(stats.misses - before.misses, 1);
+    ASSERT_EQ(stats.hits + stats.misses - before.hits - before.misses, 3);
+  };
+}
+
+TEST(BufferPool, testCrossThread) {
+  FORK {
+    auto before = statsBefore();
+    const int num = 1000;
+    vector<void*> bufs;
+    for (int i = 0; i < num; ++i) {
+      bufs.push_back(BufferPool::allocate(4096));
+    }
+
+    // freed on another thread, whose cache goes to the depot on exit
+    thread t([&bufs]() {
+      for (auto p : bufs) {
+        BufferPool::deallocate(p, 4096);
+      }
+    });
+    t.join();
+
+    // every buffer is back in the pool
+    BufferPool::flushThreadCache();
+    auto stats = BufferPool::getStats();
+    auto misses = stats.misses - before.misses;
+    ASSERT_EQ(stats.hits + misses - before.hits, num);
+    ASSERT_EQ(stats.bytesRetained - before.bytesRetained, misses * 4096);
+    before = stats;
+
+    // picked up again from the depot
+    for (int i = 0; i < num; ++i) {
+      bufs[i] = BufferPool::allocate(4096);
+    }
+    BufferPool::flushThreadCache();
+    stats = BufferPool::getStats();
+    ASSERT_EQ(stats.misses, before.misses);
+    ASSERT_EQ(stats.hits - before.hits, num);
+    ASSERT_EQ(before.bytesRetained - stats.bytesRetained, num * 4096);
+
+    for (auto p : bufs) {
+      BufferPool::deallocate(p, 4096);
+    }
+  };
+}
+
+TEST(BufferPool, testDepotLimit) {
+  FORK {
+    auto before = statsBefore();
+    const size_t size = BufferPool::kMaxClassSize;
+    const int num = 2 * BufferPool::kMaxDepotBytes / size;
+    vector<void*> bufs;
+    for (int i = 0; i < num; ++i) {
+      bufs.push_back(BufferPool::allocate(size));
+    }
+    for (auto p : bufs) {
+      BufferPool::deallocate(p, size);
+    }
+    BufferPool::flushThreadCache();
+
+    // the rest went back to the system
+    auto stats = BufferPool::getStats();
+    ASSERT_LE(stats.bytesRetained - before.bytesRetained,
+              BufferPool::kMaxDepotBytes);
+  };
+}
+
+TEST(BufferPool, testIoRange) {
+  FORK {
+    auto before = statsBefore();
+    for (int i = 0; i < 100; ++i) {
+      IoRange r;
+      r.append(string(100 * 1024, 'a'));
+      ASSERT_EQ(r.getRange().size(), 100 * 1024);
+    }
+
+    // only the first round allocates, and each round grows its buffer
+    // once
+    BufferPool::flushThreadCache();
+    auto stats = BufferPool::getStats();
+    ASSERT_LE(stats.misses - before.misses, 2);
+    ASSERT_EQ(stats.hits + stats.misses - before.hits - before.misses, 200);
+  };
+}
+
+// keeps the compiler from dropping malloc/free pairs
+static char* volatile sink;
+
+// IoRange used to malloc a 32KB buffer per instance
+TEST(BufferPool, testPerf) {
+  const int num = printPerf ? 1000000 : 10000;
+  string msg(200, 'm');
+
+  {
+    auto beg = steady_clock::now();
+    for (int i = 0; i < num; ++i) {
+      auto p = (char*)malloc(32 * 1024);
+      memcpy(p, msg.data(), msg.size());
+      sink = p;
+      free(p);
+    }
+    auto us = duration_cast<microseconds>(steady_clock::now() - beg).count();
+
+    if (printPerf) {
+      cout << "malloc of 32KB buffers takes " << us << " microseconds"
+           << endl;
+    }
+  }
+
+  {
+    auto beg = steady_clock::now();
+    for (int i = 0; i < num; ++i) {
+      IoRange r;
+      r.append(msg);
+    }
+    auto us = duration_cast<microseconds>(steady_clock::now() - beg).count();
+
+    if (printPerf) {
+      cout << "pooled IoRange takes " << us << " microseconds" << endl;
+    }
+  }
+}
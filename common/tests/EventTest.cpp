@@ -4,18 +4,183 @@
 #include "common/UnitTest.h"
 
 #include <chrono>
+#include <atomic>
+#include <thread>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace sdb;
 using namespace std;
 using namespace std::chrono;
 
+// enable this if you want to print out perf info
+const bool printPerf = false;
+
 
 int64_t nowInMs() {
   auto ts = steady_clock::now();
   return duration_cast<milliseconds>(ts.time_since_epoch()).count();
 }
 
+TEST(Event, testSubmitOrder) {
+  FORK {
+    auto tp = new ThreadPool(1);
+    auto eloop = new EventLoop(8);
+
+    tp->submit([eloop]() { eloop->loop(); });
+
+    // more than one batch of tasks
+    vector<int> seen;
+    for (int i = 0; i < 1000; ++i) {
+      eloop->submit([&seen, i]() { seen.push_back(i); });
+    }
+
+    auto fut = eloop->async([&seen]() { return (int)seen.size(); });
+    ASSERT_EQ(fut.get(), 1000);
+
+    for (int i = 0; i < 1000; ++i) {
+      ASSERT_EQ(seen[i], i);
+    }
+
+    eloop->quitLoopSoon();
+    tp->drain();
+
+    delete eloop;
+    delete tp;
+  };
+}
+
+TEST(Event, testSubmitFromManyThreads) {
+  FORK {
+    auto tp = new ThreadPool(5);
+    auto eloop = new EventLoop(8);
+    atomic<int> count(0);
+
+    tp->submit([eloop]() { eloop->loop(); });
+
+    vector<Future<bool>> futs;
+    for (int i = 0; i < 4; ++i) {
+      futs.push_back(tp->async([eloop, &count]() {
+        for (int j = 0; j < 2000; ++j) {
+          eloop->submit([&count]() { ++count; });
+        }
+        return true;
+      }));
+    }
+
+    for (auto& f : futs) {
+      ASSERT_TRUE(f.get());
+    }
+
+    // runs after all tasks above since they were submitted earlier
+    ASSERT_EQ(eloop->async([&count]() { return count.load(); }).get(), 8000);
+
+    eloop->quitLoopSoon();
+    tp->drain();
+
+    delete eloop;
+    delete tp;
+  };
+}
+
+
+// The submit path used before EventLoop had a task queue: one pipe and
+// one epoll registration per task
+class PipeTaskEvent : virtual public SynchronizedEvent {
+ public:
+
+  explicit PipeTaskEvent(Task&& cb) : cb_(move(cb)) {}
+
+  void process() override {
+    cb_();
+    delete this;
+  }
+
+  static void submit(EventLoop* loop, Task&& cb) {
+    auto p = new PipeTaskEvent(move(cb));
+    p->notify_one();
+    loop->addEvent(p, EventLoop::handle_read);
+  }
+
+ private:
+
+  Task cb_;
+};
+
+// cross-thread submit latency and throughput of pipe per task, the task
+// queue, and the task queue with busy polling
+TEST(Event, testPerf) {
+  FORK {
+    // keep it short unless we are measuring, other tests are timing
+    const int numTasks = printPerf ? 200000 : 200;
+
+    const char* modes[] = { "pipe per task", "task queue", "busy poll" };
+
+    // spinning takes a whole CPU, only do it when measuring
+    for (int mode = 0; mode < (printPerf ? 3 : 2); ++mode) {
+      bool legacy = (mode == 0);
+
+      auto tp = new ThreadPool(1);
+      auto eloop = new EventLoop(64);
+      if (mode == 2) {
+        eloop->setBusyPoll(100);
+      }
+      tp->submit([eloop]() { eloop->loop(); });
+
+      auto submit = [eloop, legacy](Task&& t) {
+        if (legacy) {
+          PipeTaskEvent::submit(eloop, move(t));
+        } else {
+          eloop->submit(move(t));
+        }
+      };
+
+      // latency: one round trip at a time
+      auto beg = steady_clock::now();
+      for (int i = 0; i < numTasks / 10; ++i) {
+        Promise<int> pr;
+        auto fut = pr.getFuture();
+        submit([pr = move(pr)]() mutable { pr.setValue(1); });
+        ASSERT_EQ(fut.get(), 1);
+      }
+      auto latency = duration_cast<nanoseconds>(
+        steady_clock::now() - beg).count() / (numTasks / 10);
+
+      // throughput: bursts of tasks, each pending pipe holds two fds
+      const int burst = min(numTasks, 1000);
+      beg = steady_clock::now();
+      for (int i = 0; i < numTasks / burst; ++i) {
+        int count = 0;
+        Promise<void> done;
+        auto fut = done.getFuture();
+        for (int j = 0; j < burst; ++j) {
+          submit([&count, &done, burst]() {
+            if (++count == burst) {
+              done.setValue();
+            }
+          });
+        }
+        fut.get();
+      }
+      auto us = duration_cast<microseconds>(steady_clock::now() - beg).count();
+
+      if (printPerf) {
+        cout << modes[mode] << ": "
+             << latency << " ns/round trip, "
+             << (int64_t)numTasks * 1000000 / max((int64_t)us, (int64_t)1)
+             << " tasks/s" << endl;
+      }
+
+      eloop->quitLoopSoon();
+      tp->drain();
+
+      delete eloop;
+      delete tp;
+    }
+  };
+}
+
 TEST(Event, testEventLoopAsync) {
   FORK {
     auto tp = new ThreadPool(1);
@@ -47,10 +212,27 @@ TEST(Event, testSingleEventManagerAsync) {
   };
 }
 
+// the destructor quits the loops by itself, with timers still pending
+TEST(Event, testDeleteWithoutDrain) {
+  FORK {
+    auto eventMgr = new EventManager(2, 1);
+    auto fut = eventMgr->async([]() { return 32; });
+    ASSERT_EQ(fut.get(), 32);
+
+    auto pending = eventMgr->schedule(nowInMs() + 60000, []() { return 1; });
+    delete eventMgr;
+
+    // draining twice is fine as well
+    eventMgr = new EventManager(1, 1);
+    eventMgr->drain();
+    delete eventMgr;
+  };
+}
+
 TEST(Event, testManyEventManagerAsync) {
   FORK {
     auto eventMgr = new EventManager(8, 1);
-    vector<future<int>> futs;
+    vector<Future<int>> futs;
 
     for (int i = 0; i < 100; ++i) {
       futs.push_back(eventMgr->async([i]() { return i; }));
@@ -84,7 +266,7 @@ TEST(Event, testSingleEventManagerSchedule) {
 TEST(Event, testManyEventManagerSchedule) {
   FORK {
     auto eventMgr = new EventManager(8, 1);
-    vector<future<int>> futs;
+    vector<Future<int>> futs;
     auto startTime = nowInMs();
 
     for (int i = 0; i < 16; ++i) {
@@ -103,3 +285,300 @@ TEST(Event, testManyEventManagerSchedule) {
     delete eventMgr;
   };
 }
+
+TEST(Event, testCancelSchedule) {
+  FORK {
+    auto eventMgr = new EventManager(2, 1);
+    auto startTime = nowInMs();
+
+    TimerHandle h1, h2;
+    auto f1 = eventMgr->schedule(startTime + 100, []() { return 1; }, &h1);
+    auto f2 = eventMgr->schedule(startTime + 10, []() { return 2; }, &h2);
+
+    ASSERT_TRUE(h1.pending());
+    ASSERT_TRUE(h1.cancel());
+    ASSERT_FALSE(h1.pending());
+    ASSERT_FALSE(h1.cancel());
+
+    bool caught = false;
+    try {
+      f1.get();
+    } catch (future_error& e) {
+      caught = true;
+    }
+    ASSERT_TRUE(caught);
+
+    // fired timers can not be cancelled
+    ASSERT_EQ(f2.get(), 2);
+    ASSERT_FALSE(h2.cancel());
+
+    eventMgr->drain();
+    delete eventMgr;
+  };
+}
+
+TEST(Event, testScheduleFromTimerLoop) {
+  FORK {
+    auto eventMgr = new EventManager(2, 1);
+    auto startTime = nowInMs();
+
+    // timers added and cancelled on the timer loop itself
+    auto fut = eventMgr->schedule(startTime + 10, [eventMgr]() {
+      auto now = nowInMs();
+      vector<Future<int>> ret;
+      TimerHandle h;
+
+      ret.push_back(eventMgr->schedule(now + 10, []() { return 3; }));
+      ret.push_back(eventMgr->schedule(now + 5, []() { return 4; }, &h));
+      h.cancel();
+      return ret;
+    });
+
+    auto futs = fut.get();
+    ASSERT_EQ(futs[0].get(), 3);
+
+    bool caught = false;
+    try {
+      futs[1].get();
+    } catch (future_error& e) {
+      caught = true;
+    }
+    ASSERT_TRUE(caught);
+
+    eventMgr->drain();
+    delete eventMgr;
+  };
+}
+
+TEST(Event, testManyCancelledTimers) {
+  FORK {
+    auto eventMgr = new EventManager(2, 2);
+    auto startTime = nowInMs();
+    vector<TimerHandle> handles(10000);
+    vector<Future<int>> futs;
+
+    for (int i = 0; i < (int)handles.size(); ++i) {
+      futs.push_back(eventMgr->schedule(
+        startTime + 20 + i % 200, [i]() { return i; }, &handles[i]));
+    }
+
+    // keep one in ten
+    for (int i = 0; i < (int)handles.size(); ++i) {
+      if (i % 10) {
+        handles[i].cancel();
+      }
+    }
+
+    for (int i = 0; i < (int)futs.size(); ++i) {
+      if (i % 10) {
+        continue;
+      }
+      ASSERT_EQ(futs[i].get(), i);
+    }
+
+    eventMgr->drain();
+    delete eventMgr;
+  };
+}
+
+
+// Reads a few bytes from a pipe per notification, or until EAGAIN if
+// @drain is set
+class PipeReader : public Event {
+ public:
+
+  PipeReader(bool drain, vector<string>* order = nullptr,
+             const string& name = "")
+    : drain_(drain), order_(order), name_(name), notified(0), bytes(0) {
+    if (0 > pipe2(fds_, O_NONBLOCK | O_CLOEXEC)) {
+      LOG(FATAL) << "Fails to create pipe!";
+    }
+  }
+
+  ~PipeReader() override {
+    close(fds_[0]);
+    close(fds_[1]);
+  }
+
+  int getFD() const override { return fds_[0]; }
+
+  void handleRead() override {
+    ++notified;
+    if (order_) {
+      order_->push_back(name_);
+    }
+
+    char buf[4];
+    int n = 0;
+    do {
+      n = read(fds_[0], buf, sizeof(buf));
+      if (n > 0) {
+        bytes += n;
+      }
+    } while (drain_ && n > 0);
+  }
+
+  void handleWrite() override {}
+
+  void handleError() override {}
+
+  void send(int n) {
+    string data(n, 'x');
+    ASSERT_EQ(write(fds_[1], data.data(), n), n);
+  }
+
+ private:
+
+  int fds_[2];
+
+  bool drain_;
+
+  vector<string>* order_;
+
+  string name_;
+
+ public:
+
+  atomic<int> notified;
+
+  atomic<int> bytes;
+};
+
+// wait until @pred holds or @ms passes
+template <class Pred>
+bool waitFor(Pred pred, int ms) {
+  auto deadline = nowInMs() + ms;
+  while (!pred()) {
+    if (nowInMs() > deadline) {
+      return false;
+    }
+    this_thread::sleep_for(milliseconds(1));
+  }
+  return true;
+}
+
+TEST(Event, testEdgeTriggered) {
+  FORK {
+    auto tp = new ThreadPool(1);
+    auto eloop = new EventLoop(8);
+    tp->submit([eloop]() { eloop->loop(); });
+
+    // level triggered keeps reporting until everything is read
+    PipeReader level(false);
+    ASSERT_TRUE(eloop->addEvent(&level, EventLoop::handle_read));
+    level.send(10);
+    ASSERT_TRUE(waitFor([&]() { return level.bytes == 10; }, 1000));
+    ASSERT_EQ(level.notified.load(), 3);
+
+    // edge triggered reports once, what is not read is left behind
+    PipeReader partial(false);
+    ASSERT_TRUE(eloop->addEvent(
+      &partial, EventLoop::handle_read | EventLoop::handle_edge));
+    partial.send(10);
+    ASSERT_TRUE(waitFor([&]() { return partial.bytes == 4; }, 1000));
+    this_thread::sleep_for(milliseconds(20));
+    ASSERT_EQ(partial.bytes.load(), 4);
+    ASSERT_EQ(partial.notified.load(), 1);
+
+    // which is why edge triggered handlers read until EAGAIN
+    PipeReader edge(true);
+    ASSERT_TRUE(eloop->addEvent(
+      &edge, EventLoop::handle_read | EventLoop::handle_edge));
+    edge.send(10);
+    ASSERT_TRUE(waitFor([&]() { return edge.bytes == 10; }, 1000));
+    edge.send(3);
+    ASSERT_TRUE(waitFor([&]() { return edge.bytes == 13; }, 1000));
+    ASSERT_EQ(edge.notified.load(), 2);
+
+    eloop->quitLoopSoon();
+    tp->drain();
+
+    delete eloop;
+    delete tp;
+  };
+}
+
+TEST(Event, testOneshot) {
+  FORK {
+    auto tp = new ThreadPool(1);
+    auto eloop = new EventLoop(8);
+    tp->submit([eloop]() { eloop->loop(); });
+
+    const int opt = EventLoop::handle_read | EventLoop::handle_oneshot;
+    PipeReader reader(false);
+    ASSERT_TRUE(eloop->addEvent(&reader, opt));
+
+    reader.send(10);
+    ASSERT_TRUE(waitFor([&]() { return reader.bytes == 4; }, 1000));
+    this_thread::sleep_for(milliseconds(20));
+    ASSERT_EQ(reader.notified.load(), 1);
+
+    // enable it again for one more notification
+    ASSERT_TRUE(eloop->updateEvent(&reader, opt));
+    ASSERT_TRUE(waitFor([&]() { return reader.bytes == 8; }, 1000));
+    this_thread::sleep_for(milliseconds(20));
+    ASSERT_EQ(reader.notified.load(), 2);
+
+    eloop->quitLoopSoon();
+    tp->drain();
+
+    delete eloop;
+    delete tp;
+  };
+}
+
+TEST(Event, testDispatchOrder) {
+  FORK {
+    auto eloop = new EventLoop(8);
+    vector<string> order;
+
+    PipeReader io(true, &order, "io");
+    PipeReader timer(true, &order, "timer");
+    ASSERT_TRUE(eloop->addEvent(&io, EventLoop::handle_read));
+    ASSERT_TRUE(eloop->addEvent(
+      &timer, EventLoop::handle_read | EventLoop::handle_priority));
+
+    // everything is ready when the loop polls the first time
+    io.send(1);
+    timer.send(1);
+    eloop->submit([&order]() { order.push_back("task"); });
+    eloop->quitLoopSoon();
+    eloop->loop();
+
+    ASSERT_EQ(order.size(), 3);
+    ASSERT_EQ(order[0], "task");
+    ASSERT_EQ(order[1], "timer");
+    ASSERT_EQ(order[2], "io");
+
+    delete eloop;
+  };
+}
+
+TEST(Event, testBusyPoll) {
+  FORK {
+    auto tp = new ThreadPool(1);
+    auto eloop = new EventLoop(8);
+    eloop->setBusyPoll(200);
+    tp->submit([eloop]() { eloop->loop(); });
+
+    for (int i = 0; i < 100; ++i) {
+      ASSERT_EQ(eloop->async([i]() { return i; }).get(), i);
+
+      // let the loop fall back to blocking now and then
+      if (i % 20 == 0) {
+        this_thread::sleep_for(milliseconds(2));
+      }
+    }
+
+    PipeReader reader(true);
+    ASSERT_TRUE(eloop->addEvent(&reader, EventLoop::handle_read));
+    reader.send(5);
+    ASSERT_TRUE(waitFor([&]() { return reader.bytes == 5; }, 1000));
+
+    eloop->quitLoopSoon();
+    tp->drain();
+
+    delete eloop;
+    delete tp;
+  };
+}
@@ -4,6 +4,8 @@
 #include <vector>
 #include <map>
 #include <chrono>
+#include <memory>
+#include <mutex>
 
 using namespace std;
 using namespace sdb;
@@ -70,36 +72,159 @@ TEST(FastAlloc, testMapDifferentAlloc) {
   }
 }
 
-TEST(FastAlloc, testPerf) {
+TEST(FastAlloc, testSharedArena) {
+  FastAlloc<int> alloc(1024);
+  vector<int, FastAlloc<int>> a(alloc);
+  vector<int, FastAlloc<int>> b(alloc);
   {
-    map<int, int, less<int>, FastAlloc<char, uint64_t, 256*1024>> m;
-    auto beg = steady_clock::now();
+    // copies share the arena and keep it alive
+    FastAlloc<char> copy(alloc);
+    ASSERT_TRUE(copy == alloc);
+    copy = FastAlloc<char>();
+    ASSERT_TRUE(copy != alloc);
+  }
 
-    for (int i = 0; i < 4096; ++i) {
-      m.insert({i, i});
+  for (int i = 0; i < 10000; ++i) {
+    a.push_back(i);
+    b.push_back(-i);
+  }
+  ASSERT_EQ(a[9999] + b[9999], 0);
+  ASSERT_GE(alloc.impl_->arena.memoryUsage(), 2 * 10000 * sizeof(int));
+}
+
+
+// FastAlloc as it was before it moved to Arena: a mutex per allocation,
+// and malloc once the first chunk is used up
+struct FastAllocTestMutexImpl {
+  mutex mt;
+  char* begin;
+  char* end;
+  vector<char*> overflows;
+
+  FastAllocTestMutexImpl() {
+    begin = (char*)malloc(256 * 1024);
+    end = begin + 256 * 1024;
+    overflows.push_back(begin);
+  }
+
+  ~FastAllocTestMutexImpl() {
+    for (auto p : overflows) {
+      free(p);
     }
+  }
+};
+
+template <class T>
+class FastAllocTestMutexAlloc {
+ public:
+
+  typedef T value_type;
+
+  FastAllocTestMutexAlloc() : impl_(make_shared<FastAllocTestMutexImpl>()) {}
 
-    auto end = steady_clock::now();
-    auto ms = duration_cast<microseconds>(end - beg).count();
+  template <class U>
+  FastAllocTestMutexAlloc(const FastAllocTestMutexAlloc<U>& other)
+    : impl_(other.impl_) {}
 
-    if (printPerf) {
-      cout << "fast alloc takes " << ms << " microseconds" << endl;
+  T* allocate(size_t n) {
+    lock_guard<mutex> l(impl_->mt);
+    size_t nbytes = (n * sizeof(T) + 7) / 8 * 8;
+    if (impl_->begin + nbytes < impl_->end) {
+      auto ret = impl_->begin;
+      impl_->begin += nbytes;
+      return (T*)ret;
     }
+    auto ret = (char*)malloc(nbytes);
+    impl_->overflows.push_back(ret);
+    return (T*)ret;
   }
 
-  {
-    map<int, int> m;
-    auto beg = steady_clock::now();
+  void deallocate(T* p, size_t n) {}
+
+  shared_ptr<FastAllocTestMutexImpl> impl_;
+};
+
+template <class T, class U>
+bool operator==(const FastAllocTestMutexAlloc<T>& a,
+                const FastAllocTestMutexAlloc<U>& b) {
+  return a.impl_ == b.impl_;
+}
+
+template <class T, class U>
+bool operator!=(const FastAllocTestMutexAlloc<T>& a,
+                const FastAllocTestMutexAlloc<U>& b) {
+  return a.impl_ != b.impl_;
+}
+
+// microseconds to build a map of @num entries and @num small vectors
+// with allocators copied from @alloc
+template <class Alloc>
+static int64_t timeContainers(const Alloc& alloc, int num) {
+  typedef typename allocator_traits<Alloc>::template
+    rebind_alloc<pair<const int, int>> MapAlloc;
+  typedef typename allocator_traits<Alloc>::template
+    rebind_alloc<int> IntAlloc;
 
-    for (int i = 0; i < 4096; ++i) {
+  auto beg = steady_clock::now();
+  {
+    MapAlloc mapAlloc(alloc);
+    map<int, int, less<int>, MapAlloc> m(less<int>(), mapAlloc);
+    for (int i = 0; i < num; ++i) {
       m.insert({i, i});
     }
 
-    auto end = steady_clock::now();
-    auto ms = duration_cast<microseconds>(end - beg).count();
+    vector<vector<int, IntAlloc>> vecs;
+    vecs.reserve(num);
+    for (int i = 0; i < num; ++i) {
+      vecs.emplace_back(IntAlloc(alloc));
+      for (int k = 0; k < 8; ++k) {
+        vecs.back().push_back(k);
+      }
+    }
+    ASSERT_EQ(m.size() + vecs.size(), 2 * num);
+  }
+  return duration_cast<microseconds>(steady_clock::now() - beg).count() + 1;
+}
+
+// malloc, FastAlloc as it was, FastAlloc on Arena, and an Arena that is
+// reset and reused for every round
+TEST(FastAlloc, testPerf) {
+  const int num = printPerf ? 100000 : 1000;
+  const int rounds = printPerf ? 20 : 2;
+
+  int64_t mallocUs = 0;
+  int64_t mutexUs = 0;
+  int64_t fastUs = 0;
+  int64_t arenaUs = 0;
+  int64_t resourceUs = 0;
+  Arena arena;
+  for (int r = 0; r < rounds; ++r) {
+    mallocUs += timeContainers(allocator<char>(), num);
+    mutexUs += timeContainers(FastAllocTestMutexAlloc<char>(), num);
+    fastUs += timeContainers(FastAlloc<char, uint64_t, 256*1024>(), num);
+
+    arena.reset();
+    arenaUs += timeContainers(ArenaAllocator<char>(&arena), num);
+
+#if __cplusplus >= 201703L
+    arena.reset();
+    ArenaResource resource(&arena);
+    resourceUs += timeContainers(
+      pmr::polymorphic_allocator<char>(&resource), num);
+#endif
+  }
 
-    if (printPerf) {
-      cout << "standard alloc takes " << ms << " microseconds" << endl;
+  if (printPerf) {
+    // one allocation per map entry, four per vector of 8 ints, with the
+    // work of the containers included
+    double allocs = (double)rounds * num * 5 / 1000;
+    cout << "container ns per allocation: malloc " << mallocUs / allocs
+         << ", mutex FastAlloc " << mutexUs / allocs
+         << ", FastAlloc " << fastUs / allocs
+         << ", reused Arena " << arenaUs / allocs;
+    if (resourceUs) {
+      cout << ", pmr ArenaResource " << resourceUs / allocs;
     }
+    cout << endl;
   }
 }
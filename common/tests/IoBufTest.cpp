@@ -0,0 +1,144 @@
+#include "common/IoBuf.h"
+#include "common/Serializer.h"
+#include "common/Logging.h"
+#include "common/UnitTest.h"
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace sdb;
+using namespace std;
+
+
+TEST(IoBuf, testAppendAcrossSegments) {
+  IoBuf buf(16);
+  ASSERT_TRUE(buf.empty());
+
+  string s;
+  for (int i = 0; i < 20; ++i) {
+    auto part = to_string(i) + ",";
+    buf.append(part);
+    s += part;
+  }
+
+  ASSERT_EQ(buf.size(), s.size());
+  ASSERT_EQ(buf.getNumSegments(), (s.size() + 15) / 16);
+  ASSERT_EQ(buf.toString(), s);
+}
+
+TEST(IoBuf, testNoCopyOnGrowth) {
+  IoBuf buf(16);
+  buf.append(string(16, 'a'));
+
+  struct iovec iov[4];
+  ASSERT_EQ(buf.fillIov(iov, 4), 1);
+  auto first = iov[0].iov_base;
+
+  // bytes already in the chain stay where they are
+  buf.append(string(100, 'b'));
+  ASSERT_EQ(buf.fillIov(iov, 4), 4);
+  ASSERT_TRUE(iov[0].iov_base == first);
+}
+
+TEST(IoBuf, testPrepend) {
+  IoBuf buf;
+  buf.append(string("body"));
+
+  string len("0004");
+  buf.prepend(Range(len));
+  string type("T:");
+  buf.prepend(Range(type));
+
+  ASSERT_EQ(buf.size(), 10);
+  ASSERT_EQ(buf.toString(), "T:0004body");
+
+  // both headers went into one segment in front of the body
+  ASSERT_EQ(buf.getNumSegments(), 2);
+}
+
+TEST(IoBuf, testSplit) {
+  IoBuf buf(8);
+  buf.append(string("0123456789abcdefghij"));
+
+  auto head = buf.split(12);
+  ASSERT_EQ(head.size(), 12);
+  ASSERT_EQ(buf.size(), 8);
+  ASSERT_EQ(head.toString(), "0123456789ab");
+  ASSERT_EQ(buf.toString(), "cdefghij");
+
+  // the shared segment is not written to by either chain
+  head.append(string("XY"));
+  buf.append(string("Z"));
+  ASSERT_EQ(head.toString(), "0123456789abXY");
+  ASSERT_EQ(buf.toString(), "cdefghijZ");
+
+  ASSERT_EQ(buf.skip(3), 3);
+  ASSERT_EQ(buf.toString(), "fghijZ");
+  ASSERT_EQ(buf.skip(100), 6);
+  ASSERT_TRUE(buf.empty());
+}
+
+TEST(IoBuf, testShareAndChain) {
+  IoBuf a(8);
+  a.append(string("hello world"));
+
+  IoBuf b(a);
+  b.append(string("!"));
+  ASSERT_EQ(a.toString(), "hello world");
+  ASSERT_EQ(b.toString(), "hello world!");
+
+  IoRange r;
+  r.append(string(" again"));
+  b.append(move(r));
+  a.append(move(b));
+  ASSERT_TRUE(b.empty());
+  ASSERT_EQ(a.toString(), "hello worldhello world! again");
+}
+
+TEST(IoBuf, testCoalesce) {
+  IoBuf buf(4);
+  buf.append(string("abcdefghij"));
+  ASSERT_GT(buf.getNumSegments(), 1);
+
+  auto range = buf.coalesce();
+  ASSERT_EQ(range.toString(), "abcdefghij");
+  ASSERT_EQ(buf.getNumSegments(), 1);
+
+  // parse a message that was serialized across segments
+  IoBuf msg(4);
+  vector<string> val{"one", "two", "three"};
+  Serializer<vector<string>>().append(msg, val);
+  ASSERT_GT(msg.getNumSegments(), 1);
+
+  auto input = msg.coalesce();
+  vector<string> ret;
+  ASSERT_TRUE(Deserializer<vector<string>>().parse(input, ret));
+  ASSERT_TRUE(ret == val);
+  ASSERT_EQ(input.size(), 0);
+}
+
+TEST(IoBuf, testReadv) {
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  string data(100, 'x');
+  ASSERT_EQ(write(fds[1], data.data(), data.size()), 100);
+
+  IoBuf buf(32);
+  buf.append(string("head"));
+
+  struct iovec iov[8];
+  int num = buf.prepareRead(iov, 8, 200);
+  ASSERT_GT(num, 1);
+  auto n = readv(fds[0], iov, num);
+  ASSERT_EQ(n, 100);
+  buf.commit(n);
+
+  ASSERT_EQ(buf.size(), 104);
+  ASSERT_TRUE(buf.toString() == "head" + data);
+
+  // segments the read did not reach are dropped
+  ASSERT_EQ(buf.getNumSegments(), 4);
+
+  close(fds[0]);
+  close(fds[1]);
+}
@@ -0,0 +1,171 @@
+#include "common/MemoryProvider.h"
+#include "common/Arena.h"
+#include "common/BufferPool.h"
+#include "common/Range.h"
+#include "common/Logging.h"
+#include "common/UnitTest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string.h>
+#include <stdlib.h>
+
+using namespace sdb;
+using namespace std;
+using namespace std::chrono;
+
+// enable this if you want to print out perf info
+const bool printPerf = false;
+
+
+TEST(MemoryProvider, testMap) {
+  MemoryProvider provider;
+  auto region = provider.map(1);
+  ASSERT_EQ(region.size, MemoryProvider::kHugePageSize);
+  ASSERT_EQ((uintptr_t)region.addr % MemoryProvider::kHugePageSize, 0);
+  memset(region.addr, 'x', region.size);
+
+  auto stats = provider.getStats();
+  ASSERT_EQ(stats.bytesMapped, region.size);
+  if (region.flags & MemoryProvider::page_transparent) {
+    ASSERT_EQ(stats.bytesTransparent, region.size);
+  }
+
+  // hugetlb pages are only there if the system reserved some
+  if (!(region.flags & MemoryProvider::page_hugetlb)) {
+    ASSERT_GE(stats.numFallbacks, 1);
+  }
+
+  auto large = provider.map(MemoryProvider::kHugePageSize + 1);
+  ASSERT_EQ(large.size, 2 * MemoryProvider::kHugePageSize);
+  ASSERT_EQ((uintptr_t)large.addr % MemoryProvider::kHugePageSize, 0);
+
+  provider.unmap(region);
+  provider.unmap(large);
+  stats = provider.getStats();
+  ASSERT_EQ(stats.bytesMapped, 0);
+  ASSERT_EQ(stats.bytesTransparent, 0);
+  ASSERT_EQ(stats.bytesLocal, 0);
+}
+
+TEST(MemoryProvider, testOptions) {
+  ASSERT_GE(MemoryProvider::currentNode(), 0);
+
+  MemoryProvider plain(0);
+  auto region = plain.map(100);
+  ASSERT_EQ(region.flags, 0);
+  ASSERT_EQ(plain.getStats().numFallbacks, 0);
+  plain.unmap(region);
+
+  MemoryProvider local(MemoryProvider::numa_local);
+  region = local.map(100);
+  ASSERT_EQ(region.flags, MemoryProvider::numa_local);
+  ASSERT_EQ(local.getStats().bytesLocal, region.size);
+  local.unmap(region);
+}
+
+TEST(MemoryProvider, testArena) {
+  MemoryProvider provider;
+  {
+    Arena arena(4096, 8, &provider);
+    ASSERT_EQ(arena.memoryUsage(), MemoryProvider::kHugePageSize);
+
+    // the first chunk is a whole huge page
+    vector<char*> ptrs;
+    for (int i = 0; i < 1000; ++i) {
+      ptrs.push_back((char*)arena.allocate(1024));
+      memset(ptrs.back(), 'a', 1024);
+    }
+    ASSERT_EQ(arena.memoryUsage(), MemoryProvider::kHugePageSize);
+
+    auto big = (char*)arena.allocate(3 * MemoryProvider::kHugePageSize);
+    memset(big, 'b', 3 * MemoryProvider::kHugePageSize);
+    ASSERT_EQ(provider.getStats().bytesMapped, arena.memoryUsage());
+  }
+  ASSERT_EQ(provider.getStats().bytesMapped, 0);
+}
+
+TEST(MemoryProvider, testBufferPool) {
+  FORK {
+    auto provider = new MemoryProvider;
+    BufferPool::setMemoryProvider(provider);
+
+    vector<void*> bufs;
+    for (int i = 0; i < 100; ++i) {
+      bufs.push_back(BufferPool::allocate(64 * 1024));
+      memset(bufs.back(), 'c', 64 * 1024);
+    }
+    ASSERT_GE(provider->getStats().bytesMapped, 100 * 64 * 1024);
+
+    // buffers above the largest class still come from malloc
+    auto mapped = provider->getStats().bytesMapped;
+    auto huge = BufferPool::allocate(4 * 1024 * 1024);
+    ASSERT_EQ(provider->getStats().bytesMapped, mapped);
+    BufferPool::deallocate(huge, 4 * 1024 * 1024);
+
+    for (auto p : bufs) {
+      BufferPool::deallocate(p, 64 * 1024);
+    }
+
+    // freed buffers are kept and reused
+    BufferPool::flushThreadCache();
+    for (int i = 0; i < 100; ++i) {
+      BufferPool::deallocate(BufferPool::allocate(64 * 1024), 64 * 1024);
+    }
+    ASSERT_EQ(provider->getStats().bytesMapped, mapped);
+
+    // and so do IoRange buffers
+    IoRange ioRange(128 * 1024);
+    ioRange.append(string(1000, 'd'));
+    ASSERT_EQ(ioRange.getRange().size(), 1000);
+  };
+}
+
+// follow a random cycle through @slots cache lines at @base, return the
+// nanoseconds per step
+static double chaseNs(char* base, size_t slots) {
+  vector<uint32_t> order(slots);
+  for (size_t i = 0; i < slots; ++i) {
+    order[i] = i;
+  }
+  shuffle(order.begin() + 1, order.end(), mt19937(17));
+  for (size_t i = 0; i < slots; ++i) {
+    *(char**)(base + (size_t)order[i] * 64) =
+      base + (size_t)order[(i + 1) % slots] * 64;
+  }
+
+  const size_t steps = printPerf ? 20000000 : 10000;
+  auto p = base;
+  auto beg = steady_clock::now();
+  for (size_t i = 0; i < steps; ++i) {
+    p = *(char**)p;
+  }
+  auto ns = duration_cast<nanoseconds>(steady_clock::now() - beg).count();
+  ASSERT_TRUE(p != nullptr);
+  return (double)ns / steps;
+}
+
+// random reads over a table much larger than the TLB covers, on 4KB
+// pages from malloc and on huge pages from a provider
+TEST(MemoryProvider, testPerf) {
+  FORK {
+    const size_t bytes = printPerf ? (1UL << 30) : (4UL << 20);
+
+    auto table = (char*)malloc(bytes);
+    auto mallocNs = chaseNs(table, bytes / 64);
+    free(table);
+
+    MemoryProvider provider;
+    auto region = provider.map(bytes);
+    auto providerNs = chaseNs((char*)region.addr, bytes / 64);
+
+    if (printPerf) {
+      cout << "ns per random read of " << (bytes >> 20) << "MB: malloc "
+           << mallocNs << ", provider " << providerNs << " (flags "
+           << region.flags << ")" << endl;
+    }
+    provider.unmap(region);
+  };
+}
@@ -0,0 +1,86 @@
+#include "common/MpscQueue.h"
+#include "common/Logging.h"
+#include "common/UnitTest.h"
+
+#include <vector>
+#include <thread>
+#include <memory>
+
+using namespace sdb;
+using namespace std;
+
+
+TEST(MpscQueue, testFifo) {
+  MpscQueue<int> q;
+  int val = 0;
+
+  ASSERT_FALSE(q.pop(val));
+
+  for (int i = 0; i < 100; ++i) {
+    q.push(int(i));
+  }
+
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_TRUE(q.pop(val));
+    ASSERT_EQ(val, i);
+  }
+
+  ASSERT_FALSE(q.pop(val));
+
+  // the queue is reusable after being drained
+  q.push(7);
+  ASSERT_TRUE(q.pop(val));
+  ASSERT_EQ(val, 7);
+}
+
+TEST(MpscQueue, testMoveOnly) {
+  MpscQueue<unique_ptr<int>> q;
+  q.push(unique_ptr<int>(new int(5)));
+  q.push(unique_ptr<int>(new int(6)));
+
+  unique_ptr<int> p;
+  ASSERT_TRUE(q.pop(p));
+  ASSERT_EQ(*p, 5);
+}
+
+TEST(MpscQueue, testMultiProducers) {
+  FORK {
+    const int numProducers = 4;
+    const int perProducer = 10000;
+
+    MpscQueue<int64_t> q;
+    vector<thread> producers;
+
+    for (int i = 0; i < numProducers; ++i) {
+      producers.emplace_back([&q, i]() {
+        for (int j = 0; j < perProducer; ++j) {
+          q.push((int64_t)i * perProducer + j);
+        }
+      });
+    }
+
+    // items of one producer must come out in order
+    vector<int64_t> last(numProducers, -1);
+    int received = 0;
+
+    while (received < numProducers * perProducer) {
+      int64_t val = 0;
+      if (!q.pop(val)) {
+        this_thread::yield();
+        continue;
+      }
+
+      int producer = val / perProducer;
+      ASSERT_GT(val, last[producer]);
+      last[producer] = val;
+      ++received;
+    }
+
+    for (auto& t : producers) {
+      t.join();
+    }
+
+    int64_t val = 0;
+    ASSERT_FALSE(q.pop(val));
+  };
+}
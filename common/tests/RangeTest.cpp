@@ -2,8 +2,17 @@
 #include "common/Logging.h"
 #include "common/UnitTest.h"
 
+#include <string.h>
+#include <stdlib.h>
+#include <chrono>
+#include <unordered_set>
+
 using namespace sdb;
 using namespace std;
+using namespace std::chrono;
+
+// enable this if you want to print out perf info
+const bool printPerf = false;
 
 
 TEST(Range, testSimpleRange) {
@@ -131,3 +140,229 @@ TEST(Range, testResizeIoRange) {
   ASSERT_TRUE(bigRange == Range(big));
 }
 
+
+TEST(Range, testResizeAfterRead) {
+  string big(40000, 'b');
+
+  IoRange ioRange;
+  ioRange.append(string("head"));
+  ioRange.read(2);
+  ioRange.append(big);
+
+  ASSERT_TRUE(ioRange.read(2).toString() == "ad");
+  ASSERT_TRUE(ioRange.getRange() == Range(big));
+}
+
+TEST(Range, testSharedIoRange) {
+  IoRange ioRange;
+  ioRange.append(string("hello"));
+
+  {
+    IoRange copy(ioRange);
+    ASSERT_TRUE(copy.getRange().toString() == "hello");
+  }
+
+  // the buffer outlives the copy
+  ASSERT_TRUE(ioRange.getRange().toString() == "hello");
+
+  IoRange moved(std::move(ioRange));
+  ASSERT_TRUE(moved.getRange().toString() == "hello");
+}
+
+TEST(Range, testGrowSharedIoRange) {
+  IoRange ioRange(16);
+  ioRange.append(string("hello"));
+  ioRange.skip(1);
+
+  IoRange pinned(ioRange);
+  auto beg = pinned.begin();
+
+  // the writer moves to a larger buffer, the other one stays in place
+  string big(1000, 'b');
+  ioRange.append(big);
+  ASSERT_TRUE(ioRange.getRange().toString() == "ello" + big);
+  ASSERT_TRUE(pinned.begin() == beg);
+  ASSERT_TRUE(pinned.getRange().toString() == "ello");
+  ASSERT_TRUE(ioRange.unique());
+  ASSERT_TRUE(pinned.unique());
+}
+
+TEST(Range, testReserveCommit) {
+  IoRange ioRange;
+  ioRange.append(string("abc"));
+  ioRange.reserve(100000);
+  ASSERT_GE(ioRange.tailroom(), 100000);
+
+  // write directly after end(), e.g. with read(2)
+  memcpy(ioRange.end(), "def", 3);
+  ioRange.commit(3);
+  ASSERT_TRUE(ioRange.getRange().toString() == "abcdef");
+}
+
+// random bytes from a small alphabet, so that searches find partial
+// matches
+static string randomBytes(size_t size, int alphabet) {
+  string ret(size, 0);
+  for (auto& c : ret) {
+    c = (char)(0x7e + rand() % alphabet);
+  }
+  return ret;
+}
+
+TEST(Range, testCompare) {
+  srand(12);
+  for (int i = 0; i < 10000; ++i) {
+    auto s1 = randomBytes(rand() % 40, 3);
+    auto s2 = randomBytes(rand() % 40, 3);
+    if (i % 2) {
+      // a long common prefix
+      s2 = s1.substr(0, rand() % (s1.size() + 1)) + s2;
+    }
+
+    Range r1(s1);
+    Range r2(s2);
+    auto expected = s1.compare(s2);
+    auto ret = r1.compare(r2);
+    ASSERT_TRUE((ret < 0) == (expected < 0));
+    ASSERT_TRUE((ret == 0) == (expected == 0));
+    ASSERT_EQ(r1 < r2, s1 < s2);
+    ASSERT_EQ(r1 == r2, s1 == s2);
+  }
+}
+
+TEST(Range, testFindKernels) {
+  srand(34);
+  for (int i = 0; i < 2000; ++i) {
+    auto hay = randomBytes(rand() % 300, 4);
+    auto needle = randomBytes(rand() % 6, 4);
+    if (i % 3 == 0 && hay.size() > 0) {
+      auto pos = rand() % hay.size();
+      needle = hay.substr(pos, rand() % 70);
+    }
+
+    Range main(hay);
+    Range sub(needle);
+    auto pos = hay.find(needle);
+    auto it = main.find(sub);
+    if (pos == string::npos) {
+      ASSERT_TRUE(it == main.end());
+    } else {
+      ASSERT_EQ(it - main.begin(), pos);
+    }
+  }
+}
+
+TEST(Range, testHash) {
+  string s("hello, world");
+  Range r1(s);
+  string copy(s);
+  Range r2(copy);
+  ASSERT_EQ(r1.hash(), r2.hash());
+  ASSERT_TRUE(r1.hash() != r1.hash(1));
+  ASSERT_EQ(std::hash<Range>()(r1), r1.hash());
+
+  // keys that differ in one byte or in length
+  unordered_set<uint64_t> hashes;
+  string key(100, 'k');
+  for (int len = 0; len <= 100; ++len) {
+    for (int pos = 0; pos < len; ++pos) {
+      auto k = key.substr(0, len);
+      k[pos] = 'x';
+      hashes.insert(Range(k).hash());
+    }
+    auto k = key.substr(0, len);
+    hashes.insert(Range(k).hash());
+  }
+  ASSERT_EQ(hashes.size(), 101 * 100 / 2 + 101);
+}
+
+TEST(Range, testSwapBytes) {
+  for (int width : {2, 4, 8}) {
+    for (int num : {0, 1, 7, 8, 33, 1000}) {
+      string src;
+      for (int i = 0; i < num * width; ++i) {
+        src.push_back((char)(i * 7 + width));
+      }
+
+      string dst(src.size(), 0);
+      swapBytes(&dst[0], src.data(), num, width);
+      for (int i = 0; i < num; ++i) {
+        for (int j = 0; j < width; ++j) {
+          ASSERT_EQ(dst[i * width + j], src[i * width + width - 1 - j]);
+        }
+      }
+
+      // in place
+      swapBytes(&dst[0], dst.data(), num, width);
+      ASSERT_TRUE(dst == src);
+    }
+  }
+}
+
+
+// the byte by byte templates the char kernels replaced
+static bool lessTemplate(const Range& a, const Range& b) {
+  return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end());
+}
+
+static const char* findTemplate(const Range& a, const Range& b) {
+  return std::search(a.begin(), a.end(), b.begin(), b.end());
+}
+
+// FNV-1a, a byte at a time
+static uint64_t hashTemplate(const Range& a) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (auto c : a) {
+    h = (h ^ (unsigned char)c) * 0x100000001b3ull;
+  }
+  return h;
+}
+
+// nanoseconds per call of @fn
+template <class Fn>
+static double nsPerCall(int num, Fn fn) {
+  auto beg = steady_clock::now();
+  for (int i = 0; i < num; ++i) {
+    fn();
+  }
+  auto ns = duration_cast<nanoseconds>(steady_clock::now() - beg).count();
+  return (double)ns / num;
+}
+
+TEST(Range, testPerf) {
+  volatile int64_t sink = 0;
+
+  for (int len = 8; len <= 4096; len *= 2) {
+    const int num = printPerf ? 20000000 / len + 1000 : 10;
+
+    // keys that differ in their last byte
+    string k1(len, 'k');
+    string k2(len, 'k');
+    k2[len - 1] = 'l';
+    Range r1(k1);
+    Range r2(k2);
+
+    auto lessOld = nsPerCall(num, [&]() { sink += lessTemplate(r1, r2); });
+    auto lessNew = nsPerCall(num, [&]() { sink += (r1 < r2); });
+
+    // a needle that only matches at the very end
+    string hay = randomBytes(len, 4) + "needle!";
+    string needle("needle!");
+    Range h(hay);
+    Range n(needle);
+
+    auto findOld = nsPerCall(num, [&]() {
+      sink += findTemplate(h, n) - h.begin();
+    });
+    auto findNew = nsPerCall(num, [&]() { sink += h.find(n) - h.begin(); });
+
+    auto hashOld = nsPerCall(num, [&]() { sink += hashTemplate(r1); });
+    auto hashNew = nsPerCall(num, [&]() { sink += r1.hash(); });
+
+    if (printPerf) {
+      cout << "key length " << len << ": compare " << lessOld << " -> "
+           << lessNew << " ns, find " << findOld << " -> " << findNew
+           << " ns, hash " << hashOld << " -> " << hashNew << " ns" << endl;
+    }
+  }
+}
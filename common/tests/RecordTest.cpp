@@ -0,0 +1,324 @@
+#include "common/Record.h"
+#include "common/Serializer.h"
+#include "common/Range.h"
+#include "common/Logging.h"
+#include "common/UnitTest.h"
+
+#include <chrono>
+
+using namespace std;
+using namespace sdb;
+using namespace std::chrono;
+
+// enable this if you want to print out perf info
+const bool printPerf = false;
+
+
+// two versions of a record, as an old and a new binary would see it
+struct RecordTestAddress {
+  string city;
+  int32_t zip;
+};
+
+SDB_RECORD(RecordTestAddress, (1, city), (2, zip))
+
+struct RecordTestUserV1 {
+  int32_t uid;
+  string name;
+  vector<int32_t> scores;
+};
+
+SDB_RECORD(RecordTestUserV1, (1, uid), (2, name), (3, scores))
+
+// uid widened, scores gone, three fields added
+struct RecordTestUserV2 {
+  int64_t uid;
+  string name;
+  double weight;
+  map<string, string> tags;
+  RecordTestAddress address;
+};
+
+SDB_RECORD(RecordTestUserV2,
+           (1, uid), (2, name), (4, weight), (5, tags), (6, address))
+
+// the same message as a record and in the positional format
+struct RecordTestMessage {
+  int64_t id;
+  string name;
+  vector<int64_t> values;
+  map<string, int64_t> attrs;
+  double score;
+  int32_t flags;
+};
+
+SDB_INDEXED_RECORD(RecordTestMessage, (1, id), (2, name), (3, values),
+                   (4, attrs), (5, score), (6, flags))
+
+struct RecordTestPositional {
+  int64_t id;
+  string name;
+  vector<int64_t> values;
+  map<string, int64_t> attrs;
+  double score;
+  int32_t flags;
+};
+
+SDB_SERIALIZABLE(RecordTestPositional, id, name, values, attrs, score, flags)
+
+static RecordTestMessage makeMessage(int num) {
+  RecordTestMessage msg;
+  msg.id = 1234567;
+  msg.name = "message " + to_string(num);
+  for (int i = 0; i < num; ++i) {
+    msg.values.push_back(i * 1000);
+    msg.attrs["attr " + to_string(i)] = i;
+  }
+  msg.score = 0.75;
+  msg.flags = 3;
+  return msg;
+}
+
+static RecordTestPositional toPositional(const RecordTestMessage& msg) {
+  return {msg.id, msg.name, msg.values, msg.attrs, msg.score, msg.flags};
+}
+
+TEST(Record, testRoundTrip) {
+  RecordTestUserV2 user{-7, "alice", 61.5, {{"k", "v"}}, {"paris", 75001}};
+  IoRange ioRange;
+  serializeTo(ioRange, user);
+  ASSERT_EQ(ioRange.getRange().size(),
+            Serializer<RecordTestUserV2>().sizeOf(user));
+
+  // containers in varints, which the reader finds out by itself
+  IoRange varint;
+  serializeTo<VarintWire>(varint, user);
+  ASSERT_TRUE(varint.getRange().size() < ioRange.getRange().size());
+  auto range = varint.getRange();
+  RecordTestUserV2 ret{};
+  ASSERT_TRUE(Deserializer<RecordTestUserV2>().parse(range, ret));
+  ASSERT_TRUE(ret.tags == user.tags);
+  ASSERT_EQ(ret.address.zip, 75001);
+
+  ioRange.append(string("tail"));
+  range = ioRange.getRange();
+  ret = RecordTestUserV2{};
+  ASSERT_TRUE(Deserializer<RecordTestUserV2>().parse(range, ret));
+  ASSERT_EQ(range.toString(), "tail");
+  ASSERT_EQ(ret.uid, -7);
+  ASSERT_EQ(ret.name, "alice");
+  ASSERT_EQ(ret.weight, 61.5);
+  ASSERT_TRUE(ret.tags == user.tags);
+  ASSERT_EQ(ret.address.city, "paris");
+  ASSERT_EQ(ret.address.zip, 75001);
+
+  range = ioRange.getRange();
+  ASSERT_TRUE(Deserializer<RecordTestUserV2>().skip(range));
+  ASSERT_EQ(range.toString(), "tail");
+
+  // in containers
+  vector<RecordTestAddress> addrs{{"a", 1}, {"bb", 2}};
+  IoRange list;
+  serializeTo(list, addrs);
+  range = list.getRange();
+  vector<RecordTestAddress> addrsRet;
+  ASSERT_TRUE(Deserializer<vector<RecordTestAddress>>().parse(
+    range, addrsRet));
+  ASSERT_EQ(addrsRet.size(), 2);
+  ASSERT_EQ(addrsRet[1].city, "bb");
+  ASSERT_EQ(addrsRet[1].zip, 2);
+}
+
+TEST(Record, testOldToNew) {
+  RecordTestUserV1 old{42, "bob", {1, 2, 3}};
+  IoRange ioRange;
+  serializeTo(ioRange, old);
+
+  // scores are skipped, the new fields keep their defaults
+  auto range = ioRange.getRange();
+  RecordTestUserV2 user{0, "", -1.0, {}, {"none", 0}};
+  ASSERT_TRUE(Deserializer<RecordTestUserV2>().parse(range, user));
+  ASSERT_EQ(range.size(), 0);
+  ASSERT_EQ(user.uid, 42);
+  ASSERT_EQ(user.name, "bob");
+  ASSERT_EQ(user.weight, -1.0);
+  ASSERT_EQ(user.address.city, "none");
+}
+
+TEST(Record, testNewToOld) {
+  RecordTestUserV2 user{1LL << 20, "carol", 55.0, {{"a", "b"}},
+                        {"rome", 100}};
+  IoRange ioRange;
+  serializeTo(ioRange, user);
+
+  // the fields an old reader does not know are skipped
+  auto range = ioRange.getRange();
+  RecordTestUserV1 old{0, "", {9}};
+  ASSERT_TRUE(Deserializer<RecordTestUserV1>().parse(range, old));
+  ASSERT_EQ(range.size(), 0);
+  ASSERT_EQ(old.uid, 1 << 20);
+  ASSERT_EQ(old.name, "carol");
+  ASSERT_EQ(old.scores.size(), 1);
+
+  // a widened value that no longer fits fails
+  user.uid = 1LL << 40;
+  IoRange large;
+  serializeTo(large, user);
+  range = large.getRange();
+  ASSERT_FALSE(Deserializer<RecordTestUserV1>().parse(range, old));
+}
+
+TEST(Record, testBadRecords) {
+  RecordTestUserV1 old{42, "bob", {1, 2, 3}};
+  IoRange ioRange;
+  serializeTo(ioRange, old);
+  string bytes = ioRange.getRange().toString();
+  RecordTestUserV1 ret;
+
+  // truncated
+  for (int i = 0; i < bytes.size(); ++i) {
+    string cut = bytes.substr(0, i);
+    Range range(cut);
+    ASSERT_FALSE(Deserializer<RecordTestUserV1>().parse(range, ret));
+    range = Range(cut);
+    ASSERT_FALSE(Deserializer<RecordTestUserV1>().skip(range));
+  }
+
+  // uid with the wire type of a double
+  string wrong = bytes;
+  ASSERT_EQ(wrong[2], (char)recordKey(1, record_varint));
+  wrong[2] = (char)recordKey(1, record_fixed64);
+  Range range(wrong);
+  ASSERT_FALSE(Deserializer<RecordTestUserV1>().parse(range, ret));
+
+  // an unknown wire type can not be skipped
+  wrong[2] = (char)recordKey(9, 7);
+  range = Range(wrong);
+  ASSERT_FALSE(Deserializer<RecordTestUserV1>().parse(range, ret));
+
+  // an offset table larger than the record
+  string table = bytes;
+  table[1] |= record_has_table;
+  range = Range(table);
+  ASSERT_FALSE(Deserializer<RecordTestUserV1>().parse(range, ret));
+}
+
+TEST(Record, testReader) {
+  auto msg = makeMessage(10);
+  IoRange indexed;
+  serializeTo(indexed, msg);
+
+  RecordTestUserV2 user{5, "dave", 70.0, {}, {"oslo", 150}};
+  IoRange plain;
+  serializeTo<VarintWire>(plain, user);
+
+  for (auto ioRange : {&indexed, &plain}) {
+    auto range = ioRange->getRange();
+    RecordReader reader;
+    ASSERT_TRUE(Deserializer<RecordReader>().parse(range, reader));
+    ASSERT_EQ(range.size(), 0);
+    ASSERT_EQ(reader.hasTable(), ioRange == &indexed);
+
+    string name;
+    ASSERT_TRUE(reader.get(2, name));
+    ASSERT_EQ(name, ioRange == &indexed ? msg.name : user.name);
+    int64_t id = 0;
+    ASSERT_TRUE(reader.get(1, id));
+    ASSERT_EQ(id, ioRange == &indexed ? msg.id : user.uid);
+    ASSERT_FALSE(reader.get(3, id));
+    ASSERT_FALSE(reader.get(100, id));
+  }
+
+  RecordReader reader;
+  auto range = indexed.getRange();
+  ASSERT_TRUE(reader.parse(range));
+  vector<int64_t> values;
+  ASSERT_TRUE(reader.get(3, values));
+  ASSERT_TRUE(values == msg.values);
+  int32_t flags = 0;
+  ASSERT_TRUE(reader.get(6, flags));
+  ASSERT_EQ(flags, 3);
+
+  // a nested record read in place
+  range = plain.getRange();
+  ASSERT_TRUE(reader.parse(range));
+  RecordReader address;
+  ASSERT_TRUE(reader.get(6, address));
+  string city;
+  ASSERT_TRUE(address.get(1, city));
+  ASSERT_EQ(city, "oslo");
+}
+
+// the record format against the positional one, and a lookup of two
+// fields against a full parse
+TEST(Record, testPerf) {
+  const int num = printPerf ? 100000 : 100;
+  auto msg = makeMessage(20);
+  auto positional = toPositional(msg);
+
+  // on the default wire, as the positional format
+  IoRange recordBytes;
+  serializeTo(recordBytes, msg);
+  IoRange positionalBytes;
+  serializeTo(positionalBytes, positional);
+
+  // the best of a few rounds, taken in turns so that noise hits all
+  const int numRounds = 5;
+  auto timeUs = [num](std::function<void()> fn, int64_t& best) {
+    auto beg = steady_clock::now();
+    for (int i = 0; i < num; ++i) {
+      fn();
+    }
+    auto us =
+      duration_cast<microseconds>(steady_clock::now() - beg).count() + 1;
+    best = best ? min<int64_t>(best, us) : us;
+  };
+
+  int64_t positionalEncode = 0;
+  int64_t recordEncode = 0;
+  int64_t positionalDecode = 0;
+  int64_t recordDecode = 0;
+  int64_t lookup = 0;
+  for (int round = 0; round < numRounds; ++round) {
+    timeUs([&positional]() {
+      IoRange ioRange;
+      serializeTo(ioRange, positional);
+    }, positionalEncode);
+    timeUs([&msg]() {
+      IoRange ioRange;
+      serializeTo(ioRange, msg);
+    }, recordEncode);
+
+    timeUs([&positionalBytes]() {
+      auto range = positionalBytes.getRange();
+      RecordTestPositional ret;
+      ASSERT_TRUE(Deserializer<RecordTestPositional>().parse(range, ret));
+    }, positionalDecode);
+    timeUs([&recordBytes]() {
+      auto range = recordBytes.getRange();
+      RecordTestMessage ret;
+      ASSERT_TRUE(Deserializer<RecordTestMessage>().parse(range, ret));
+    }, recordDecode);
+    timeUs([&recordBytes]() {
+      auto range = recordBytes.getRange();
+      RecordReader reader;
+      int32_t flags = 0;
+      double score = 0;
+      ASSERT_TRUE(reader.parse(range));
+      ASSERT_TRUE(reader.get(6, flags) && reader.get(5, score));
+    }, lookup);
+  }
+
+  if (printPerf) {
+    cout << "bytes: positional " << positionalBytes.getRange().size()
+         << ", record " << recordBytes.getRange().size() << endl;
+    cout << "encode messages/s: positional "
+         << (int64_t)num * 1000000 / positionalEncode
+         << ", record " << (int64_t)num * 1000000 / recordEncode << endl;
+    cout << "decode messages/s: positional "
+         << (int64_t)num * 1000000 / positionalDecode
+         << ", record " << (int64_t)num * 1000000 / recordDecode
+         << ", two fields by id " << (int64_t)num * 1000000 / lookup
+         << endl;
+  }
+}
@@ -1,10 +1,49 @@
 #include "common/Serializer.h"
 #include "common/Range.h"
+#include "common/IoBuf.h"
 #include "common/Logging.h"
 #include "common/UnitTest.h"
 
+#include <chrono>
+#include <functional>
+
 using namespace std;
 using namespace sdb;
+using namespace std::chrono;
+
+// enable this if you want to print out perf info
+const bool printPerf = false;
+
+
+// messages with generated serializers
+struct SerializerTestPoint {
+  int32_t x;
+  int32_t y;
+  double weight;
+};
+
+SDB_SERIALIZABLE(SerializerTestPoint, x, y, weight)
+
+struct SerializerTestShape {
+  string name;
+  vector<SerializerTestPoint> points;
+  map<string, int64_t> tags;
+  bool closed;
+};
+
+SDB_SERIALIZABLE(SerializerTestShape, name, points, tags, closed)
+
+static SerializerTestShape makeShape(int numPoints) {
+  SerializerTestShape shape;
+  shape.name = "shape " + to_string(numPoints);
+  for (int i = 0; i < numPoints; ++i) {
+    shape.points.push_back({i, -i, i * 0.5});
+  }
+  shape.tags["color"] = 3;
+  shape.tags["layer"] = numPoints;
+  shape.closed = (numPoints % 2 == 0);
+  return shape;
+}
 
 
 TEST(Serializer, testProcessChar) {
@@ -463,3 +502,366 @@ TEST(Serializer, testProcessTuple) {
   }
 }
 #endif
+
+TEST(Serializer, testAppendToIoBuf) {
+  map<string, int64_t> val{{"a", 1}, {"b", 2}, {string(100, 'c'), 3}};
+
+  IoRange ioRange;
+  Serializer<map<string, int64_t>>().append(ioRange, val);
+
+  IoBuf buf(16);
+  Serializer<map<string, int64_t>>().append(buf, val);
+  ASSERT_GT(buf.getNumSegments(), 1);
+  ASSERT_EQ(buf.toString(), ioRange.getRange().toString());
+}
+
+TEST(Serializer, testFixedSize) {
+  ASSERT_EQ(FixedSize<int32_t>::value, 4);
+  ASSERT_EQ(FixedSize<string>::value, 0);
+  ASSERT_EQ((FixedSize<pair<int64_t, char>>::value), 9);
+  ASSERT_EQ((FixedSize<tuple<int16_t, string>>::value), 0);
+  ASSERT_EQ(FixedSize<SerializerTestPoint>::value, 16);
+  ASSERT_EQ(FixedSize<SerializerTestShape>::value, 0);
+
+  vector<SerializerTestPoint> points(10);
+  ASSERT_EQ(Serializer<vector<SerializerTestPoint>>().sizeOf(points), 164);
+}
+
+TEST(Serializer, testSerializableStruct) {
+  auto shape = makeShape(5);
+
+  IoRange ioRange;
+  Serializer<SerializerTestShape>().append(ioRange, shape);
+  auto range = ioRange.getRange();
+  ASSERT_EQ(range.size(), Serializer<SerializerTestShape>().sizeOf(shape));
+
+  SerializerTestShape ret;
+  ASSERT_TRUE(Deserializer<SerializerTestShape>().parse(range, ret));
+  ASSERT_EQ(range.size(), 0);
+  ASSERT_EQ(ret.name, shape.name);
+  ASSERT_EQ(ret.points.size(), 5);
+  ASSERT_EQ(ret.points[3].y, -3);
+  ASSERT_EQ(ret.points[3].weight, 1.5);
+  ASSERT_TRUE(ret.tags == shape.tags);
+  ASSERT_EQ(ret.closed, false);
+
+  range = ioRange.getRange();
+  ASSERT_TRUE(Deserializer<SerializerTestShape>().skip(range));
+  ASSERT_EQ(range.size(), 0);
+
+  // a truncated message does not parse
+  auto cut = ioRange.getRange();
+  cut.pop_back(3);
+  ASSERT_FALSE(Deserializer<SerializerTestShape>().parse(cut, ret));
+}
+
+TEST(Serializer, testSerializeTo) {
+  vector<SerializerTestShape> shapes;
+  for (int i = 0; i < 20; ++i) {
+    shapes.push_back(makeShape(i * 100));
+  }
+
+  IoRange piecewise;
+  Serializer<vector<SerializerTestShape>>().append(piecewise, shapes);
+
+  IoRange onePass;
+  onePass.append(string("header"));
+  serializeTo(onePass, shapes);
+  ASSERT_TRUE(onePass.getRange().toString() ==
+              "header" + piecewise.getRange().toString());
+
+  IoRange point;
+  serializeTo(point, shapes[3].points[1]);
+  ASSERT_EQ(point.getRange().size(), 16);
+}
+
+TEST(Serializer, testPerf) {
+  const int num = printPerf ? 20000 : 20;
+  auto shape = makeShape(200);
+  int64_t bytes = 0;
+
+  auto beg = steady_clock::now();
+  for (int i = 0; i < num; ++i) {
+    IoRange ioRange;
+    Serializer<SerializerTestShape>().append(ioRange, shape);
+    bytes += ioRange.getRange().size();
+  }
+  auto piecewiseUs =
+    duration_cast<microseconds>(steady_clock::now() - beg).count() + 1;
+
+  beg = steady_clock::now();
+  for (int i = 0; i < num; ++i) {
+    IoRange ioRange;
+    serializeTo(ioRange, shape);
+    bytes += ioRange.getRange().size();
+  }
+  auto onePassUs =
+    duration_cast<microseconds>(steady_clock::now() - beg).count() + 1;
+
+  if (printPerf) {
+    auto mb = bytes / 2 / (1 << 20);
+    cout << "append per field: " << mb * 1000000 / piecewiseUs << " MB/s, "
+         << "serializeTo: " << mb * 1000000 / onePassUs << " MB/s" << endl;
+  }
+}
+
+TEST(Serializer, testVarintWire) {
+  ASSERT_EQ((FixedSize<int32_t, VarintWire>::value), 0);
+  ASSERT_EQ((FixedSize<double, VarintWire>::value), 8);
+  ASSERT_EQ((FixedSize<SerializerTestPoint, VarintWire>::value), 0);
+
+  typedef tuple<int16_t, int32_t, uint64_t, string, vector<int32_t>,
+                map<string, int64_t>> Message;
+  Message val(-3, INT32_MIN, 1ULL << 40, "hello",
+              {0, -1, 1, 1000, -100000, INT32_MAX}, {{"a", -1}, {"b", 2}});
+
+  IoRange compact;
+  Serializer<Message, VarintWire>().append(compact, val);
+  auto range = compact.getRange();
+  ASSERT_EQ(range.size(), (Serializer<Message, VarintWire>().sizeOf(val)));
+
+  IoRange fixed;
+  Serializer<Message>().append(fixed, val);
+  ASSERT_LT(range.size(), fixed.getRange().size());
+
+  Message ret;
+  ASSERT_TRUE((Deserializer<Message, VarintWire>().parse(range, ret)));
+  ASSERT_EQ(range.size(), 0);
+  ASSERT_TRUE(ret == val);
+
+  range = compact.getRange();
+  ASSERT_TRUE((Deserializer<Message, VarintWire>().skip(range)));
+  ASSERT_EQ(range.size(), 0);
+
+  // picked per call
+  IoRange onePass;
+  serializeTo<VarintWire>(onePass, val);
+  ASSERT_TRUE(onePass.getRange().toString() ==
+              compact.getRange().toString());
+
+  auto shape = makeShape(50);
+  IoRange shapeRange;
+  serializeTo<VarintWire>(shapeRange, shape);
+  range = shapeRange.getRange();
+  SerializerTestShape shapeRet;
+  ASSERT_TRUE((Deserializer<SerializerTestShape, VarintWire>().parse(
+    range, shapeRet)));
+  ASSERT_EQ(shapeRet.points[49].y, -49);
+  ASSERT_TRUE(shapeRet.tags == shape.tags);
+}
+
+TEST(Serializer, testVarintOutOfRange) {
+  IoRange ioRange;
+  Serializer<uint32_t, VarintWire>().append(ioRange, 70000);
+  ASSERT_EQ(ioRange.getRange().size(), 3);
+
+  auto range = ioRange.getRange();
+  uint16_t small = 0;
+  ASSERT_FALSE((Deserializer<uint16_t, VarintWire>().parse(range, small)));
+  ASSERT_EQ(range.size(), 3);
+
+  // a run of 32-bit values stops at one that does not fit
+  IoRange run;
+  Serializer<vector<uint64_t>, VarintWire>().append(
+    run, vector<uint64_t>{1, 2, 1ULL << 33});
+  range = run.getRange();
+  vector<uint32_t> ret;
+  ASSERT_FALSE((Deserializer<vector<uint32_t>, VarintWire>().parse(
+    range, ret)));
+}
+
+// encoded size and speed of ids and counts on both wires
+TEST(Serializer, testVarintPerf) {
+  const int num = printPerf ? 1000 : 10;
+  vector<uint32_t> ids;
+  for (int i = 0; i < 10000; ++i) {
+    ids.push_back((i * 7919) % 5000);
+  }
+
+  int64_t fixedBytes = 0;
+  auto beg = steady_clock::now();
+  for (int i = 0; i < num; ++i) {
+    IoRange ioRange;
+    serializeTo(ioRange, ids);
+    vector<uint32_t> ret;
+    auto range = ioRange.getRange();
+    fixedBytes = range.size();
+    ASSERT_TRUE(Deserializer<vector<uint32_t>>().parse(range, ret));
+  }
+  auto fixedUs =
+    duration_cast<microseconds>(steady_clock::now() - beg).count() + 1;
+
+  int64_t varintBytes = 0;
+  beg = steady_clock::now();
+  for (int i = 0; i < num; ++i) {
+    IoRange ioRange;
+    serializeTo<VarintWire>(ioRange, ids);
+    vector<uint32_t> ret;
+    auto range = ioRange.getRange();
+    varintBytes = range.size();
+    ASSERT_TRUE((Deserializer<vector<uint32_t>, VarintWire>().parse(
+      range, ret)));
+  }
+  auto varintUs =
+    duration_cast<microseconds>(steady_clock::now() - beg).count() + 1;
+
+  ASSERT_LT(varintBytes, fixedBytes);
+
+  if (printPerf) {
+    int64_t values = (int64_t)num * ids.size();
+    cout << "fixed: " << fixedBytes << " bytes, "
+         << values / fixedUs << "M values/s round trip, "
+         << "varint: " << varintBytes << " bytes, "
+         << values / varintUs << "M values/s round trip" << endl;
+  }
+}
+
+// wires that take the bulk path for vectors of numbers
+template <class Wire, class T>
+static void checkBulkVector(const vector<T>& val) {
+  IoRange ioRange;
+  Serializer<vector<T>, Wire>().append(ioRange, val);
+  auto range = ioRange.getRange();
+  ASSERT_EQ(range.size(), (Serializer<vector<T>, Wire>().sizeOf(val)));
+
+  // element by element, as vectors of numbers were written before
+  IoRange piecewise;
+  Wire::appendLength(piecewise, val.size());
+  for (auto& v : val) {
+    Serializer<T, Wire>().append(piecewise, v);
+  }
+  ASSERT_TRUE(range.toString() == piecewise.getRange().toString());
+
+  // through the unchecked writer, and a chain of small segments
+  IoRange onePass;
+  serializeTo<Wire>(onePass, val);
+  ASSERT_TRUE(range.toString() == onePass.getRange().toString());
+  IoBuf buf(100);
+  Serializer<vector<T>, Wire>().append(buf, val);
+  ASSERT_TRUE(range.toString() == buf.toString());
+
+  vector<T> ret;
+  ASSERT_TRUE((Deserializer<vector<T>, Wire>().parse(range, ret)));
+  ASSERT_EQ(range.size(), 0);
+  ASSERT_TRUE(ret == val);
+
+  range = ioRange.getRange();
+  ASSERT_TRUE((Deserializer<vector<T>, Wire>().skip(range)));
+  ASSERT_EQ(range.size(), 0);
+
+  auto cut = ioRange.getRange();
+  cut.pop_back(1);
+  if (!val.empty()) {
+    ASSERT_FALSE((Deserializer<vector<T>, Wire>().parse(cut, ret)));
+  }
+}
+
+template <class Wire>
+static void checkBulkVectors() {
+  vector<uint64_t> u64;
+  vector<int32_t> i32;
+  vector<int16_t> i16;
+  vector<double> f64;
+  vector<float> f32;
+  vector<char> chars;
+  for (int i = 0; i < 3000; ++i) {
+    u64.push_back((uint64_t)i * 0x0102030405ULL);
+    i32.push_back(i % 2 ? i : -i * 1000);
+    i16.push_back(-i);
+    f64.push_back(i * 0.125);
+    f32.push_back(i * -0.5f);
+    chars.push_back((char)i);
+  }
+
+  checkBulkVector<Wire>(u64);
+  checkBulkVector<Wire>(i32);
+  checkBulkVector<Wire>(i16);
+  checkBulkVector<Wire>(f64);
+  checkBulkVector<Wire>(f32);
+  checkBulkVector<Wire>(chars);
+  checkBulkVector<Wire>(vector<double>());
+}
+
+TEST(Serializer, testBulkVector) {
+  checkBulkVectors<FixedWire>();
+  checkBulkVectors<VarintWire>();
+  checkBulkVectors<NativeWire>();
+
+  // host byte order
+  IoRange ioRange;
+  Serializer<vector<uint32_t>, NativeWire>().append(
+    ioRange, vector<uint32_t>{0x01020304});
+  uint32_t val = 0;
+  memcpy(&val, ioRange.getRange().begin() + 4, 4);
+  ASSERT_EQ(val, 0x01020304);
+}
+
+// vectors of numbers element by element, as they were written before,
+// against one block on the default and the native wire
+TEST(Serializer, testBulkPerf) {
+  const int num = printPerf ? 100 : 2;
+  vector<double> val(1000000);
+  for (int i = 0; i < val.size(); ++i) {
+    val[i] = i * 0.5;
+  }
+
+  IoRange encoded;
+  serializeTo(encoded, val);
+  IoRange native;
+  serializeTo<NativeWire>(native, val);
+  vector<double> ret(val.size());
+
+  auto timeUs = [num](std::function<void()> fn) {
+    auto beg = steady_clock::now();
+    for (int i = 0; i < num; ++i) {
+      fn();
+    }
+    return duration_cast<microseconds>(steady_clock::now() - beg).count() + 1;
+  };
+
+  auto loopEncode = timeUs([&val]() {
+    IoRange ioRange;
+    ioRange.reserve(val.size() * 8 + 4);
+    Serializer<int32_t>().append(ioRange, val.size());
+    for (auto v : val) {
+      Serializer<double>().append(ioRange, v);
+    }
+  });
+  auto bulkEncode = timeUs([&val]() {
+    IoRange ioRange;
+    serializeTo(ioRange, val);
+  });
+  auto nativeEncode = timeUs([&val]() {
+    IoRange ioRange;
+    serializeTo<NativeWire>(ioRange, val);
+  });
+
+  auto loopDecode = timeUs([&encoded, &ret]() {
+    auto range = encoded.getRange();
+    int32_t len = 0;
+    Deserializer<int32_t>().parse(range, len);
+    for (auto& v : ret) {
+      Deserializer<double>().parse(range, v);
+    }
+  });
+  auto bulkDecode = timeUs([&encoded, &ret]() {
+    auto range = encoded.getRange();
+    ASSERT_TRUE(Deserializer<vector<double>>().parse(range, ret));
+  });
+  auto nativeDecode = timeUs([&native, &ret]() {
+    auto range = native.getRange();
+    ASSERT_TRUE((Deserializer<vector<double>, NativeWire>().parse(
+      range, ret)));
+  });
+  ASSERT_TRUE(ret == val);
+
+  if (printPerf) {
+    int64_t mb = (int64_t)num * val.size() * 8 / (1 << 20);
+    cout << "encode MB/s: per element " << mb * 1000000 / loopEncode
+         << ", bulk " << mb * 1000000 / bulkEncode
+         << ", native " << mb * 1000000 / nativeEncode << endl;
+    cout << "decode MB/s: per element " << mb * 1000000 / loopDecode
+         << ", bulk " << mb * 1000000 / bulkDecode
+         << ", native " << mb * 1000000 / nativeDecode << endl;
+  }
+}
@@ -0,0 +1,255 @@
+#include "common/SerializerView.h"
+#include "common/Serializer.h"
+#include "common/Range.h"
+#include "common/Logging.h"
+#include "common/UnitTest.h"
+
+#include <chrono>
+
+using namespace std;
+using namespace sdb;
+using namespace std::chrono;
+
+// enable this if you want to print out perf info
+const bool printPerf = false;
+
+
+// a large message, and a view of it for handlers that read a few fields
+struct ViewTestMessage {
+  int64_t id;
+  vector<string> items;
+  map<string, int64_t> attrs;
+  vector<int32_t> counts;
+  string owner;
+};
+
+SDB_SERIALIZABLE(ViewTestMessage, id, items, attrs, counts, owner)
+
+struct ViewTestMessageView {
+  int64_t id;
+  VectorView<string> items;
+  MapView<StringView, int64_t> attrs;
+  VectorView<int32_t> counts;
+  StringView owner;
+};
+
+SDB_SERIALIZABLE(ViewTestMessageView, id, items, attrs, counts, owner)
+
+static ViewTestMessage makeMessage(int numItems) {
+  ViewTestMessage msg;
+  msg.id = 42;
+  for (int i = 0; i < numItems; ++i) {
+    msg.items.push_back("item " + to_string(i));
+    msg.attrs["attr " + to_string(i)] = i;
+    msg.counts.push_back(i * 3);
+  }
+  msg.owner = "owner";
+  return msg;
+}
+
+TEST(SerializerView, testVectorView) {
+  vector<string> val{"a", "bb", "", "dddd"};
+  IoRange ioRange;
+  Serializer<vector<string>>().append(ioRange, val);
+  ioRange.append(string("tail"));
+
+  auto range = ioRange.getRange();
+  VectorView<string> view;
+  ASSERT_TRUE(Deserializer<VectorView<string>>().parse(range, view));
+  ASSERT_EQ(range.toString(), "tail");
+  ASSERT_EQ(view.size(), 4);
+  ASSERT_EQ(view[3], "dddd");
+  ASSERT_EQ(view[1], "bb");
+
+  vector<string> ret;
+  for (auto s : view) {
+    ret.push_back(s);
+  }
+  ASSERT_TRUE(ret == val);
+
+  // elements point into the source
+  range = ioRange.getRange();
+  VectorView<StringView> strs;
+  ASSERT_TRUE(Deserializer<VectorView<StringView>>().parse(range, strs));
+  auto s = strs[3];
+  ASSERT_TRUE(s.begin() > ioRange.getRange().begin());
+  ASSERT_TRUE(s.end() < ioRange.getRange().end());
+  ASSERT_EQ(s.toString(), "dddd");
+
+  // truncated
+  auto cut = ioRange.getRange();
+  cut.pop_back(7);
+  ASSERT_FALSE(Deserializer<VectorView<string>>().parse(cut, view));
+}
+
+TEST(SerializerView, testFixedSizeElements) {
+  vector<pair<int32_t, double>> val;
+  for (int i = 0; i < 100; ++i) {
+    val.emplace_back(i, i * 0.25);
+  }
+
+  IoRange ioRange;
+  Serializer<vector<pair<int32_t, double>>>().append(ioRange, val);
+  auto range = ioRange.getRange();
+
+  VectorView<pair<int32_t, double>> view;
+  ASSERT_TRUE(view.parse(range));
+  ASSERT_EQ(view.size(), 100);
+  ASSERT_EQ(view[77].first, 77);
+  ASSERT_EQ(view[77].second, 77 * 0.25);
+  ASSERT_EQ(view.data().size(), 100 * 12);
+
+  // on the varint wire, elements have to be walked
+  IoRange compact;
+  vector<int64_t> nums{-5, 300, 1LL << 40, 7};
+  Serializer<vector<int64_t>, VarintWire>().append(compact, nums);
+  range = compact.getRange();
+  VectorView<int64_t, VarintWire> numView;
+  ASSERT_TRUE((Deserializer<VectorView<int64_t, VarintWire>, VarintWire>()
+               .parse(range, numView)));
+  ASSERT_EQ(numView[2], 1LL << 40);
+  ASSERT_EQ(numView[0], -5);
+}
+
+TEST(SerializerView, testNativeArray) {
+  vector<double> val{0.5, 1.5, -2.5};
+
+  IoRange ioRange;
+  Serializer<vector<double>, NativeWire>().append(ioRange, val);
+  auto range = ioRange.getRange();
+  VectorView<double, NativeWire> view;
+  ASSERT_TRUE(view.parse(range));
+
+  // the 4-byte length leaves the doubles aligned to 4 only
+  auto array = view.array();
+  if ((uintptr_t)view.data().begin() % alignof(double) == 0) {
+    ASSERT_TRUE(array == (const double*)view.data().begin());
+    ASSERT_EQ(array[2], -2.5);
+  } else {
+    ASSERT_TRUE(array == nullptr);
+  }
+  ASSERT_EQ(view[1], 1.5);
+
+  // byte swapped on the default wire
+  IoRange fixed;
+  Serializer<vector<double>>().append(fixed, val);
+  range = fixed.getRange();
+  VectorView<double> fixedView;
+  ASSERT_TRUE(fixedView.parse(range));
+  ASSERT_TRUE(fixedView.array() == nullptr);
+  ASSERT_EQ(fixedView[2], -2.5);
+}
+
+TEST(SerializerView, testMapView) {
+  map<string, vector<int32_t>> val;
+  val["x"] = {1, 2};
+  val["yy"] = {};
+  val["zzz"] = {3};
+
+  IoRange ioRange;
+  Serializer<map<string, vector<int32_t>>>().append(ioRange, val);
+  auto range = ioRange.getRange();
+
+  MapView<string, VectorView<int32_t>> view;
+  ASSERT_TRUE(view.parse(range));
+  ASSERT_EQ(view.size(), 3);
+
+  VectorView<int32_t> ints;
+  ASSERT_TRUE(view.find("x", ints));
+  ASSERT_EQ(ints.size(), 2);
+  ASSERT_EQ(ints[1], 2);
+  ASSERT_TRUE(view.find("zzz", ints));
+  ASSERT_EQ(ints[0], 3);
+  ASSERT_FALSE(view.find("w", ints));
+
+  int num = 0;
+  for (auto p : view) {
+    num += p.second.size();
+  }
+  ASSERT_EQ(num, 3);
+}
+
+TEST(SerializerView, testTupleView) {
+  typedef tuple<int32_t, string, vector<int64_t>, char> Tuple;
+  Tuple val(5, "hello", {1, 2, 3}, 'c');
+
+  IoRange ioRange;
+  Serializer<Tuple>().append(ioRange, val);
+  auto range = ioRange.getRange();
+
+  TupleView<Tuple> view;
+  ASSERT_TRUE(Deserializer<TupleView<Tuple>>().parse(range, view));
+  ASSERT_EQ(range.size(), 0);
+  ASSERT_EQ(view.get<3>(), 'c');
+  ASSERT_EQ(view.get<1>(), "hello");
+  ASSERT_EQ(view.get<2>().size(), 3);
+  ASSERT_EQ(view.get<0>(), 5);
+
+  // views of the parts
+  typedef tuple<int32_t, StringView, VectorView<int64_t>, char> Parts;
+  range = ioRange.getRange();
+  TupleView<Parts> parts;
+  ASSERT_TRUE(parts.parse(range));
+  ASSERT_EQ(parts.get<2>()[2], 3);
+}
+
+TEST(SerializerView, testMessageView) {
+  auto msg = makeMessage(100);
+  IoRange ioRange;
+  serializeTo(ioRange, msg);
+
+  auto range = ioRange.getRange();
+  ViewTestMessageView view;
+  ASSERT_TRUE(Deserializer<ViewTestMessageView>().parse(range, view));
+  ASSERT_EQ(range.size(), 0);
+  ASSERT_EQ(view.id, 42);
+  ASSERT_EQ(view.owner.toString(), "owner");
+  ASSERT_EQ(view.items[99], "item 99");
+  ASSERT_EQ(view.counts[50], 150);
+
+  int64_t attr = 0;
+  string key("attr 7");
+  ASSERT_TRUE(view.attrs.find(StringView(key), attr));
+  ASSERT_EQ(attr, 7);
+
+  // written back as is
+  IoRange copy;
+  serializeTo(copy, view);
+  ASSERT_TRUE(copy.getRange().toString() == ioRange.getRange().toString());
+}
+
+// a handler that reads two fields of a large message
+TEST(SerializerView, testPerf) {
+  const int num = printPerf ? 10000 : 10;
+  auto msg = makeMessage(1000);
+  IoRange ioRange;
+  serializeTo(ioRange, msg);
+
+  int64_t sum = 0;
+  auto beg = steady_clock::now();
+  for (int i = 0; i < num; ++i) {
+    auto range = ioRange.getRange();
+    ViewTestMessage ret;
+    ASSERT_TRUE(Deserializer<ViewTestMessage>().parse(range, ret));
+    sum += ret.id + ret.counts[i % 1000];
+  }
+  auto fullUs =
+    duration_cast<microseconds>(steady_clock::now() - beg).count() + 1;
+
+  beg = steady_clock::now();
+  for (int i = 0; i < num; ++i) {
+    auto range = ioRange.getRange();
+    ViewTestMessageView ret;
+    ASSERT_TRUE(Deserializer<ViewTestMessageView>().parse(range, ret));
+    sum -= ret.id + ret.counts[i % 1000];
+  }
+  auto viewUs =
+    duration_cast<microseconds>(steady_clock::now() - beg).count() + 1;
+  ASSERT_EQ(sum, 0);
+
+  if (printPerf) {
+    cout << "full parse: " << (int64_t)num * 1000000 / fullUs
+         << " messages/s, view: " << (int64_t)num * 1000000 / viewUs
+         << " messages/s" << endl;
+  }
+}
@@ -0,0 +1,180 @@
+#include "common/Slab.h"
+#include "common/Event.h"
+#include "common/Logging.h"
+#include "common/UnitTest.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace sdb;
+using namespace std;
+using namespace std::chrono;
+
+// enable this if you want to print out perf info
+const bool printPerf = false;
+
+
+struct SlabTestObject {
+  int64_t id;
+  char payload[40];
+
+  explicit SlabTestObject(int64_t i) : id(i) {}
+};
+
+struct SlabTestPooled {
+  int64_t id;
+  SlabTestPooled* next;
+
+  SDB_POOLED(SlabTestPooled)
+};
+
+// larger than its base, so it does not fit the blocks of its pool
+struct SlabTestDerived : public SlabTestPooled {
+  char more[64];
+};
+
+// an event sized object, freed on another thread than its own
+struct SlabTestEvent {
+  int64_t id;
+  int64_t args[10];
+  atomic<int>* done;
+};
+
+TEST(Slab, testObjectPool) {
+  FORK {
+    typedef ObjectPool<SlabTestObject> Pool;
+    ASSERT_EQ(Pool::stats().numBlocks, 0);
+    ASSERT_EQ(Pool::stats().blockSize, 48);
+
+    vector<SlabTestObject*> objs;
+    for (int i = 0; i < 100; ++i) {
+      objs.push_back(Pool::create(i));
+      ASSERT_EQ((uintptr_t)objs.back() % 16, 0);
+    }
+
+    auto stats = Pool::stats();
+    ASSERT_EQ(stats.numLive, 100);
+    ASSERT_EQ(stats.numBlocks, Pool::pool_type::kSlabBlocks);
+    ASSERT_TRUE(stats.utilization() > 0.0 && stats.utilization() < 1.0);
+
+    for (int i = 0; i < 100; ++i) {
+      ASSERT_EQ(objs[i]->id, i);
+      Pool::destroy(objs[i]);
+    }
+
+    // blocks are reused, not carved again
+    ASSERT_EQ(Pool::stats().numLive, 0);
+    auto obj = Pool::create(7);
+    ASSERT_EQ(Pool::stats().numBlocks, stats.numBlocks);
+    Pool::destroy(obj);
+  };
+}
+
+TEST(Slab, testPooledClass) {
+  FORK {
+    typedef ObjectPool<SlabTestPooled> Pool;
+    auto p = new SlabTestPooled;
+    ASSERT_EQ(Pool::stats().numLive, 1);
+
+    // too large for the pool, from the heap
+    SlabTestPooled* d = new SlabTestDerived;
+    ASSERT_EQ(Pool::stats().numLive, 1);
+
+    delete p;
+    ASSERT_EQ(Pool::stats().numLive, 0);
+    delete (SlabTestDerived*)d;
+    ASSERT_EQ(Pool::stats().numLive, 0);
+  };
+}
+
+TEST(Slab, testCrossThreadFree) {
+  FORK {
+    typedef ObjectPool<SlabTestObject> Pool;
+    const int num = 10000;
+    vector<SlabTestObject*> objs;
+
+    thread producer([&objs]() {
+      for (int i = 0; i < num; ++i) {
+        objs.push_back(Pool::create(i));
+      }
+    });
+    producer.join();
+    ASSERT_EQ(Pool::stats().numLive, num);
+
+    // freed here, the blocks join the cache of this thread and the depot
+    for (auto obj : objs) {
+      Pool::destroy(obj);
+    }
+    ASSERT_EQ(Pool::stats().numLive, 0);
+
+    // the blocks flushed to the depot are picked up by another thread
+    auto numBlocks = Pool::stats().numBlocks;
+    thread consumer([]() {
+      vector<SlabTestObject*> more;
+      for (int i = 0; i < num / 2; ++i) {
+        more.push_back(Pool::create(i));
+      }
+      ASSERT_EQ(Pool::stats().numLive, num / 2);
+      for (auto obj : more) {
+        Pool::destroy(obj);
+      }
+    });
+    consumer.join();
+    ASSERT_EQ(Pool::stats().numBlocks, numBlocks);
+    ASSERT_EQ(Pool::stats().numLive, 0);
+  };
+}
+
+// allocate events on the caller thread and free them on event loops, as
+// with a malloc'ed event and one from an ObjectPool
+TEST(Slab, testPerf) {
+  FORK {
+    const int num = printPerf ? 1000000 : 10000;
+    auto eventMgr = new EventManager(2, 1);
+
+    auto timeUs = [eventMgr, num](bool pooled) {
+      atomic<int> done(0);
+      auto beg = steady_clock::now();
+      for (int i = 0; i < num; ++i) {
+        SlabTestEvent* ev = pooled ? ObjectPool<SlabTestEvent>::create()
+                                   : new SlabTestEvent;
+        ev->id = i;
+        ev->done = &done;
+        eventMgr->submit([ev, pooled]() {
+          ev->done->fetch_add(1, memory_order_relaxed);
+          if (pooled) {
+            ObjectPool<SlabTestEvent>::destroy(ev);
+          } else {
+            delete ev;
+          }
+        });
+      }
+
+      while (done.load() < num) {
+        this_thread::yield();
+      }
+      return duration_cast<microseconds>(steady_clock::now() - beg).count();
+    };
+
+    // warm up both allocators
+    timeUs(false);
+    timeUs(true);
+
+    auto mallocUs = timeUs(false);
+    auto poolUs = timeUs(true);
+    ASSERT_EQ(ObjectPool<SlabTestEvent>::stats().numLive, 0);
+
+    if (printPerf) {
+      auto stats = ObjectPool<SlabTestEvent>::stats();
+      cout << "ns per event: malloc " << mallocUs * 1000.0 / num
+           << ", pool " << poolUs * 1000.0 / num << endl;
+      cout << "pool blocks " << stats.numBlocks << " of "
+           << stats.blockSize << " bytes" << endl;
+    }
+
+    eventMgr->drain();
+    delete eventMgr;
+  };
+}
@@ -0,0 +1,305 @@
+#include "common/Task.h"
+#include "common/Future.h"
+#include "common/ThreadPool.h"
+#include "common/Logging.h"
+#include "common/UnitTest.h"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+
+#include <stdlib.h>
+
+using namespace sdb;
+using namespace std;
+using namespace std::chrono;
+
+// enable this if you want to print out perf info
+const bool printPerf = false;
+
+// number of calls to global operator new in this process
+static atomic<int64_t> numNews(0);
+
+__attribute__((noinline)) static void* countedAlloc(size_t n) {
+  ++numNews;
+  auto p = malloc(n ? n : 1);
+  if (!p) {
+    throw bad_alloc();
+  }
+  return p;
+}
+
+__attribute__((noinline)) static void countedFree(void* p) {
+  free(p);
+}
+
+void* operator new(size_t n) {
+  return countedAlloc(n);
+}
+
+void* operator new[](size_t n) {
+  return countedAlloc(n);
+}
+
+void operator delete(void* p) noexcept {
+  countedFree(p);
+}
+
+void operator delete[](void* p) noexcept {
+  countedFree(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  countedFree(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  countedFree(p);
+}
+
+
+TEST(Task, testInlineClosure) {
+  // other tests allocate concurrently, count in a child process
+  FORK {
+    int val = 0;
+    int64_t a = 1, b = 2, c = 3;
+
+    auto before = numNews.load();
+    Task t([&val, a, b, c]() { val = a + b + c; });
+    ASSERT_EQ(numNews.load(), before);
+
+    t();
+    ASSERT_EQ(val, 6);
+  };
+}
+
+TEST(Task, testLargeClosure) {
+  char big[128] = {0};
+  big[127] = 'x';
+  char ret = 0;
+
+  // kept in a pool instead of the heap, once the pool is set up
+  int64_t news = -1;
+  for (int i = 0; i < 2; ++i) {
+    auto before = numNews.load();
+    Task pooled([big, &ret]() { ret = big[0]; });
+    news = numNews.load() - before;
+  }
+  ASSERT_EQ(news, 0);
+
+  Task t([big, &ret]() { ret = big[127]; });
+  Task moved(move(t));
+
+  ASSERT_FALSE(t);
+  ASSERT_TRUE(moved);
+
+  moved();
+  ASSERT_EQ(ret, 'x');
+}
+
+TEST(Task, testMoveOnlyClosure) {
+  unique_ptr<int> p(new int(42));
+  int ret = 0;
+
+  Task t([p = move(p), &ret]() { ret = *p; });
+  Task other;
+  other = move(t);
+  other();
+
+  ASSERT_EQ(ret, 42);
+}
+
+TEST(Task, testDestroyClosure) {
+  auto sp = make_shared<int>(1);
+  {
+    Task t([sp]() {});
+    ASSERT_EQ(sp.use_count(), 2);
+  }
+  ASSERT_EQ(sp.use_count(), 1);
+}
+
+TEST(Future, testValue) {
+  Promise<string> pr;
+  auto fut = pr.getFuture();
+  ASSERT_FALSE(fut.isReady());
+
+  pr.setValue("hello");
+  ASSERT_TRUE(fut.isReady());
+  ASSERT_EQ(fut.get(), "hello");
+}
+
+TEST(Future, testVoid) {
+  Promise<void> pr;
+  auto fut = pr.getFuture();
+  pr.setValue();
+  fut.get();
+}
+
+TEST(Future, testException) {
+  FORK {
+    ThreadPool tp(1);
+    auto fut = tp.async([]() -> int { throw runtime_error("oops"); });
+
+    bool caught = false;
+    try {
+      fut.get();
+    } catch (runtime_error& e) {
+      caught = true;
+    }
+    ASSERT_TRUE(caught);
+  };
+}
+
+TEST(Future, testBrokenPromise) {
+  Future<int> fut;
+  {
+    Promise<int> pr;
+    fut = pr.getFuture();
+    ASSERT_FALSE(fut.isReady());
+  }
+
+  // a broken promise is ready, get() throws
+  ASSERT_TRUE(fut.isReady());
+
+  bool caught = false;
+  try {
+    fut.get();
+  } catch (future_error& e) {
+    caught = true;
+  }
+  ASSERT_TRUE(caught);
+}
+
+TEST(Future, testSatisfiedTwice) {
+  Promise<string> pr;
+  auto fut = pr.getFuture();
+  pr.setValue("first");
+
+  int numCaught = 0;
+  try {
+    pr.setValue("second");
+  } catch (future_error& e) {
+    ASSERT_TRUE(e.code() == future_errc::promise_already_satisfied);
+    ++numCaught;
+  }
+  try {
+    pr.setException(make_exception_ptr(runtime_error("oops")));
+  } catch (future_error& e) {
+    ++numCaught;
+  }
+  ASSERT_EQ(numCaught, 2);
+  ASSERT_EQ(fut.get(), "first");
+
+  Promise<void> vpr;
+  vpr.setException(make_exception_ptr(runtime_error("oops")));
+  try {
+    vpr.setValue();
+  } catch (future_error& e) {
+    ++numCaught;
+  }
+  ASSERT_EQ(numCaught, 3);
+}
+
+TEST(Future, testCrossThread) {
+  FORK {
+    ThreadPool tp(2, ThreadPool::mode_stealing);
+    vector<Future<int>> futs;
+
+    for (int i = 0; i < 100; ++i) {
+      futs.push_back(tp.async([i]() { return i; }));
+    }
+
+    for (int i = 0; i < 100; ++i) {
+      ASSERT_EQ(futs[i].get(), i);
+    }
+  };
+}
+
+// count the heap allocations of a submit/async round trip
+TEST(Task, testPerf) {
+  FORK {
+    const int numTasks = 20000;
+    int64_t payload[4] = {1, 2, 3, 4};
+
+    // std::function and std::promise, as used before
+    {
+      auto before = numNews.load();
+      auto beg = steady_clock::now();
+
+      for (int i = 0; i < numTasks; ++i) {
+        auto pr = new promise<int64_t>();
+        auto fut = pr->get_future();
+        function<void()> fn([pr, payload]() {
+          pr->set_value(payload[0] + payload[3]);
+          delete pr;
+        });
+        fn();
+        fut.get();
+      }
+
+      auto us = duration_cast<microseconds>(steady_clock::now() - beg).count();
+      if (printPerf) {
+        cout << "std::function + std::promise: "
+             << (double)(numNews.load() - before) / numTasks
+             << " allocations/task, " << us << " microseconds" << endl;
+      }
+    }
+
+    // Task and Promise
+    {
+      // the first promise sets up its block pool
+      Promise<int64_t>().getFuture();
+
+      auto before = numNews.load();
+      auto beg = steady_clock::now();
+
+      for (int i = 0; i < numTasks; ++i) {
+        Promise<int64_t> pr;
+        auto fut = pr.getFuture();
+        Task t([pr = move(pr), payload]() mutable {
+          pr.setValue(payload[0] + payload[3]);
+        });
+        t();
+        fut.get();
+      }
+
+      auto news = numNews.load() - before;
+      auto us = duration_cast<microseconds>(steady_clock::now() - beg).count();
+      if (printPerf) {
+        cout << "Task + Promise: " << (double)news / numTasks
+             << " allocations/task, " << us << " microseconds" << endl;
+      }
+      ASSERT_EQ(news, 0);
+    }
+
+    // ThreadPool::async round trips
+    {
+      ThreadPool tp(2, ThreadPool::mode_stealing);
+
+      // warm up the worker threads and the block pools
+      for (int i = 0; i < 1000; ++i) {
+        tp.async([payload]() { return payload[1]; }).get();
+      }
+
+      auto before = numNews.load();
+      auto beg = steady_clock::now();
+
+      for (int i = 0; i < numTasks; ++i) {
+        auto fut = tp.async([payload]() { return payload[1]; });
+        ASSERT_EQ(fut.get(), 2);
+      }
+
+      auto news = numNews.load() - before;
+      auto us = duration_cast<microseconds>(steady_clock::now() - beg).count();
+      if (printPerf) {
+        cout << "ThreadPool::async: " << (double)news / numTasks
+             << " allocations/task, "
+             << (int64_t)numTasks * 1000000 / max((int64_t)us, (int64_t)1)
+             << " tasks/s" << endl;
+      }
+      ASSERT_EQ(news, 0);
+    }
+  };
+}
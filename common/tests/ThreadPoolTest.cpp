@@ -4,6 +4,8 @@
 
 #include <map>
 #include <string>
+#include <atomic>
+#include <chrono>
 
 #include <unistd.h>
 #include <sys/types.h>
@@ -11,12 +13,16 @@
 
 using namespace sdb;
 using namespace std;
+using namespace std::chrono;
+
+// enable this if you want to print out perf info
+const bool printPerf = false;
 
 
 TEST(ThreadPool, testWithFuture) {
   FORK {
     ThreadPool tp(1);
-    future<bool> fut = tp.async([]() -> bool { return true; });
+    Future<bool> fut = tp.async([]() -> bool { return true; });
     ASSERT_TRUE(fut.get());
     tp.drain();
   };
@@ -25,7 +31,7 @@ TEST(ThreadPool, testWithFuture) {
 TEST(ThreadPool, testMoreTasks) {
   FORK {
     ThreadPool tp(1);
-    vector<future<bool>> futs(10);
+    vector<Future<bool>> futs(10);
 
     for (int i = 0; i < 10; ++i) {
       futs[i] = tp.async([]() ->bool {
@@ -41,3 +47,88 @@ TEST(ThreadPool, testMoreTasks) {
     tp.drain();
   };
 }
+
+TEST(ThreadPool, testStealingWithFuture) {
+  FORK {
+    ThreadPool tp(2, ThreadPool::mode_stealing);
+    Future<bool> fut = tp.async([]() -> bool { return true; });
+    ASSERT_TRUE(fut.get());
+    tp.drain();
+  };
+}
+
+TEST(ThreadPool, testStealingNestedSubmit) {
+  FORK {
+    ThreadPool tp(4, ThreadPool::mode_stealing);
+    atomic<int> count(0);
+
+    for (int i = 0; i < 16; ++i) {
+      tp.submit([&tp, &count]() {
+        // tasks submitted by a worker go to its own deque
+        for (int j = 0; j < 64; ++j) {
+          tp.submit([&count]() { ++count; });
+        }
+        ++count;
+      });
+    }
+
+    tp.drain();
+    ASSERT_EQ(count.load(), 16 * 65);
+  };
+}
+
+TEST(ThreadPool, testDestructWithPendingTasks) {
+  FORK {
+    atomic<int> count(0);
+    {
+      ThreadPool tp(2, ThreadPool::mode_stealing);
+      for (int i = 0; i < 100; ++i) {
+        tp.submit([&count]() { ++count; });
+      }
+    }
+    ASSERT_EQ(count.load(), 100);
+  };
+}
+
+// measure submit throughput as the number of workers grows
+TEST(ThreadPool, testPerf) {
+  FORK {
+    const int numTasks = 20000;
+    int maxWorkers = max(4, (int)thread::hardware_concurrency());
+
+    for (auto mode : {ThreadPool::mode_shared, ThreadPool::mode_stealing}) {
+      for (int n = 1; n <= maxWorkers; n *= 2) {
+        ThreadPool tp(n, mode);
+        atomic<int> count(0);
+
+        auto beg = steady_clock::now();
+
+        // half of the tasks come from outside, the other half are
+        // spawned by workers
+        for (int i = 0; i < numTasks / 16; ++i) {
+          tp.submit([&tp, &count]() {
+            for (int j = 0; j < 8; ++j) {
+              tp.submit([&count]() { ++count; });
+            }
+            ++count;
+          });
+          for (int j = 0; j < 7; ++j) {
+            tp.submit([&count]() { ++count; });
+          }
+        }
+        tp.drain();
+
+        auto end = steady_clock::now();
+        auto us = duration_cast<microseconds>(end - beg).count();
+
+        ASSERT_EQ(count.load(), numTasks);
+        if (printPerf) {
+          cout << (mode == ThreadPool::mode_shared ? "shared" : "stealing")
+               << " pool with " << n << " workers: "
+               << (int64_t)numTasks * 1000000 / max((int64_t)us, (int64_t)1)
+               << " tasks/s" << endl;
+        }
+      }
+    }
+  };
+}
@@ -0,0 +1,274 @@
+#include "common/TimerWheel.h"
+#include "common/Logging.h"
+#include "common/UnitTest.h"
+
+#include <map>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <stdlib.h>
+
+using namespace sdb;
+using namespace std;
+using namespace std::chrono;
+
+// enable this if you want to print out perf info
+const bool printPerf = false;
+
+
+// expiry times of a list returned from the wheel
+static vector<int64_t> expiries(TimerNode* p) {
+  vector<int64_t> ret;
+  for (; p; p = p->next) {
+    ret.push_back(p->expiry);
+  }
+  return ret;
+}
+
+
+TEST(TimerWheel, testFire) {
+  TimerWheel wheel(1000);
+  TimerNode a, b, c;
+  a.expiry = 1005;
+  b.expiry = 1003;
+  c.expiry = 1003;
+
+  wheel.add(&a);
+  wheel.add(&b);
+  wheel.add(&c);
+  ASSERT_EQ(wheel.size(), 3);
+  ASSERT_EQ(wheel.nextExpiry(), 1003);
+
+  ASSERT_TRUE(wheel.advance(1002) == nullptr);
+
+  auto fired = expiries(wheel.advance(1004));
+  ASSERT_EQ(fired.size(), 2);
+  ASSERT_EQ(fired[0], 1003);
+  ASSERT_EQ(fired[1], 1003);
+  ASSERT_FALSE(b.linked());
+  ASSERT_EQ(wheel.nextExpiry(), 1005);
+
+  fired = expiries(wheel.advance(2000));
+  ASSERT_EQ(fired.size(), 1);
+  ASSERT_EQ(fired[0], 1005);
+  ASSERT_EQ(wheel.size(), 0);
+  ASSERT_EQ(wheel.nextExpiry(), -1);
+}
+
+TEST(TimerWheel, testPastDue) {
+  TimerWheel wheel(1000);
+  ASSERT_TRUE(wheel.advance(1500) == nullptr);
+
+  TimerNode a;
+  a.expiry = 10;
+  wheel.add(&a);
+  ASSERT_EQ(wheel.nextExpiry(), 1501);
+
+  auto fired = expiries(wheel.advance(1501));
+  ASSERT_EQ(fired.size(), 1);
+}
+
+TEST(TimerWheel, testRemove) {
+  TimerWheel wheel(0);
+  TimerNode a, b, c;
+  a.expiry = 10;
+  b.expiry = 10;
+  c.expiry = 100000;
+
+  wheel.add(&a);
+  wheel.add(&b);
+  wheel.add(&c);
+
+  wheel.remove(&a);
+  wheel.remove(&c);
+  ASSERT_FALSE(a.linked());
+  ASSERT_EQ(wheel.size(), 1);
+
+  // removing an unlinked node does nothing
+  wheel.remove(&a);
+  ASSERT_EQ(wheel.size(), 1);
+
+  auto fired = expiries(wheel.advance(1000000));
+  ASSERT_EQ(fired.size(), 1);
+  ASSERT_TRUE(wheel.advance(10000000) == nullptr);
+}
+
+TEST(TimerWheel, testUpperLevels) {
+  const int64_t start = 123456789;
+  TimerWheel wheel(start);
+
+  vector<int64_t> offsets = {
+    255, 256, 300, 16383, 16384, 20000, 1 << 20, (1 << 20) + 7,
+    1LL << 26, (1LL << 26) + 1, 1LL << 31, (1LL << 32) + 5, 1LL << 34,
+  };
+
+  vector<TimerNode> nodes(offsets.size());
+  for (size_t i = 0; i < offsets.size(); ++i) {
+    nodes[i].expiry = start + offsets[i];
+    wheel.add(&nodes[i]);
+  }
+
+  // no timer may fire before its time, nor be late
+  for (size_t i = 0; i < offsets.size(); ++i) {
+    auto fired = expiries(wheel.advance(start + offsets[i] - 1));
+    ASSERT_EQ(fired.size(), 0);
+
+    ASSERT_LE(wheel.nextExpiry(), start + offsets[i]);
+
+    fired = expiries(wheel.advance(start + offsets[i]));
+    ASSERT_EQ(fired.size(), 1);
+    ASSERT_EQ(fired[0], start + offsets[i]);
+  }
+
+  ASSERT_EQ(wheel.size(), 0);
+}
+
+TEST(TimerWheel, testRandom) {
+  srand(17);
+
+  int64_t now = 5000;
+  TimerWheel wheel(now);
+  multimap<int64_t, TimerNode*> expected;
+  vector<TimerNode> nodes(20000);
+
+  for (auto& n : nodes) {
+    int64_t range = (rand() % 4 == 0) ? 10000000 : 3000;
+    n.expiry = now + rand() % range;
+    wheel.add(&n);
+    expected.insert(make_pair(n.expiry, &n));
+  }
+
+  // cancel a third of them
+  for (size_t i = 0; i < nodes.size(); i += 3) {
+    auto& n = nodes[i];
+    wheel.remove(&n);
+    auto r = expected.equal_range(n.expiry);
+    for (auto it = r.first; it != r.second; ++it) {
+      if (it->second == &n) {
+        expected.erase(it);
+        break;
+      }
+    }
+  }
+
+  ASSERT_EQ(wheel.size(), expected.size());
+
+  while (!expected.empty()) {
+    // jump in steps of various length
+    now += 1 + rand() % ((rand() % 8 == 0) ? 200000 : 300);
+
+    auto fired = expiries(wheel.advance(now));
+    size_t numDue = 0;
+    while (!expected.empty() && expected.begin()->first <= now) {
+      expected.erase(expected.begin());
+      ++numDue;
+    }
+
+    ASSERT_EQ(fired.size(), numDue);
+    for (auto ts : fired) {
+      ASSERT_LE(ts, now);
+    }
+  }
+
+  ASSERT_EQ(wheel.size(), 0);
+}
+
+
+// The timer container used before the wheel
+struct MapTimers {
+  std::map<int64_t, std::vector<TimerNode*>> hmap;
+  std::mutex mt;
+
+  void add(TimerNode* p) {
+    lock_guard<mutex> l(mt);
+    hmap[p->expiry].push_back(p);
+  }
+
+  void remove(TimerNode* p) {
+    lock_guard<mutex> l(mt);
+    auto it = hmap.find(p->expiry);
+    auto& v = it->second;
+    for (auto& x : v) {
+      if (x == p) {
+        x = v.back();
+        v.pop_back();
+        break;
+      }
+    }
+    if (v.empty()) {
+      hmap.erase(it);
+    }
+  }
+
+  size_t advance(int64_t now) {
+    lock_guard<mutex> l(mt);
+    size_t ret = 0;
+    auto it = hmap.begin();
+    while (it != hmap.end() && it->first <= now) {
+      ret += it->second.size();
+      ++it;
+    }
+    hmap.erase(hmap.begin(), it);
+    return ret;
+  }
+};
+
+// request deadlines: schedule, cancel most of them, fire the rest
+TEST(TimerWheel, testPerf) {
+  const int numTimers = printPerf ? 1000000 : 20000;
+  const int64_t start = 1000000;
+
+  vector<TimerNode> nodes(numTimers);
+  srand(3);
+  for (auto& n : nodes) {
+    n.expiry = start + 100 + rand() % 30000;
+  }
+
+  int64_t wheelUs = 0, mapUs = 0;
+  size_t wheelFired = 0, mapFired = 0;
+
+  {
+    TimerWheel wheel(start);
+    auto beg = steady_clock::now();
+
+    for (auto& n : nodes) {
+      wheel.add(&n);
+    }
+    for (int i = 0; i < numTimers; ++i) {
+      if (i % 10) {
+        wheel.remove(&nodes[i]);
+      }
+    }
+    for (int64_t t = start; wheel.size() > 0; t += 1) {
+      wheelFired += expiries(wheel.advance(t)).size();
+    }
+
+    wheelUs = duration_cast<microseconds>(steady_clock::now() - beg).count();
+  }
+
+  {
+    MapTimers timers;
+    auto beg = steady_clock::now();
+
+    for (auto& n : nodes) {
+      timers.add(&n);
+    }
+    for (int i = 0; i < numTimers; ++i) {
+      if (i % 10) {
+        timers.remove(&nodes[i]);
+      }
+    }
+    for (int64_t t = start; !timers.hmap.empty(); t += 1) {
+      mapFired += timers.advance(t);
+    }
+
+    mapUs = duration_cast<microseconds>(steady_clock::now() - beg).count();
+  }
+
+  ASSERT_EQ(wheelFired, mapFired);
+
+  if (printPerf) {
+    cout << "timer wheel: " << wheelUs << " microseconds, "
+         << "map: " << mapUs << " microseconds" << endl;
+  }
+}
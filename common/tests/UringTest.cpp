@@ -0,0 +1,447 @@
+#include "common/Event.h"
+#include "common/ThreadPool.h"
+#include "common/Logging.h"
+#include "common/UnitTest.h"
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace sdb;
+using namespace std;
+using namespace std::chrono;
+
+
+static int64_t nowInMs() {
+  auto ts = steady_clock::now();
+  return duration_cast<milliseconds>(ts.time_since_epoch()).count();
+}
+
+// wait until @pred holds or @ms passes
+template <class Pred>
+static bool waitFor(Pred pred, int ms) {
+  auto deadline = nowInMs() + ms;
+  while (!pred()) {
+    if (nowInMs() > deadline) {
+      return false;
+    }
+    this_thread::sleep_for(milliseconds(1));
+  }
+  return true;
+}
+
+// an io_uring loop, or nullptr if the kernel does not support it
+static EventLoop* newUringLoop() {
+  auto eloop = new EventLoop(64, Poller::backend_uring);
+  if (eloop->getBackend() != Poller::backend_uring) {
+    LOG(WARNING) << "io_uring is not available, skip the test";
+    delete eloop;
+    return nullptr;
+  }
+  return eloop;
+}
+
+
+// read at most 4 bytes on each notification
+class UringPipeReader : public Event {
+ public:
+
+  explicit UringPipeReader(bool drain)
+    : drain_(drain), notified(0), bytes(0) {
+    if (0 != pipe2(fds_, O_NONBLOCK | O_CLOEXEC)) {
+      LOG(FATAL) << "Fails to create pipe " << strerror(errno);
+    }
+  }
+
+  ~UringPipeReader() override {
+    close(fds_[0]);
+    close(fds_[1]);
+  }
+
+  int getFD() const override { return fds_[0]; }
+
+  void handleRead() override {
+    ++notified;
+
+    char buf[4];
+    int n = 0;
+    do {
+      n = read(fds_[0], buf, sizeof(buf));
+      if (n > 0) {
+        bytes += n;
+      }
+    } while (drain_ && n > 0);
+  }
+
+  void handleWrite() override {}
+
+  void handleError() override {}
+
+  void send(int n) {
+    string data(n, 'x');
+    ASSERT_EQ(write(fds_[1], data.data(), n), n);
+  }
+
+ private:
+
+  int fds_[2];
+
+  bool drain_;
+
+ public:
+
+  atomic<int> notified;
+
+  atomic<int> bytes;
+};
+
+
+// records the completions delivered on the loop thread
+class UringRecorder : public IoCompletion {
+ public:
+
+  UringRecorder() : count(0) {}
+
+  void handleCompletion(int res, uint32_t flags) override {
+    lock_guard<mutex> l(mt_);
+    results_.push_back(res);
+    flags_.push_back(flags);
+    ++count;
+  }
+
+  int result(size_t i) {
+    lock_guard<mutex> l(mt_);
+    return results_[i];
+  }
+
+  uint32_t flags(size_t i) {
+    lock_guard<mutex> l(mt_);
+    return flags_[i];
+  }
+
+ private:
+
+  mutex mt_;
+
+  vector<int> results_;
+
+  vector<uint32_t> flags_;
+
+ public:
+
+  atomic<int> count;
+};
+
+// requests must be submitted on the loop thread
+static bool submitIo(
+  EventLoop* eloop, const IoRequest& req, UringRecorder* rec) {
+  return eloop->async([=]() { return eloop->submitIo(req, rec); }).get();
+}
+
+static void stopLoop(EventLoop* eloop, ThreadPool* tp) {
+  eloop->quitLoopSoon();
+  tp->drain();
+  delete eloop;
+  delete tp;
+}
+
+// a listening socket on a free port of the loopback address
+static int listenOnLoopback(struct sockaddr_in* addr) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr->sin_port = 0;
+
+  socklen_t len = sizeof(*addr);
+  if (fd < 0 || 0 != bind(fd, (struct sockaddr*)addr, len) ||
+      0 != getsockname(fd, (struct sockaddr*)addr, &len) ||
+      0 != listen(fd, 16)) {
+    LOG(FATAL) << "Fails to listen " << strerror(errno);
+  }
+  return fd;
+}
+
+static string tempFile() {
+  char path[] = "/tmp/uring_test_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    LOG(FATAL) << "Fails to create temp file " << strerror(errno);
+  }
+  close(fd);
+  return path;
+}
+
+
+TEST(Uring, testEpollHasNoCompletions) {
+  FORK {
+    EventLoop eloop(8);
+    ASSERT_EQ(eloop.getBackend(), Poller::backend_epoll);
+
+    UringRecorder rec;
+    IoRequest req(IoRequest::io_timeout, -1);
+    ASSERT_FALSE(eloop.submitIo(req, &rec));
+    ASSERT_FALSE(eloop.provideBuffers(nullptr, 16, 1, 0, 0));
+  };
+}
+
+TEST(Uring, testReadiness) {
+  FORK {
+    auto eloop = newUringLoop();
+    if (!eloop) {
+      return;
+    }
+
+    auto tp = new ThreadPool(1);
+    tp->submit([eloop]() { eloop->loop(); });
+
+    // events are added from another thread, through the task queue
+    UringPipeReader level(false);
+    ASSERT_TRUE(eloop->addEvent(&level, EventLoop::handle_read));
+    level.send(10);
+    ASSERT_TRUE(waitFor([&]() { return level.bytes == 10; }, 1000));
+    ASSERT_EQ(level.notified.load(), 3);
+
+    UringPipeReader edge(true);
+    ASSERT_TRUE(eloop->addEvent(
+      &edge, EventLoop::handle_read | EventLoop::handle_edge));
+    edge.send(10);
+    ASSERT_TRUE(waitFor([&]() { return edge.bytes == 10; }, 1000));
+    edge.send(3);
+    ASSERT_TRUE(waitFor([&]() { return edge.bytes == 13; }, 1000));
+    ASSERT_EQ(edge.notified.load(), 2);
+
+    const int opt = EventLoop::handle_read | EventLoop::handle_oneshot;
+    UringPipeReader oneshot(false);
+    ASSERT_TRUE(eloop->addEvent(&oneshot, opt));
+    oneshot.send(10);
+    ASSERT_TRUE(waitFor([&]() { return oneshot.bytes == 4; }, 1000));
+    this_thread::sleep_for(milliseconds(20));
+    ASSERT_EQ(oneshot.notified.load(), 1);
+
+    ASSERT_TRUE(eloop->updateEvent(&oneshot, opt));
+    ASSERT_TRUE(waitFor([&]() { return oneshot.bytes == 8; }, 1000));
+
+    // nothing is reported after the event is removed
+    ASSERT_TRUE(eloop->removeEvent(&level));
+    ASSERT_EQ(eloop->async([]() { return 1; }).get(), 1);
+    level.send(1);
+    this_thread::sleep_for(milliseconds(20));
+    ASSERT_EQ(level.notified.load(), 3);
+
+    ASSERT_TRUE(eloop->removeEvent(&edge));
+    ASSERT_TRUE(eloop->removeEvent(&oneshot));
+    stopLoop(eloop, tp);
+  };
+}
+
+TEST(Uring, testReadWriteTimeout) {
+  FORK {
+    auto eloop = newUringLoop();
+    if (!eloop) {
+      return;
+    }
+
+    auto tp = new ThreadPool(1);
+    tp->submit([eloop]() { eloop->loop(); });
+
+    auto path = tempFile();
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    ASSERT_TRUE(fd >= 0);
+
+    char out[] = "hello uring";
+    char in[32];
+    memset(in, 0, sizeof(in));
+    UringRecorder rec;
+
+    IoRequest w(IoRequest::io_write, fd, out, sizeof(out));
+    w.offset = 100;
+    ASSERT_TRUE(submitIo(eloop, w, &rec));
+    ASSERT_TRUE(waitFor([&]() { return rec.count == 1; }, 1000));
+    ASSERT_EQ(rec.result(0), (int)sizeof(out));
+
+    IoRequest r(IoRequest::io_read, fd, in, sizeof(in));
+    r.offset = 100;
+    ASSERT_TRUE(submitIo(eloop, r, &rec));
+    ASSERT_TRUE(waitFor([&]() { return rec.count == 2; }, 1000));
+    ASSERT_EQ(rec.result(1), (int)sizeof(out));
+    ASSERT_EQ(string(in), string(out));
+
+    IoRequest t(IoRequest::io_timeout, -1);
+    t.offset = 30;
+    auto beg = nowInMs();
+    ASSERT_TRUE(submitIo(eloop, t, &rec));
+    ASSERT_TRUE(waitFor([&]() { return rec.count == 3; }, 1000));
+    ASSERT_EQ(rec.result(2), -ETIME);
+    ASSERT_GE(nowInMs() - beg, 29);
+
+    stopLoop(eloop, tp);
+    close(fd);
+    unlink(path.c_str());
+  };
+}
+
+TEST(Uring, testRegistered) {
+  FORK {
+    auto eloop = newUringLoop();
+    if (!eloop) {
+      return;
+    }
+
+    auto path = tempFile();
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    ASSERT_TRUE(fd >= 0);
+    ASSERT_TRUE(eloop->registerFiles(&fd, 1));
+
+    vector<char> mem(8192, 'a');
+    struct iovec iov[2];
+    iov[0].iov_base = &mem[0];
+    iov[0].iov_len = 4096;
+    iov[1].iov_base = &mem[4096];
+    iov[1].iov_len = 4096;
+    ASSERT_TRUE(eloop->registerBuffers(iov, 2));
+
+    auto tp = new ThreadPool(1);
+    tp->submit([eloop]() { eloop->loop(); });
+
+    // write from the first buffer, read back into the second one, both
+    // through the registered file at index 0
+    memcpy(&mem[0], "registered", 10);
+    UringRecorder rec;
+
+    IoRequest w(IoRequest::io_write, 0, &mem[0], 4096);
+    w.opt = IoRequest::io_fixed_file | IoRequest::io_fixed_buffer;
+    w.bufIndex = 0;
+    ASSERT_TRUE(submitIo(eloop, w, &rec));
+    ASSERT_TRUE(waitFor([&]() { return rec.count == 1; }, 1000));
+
+    IoRequest r(IoRequest::io_read, 0, &mem[4096], 4096);
+    r.opt = IoRequest::io_fixed_file | IoRequest::io_fixed_buffer;
+    r.bufIndex = 1;
+    ASSERT_TRUE(submitIo(eloop, r, &rec));
+    ASSERT_TRUE(waitFor([&]() { return rec.count == 2; }, 1000));
+
+    ASSERT_EQ(rec.result(0), 4096);
+    ASSERT_EQ(rec.result(1), 4096);
+    ASSERT_EQ(memcmp(&mem[4096], "registered", 10), 0);
+
+    stopLoop(eloop, tp);
+    close(fd);
+    unlink(path.c_str());
+  };
+}
+
+TEST(Uring, testMultishotAccept) {
+  FORK {
+    auto eloop = newUringLoop();
+    if (!eloop) {
+      return;
+    }
+
+    auto tp = new ThreadPool(1);
+    tp->submit([eloop]() { eloop->loop(); });
+
+    struct sockaddr_in addr;
+    int lfd = listenOnLoopback(&addr);
+
+    UringRecorder rec;
+    IoRequest req(IoRequest::io_accept, lfd);
+    req.opt = IoRequest::io_multishot;
+    ASSERT_TRUE(submitIo(eloop, req, &rec));
+
+    // one request, one completion per connection
+    const int numClients = 3;
+    vector<int> clients;
+    for (int i = 0; i < numClients; ++i) {
+      int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      ASSERT_EQ(connect(fd, (struct sockaddr*)&addr, sizeof(addr)), 0);
+      clients.push_back(fd);
+    }
+
+    ASSERT_TRUE(waitFor([&]() { return rec.count == numClients; }, 1000));
+    for (int i = 0; i < numClients; ++i) {
+      int fd = rec.result(i);
+      ASSERT_GE(fd, 0);
+      ASSERT_TRUE(rec.flags(i) & IORING_CQE_F_MORE);
+      ASSERT_TRUE(fcntl(fd, F_GETFL) & O_NONBLOCK);
+      close(fd);
+    }
+
+    stopLoop(eloop, tp);
+    for (auto fd : clients) {
+      close(fd);
+    }
+    close(lfd);
+  };
+}
+
+TEST(Uring, testMultishotRecv) {
+  FORK {
+    auto eloop = newUringLoop();
+    if (!eloop) {
+      return;
+    }
+
+    auto tp = new ThreadPool(1);
+    tp->submit([eloop]() { eloop->loop(); });
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds), 0);
+
+    // the kernel picks one of the provided buffers for each completion
+    const int bufSize = 64;
+    const int numBufs = 8;
+    const int group = 7;
+    vector<char> bufs(bufSize * numBufs);
+    ASSERT_TRUE(eloop->async([&]() {
+      return eloop->provideBuffers(&bufs[0], bufSize, numBufs, group, 0);
+    }).get());
+
+    UringRecorder rec;
+    IoRequest req(IoRequest::io_recv, fds[0]);
+    req.opt = IoRequest::io_multishot | IoRequest::io_buffer_select;
+    req.bufIndex = group;
+    ASSERT_TRUE(submitIo(eloop, req, &rec));
+
+    // wait for each message so that they are not coalesced
+    const int numMessages = 3;
+    for (int i = 0; i < numMessages; ++i) {
+      string msg = "message" + to_string(i);
+      ASSERT_EQ(write(fds[1], msg.data(), msg.size()), (int)msg.size());
+      ASSERT_TRUE(waitFor([&]() { return rec.count == i + 1; }, 1000));
+    }
+
+    string received;
+    for (int i = 0; i < numMessages; ++i) {
+      auto flags = rec.flags(i);
+      ASSERT_TRUE(flags & IORING_CQE_F_BUFFER);
+      ASSERT_TRUE(flags & IORING_CQE_F_MORE);
+
+      int id = flags >> IORING_CQE_BUFFER_SHIFT;
+      ASSERT_LT(id, numBufs);
+      received.append(&bufs[id * bufSize], rec.result(i));
+    }
+    ASSERT_EQ(received, "message0message1message2");
+
+    // the peer closing ends the multishot request
+    close(fds[1]);
+    ASSERT_TRUE(waitFor([&]() { return rec.count == numMessages + 1; }, 1000));
+    ASSERT_EQ(rec.result(numMessages), 0);
+    ASSERT_FALSE(rec.flags(numMessages) & IORING_CQE_F_MORE);
+
+    stopLoop(eloop, tp);
+    close(fds[0]);
+  };
+}
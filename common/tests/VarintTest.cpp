@@ -0,0 +1,173 @@
+#include "common/Varint.h"
+#include "common/Range.h"
+#include "common/Logging.h"
+#include "common/UnitTest.h"
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace sdb;
+using namespace std;
+using namespace std::chrono;
+
+// enable this if you want to print out perf info
+const bool printPerf = false;
+
+
+// varints of @vals back to back
+static string encodeAll(const vector<uint64_t>& vals) {
+  string ret;
+  char tmp[kMaxVarintSize];
+  for (auto v : vals) {
+    ret.append(tmp, encodeVarint(tmp, v));
+  }
+  return ret;
+}
+
+// values of random bit lengths up to @maxBits, mostly short ones
+static vector<uint64_t> randomValues(int num, int maxBits, int seed) {
+  mt19937_64 rng(seed);
+  vector<uint64_t> ret;
+  for (int i = 0; i < num; ++i) {
+    int bits = rng() % 4 ? rng() % 8 : rng() % (maxBits + 1);
+    ret.push_back(bits == 64 ? rng() : rng() & ((1ULL << bits) - 1));
+  }
+  return ret;
+}
+
+TEST(Varint, testEncode) {
+  ASSERT_EQ(varintSize(0), 1);
+  ASSERT_EQ(varintSize(127), 1);
+  ASSERT_EQ(varintSize(128), 2);
+  ASSERT_EQ(varintSize(16383), 2);
+  ASSERT_EQ(varintSize(16384), 3);
+  ASSERT_EQ(varintSize(~0ULL), kMaxVarintSize);
+
+  char buf[kMaxVarintSize];
+  ASSERT_EQ(encodeVarint(buf, 300) - buf, 2);
+  ASSERT_EQ((unsigned char)buf[0], 0xac);
+  ASSERT_EQ(buf[1], 0x02);
+
+  for (uint64_t v : vector<uint64_t>{0, 1, 127, 128, 1ULL << 35, ~0ULL}) {
+    auto end = encodeVarint(buf, v);
+    ASSERT_EQ(end - buf, varintSize(v));
+
+    Range range(buf, end);
+    uint64_t ret = 0;
+    ASSERT_TRUE(decodeVarint(range, ret));
+    ASSERT_EQ(ret, v);
+    ASSERT_EQ(range.size(), 0);
+  }
+}
+
+TEST(Varint, testZigzag) {
+  ASSERT_EQ(zigzagEncode(0), 0);
+  ASSERT_EQ(zigzagEncode(-1), 1);
+  ASSERT_EQ(zigzagEncode(1), 2);
+  ASSERT_EQ(zigzagEncode(-2), 3);
+  ASSERT_EQ(zigzagEncode(INT64_MIN), ~0ULL);
+
+  for (int64_t v : vector<int64_t>{0, -1, 63, -64, INT64_MAX, INT64_MIN}) {
+    ASSERT_EQ(zigzagDecode(zigzagEncode(v)), v);
+  }
+}
+
+TEST(Varint, testDecodeBad) {
+  uint64_t val = 0;
+
+  // truncated
+  string s("\x80\x80", 2);
+  Range range(s);
+  ASSERT_FALSE(decodeVarint(range, val));
+  ASSERT_EQ(range.size(), 2);
+
+  // longer than 10 bytes
+  s = string(10, '\x80') + '\x01';
+  range = Range(s);
+  ASSERT_FALSE(decodeVarint(range, val));
+
+  // the 10th byte has bits beyond 64
+  s = string(9, '\xff') + '\x02';
+  range = Range(s);
+  ASSERT_FALSE(decodeVarint(range, val));
+
+  s = string(9, '\xff') + '\x01';
+  range = Range(s);
+  ASSERT_TRUE(decodeVarint(range, val));
+  ASSERT_EQ(val, ~0ULL);
+}
+
+TEST(Varint, testDecodeRun) {
+  for (int maxBits : {7, 14, 32, 64}) {
+    auto vals = randomValues(5000, maxBits, maxBits);
+    auto s = encodeAll(vals);
+
+    Range range(s);
+    vector<uint64_t> ret(vals.size());
+    ASSERT_EQ(decodeVarints(range, ret.data(), ret.size()), vals.size());
+    ASSERT_EQ(range.size(), 0);
+    ASSERT_TRUE(ret == vals);
+
+    // stop in the middle, the rest is left in place
+    range = Range(s);
+    ASSERT_EQ(decodeVarints(range, ret.data(), 1000), 1000);
+    uint64_t next = 0;
+    ASSERT_TRUE(decodeVarint(range, next));
+    ASSERT_EQ(next, vals[1000]);
+  }
+
+  // too large for 32 bits
+  auto vals = randomValues(100, 32, 7);
+  vals[60] = 1ULL << 32;
+  auto s = encodeAll(vals);
+  Range range(s);
+  vector<uint32_t> ret(vals.size());
+  ASSERT_EQ(decodeVarints(range, ret.data(), ret.size()), 60);
+  ASSERT_EQ(ret[59], vals[59]);
+  uint64_t next = 0;
+  ASSERT_TRUE(decodeVarint(range, next));
+  ASSERT_EQ(next, 1ULL << 32);
+
+  // truncated at the end
+  s = encodeAll({1, 2, 300});
+  s.pop_back();
+  range = Range(s);
+  ASSERT_EQ(decodeVarints(range, ret.data(), 3), 2);
+  ASSERT_EQ(range.size(), 1);
+}
+
+// the bulk decoder against one decodeVarint() per value
+TEST(Varint, testPerf) {
+  const int num = printPerf ? 10000000 : 10000;
+
+  for (int maxBits : {7, 21, 64}) {
+    auto vals = randomValues(num, maxBits, 1);
+    auto s = encodeAll(vals);
+    vector<uint64_t> ret(num);
+
+    auto beg = steady_clock::now();
+    Range range(s);
+    for (int i = 0; i < num; ++i) {
+      decodeVarint(range, ret[i]);
+    }
+    auto oneUs =
+      duration_cast<microseconds>(steady_clock::now() - beg).count();
+    ASSERT_TRUE(ret == vals);
+
+    beg = steady_clock::now();
+    range = Range(s);
+    decodeVarints(range, ret.data(), num);
+    auto runUs =
+      duration_cast<microseconds>(steady_clock::now() - beg).count();
+    ASSERT_TRUE(ret == vals);
+
+    if (printPerf) {
+      cout << "up to " << maxBits << " bits, " << s.size() * 1.0 / num
+           << " bytes per value: one at a time "
+           << (int64_t)num / (oneUs + 1) << "M values/s, in bulk "
+           << (int64_t)num / (runUs + 1) << "M values/s" << endl;
+    }
+  }
+}
@@ -0,0 +1,98 @@
+#include "common/WorkStealingDeque.h"
+#include "common/ThreadPool.h"
+#include "common/Logging.h"
+#include "common/UnitTest.h"
+
+#include <vector>
+#include <atomic>
+#include <thread>
+
+using namespace sdb;
+using namespace std;
+
+
+TEST(WorkStealingDeque, testPushPop) {
+  WorkStealingDeque<int*> dq(4);
+  vector<int> vals(100);
+
+  for (auto& v : vals) {
+    dq.push(&v);
+  }
+  ASSERT_EQ(dq.size(), 100);
+
+  // owner pops in LIFO order
+  for (int i = 99; i >= 0; --i) {
+    int* p = nullptr;
+    ASSERT_TRUE(dq.pop(p));
+    ASSERT_TRUE(p == &vals[i]);
+  }
+
+  int* p = nullptr;
+  ASSERT_FALSE(dq.pop(p));
+  ASSERT_TRUE(dq.empty());
+}
+
+TEST(WorkStealingDeque, testSteal) {
+  WorkStealingDeque<int*> dq(4);
+  vector<int> vals(10);
+
+  for (auto& v : vals) {
+    dq.push(&v);
+  }
+
+  // thieves take in FIFO order
+  for (int i = 0; i < 10; ++i) {
+    int* p = nullptr;
+    ASSERT_TRUE(dq.steal(p));
+    ASSERT_TRUE(p == &vals[i]);
+  }
+
+  int* p = nullptr;
+  ASSERT_FALSE(dq.steal(p));
+}
+
+TEST(WorkStealingDeque, testConcurrentSteal) {
+  FORK {
+    const int total = 100000;
+    const int numThieves = 3;
+
+    WorkStealingDeque<int*> dq(16);
+    vector<int> vals(total, 0);
+    atomic<bool> done(false);
+    atomic<int> taken(0);
+
+    vector<thread> thieves;
+    for (int i = 0; i < numThieves; ++i) {
+      thieves.emplace_back([&]() {
+        while (!done || !dq.empty()) {
+          int* p = nullptr;
+          if (dq.steal(p)) {
+            ++*p;
+            ++taken;
+          }
+        }
+      });
+    }
+
+    for (int i = 0; i < total; ++i) {
+      dq.push(&vals[i]);
+      if (i % 3 == 0) {
+        int* p = nullptr;
+        if (dq.pop(p)) {
+          ++*p;
+          ++taken;
+        }
+      }
+    }
+
+    done = true;
+    for (auto& t : thieves) {
+      t.join();
+    }
+
+    ASSERT_EQ(taken.load(), total);
+    for (auto v : vals) {
+      ASSERT_EQ(v, 1);
+    }
+  };
+}
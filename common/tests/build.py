@@ -26,6 +26,58 @@ cpp_unittest(
   ],
 )
 
+cpp_unittest(
+  name = "workstealingdeque_test",
+  srcs = [
+    "WorkStealingDequeTest.cpp",
+  ],
+  deps = [
+    "common:libbase.a",
+  ],
+  linkopt = [
+    "-pthread",
+  ],
+)
+
+cpp_unittest(
+  name = "task_test",
+  srcs = [
+    "TaskTest.cpp",
+  ],
+  deps = [
+    "common:libbase.a",
+  ],
+  linkopt = [
+    "-pthread",
+  ],
+)
+
+cpp_unittest(
+  name = "mpscqueue_test",
+  srcs = [
+    "MpscQueueTest.cpp",
+  ],
+  deps = [
+    "common:libbase.a",
+  ],
+  linkopt = [
+    "-pthread",
+  ],
+)
+
+cpp_unittest(
+  name = "timerwheel_test",
+  srcs = [
+    "TimerWheelTest.cpp",
+  ],
+  deps = [
+    "common:libbase.a",
+  ],
+  linkopt = [
+    "-pthread",
+  ],
+)
+
 cpp_unittest(
   name = "event_test",
   srcs = [
@@ -39,6 +91,19 @@ cpp_unittest(
   ],
 )
 
+cpp_unittest(
+  name = "uring_test",
+  srcs = [
+    "UringTest.cpp",
+  ],
+  deps = [
+    "common:libbase.a",
+  ],
+  linkopt = [
+    "-pthread",
+  ],
+)
+
 cpp_unittest(
   name = "range_test",
   srcs = [
@@ -49,6 +114,29 @@ cpp_unittest(
   ],
 )
 
+cpp_unittest(
+  name = "bufferpool_test",
+  srcs = [
+    "BufferPoolTest.cpp",
+  ],
+  deps = [
+    "common:libbase.a",
+  ],
+  linkopt = [
+    "-pthread",
+  ],
+)
+
+cpp_unittest(
+  name = "iobuf_test",
+  srcs = [
+    "IoBufTest.cpp",
+  ],
+  deps = [
+    "common:libbase.a",
+  ],
+)
+
 cpp_unittest(
   name = "serializer_test",
   srcs = [
@@ -59,6 +147,36 @@ cpp_unittest(
   ],
 )
 
+cpp_unittest(
+  name = "varint_test",
+  srcs = [
+    "VarintTest.cpp",
+  ],
+  deps = [
+    "common:libbase.a",
+  ],
+)
+
+cpp_unittest(
+  name = "serializerview_test",
+  srcs = [
+    "SerializerViewTest.cpp",
+  ],
+  deps = [
+    "common:libbase.a",
+  ],
+)
+
+cpp_unittest(
+  name = "record_test",
+  srcs = [
+    "RecordTest.cpp",
+  ],
+  deps = [
+    "common:libbase.a",
+  ],
+)
+
 cpp_unittest(
   name = "sharedmutex_test",
   srcs = [
@@ -72,6 +190,42 @@ cpp_unittest(
   ],
 )
 
+cpp_unittest(
+  name = "slab_test",
+  srcs = [
+    "SlabTest.cpp",
+  ],
+  deps = [
+    "common:libbase.a",
+  ],
+  linkopt = [
+    "-pthread",
+  ],
+)
+
+cpp_unittest(
+  name = "memoryprovider_test",
+  srcs = [
+    "MemoryProviderTest.cpp",
+  ],
+  deps = [
+    "common:libbase.a",
+  ],
+)
+
+cpp_unittest(
+  name = "arena_test",
+  srcs = [
+    "ArenaTest.cpp",
+  ],
+  deps = [
+    "common:libbase.a",
+  ],
+  linkopt = [
+    "-pthread",
+  ],
+)
+
 cpp_unittest(
   name = "fastalloc_test",
   srcs = [
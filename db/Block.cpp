@@ -0,0 +1,77 @@
+#include "db/Block.h"
+#include "common/Logging.h"
+#include "common/Serializer.h"
+
+#include <algorithm>
+
+using namespace std;
+
+
+namespace sdb {
+
+BlockBuilder::BlockBuilder(int restartInterval)
+  : restartInterval_(restartInterval),
+    counter_(0),
+    numEntries_(0),
+    finished_(false) {
+  if (restartInterval_ < 1) {
+    LOG(FATAL) << "Fails to build blocks with restart interval "
+               << restartInterval_;
+  }
+  restarts_.push_back(0);
+}
+
+void BlockBuilder::add(const Range& key, const Range& value) {
+  if (finished_) {
+    LOG(FATAL) << "Fails to add a key to a finished block";
+  }
+
+  size_t shared = 0;
+  if (counter_ < restartInterval_) {
+    size_t n = min<size_t>(lastKey_.size(), key.size());
+    auto k = key.begin();
+    while (shared < n && lastKey_[shared] == k[shared]) {
+      ++shared;
+    }
+  } else {
+    restarts_.push_back(buffer_.size());
+    counter_ = 0;
+  }
+  size_t unshared = key.size() - shared;
+
+  char header[3 * kMaxVarintSize];
+  auto p = encodeVarint(header, shared);
+  p = encodeVarint(p, unshared);
+  p = encodeVarint(p, value.size());
+  buffer_.append(header, p);
+  buffer_.append(key.begin() + shared, unshared);
+  buffer_.append(value.begin(), value.size());
+
+  lastKey_.resize(shared);
+  lastKey_.append(key.begin() + shared, unshared);
+  ++counter_;
+  ++numEntries_;
+}
+
+Range BlockBuilder::finish() {
+  if (!finished_) {
+    for (auto offset : restarts_) {
+      FixedWire::appendInt(buffer_, offset);
+    }
+    FixedWire::appendInt(buffer_, (uint32_t)restarts_.size());
+    finished_ = true;
+  }
+  return Range(buffer_);
+}
+
+void BlockBuilder::reset() {
+  buffer_.clear();
+  restarts_.clear();
+  restarts_.push_back(0);
+  counter_ = 0;
+  numEntries_ = 0;
+  lastKey_.clear();
+  finished_ = false;
+}
+
+}
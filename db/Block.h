@@ -0,0 +1,363 @@
+#ifndef DB_BLOCK_H
+#define DB_BLOCK_H
+
+#include "db/Comparator.h"
+#include "common/Range.h"
+#include "common/Varint.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <endian.h>
+#include <string.h>
+
+
+namespace sdb {
+
+// A block of sorted keys and values, prefix compressed:
+//
+//   block   := entry* restart* fixed32 numRestarts
+//   entry   := varint(shared) varint(unshared) varint(value size)
+//              key[shared..] value
+//   restart := fixed32 offset of an entry
+//
+// where shared is the length of the prefix the key has in common with the
+// key before it. Every restartInterval keys the whole key is written, with
+// shared 0, and its offset goes into the restart array. A reader binary
+// searches the restarts, whose keys it compares in place, and decodes at
+// most an interval of entries after that, so a point lookup touches the
+// restart array, a few restart keys and a short run of entries.
+//
+// Fixed width integers are big endian, as FixedWire writes them.
+class BlockBuilder {
+ public:
+
+  explicit BlockBuilder(int restartInterval = 16);
+
+  BlockBuilder(const BlockBuilder&) = delete;
+
+  BlockBuilder& operator=(const BlockBuilder&) = delete;
+
+  // Append @key and @value. Keys must be added in the order of the
+  // comparator the block is read with, and not after finish()
+  void add(const Range& key, const Range& value);
+
+  // Append the restart array and return the block, which stays valid
+  // until the builder is reset or destroyed
+  Range finish();
+
+  // start an empty block
+  void reset();
+
+  // size of the block if it were finished now
+  size_t currentSize() const {
+    return buffer_.size() + (restarts_.size() + 1) * sizeof(uint32_t);
+  }
+
+  int64_t numEntries() const { return numEntries_; }
+
+  bool empty() const { return numEntries_ == 0; }
+
+ private:
+
+  const int restartInterval_;
+
+  std::string buffer_;
+
+  std::vector<uint32_t> restarts_;
+
+  // entries since the last restart
+  int counter_;
+
+  int64_t numEntries_;
+
+  std::string lastKey_;
+
+  bool finished_;
+};
+
+
+// Decode the header of the entry at @p, which ends before @limit, and
+// return where its key bytes start, or nullptr if it is malformed
+inline char* decodeBlockEntry(char* p, char* limit, uint32_t& shared,
+                              uint32_t& unshared, uint32_t& valueSize) {
+  if (limit - p < 3) {
+    return nullptr;
+  }
+
+  // usually all three fit in a byte each
+  shared = (unsigned char)p[0];
+  unshared = (unsigned char)p[1];
+  valueSize = (unsigned char)p[2];
+  if ((shared | unshared | valueSize) < 128) {
+    p += 3;
+  } else {
+    Range range(p, limit);
+    uint64_t vals[3];
+    for (auto& val : vals) {
+      if (!decodeVarint(range, val) || val > UINT32_MAX) {
+        return nullptr;
+      }
+    }
+    shared = vals[0];
+    unshared = vals[1];
+    valueSize = vals[2];
+    p = range.begin();
+  }
+
+  if ((uint64_t)unshared + valueSize > (uint64_t)(limit - p)) {
+    return nullptr;
+  }
+  return p;
+}
+
+
+// Reads a block written by BlockBuilder. The block memory is not copied
+// and must outlive the reader and its iterators.
+//
+// A reader may be assigned another block. Its iterators then have to be
+// positioned again with one of the seek calls.
+template <class Comparator = BytewiseComparator>
+class BlockReader {
+ public:
+
+  explicit BlockReader(const Range& contents = Range(),
+                       const Comparator& cmp = Comparator());
+
+  // whether the restart array is well formed. A bad block reads as empty
+  bool good() const { return numRestarts_ > 0; }
+
+  size_t size() const { return data_.size(); }
+
+  const Comparator& comparator() const { return cmp_; }
+
+  // Walks the block in key order, forwards or backwards. The current key
+  // is rebuilt in a buffer of the iterator, so once the buffer has grown
+  // to the longest key, moving the iterator does not allocate
+  class Iterator {
+   public:
+
+    explicit Iterator(const BlockReader* block)
+      : block_(block),
+        current_(block->restartsOffset_),
+        next_(block->restartsOffset_),
+        restartIndex_(0),
+        corrupted_(false) {}
+
+    bool valid() const { return current_ < block_->restartsOffset_; }
+
+    // whether iteration stopped at a malformed entry
+    bool corrupted() const { return corrupted_; }
+
+    Range key() const {
+      auto p = const_cast<char*>(key_.data());
+      return Range(p, p + key_.size());
+    }
+
+    Range value() const { return value_; }
+
+    void next() { parseNext(); }
+
+    // Step back by scanning forward from the restart point before the
+    // current entry
+    void prev();
+
+    void seekToFirst() {
+      seekToRestart(0);
+      parseNext();
+    }
+
+    void seekToLast();
+
+    // position at the first key not before @key
+    void seek(const Range& key);
+
+   private:
+
+    const BlockReader* block_;
+
+    // offsets of the current and of the following entry
+    uint32_t current_;
+
+    uint32_t next_;
+
+    // the restart point at or before the current entry
+    uint32_t restartIndex_;
+
+    std::string key_;
+
+    Range value_;
+
+    bool corrupted_;
+
+
+    void seekToRestart(uint32_t index);
+
+    // decode the entry at next_, false at the end of the entries
+    bool parseNext();
+
+    void markInvalid() {
+      current_ = next_ = block_->restartsOffset_;
+      key_.clear();
+    }
+  };
+
+ private:
+
+  Range data_;
+
+  Comparator cmp_;
+
+  // where the restart array starts, which is the end of the entries
+  uint32_t restartsOffset_;
+
+  uint32_t numRestarts_;
+
+
+  uint32_t restartPoint(uint32_t index) const {
+    uint32_t offset;
+    memcpy(&offset, data_.begin() + restartsOffset_ + index * 4, 4);
+    return be32toh(offset);
+  }
+
+  // the key at a restart point, in place. False if the entry is bad
+  bool restartKey(uint32_t index, Range& key) const;
+};
+
+
+template <class Comparator>
+BlockReader<Comparator>::BlockReader(
+  const Range& contents, const Comparator& cmp)
+  : data_(contents), cmp_(cmp), restartsOffset_(0), numRestarts_(0) {
+  if (data_.size() < 8 || data_.size() > UINT32_MAX) {
+    return;
+  }
+
+  uint32_t num;
+  memcpy(&num, data_.end() - 4, 4);
+  num = be32toh(num);
+  uint64_t maxRestarts = (data_.size() - 4) / 4;
+  if (num == 0 || num > maxRestarts) {
+    return;
+  }
+  restartsOffset_ = data_.size() - 4 - num * 4;
+  numRestarts_ = num;
+}
+
+template <class Comparator>
+bool BlockReader<Comparator>::restartKey(uint32_t index, Range& key) const {
+  auto p = const_cast<char*>(data_.begin());
+  auto limit = p + restartsOffset_;
+  uint32_t shared, unshared, valueSize;
+  auto offset = restartPoint(index);
+  auto k = (offset < restartsOffset_)
+    ? decodeBlockEntry(p + offset, limit, shared, unshared, valueSize)
+    : nullptr;
+  if (!k || shared != 0) {
+    return false;
+  }
+  key = Range(k, k + unshared);
+  return true;
+}
+
+template <class Comparator>
+void BlockReader<Comparator>::Iterator::seekToRestart(uint32_t index) {
+  key_.clear();
+  restartIndex_ = index;
+  next_ = (index < block_->numRestarts_)
+    ? block_->restartPoint(index) : block_->restartsOffset_;
+}
+
+template <class Comparator>
+bool BlockReader<Comparator>::Iterator::parseNext() {
+  auto limit = block_->restartsOffset_;
+  current_ = next_;
+  if (current_ >= limit) {
+    markInvalid();
+    return false;
+  }
+
+  auto base = const_cast<char*>(block_->data_.begin());
+  uint32_t shared, unshared, valueSize;
+  auto p = decodeBlockEntry(
+    base + current_, base + limit, shared, unshared, valueSize);
+  if (!p || shared > key_.size()) {
+    corrupted_ = true;
+    markInvalid();
+    return false;
+  }
+
+  key_.resize(shared);
+  key_.append(p, unshared);
+  value_ = Range(p + unshared, p + unshared + valueSize);
+  next_ = p + unshared + valueSize - base;
+
+  while (restartIndex_ + 1 < block_->numRestarts_ &&
+         block_->restartPoint(restartIndex_ + 1) <= current_) {
+    ++restartIndex_;
+  }
+  return true;
+}
+
+template <class Comparator>
+void BlockReader<Comparator>::Iterator::prev() {
+  auto original = current_;
+  while (block_->restartPoint(restartIndex_) >= original) {
+    if (restartIndex_ == 0) {
+      // before the first entry
+      markInvalid();
+      return;
+    }
+    --restartIndex_;
+  }
+
+  seekToRestart(restartIndex_);
+  while (parseNext() && next_ < original) {
+  }
+}
+
+template <class Comparator>
+void BlockReader<Comparator>::Iterator::seekToLast() {
+  seekToRestart(block_->numRestarts_ - 1);
+  while (parseNext() && next_ < block_->restartsOffset_) {
+  }
+}
+
+template <class Comparator>
+void BlockReader<Comparator>::Iterator::seek(const Range& key) {
+  if (block_->numRestarts_ == 0) {
+    markInvalid();
+    return;
+  }
+
+  // the last restart point with a key before @key, or the first one
+  uint32_t lo = 0;
+  uint32_t hi = block_->numRestarts_ - 1;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi + 1) / 2;
+    Range midKey;
+    if (!block_->restartKey(mid, midKey)) {
+      corrupted_ = true;
+      markInvalid();
+      return;
+    }
+    if (block_->cmp_(midKey, key) < 0) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+
+  seekToRestart(lo);
+  while (parseNext()) {
+    if (block_->cmp_(this->key(), key) >= 0) {
+      return;
+    }
+  }
+}
+
+}
+
+#endif // DB_BLOCK_H
@@ -0,0 +1,393 @@
+#include "db/BlockCache.h"
+#include "common/Logging.h"
+#include "common/Slab.h"
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+using namespace std;
+
+
+namespace sdb {
+
+static inline uint64_t hashCacheKey(const CacheKey& key) {
+  uint64_t h = key.fileId * 0x9e3779b97f4a7c15ULL ^ key.offset;
+  h ^= h >> 31;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 29;
+  return h;
+}
+
+struct CacheKeyHasher {
+  size_t operator()(const CacheKey& key) const { return hashCacheKey(key); }
+};
+
+
+struct BlockCache::Handle {
+  CacheKey key;
+  void* value;
+  Deleter deleter;
+  size_t charge;
+  uint64_t hash;
+
+  // one for the cache while the entry is in it, one per handle
+  uint32_t refs;
+  int priority;
+  bool inCache;
+
+  // in an LRU list if only the cache holds it, else in the free list
+  // of the caller that drops the last reference
+  Handle* prev;
+  Handle* next;
+
+  SDB_POOLED(Handle)
+};
+
+
+// Counts how often keys were looked up lately, in 4 rows of 4-bit
+// counters, a key's count being the least of its counters. All counters
+// are halved every 10 lookups per counter of a row, so that old
+// lookups fade out
+class CacheSketch {
+ public:
+
+  explicit CacheSketch(size_t width)
+    : mask_(width - 1),
+      counters_(width * kRows, 0),
+      samples_(0),
+      sampleSize_(width * 10) {}
+
+  void increment(uint64_t hash) {
+    for (int i = 0; i < kRows; ++i) {
+      auto& c = counters_[index(hash, i)];
+      if (c < 15) {
+        ++c;
+      }
+    }
+    if (++samples_ >= sampleSize_) {
+      age();
+    }
+  }
+
+  int frequency(uint64_t hash) const {
+    int ret = 15;
+    for (int i = 0; i < kRows; ++i) {
+      ret = min<int>(ret, counters_[index(hash, i)]);
+    }
+    return ret;
+  }
+
+ private:
+
+  static const int kRows = 4;
+
+  const size_t mask_;
+
+  vector<uint8_t> counters_;
+
+  size_t samples_;
+
+  const size_t sampleSize_;
+
+
+  size_t index(uint64_t hash, int row) const {
+    static const uint64_t seeds[kRows] = {
+      0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL,
+      0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL,
+    };
+    return row * (mask_ + 1) + (((hash * seeds[row]) >> 32) & mask_);
+  }
+
+  void age() {
+    for (auto& c : counters_) {
+      c >>= 1;
+    }
+    samples_ /= 2;
+  }
+};
+
+
+struct BlockCache::Shard {
+  mutex mt;
+  unordered_map<CacheKey, Handle*, CacheKeyHasher> table;
+
+  // dummy heads of the LRU lists by priority, the oldest entry first
+  Handle lru[2];
+  int64_t lruUsage[2];
+
+  const int64_t capacity;
+  const int64_t highCapacity;
+  int64_t usage;
+
+  const bool admission;
+  CacheSketch sketch;
+
+  int64_t hits;
+  int64_t misses;
+  int64_t inserts;
+  int64_t evictions;
+  int64_t rejections;
+
+  Shard(int64_t cap, double highRatio, bool admit)
+    : capacity(cap),
+      highCapacity(cap * highRatio),
+      usage(0),
+      admission(admit),
+      sketch(admit ? sketchWidth(cap) : 1),
+      hits(0),
+      misses(0),
+      inserts(0),
+      evictions(0),
+      rejections(0) {
+    for (int i = 0; i < 2; ++i) {
+      lru[i].prev = lru[i].next = &lru[i];
+      lruUsage[i] = 0;
+    }
+  }
+
+  // about two counters a row per 4KB block the shard holds
+  static size_t sketchWidth(int64_t cap) {
+    size_t width = 64;
+    while ((int64_t)width < cap / 2048) {
+      width <<= 1;
+    }
+    return width;
+  }
+
+  void lruAppend(Handle* h) {
+    auto& head = lru[h->priority];
+    h->next = &head;
+    h->prev = head.prev;
+    head.prev->next = h;
+    head.prev = h;
+    lruUsage[h->priority] += h->charge;
+  }
+
+  void lruRemove(Handle* h) {
+    h->prev->next = h->next;
+    h->next->prev = h->prev;
+    lruUsage[h->priority] -= h->charge;
+  }
+
+  // the entry to evict next, nullptr if all are pinned
+  Handle* victim() {
+    for (auto& head : lru) {
+      if (head.next != &head) {
+        return head.next;
+      }
+    }
+    return nullptr;
+  }
+
+  // drop a reference, an entry without any goes on @freed
+  void unref(Handle* h, Handle*& freed) {
+    if (--h->refs == 0) {
+      h->next = freed;
+      freed = h;
+    }
+  }
+
+  void remove(Handle* h, Handle*& freed) {
+    table.erase(h->key);
+    if (h->refs == 1) {
+      lruRemove(h);
+    }
+    h->inCache = false;
+    usage -= h->charge;
+    unref(h, freed);
+  }
+
+  void evict(Handle*& freed) {
+    // least recently used high priority entries beyond their share
+    auto& high = lru[cache_high];
+    while (lruUsage[cache_high] > highCapacity) {
+      auto h = high.next;
+      lruRemove(h);
+      h->priority = cache_low;
+      lruAppend(h);
+    }
+
+    while (usage > capacity) {
+      auto h = victim();
+      if (!h) {
+        break;
+      }
+      remove(h, freed);
+      ++evictions;
+    }
+  }
+};
+
+// outside of the shard lock, deleters may take a while
+static void freeCacheEntries(BlockCache::Handle* freed);
+
+
+BlockCache::BlockCache(size_t capacity, int numShardBits, bool admission,
+                       double highPriorityRatio)
+  : capacity_(capacity), numShardBits_(numShardBits) {
+  if (numShardBits_ < 0 || numShardBits_ > 16) {
+    LOG(FATAL) << "Fails to create a block cache of 2^" << numShardBits_
+               << " shards";
+  }
+
+  int num = 1 << numShardBits_;
+  for (int i = 0; i < num; ++i) {
+    shards_.emplace_back(new Shard(
+      (capacity + num - 1) / num, highPriorityRatio, admission));
+  }
+}
+
+BlockCache::~BlockCache() {
+  for (auto& shard : shards_) {
+    Handle* freed = nullptr;
+    for (auto& entry : shard->table) {
+      auto h = entry.second;
+      if (h->refs != 1) {
+        LOG(FATAL) << "Fails to destroy a block cache with pinned entries";
+      }
+      h->next = freed;
+      freed = h;
+    }
+    freeCacheEntries(freed);
+  }
+}
+
+BlockCache::Handle* BlockCache::insert(
+  const CacheKey& key, void* value, size_t charge, Deleter deleter,
+  int priority) {
+  auto h = new Handle;
+  h->key = key;
+  h->value = value;
+  h->deleter = deleter;
+  h->charge = charge;
+  h->hash = hashCacheKey(key);
+  h->refs = 1;
+  h->priority = priority ? cache_high : cache_low;
+  h->inCache = false;
+
+  auto& shard = shardOf(h->hash);
+  Handle* freed = nullptr;
+  {
+    lock_guard<mutex> l(shard.mt);
+    auto it = shard.table.find(key);
+    auto victim = shard.victim();
+    if ((int64_t)charge > shard.capacity) {
+      // never fits
+    } else if (shard.admission && it == shard.table.end() && victim &&
+               shard.usage + (int64_t)charge > shard.capacity &&
+               shard.sketch.frequency(h->hash) <=
+               shard.sketch.frequency(victim->hash)) {
+      ++shard.rejections;
+    } else {
+      if (it != shard.table.end()) {
+        shard.remove(it->second, freed);
+      }
+
+      ++h->refs;
+      h->inCache = true;
+      shard.usage += charge;
+      shard.table.emplace(key, h);
+      ++shard.inserts;
+      shard.evict(freed);
+    }
+  }
+
+  freeCacheEntries(freed);
+  return h;
+}
+
+BlockCache::Handle* BlockCache::lookup(const CacheKey& key) {
+  auto hash = hashCacheKey(key);
+  auto& shard = shardOf(hash);
+  lock_guard<mutex> l(shard.mt);
+  if (shard.admission) {
+    shard.sketch.increment(hash);
+  }
+
+  auto it = shard.table.find(key);
+  if (it == shard.table.end()) {
+    ++shard.misses;
+    return nullptr;
+  }
+
+  auto h = it->second;
+  if (h->refs == 1) {
+    shard.lruRemove(h);
+  }
+  ++h->refs;
+  ++shard.hits;
+  return h;
+}
+
+void BlockCache::release(Handle* h) {
+  auto& shard = shardOf(h->hash);
+  Handle* freed = nullptr;
+  {
+    lock_guard<mutex> l(shard.mt);
+    shard.unref(h, freed);
+    if (h->refs == 1 && h->inCache) {
+      shard.lruAppend(h);
+      shard.evict(freed);
+    }
+  }
+  freeCacheEntries(freed);
+}
+
+void* BlockCache::value(const Handle* h) {
+  return h->value;
+}
+
+void BlockCache::erase(const CacheKey& key) {
+  auto& shard = shardOf(hashCacheKey(key));
+  Handle* freed = nullptr;
+  {
+    lock_guard<mutex> l(shard.mt);
+    auto it = shard.table.find(key);
+    if (it != shard.table.end()) {
+      shard.remove(it->second, freed);
+    }
+  }
+  freeCacheEntries(freed);
+}
+
+BlockCache::Stats BlockCache::shardStats(int i) const {
+  auto& shard = *shards_[i];
+  lock_guard<mutex> l(shard.mt);
+  Stats ret;
+  ret.hits = shard.hits;
+  ret.misses = shard.misses;
+  ret.inserts = shard.inserts;
+  ret.evictions = shard.evictions;
+  ret.rejections = shard.rejections;
+  ret.usage = shard.usage;
+  ret.pinnedUsage =
+    shard.usage - shard.lruUsage[cache_low] - shard.lruUsage[cache_high];
+  return ret;
+}
+
+BlockCache::Stats BlockCache::stats() const {
+  Stats ret{0, 0, 0, 0, 0, 0, 0};
+  for (int i = 0; i < numShards(); ++i) {
+    auto s = shardStats(i);
+    ret.hits += s.hits;
+    ret.misses += s.misses;
+    ret.inserts += s.inserts;
+    ret.evictions += s.evictions;
+    ret.rejections += s.rejections;
+    ret.usage += s.usage;
+    ret.pinnedUsage += s.pinnedUsage;
+  }
+  return ret;
+}
+
+static void freeCacheEntries(BlockCache::Handle* freed) {
+  while (freed) {
+    auto h = freed;
+    freed = h->next;
+    h->deleter(h->key, h->value);
+    delete h;
+  }
+}
+
+}
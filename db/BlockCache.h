@@ -0,0 +1,125 @@
+#ifndef DB_BLOCKCACHE_H
+#define DB_BLOCKCACHE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+
+namespace sdb {
+
+// a block of a file
+struct CacheKey {
+  uint64_t fileId;
+  uint64_t offset;
+
+  bool operator==(const CacheKey& another) const {
+    return fileId == another.fileId && offset == another.offset;
+  }
+};
+
+
+// A cache of decoded blocks, table handles or anything else read from
+// files, charged by the bytes each entry holds.
+//
+// Keys are hashed over shards, each with its own lock, table and two LRU
+// lists: one for high priority entries such as index and filter blocks,
+// which are evicted only after the low priority ones, and one for the
+// rest. High priority entries are kept up to a share of the capacity,
+// beyond that the least recently used of them move to the low list.
+//
+// A lookup or insert returns a handle that pins the entry until it is
+// released, so that an iterator can hold on to a block. Pinned entries
+// are not evicted, and may take the cache over its capacity. An entry
+// replaced or erased while pinned is freed when its last handle is
+// released.
+//
+// With admission on, a shard that is full only takes a new entry if its
+// key was looked up more often than the key it would evict, as counted
+// by a TinyLFU sketch of recent lookups. Then a large scan, whose blocks
+// are each read once, does not flush the blocks read over and over.
+class BlockCache {
+ public:
+
+  enum {
+    cache_low = 0,
+    cache_high = 1,
+  };
+
+  struct Handle;
+
+  typedef void (*Deleter)(const CacheKey& key, void* value);
+
+  struct Stats {
+    int64_t hits;
+    int64_t misses;
+    int64_t inserts;
+    int64_t evictions;
+
+    // inserts turned away by admission
+    int64_t rejections;
+
+    // bytes charged, and of those the bytes pinned
+    int64_t usage;
+    int64_t pinnedUsage;
+  };
+
+  // @capacity bytes over 2^@numShardBits shards. @highPriorityRatio is
+  // the share of a shard high priority entries are kept in
+  explicit BlockCache(size_t capacity, int numShardBits = 4,
+                      bool admission = false,
+                      double highPriorityRatio = 0.5);
+
+  // all handles must have been released
+  ~BlockCache();
+
+  BlockCache(const BlockCache&) = delete;
+
+  BlockCache& operator=(const BlockCache&) = delete;
+
+  // Insert @value of @charge bytes for @key, replacing the entry there,
+  // and return a handle of it. @deleter frees @value once it is out of
+  // the cache and released. If admission turns it away, or it is larger
+  // than a shard, the value is not cached but the handle still works
+  Handle* insert(const CacheKey& key, void* value, size_t charge,
+                 Deleter deleter, int priority = cache_low);
+
+  // a handle of the entry of @key, nullptr if there is none
+  Handle* lookup(const CacheKey& key);
+
+  // unpin a handle returned by insert() or lookup()
+  void release(Handle* handle);
+
+  static void* value(const Handle* handle);
+
+  void erase(const CacheKey& key);
+
+  size_t capacity() const { return capacity_; }
+
+  int numShards() const { return shards_.size(); }
+
+  Stats shardStats(int shard) const;
+
+  // the sum of all shards
+  Stats stats() const;
+
+ private:
+
+  struct Shard;
+
+  const size_t capacity_;
+
+  const int numShardBits_;
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+
+
+  Shard& shardOf(uint64_t hash) const {
+    return *shards_[numShardBits_ ? hash >> (64 - numShardBits_) : 0];
+  }
+};
+
+}
+
+#endif // DB_BLOCKCACHE_H
@@ -0,0 +1,23 @@
+#ifndef DB_COMPARATOR_H
+#define DB_COMPARATOR_H
+
+#include "common/Range.h"
+
+
+namespace sdb {
+
+// Orders keys as strings of unsigned bytes, a key sorting before any
+// longer key it is a prefix of.
+//
+// Tables take their comparator as a template parameter, so any class
+// with the same call operator, returning <0, 0 or >0 as @a sorts before,
+// equal to or after @b, can replace it.
+struct BytewiseComparator {
+  int operator()(const Range& a, const Range& b) const {
+    return a.compare(b);
+  }
+};
+
+}
+
+#endif // DB_COMPARATOR_H
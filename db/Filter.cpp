@@ -0,0 +1,294 @@
+#include "db/Filter.h"
+#include "common/Logging.h"
+#include "common/Serializer.h"
+
+#include <algorithm>
+
+#include <endian.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+
+namespace sdb {
+
+const size_t FilterReader::kTrailerSize;
+
+// the bits a key sets in a Bloom block, one per word
+static const uint32_t kBloomSalts[8] = {
+  0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+  0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U,
+};
+
+static const int kBloomBlockSize = 32;
+
+// map @x to [0, @n) without a division
+static inline uint32_t reduceRange(uint32_t x, uint32_t n) {
+  return ((uint64_t)x * n) >> 32;
+}
+
+static inline void bloomMasks(uint32_t key, uint32_t* masks) {
+  for (int i = 0; i < 8; ++i) {
+    masks[i] = 1U << ((key * kBloomSalts[i]) >> 27);
+  }
+}
+
+
+typedef bool (*BloomProbe)(const char* block, uint32_t key);
+
+static bool bloomProbeScalar(const char* block, uint32_t key) {
+  uint32_t masks[8];
+  bloomMasks(key, masks);
+  for (int i = 0; i < 8; ++i) {
+    uint32_t word;
+    memcpy(&word, block + i * 4, 4);
+    if (!(le32toh(word) & masks[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2")))
+static bool bloomProbeAvx2(const char* block, uint32_t key) {
+  auto salts = _mm256_loadu_si256((const __m256i*)kBloomSalts);
+  auto shifts = _mm256_srli_epi32(
+    _mm256_mullo_epi32(_mm256_set1_epi32(key), salts), 27);
+  auto masks = _mm256_sllv_epi32(_mm256_set1_epi32(1), shifts);
+  auto words = _mm256_loadu_si256((const __m256i*)block);
+
+  // all bits of masks are set in words
+  bool ret = _mm256_testc_si256(words, masks);
+  _mm256_zeroupper();
+  return ret;
+}
+
+static BloomProbe pickBloomProbe() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") ? bloomProbeAvx2 : bloomProbeScalar;
+}
+
+#else
+
+static BloomProbe pickBloomProbe() {
+  return bloomProbeScalar;
+}
+
+#endif
+
+
+// scatters the bits of a hash, for xor filters
+static inline uint64_t xorMix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// slot @i of a mixed hash @h, in the i-th third of the slots
+static inline uint32_t xorSlot(uint64_t h, int i, uint32_t blockLength) {
+  uint64_t r = (h << (21 * i)) | (h >> ((64 - 21 * i) & 63));
+  return reduceRange((uint32_t)r, blockLength) + i * blockLength;
+}
+
+static inline uint32_t xorFingerprint(uint64_t h, int width) {
+  return (uint32_t)(h ^ (h >> 32)) & ((1U << width) - 1);
+}
+
+
+FilterBuilder::FilterBuilder(int type, int bitsPerKey)
+  : type_(type), bitsPerKey_(bitsPerKey) {
+  if (type_ != filter_bloom && type_ != filter_xor) {
+    LOG(FATAL) << "Fails to build filters of type " << type_;
+  }
+  if (bitsPerKey_ < 1) {
+    LOG(FATAL) << "Fails to build filters of " << bitsPerKey_
+               << " bits per key";
+  }
+}
+
+void FilterBuilder::finish(string& out) {
+  if (type_ == filter_bloom) {
+    finishBloom(out);
+  } else {
+    finishXor(out);
+  }
+  hashes_.clear();
+}
+
+void FilterBuilder::finishBloom(string& out) {
+  uint64_t bits = (uint64_t)hashes_.size() * bitsPerKey_;
+  uint32_t numBlocks = max<uint64_t>(1, (bits + 255) / 256);
+
+  vector<uint32_t> words(numBlocks * 8, 0);
+  for (auto hash : hashes_) {
+    auto block = &words[reduceRange(hash >> 32, numBlocks) * 8];
+    uint32_t masks[8];
+    bloomMasks((uint32_t)hash, masks);
+    for (int i = 0; i < 8; ++i) {
+      block[i] |= masks[i];
+    }
+  }
+
+  for (auto word : words) {
+    word = htole32(word);
+    out.append((const char*)&word, 4);
+  }
+  FixedWire::appendInt(out, numBlocks);
+  FixedWire::appendInt(out, (uint64_t)0);
+  out.push_back(0);
+  out.push_back(filter_bloom);
+}
+
+void FilterBuilder::finishXor(string& out) {
+  // the same key twice could never be peeled
+  sort(hashes_.begin(), hashes_.end());
+  hashes_.erase(unique(hashes_.begin(), hashes_.end()), hashes_.end());
+
+  int width = (bitsPerKey_ >= 16) ? 16 : 8;
+  uint32_t blockLength = (32 + 1.23 * hashes_.size()) / 3;
+  uint32_t capacity = blockLength * 3;
+
+  vector<uint64_t> xorMask(capacity);
+  vector<uint32_t> count(capacity);
+  vector<uint32_t> queue;
+  vector<pair<uint64_t, uint32_t>> stack;
+
+  // try seeds until every key has a slot of its own. Each try succeeds
+  // with a high probability
+  uint64_t seed = 0;
+  for (int attempt = 0; ; ++attempt) {
+    seed = xorMix(0x9e3779b97f4a7c15ULL * (attempt + 1));
+    fill(xorMask.begin(), xorMask.end(), 0);
+    fill(count.begin(), count.end(), 0);
+    for (auto hash : hashes_) {
+      auto h = xorMix(hash + seed);
+      for (int i = 0; i < 3; ++i) {
+        auto slot = xorSlot(h, i, blockLength);
+        xorMask[slot] ^= h;
+        ++count[slot];
+      }
+    }
+
+    queue.clear();
+    for (uint32_t i = 0; i < capacity; ++i) {
+      if (count[i] == 1) {
+        queue.push_back(i);
+      }
+    }
+
+    stack.clear();
+    while (!queue.empty()) {
+      auto slot = queue.back();
+      queue.pop_back();
+      if (count[slot] != 1) {
+        continue;
+      }
+
+      auto h = xorMask[slot];
+      stack.emplace_back(h, slot);
+      for (int i = 0; i < 3; ++i) {
+        auto other = xorSlot(h, i, blockLength);
+        xorMask[other] ^= h;
+        if (--count[other] == 1) {
+          queue.push_back(other);
+        }
+      }
+    }
+
+    if (stack.size() == hashes_.size()) {
+      break;
+    }
+  }
+
+  // the last key peeled is assigned first, its other slots are final
+  vector<uint16_t> fingerprints(capacity, 0);
+  for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+    auto h = it->first;
+    uint32_t fp = xorFingerprint(h, width);
+    for (int i = 0; i < 3; ++i) {
+      fp ^= fingerprints[xorSlot(h, i, blockLength)];
+    }
+    fingerprints[it->second] = fp;
+  }
+
+  for (auto fp : fingerprints) {
+    if (width == 8) {
+      out.push_back((char)fp);
+    } else {
+      fp = htole16(fp);
+      out.append((const char*)&fp, 2);
+    }
+  }
+  FixedWire::appendInt(out, blockLength);
+  FixedWire::appendInt(out, seed);
+  out.push_back(width);
+  out.push_back(filter_xor);
+}
+
+
+FilterReader::FilterReader(const Range& contents)
+  : data_(contents.begin()), type_(filter_none), width_(0), size_(0),
+    seed_(0) {
+  if (contents.size() < (int64_t)kTrailerSize) {
+    return;
+  }
+
+  auto end = const_cast<char*>(contents.end());
+  Range trailer(end - kTrailerSize, end);
+  FixedWire::parseInt(trailer, size_);
+  FixedWire::parseInt(trailer, seed_);
+  int width = (unsigned char)trailer.begin()[0];
+  int type = (unsigned char)trailer.begin()[1];
+
+  uint64_t payload = contents.size() - kTrailerSize;
+  if (type == filter_bloom && size_ > 0 &&
+      payload == (uint64_t)size_ * kBloomBlockSize) {
+    type_ = filter_bloom;
+  } else if (type == filter_xor && (width == 8 || width == 16) &&
+             payload == (uint64_t)size_ * 3 * width / 8) {
+    type_ = filter_xor;
+    width_ = width;
+  }
+}
+
+bool FilterReader::mayContain(uint64_t hash) const {
+  static const BloomProbe probe = pickBloomProbe();
+
+  switch (type_) {
+    case filter_bloom: {
+      auto block = data_ + reduceRange(hash >> 32, size_) * kBloomBlockSize;
+      return probe(block, (uint32_t)hash);
+    }
+    case filter_xor:
+      return mayContainXor(hash);
+    default:
+      return true;
+  }
+}
+
+bool FilterReader::mayContainXor(uint64_t hash) const {
+  auto h = xorMix(hash + seed_);
+  uint32_t fp = xorFingerprint(h, width_);
+  for (int i = 0; i < 3; ++i) {
+    auto slot = xorSlot(h, i, size_);
+    if (width_ == 8) {
+      fp ^= (unsigned char)data_[slot];
+    } else {
+      uint16_t v;
+      memcpy(&v, data_ + slot * 2, 2);
+      fp ^= le16toh(v);
+    }
+  }
+  return fp == 0;
+}
+
+}
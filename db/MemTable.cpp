@@ -0,0 +1,31 @@
+#include "db/MemTable.h"
+
+#include <chrono>
+#include <functional>
+#include <thread>
+
+
+namespace sdb {
+
+int randomSkiplistHeight(int maxHeight) {
+  // xorshift, seeded differently on each thread
+  static thread_local uint64_t state =
+    std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+    std::chrono::steady_clock::now().time_since_epoch().count() ^
+    0x9e3779b97f4a7c15ULL;
+
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+
+  // two random bits per level
+  int height = 1;
+  auto bits = state;
+  while (height < maxHeight && (bits & 3) == 0) {
+    ++height;
+    bits >>= 2;
+  }
+  return height;
+}
+
+}
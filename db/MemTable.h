@@ -0,0 +1,270 @@
+#ifndef DB_MEMTABLE_H
+#define DB_MEMTABLE_H
+
+#include "db/Comparator.h"
+#include "common/Arena.h"
+#include "common/Range.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <new>
+
+#include <string.h>
+
+
+namespace sdb {
+
+// a random node height for a skiplist of @maxHeight levels, where each
+// level holds a quarter of the nodes of the level below
+int randomSkiplistHeight(int maxHeight);
+
+
+// An ordered in-memory table of keys and values, kept in a skiplist.
+//
+// Any number of threads may put() at the same time: a node is linked
+// into each level with a compare-and-swap, and a thread that loses a
+// race searches again from where it was. Readers never lock or retry,
+// a node becomes visible to them once it is linked on the bottom level.
+//
+// Each node is allocated from an Arena in one piece with its key and
+// value, so a put does not call malloc, and all memory is freed with the
+// table. Keys are never removed or updated in place.
+template <class Comparator = BytewiseComparator>
+class MemTable {
+ private:
+
+  struct Node;
+
+ public:
+
+  static const int kMaxHeight = 12;
+
+  // @provider, if any, must outlive the table
+  explicit MemTable(size_t chunkSize = 1024 * 1024,
+                    MemoryProvider* provider = nullptr,
+                    const Comparator& cmp = Comparator());
+
+  MemTable(const MemTable&) = delete;
+
+  MemTable& operator=(const MemTable&) = delete;
+
+  // Insert a copy of @key and @value. If @key is already in the table,
+  // the table is not changed and false is returned
+  bool put(const Range& key, const Range& value);
+
+  // find @key, @value points into the table if it is found
+  bool get(const Range& key, Range& value) const;
+
+  int64_t size() const { return size_.load(std::memory_order_relaxed); }
+
+  // bytes held by the arena of the table
+  size_t memoryUsage() const { return arena_.memoryUsage(); }
+
+  const Comparator& comparator() const { return cmp_; }
+
+  // Walks the table in key order. It sees every key put before it is
+  // positioned, and may or may not see keys put concurrently
+  class Iterator {
+   public:
+
+    explicit Iterator(const MemTable* table)
+      : table_(table), node_(nullptr) {}
+
+    bool valid() const { return node_ != nullptr; }
+
+    Range key() const { return node_->key(); }
+
+    Range value() const { return node_->value(); }
+
+    void next() { node_ = node_->next(0); }
+
+    void seekToFirst() { node_ = table_->head_->next(0); }
+
+    // position at the first key not before @key
+    void seek(const Range& key) { node_ = table_->findGreaterOrEqual(key); }
+
+   private:
+
+    const MemTable* table_;
+
+    const Node* node_;
+  };
+
+ private:
+
+  // allocated with one link per level of the node, followed by the key
+  // and the value
+  struct Node {
+    char* data;
+    uint32_t keySize;
+    uint32_t valueSize;
+    std::atomic<Node*> next_[1];
+
+    Node* next(int level) const {
+      return next_[level].load(std::memory_order_acquire);
+    }
+
+    Range key() const { return Range(data, data + keySize); }
+
+    Range value() const {
+      return Range(data + keySize, data + keySize + valueSize);
+    }
+  };
+
+  Arena arena_;
+
+  const Comparator cmp_;
+
+  Node* head_;
+
+  // height of the tallest node so far
+  std::atomic<int> maxHeight_;
+
+  std::atomic<int64_t> size_;
+
+
+  Node* newNode(const Range& key, const Range& value, int height);
+
+  // the first node not before @key, nullptr if there is none
+  Node* findGreaterOrEqual(const Range& key) const;
+
+  // Starting at @before, which sorts before @key, find the nodes on
+  // @level between which @key belongs. @bound, if reached, is known not
+  // to sort before @key, so it is not compared again
+  void findSplice(const Range& key, Node* before, Node* bound, int level,
+                  Node** prev, Node** next) const;
+};
+
+
+template <class Comparator>
+MemTable<Comparator>::MemTable(
+  size_t chunkSize, MemoryProvider* provider, const Comparator& cmp)
+  : arena_(chunkSize, alignof(Node), provider),
+    cmp_(cmp),
+    head_(nullptr),
+    maxHeight_(1),
+    size_(0) {
+  head_ = newNode(Range(), Range(), kMaxHeight);
+}
+
+template <class Comparator>
+typename MemTable<Comparator>::Node* MemTable<Comparator>::newNode(
+  const Range& key, const Range& value, int height) {
+  size_t header = offsetof(Node, next_) + sizeof(std::atomic<Node*>) * height;
+  auto mem = (char*)arena_.allocate(
+    header + key.size() + value.size(), alignof(Node));
+
+  auto node = (Node*)mem;
+  node->data = mem + header;
+  node->keySize = key.size();
+  node->valueSize = value.size();
+  for (int i = 0; i < height; ++i) {
+    new (&node->next_[i]) std::atomic<Node*>(nullptr);
+  }
+
+  // an empty key or value may be null
+  if (key.size() > 0) {
+    memcpy(mem + header, key.begin(), key.size());
+  }
+  if (value.size() > 0) {
+    memcpy(mem + header + key.size(), value.begin(), value.size());
+  }
+  return node;
+}
+
+template <class Comparator>
+bool MemTable<Comparator>::put(const Range& key, const Range& value) {
+  Node* prev[kMaxHeight];
+  Node* next[kMaxHeight];
+
+  int height = randomSkiplistHeight(kMaxHeight);
+  int maxHeight = maxHeight_.load(std::memory_order_relaxed);
+  while (height > maxHeight &&
+         !maxHeight_.compare_exchange_weak(maxHeight, height)) {
+  }
+  if (height > maxHeight) {
+    maxHeight = height;
+  }
+
+  // top down, each level starting from the node found above it
+  Node* before = head_;
+  Node* bound = nullptr;
+  for (int level = maxHeight - 1; level >= 0; --level) {
+    findSplice(key, before, bound, level, &prev[level], &next[level]);
+    before = prev[level];
+    bound = next[level];
+  }
+  if (next[0] && cmp_(next[0]->key(), key) == 0) {
+    return false;
+  }
+
+  auto node = newNode(key, value, height);
+  for (int level = 0; level < height; ++level) {
+    for (;;) {
+      node->next_[level].store(next[level], std::memory_order_relaxed);
+      if (prev[level]->next_[level].compare_exchange_strong(
+            next[level], node, std::memory_order_release)) {
+        break;
+      }
+
+      // another node was linked in between, search again from there
+      findSplice(
+        key, prev[level], nullptr, level, &prev[level], &next[level]);
+      if (level == 0 && next[0] && cmp_(next[0]->key(), key) == 0) {
+        // the memory of the node stays in the arena
+        return false;
+      }
+    }
+  }
+
+  size_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+template <class Comparator>
+bool MemTable<Comparator>::get(const Range& key, Range& value) const {
+  auto node = findGreaterOrEqual(key);
+  if (node && cmp_(node->key(), key) == 0) {
+    value = node->value();
+    return true;
+  }
+  return false;
+}
+
+template <class Comparator>
+typename MemTable<Comparator>::Node*
+MemTable<Comparator>::findGreaterOrEqual(const Range& key) const {
+  Node* prev = nullptr;
+  Node* next = nullptr;
+  Node* before = head_;
+  for (int level = maxHeight_.load(std::memory_order_relaxed) - 1;
+       level >= 0; --level) {
+    findSplice(key, before, next, level, &prev, &next);
+    before = prev;
+  }
+  return next;
+}
+
+template <class Comparator>
+void MemTable<Comparator>::findSplice(const Range& key, Node* before,
+                                      Node* bound, int level, Node** prev,
+                                      Node** next) const {
+  for (;;) {
+    auto after = before->next(level);
+    if (after) {
+      // the node compared next, most likely a cache miss
+      __builtin_prefetch(after->next_[level].load(std::memory_order_relaxed));
+    }
+    if (!after || after == bound || cmp_(after->key(), key) >= 0) {
+      *prev = before;
+      *next = after;
+      return;
+    }
+    before = after;
+  }
+}
+
+}
+
+#endif // DB_MEMTABLE_H
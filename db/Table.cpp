@@ -0,0 +1,260 @@
+#include "db/Table.h"
+#include "common/Logging.h"
+#include "common/Serializer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+
+namespace sdb {
+
+const size_t TableFooter::kSize;
+
+const uint32_t TableFooter::kMagic;
+
+const size_t TableBuilder::kWriteBufferSize;
+
+void BlockHandle::encode(string& buf) const {
+  char tmp[2 * kMaxVarintSize];
+  auto p = encodeVarint(tmp, offset);
+  p = encodeVarint(p, size);
+  buf.append(tmp, p);
+}
+
+bool BlockHandle::decode(Range& range) {
+  return decodeVarint(range, offset) && decodeVarint(range, size);
+}
+
+void TableFooter::encode(string& buf) const {
+  FixedWire::appendInt(buf, index.offset);
+  FixedWire::appendInt(buf, index.size);
+  FixedWire::appendInt(buf, filter.offset);
+  FixedWire::appendInt(buf, filter.size);
+  FixedWire::appendInt(buf, numEntries);
+  FixedWire::appendInt(buf, flags);
+  FixedWire::appendInt(buf, kMagic);
+}
+
+bool TableFooter::decode(const Range& file) {
+  if (file.size() < (int64_t)kSize) {
+    return false;
+  }
+
+  auto end = const_cast<char*>(file.end());
+  Range range(end - kSize, end);
+  uint32_t magic = 0;
+  FixedWire::parseInt(range, index.offset);
+  FixedWire::parseInt(range, index.size);
+  FixedWire::parseInt(range, filter.offset);
+  FixedWire::parseInt(range, filter.size);
+  FixedWire::parseInt(range, numEntries);
+  FixedWire::parseInt(range, flags);
+  FixedWire::parseInt(range, magic);
+  return magic == kMagic;
+}
+
+TableBuilder* TableBuilder::create(
+  const string& path, const TableOptions& options) {
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  if (fd < 0) {
+    LOG(ERROR) << "open " << path << " " << strerror(errno);
+    return nullptr;
+  }
+  return new TableBuilder(path, options, fd);
+}
+
+TableBuilder::TableBuilder(
+  const string& path, const TableOptions& options, int fd)
+  : path_(path),
+    options_(options),
+    fd_(fd),
+    dataBlock_(options.restartInterval),
+    indexBlock_(options.indexRestartInterval),
+    topIndex_(options.indexRestartInterval),
+    offset_(0),
+    numEntries_(0),
+    ok_(true) {
+  if (options.filterType != filter_none) {
+    filter_.reset(
+      new FilterBuilder(options.filterType, options.filterBitsPerKey));
+  }
+}
+
+TableBuilder::~TableBuilder() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+void TableBuilder::add(const Range& key, const Range& value) {
+  dataBlock_.add(key, value);
+  lastKey_.assign(key.begin(), key.size());
+  if (filter_) {
+    filter_->add(key);
+  }
+  ++numEntries_;
+
+  if (dataBlock_.currentSize() >= options_.blockSize) {
+    flushDataBlock();
+  }
+}
+
+bool TableBuilder::finish() {
+  if (fd_ < 0) {
+    LOG(FATAL) << "Fails to finish table " << path_ << " twice";
+  }
+
+  flushDataBlock();
+  TableFooter footer;
+  footer.filter = BlockHandle{0, 0};
+  footer.numEntries = numEntries_;
+  footer.flags = 0;
+  if (partitionFilters()) {
+    footer.flags |= TableFooter::table_partition_filters;
+  } else if (filter_) {
+    footer.filter = writeFilter();
+  }
+
+  if (options_.partitionSize > 0) {
+    flushPartition();
+    footer.index = writeBlock(topIndex_.finish());
+    footer.flags |= TableFooter::table_partitioned;
+  } else {
+    footer.index = writeBlock(indexBlock_.finish());
+  }
+
+  footer.encode(out_);
+  offset_ += TableFooter::kSize;
+  flushOut();
+
+  if (ok_ && 0 > fdatasync(fd_)) {
+    LOG(ERROR) << "fdatasync " << path_ << " " << strerror(errno);
+    ok_ = false;
+  }
+  if (0 > close(fd_)) {
+    LOG(ERROR) << "close " << path_ << " " << strerror(errno);
+    ok_ = false;
+  }
+  fd_ = -1;
+  return ok_;
+}
+
+void TableBuilder::flushDataBlock() {
+  if (dataBlock_.empty()) {
+    return;
+  }
+
+  auto handle = writeBlock(dataBlock_.finish());
+  dataBlock_.reset();
+
+  handleBuf_.clear();
+  handle.encode(handleBuf_);
+  indexBlock_.add(Range(lastKey_), Range(handleBuf_));
+  if (options_.partitionSize > 0 &&
+      indexBlock_.currentSize() >= options_.partitionSize) {
+    flushPartition();
+  }
+}
+
+void TableBuilder::flushPartition() {
+  if (indexBlock_.empty()) {
+    return;
+  }
+
+  BlockHandle filter{0, 0};
+  if (partitionFilters()) {
+    filter = writeFilter();
+  }
+
+  // the last key of the partition is that of its last data block
+  auto handle = writeBlock(indexBlock_.finish());
+  indexBlock_.reset();
+
+  handleBuf_.clear();
+  handle.encode(handleBuf_);
+  if (partitionFilters()) {
+    filter.encode(handleBuf_);
+  }
+  topIndex_.add(Range(lastKey_), Range(handleBuf_));
+}
+
+BlockHandle TableBuilder::writeBlock(const Range& block) {
+  BlockHandle handle{offset_, (uint64_t)block.size()};
+  out_.append(block.begin(), block.size());
+  offset_ += block.size();
+  if (out_.size() >= kWriteBufferSize) {
+    flushOut();
+  }
+  return handle;
+}
+
+BlockHandle TableBuilder::writeFilter() {
+  // pad to a cache line, the mapping of the file is page aligned
+  size_t pad = (64 - offset_ % 64) % 64;
+  out_.append(pad, 0);
+  offset_ += pad;
+
+  filterBuf_.clear();
+  filter_->finish(filterBuf_);
+  return writeBlock(Range(filterBuf_));
+}
+
+void TableBuilder::flushOut() {
+  size_t done = 0;
+  while (ok_ && done < out_.size()) {
+    auto n = write(fd_, out_.data() + done, out_.size() - done);
+    if (n < 0 && errno != EINTR) {
+      LOG(ERROR) << "write " << path_ << " " << strerror(errno);
+      ok_ = false;
+    } else if (n > 0) {
+      done += n;
+    }
+  }
+  out_.clear();
+}
+
+bool mapTableFile(const string& path, Range& contents) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    LOG(ERROR) << "open " << path << " " << strerror(errno);
+    return false;
+  }
+
+  struct stat st;
+  if (0 > fstat(fd, &st)) {
+    LOG(ERROR) << "fstat " << path << " " << strerror(errno);
+    close(fd);
+    return false;
+  }
+  if (st.st_size < (off_t)TableFooter::kSize) {
+    LOG(ERROR) << "Fails to open table " << path << ", too small";
+    close(fd);
+    return false;
+  }
+
+  // the mapping keeps the file open
+  auto p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    LOG(ERROR) << "mmap " << path << " " << strerror(errno);
+    return false;
+  }
+
+  contents = Range((char*)p, (char*)p + st.st_size);
+  return true;
+}
+
+void unmapTableFile(const Range& contents) {
+  if (0 > munmap(const_cast<char*>(contents.begin()), contents.size())) {
+    LOG(FATAL) << "Fails to unmap a table of " << contents.size();
+  }
+}
+
+}
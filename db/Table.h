@@ -0,0 +1,601 @@
+#ifndef DB_TABLE_H
+#define DB_TABLE_H
+
+#include "db/Block.h"
+#include "db/Comparator.h"
+#include "db/Filter.h"
+#include "common/Logging.h"
+#include "common/Range.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include <string>
+
+
+namespace sdb {
+
+// An immutable sorted table of keys and values in a file:
+//
+//   table  := data block* [filter] [index partition*] index footer
+//   footer := fixed64 index offset, fixed64 index size,
+//             fixed64 filter offset, fixed64 filter size,
+//             fixed64 number of keys, fixed32 flags, fixed32 magic
+//
+// Data blocks are Blocks of the keys and values. The index is a Block
+// with an entry per data block, keyed by the last key of that block, and
+// whose value is a BlockHandle of it. If the index is partitioned, the
+// index entries are themselves cut into blocks of about partitionSize
+// bytes, and the index in the footer has an entry per partition. Then
+// only the top level and the partitions that are used have to be read.
+//
+// A table may have a filter of all its keys, or, with a partitioned
+// index, one filter per partition, written before the partition and
+// whose handle follows that of the partition in the top level index.
+// Filters start at a multiple of 64 bytes in the file, which the mapping
+// keeps in memory, so their blocks line up with cache lines.
+
+// where a block is in a table file
+struct BlockHandle {
+  uint64_t offset;
+  uint64_t size;
+
+  void encode(std::string& buf) const;
+
+  // take a handle from the front of @range
+  bool decode(Range& range);
+};
+
+struct TableFooter {
+  enum {
+    table_partitioned = 1,
+    table_partition_filters = 2,
+  };
+
+  static const size_t kSize = 48;
+
+  static const uint32_t kMagic = 0x73646274;
+
+  BlockHandle index;
+
+  // size 0 if there is no filter of the whole table
+  BlockHandle filter;
+
+  int64_t numEntries;
+  uint32_t flags;
+
+  void encode(std::string& buf) const;
+
+  // decode the footer at the end of @file
+  bool decode(const Range& file);
+};
+
+struct TableOptions {
+  // a data block is cut once it reaches this size
+  size_t blockSize = 4096;
+
+  int restartInterval = 16;
+
+  int indexRestartInterval = 1;
+
+  // cut the index into partitions of about this size, 0 for a single
+  // index block
+  size_t partitionSize = 0;
+
+  // filter_bloom or filter_xor to write filters, see FilterBuilder
+  int filterType = filter_none;
+
+  int filterBitsPerKey = 10;
+
+  // a filter per index partition rather than one of the whole table, if
+  // the index is partitioned
+  bool partitionFilters = false;
+};
+
+
+// Writes a table, streaming each block to the file once it is cut. Keys
+// must be added in the order of the comparator the table is read with.
+class TableBuilder {
+ public:
+
+  // return nullptr if @path can not be created
+  static TableBuilder* create(const std::string& path,
+                              const TableOptions& options = TableOptions());
+
+  // closes the file, which is incomplete unless finish() was called
+  ~TableBuilder();
+
+  TableBuilder(const TableBuilder&) = delete;
+
+  TableBuilder& operator=(const TableBuilder&) = delete;
+
+  void add(const Range& key, const Range& value);
+
+  // Write the rest of the table and sync it. Return false if anything
+  // failed to be written
+  bool finish();
+
+  int64_t numEntries() const { return numEntries_; }
+
+  // bytes of the file so far
+  uint64_t fileSize() const { return offset_; }
+
+ private:
+
+  static const size_t kWriteBufferSize = 256 * 1024;
+
+  const std::string path_;
+
+  const TableOptions options_;
+
+  int fd_;
+
+  BlockBuilder dataBlock_;
+
+  BlockBuilder indexBlock_;
+
+  // index of the partitions
+  BlockBuilder topIndex_;
+
+  // keys of the table or of the partition, if there are filters
+  std::unique_ptr<FilterBuilder> filter_;
+
+  std::string lastKey_;
+
+  std::string handleBuf_;
+
+  std::string filterBuf_;
+
+  // blocks not written yet
+  std::string out_;
+
+  // end of the file, including out_
+  uint64_t offset_;
+
+  int64_t numEntries_;
+
+  bool ok_;
+
+
+  TableBuilder(const std::string& path, const TableOptions& options, int fd);
+
+  void flushDataBlock();
+
+  void flushPartition();
+
+  BlockHandle writeBlock(const Range& block);
+
+  // write the filter of the keys added since the last one
+  BlockHandle writeFilter();
+
+  bool partitionFilters() const {
+    return filter_ && options_.partitionSize > 0 && options_.partitionFilters;
+  }
+
+  void flushOut();
+};
+
+
+// map the whole file at @path read only
+bool mapTableFile(const std::string& path, Range& contents);
+
+void unmapTableFile(const Range& contents);
+
+
+// A table file mapped into memory. Lookups and iterators read blocks
+// straight from the mapping, without copying or system calls, and the
+// kernel brings in the pages that are touched. Opening a table reads only
+// the footer, however large the file is.
+template <class Comparator = BytewiseComparator>
+class Table {
+ public:
+
+  // return nullptr if @path is missing or not a table
+  static Table* open(const std::string& path,
+                     const Comparator& cmp = Comparator());
+
+  ~Table() { unmapTableFile(file_); }
+
+  Table(const Table&) = delete;
+
+  Table& operator=(const Table&) = delete;
+
+  // Find @key, @value points into the mapping if it is found. An
+  // Iterator kept for many lookups saves rebuilding its key buffers
+  bool get(const Range& key, Range& value) const;
+
+  int64_t numEntries() const { return footer_.numEntries; }
+
+  uint64_t fileSize() const { return file_.size(); }
+
+  bool partitioned() const {
+    return footer_.flags & TableFooter::table_partitioned;
+  }
+
+  bool partitionFilters() const {
+    return footer_.flags & TableFooter::table_partition_filters;
+  }
+
+  const Comparator& comparator() const { return cmp_; }
+
+  // how get() used the filters
+  struct FilterStats {
+    // lookups a filter was asked about
+    int64_t numChecks;
+
+    // lookups a filter answered, without reading a data block
+    int64_t numRejected;
+
+    // lookups a filter let through for a key that was not there
+    int64_t numFalsePositives;
+  };
+
+  FilterStats filterStats() const;
+
+  class Iterator {
+   public:
+
+    explicit Iterator(const Table* table);
+
+    Iterator(const Iterator&) = delete;
+
+    Iterator& operator=(const Iterator&) = delete;
+
+    bool valid() const { return dataIter_.valid(); }
+
+    // whether a malformed block was skipped
+    bool corrupted() const {
+      return corrupted_ || topIter_.corrupted() || partIter_.corrupted() ||
+        dataIter_.corrupted();
+    }
+
+    Range key() const { return dataIter_.key(); }
+
+    Range value() const { return dataIter_.value(); }
+
+    void next() {
+      dataIter_.next();
+      skipForward();
+    }
+
+    void prev() {
+      dataIter_.prev();
+      skipBackward();
+    }
+
+    void seekToFirst();
+
+    void seekToLast();
+
+    // position at the first key not before @key
+    void seek(const Range& key);
+
+   private:
+
+    typedef BlockReader<Comparator> Block;
+
+    // no block loaded
+    static const uint64_t kNone = UINT64_MAX;
+
+    const Table* table_;
+
+    typename Block::Iterator topIter_;
+
+    Block partition_;
+
+    typename Block::Iterator partIter_;
+
+    Block data_;
+
+    typename Block::Iterator dataIter_;
+
+    // offsets of the blocks loaded
+    uint64_t partitionOffset_;
+
+    uint64_t dataOffset_;
+
+    bool corrupted_;
+
+
+    // the index entry of the current data block
+    const typename Block::Iterator& indexIter() const {
+      return table_->partitioned() ? partIter_ : topIter_;
+    }
+
+    // Load the block @iter points at, or an empty one if it is not
+    // valid. Iterators over @block must be positioned again
+    void load(const typename Block::Iterator& iter, Block& block,
+              uint64_t& offset);
+
+    // move the index past partitions without entries
+    void skipPartitionsForward();
+
+    void skipPartitionsBackward();
+
+    void indexNext();
+
+    void indexPrev();
+
+    // move past data blocks without entries
+    void skipForward();
+
+    void skipBackward();
+  };
+
+ private:
+
+  Range file_;
+
+  TableFooter footer_;
+
+  const Comparator cmp_;
+
+  BlockReader<Comparator> index_;
+
+  // of the whole table
+  FilterReader filter_;
+
+  mutable std::atomic<int64_t> numChecks_;
+
+  mutable std::atomic<int64_t> numRejected_;
+
+  mutable std::atomic<int64_t> numFalsePositives_;
+
+
+  Table(const Range& file, const TableFooter& footer, const Comparator& cmp)
+    : file_(file),
+      footer_(footer),
+      cmp_(cmp),
+      numChecks_(0),
+      numRejected_(0),
+      numFalsePositives_(0) {}
+
+  // whether the filter of the table, or of the partition @key is in, may
+  // contain @key
+  bool filterMayContain(const Range& key) const;
+
+  // the block at @handle, false if it is not within the file
+  bool block(const BlockHandle& handle, Range& contents) const;
+};
+
+
+template <class Comparator>
+Table<Comparator>* Table<Comparator>::open(
+  const std::string& path, const Comparator& cmp) {
+  Range file;
+  if (!mapTableFile(path, file)) {
+    return nullptr;
+  }
+
+  TableFooter footer;
+  if (!footer.decode(file)) {
+    LOG(ERROR) << "Fails to open table " << path << ", bad footer";
+    unmapTableFile(file);
+    return nullptr;
+  }
+
+  auto table = new Table(file, footer, cmp);
+  Range index;
+  if (table->block(footer.index, index)) {
+    table->index_ = BlockReader<Comparator>(index, cmp);
+  }
+  if (!table->index_.good()) {
+    LOG(ERROR) << "Fails to open table " << path << ", bad index";
+    delete table;
+    return nullptr;
+  }
+
+  Range filter;
+  if (footer.filter.size > 0 && table->block(footer.filter, filter)) {
+    table->filter_ = FilterReader(filter);
+  }
+  return table;
+}
+
+template <class Comparator>
+bool Table<Comparator>::get(const Range& key, Range& value) const {
+  bool filtered = filter_.type() != filter_none || partitionFilters();
+  if (filtered) {
+    numChecks_.fetch_add(1, std::memory_order_relaxed);
+    if (!filterMayContain(key)) {
+      numRejected_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+  }
+
+  Iterator it(this);
+  it.seek(key);
+  if (it.valid() && cmp_(it.key(), key) == 0) {
+    value = it.value();
+    return true;
+  }
+
+  if (filtered) {
+    numFalsePositives_.fetch_add(1, std::memory_order_relaxed);
+  }
+  return false;
+}
+
+template <class Comparator>
+bool Table<Comparator>::filterMayContain(const Range& key) const {
+  auto hash = filterHash(key);
+  if (!filter_.mayContain(hash)) {
+    return false;
+  }
+  if (!partitionFilters()) {
+    return true;
+  }
+
+  // the partition handle, then that of its filter
+  typename BlockReader<Comparator>::Iterator it(&index_);
+  it.seek(key);
+  if (!it.valid()) {
+    return false;
+  }
+  Range value = it.value();
+  BlockHandle partition, handle;
+  Range contents;
+  if (!partition.decode(value) || !handle.decode(value) ||
+      !block(handle, contents)) {
+    return true;
+  }
+  return FilterReader(contents).mayContain(hash);
+}
+
+template <class Comparator>
+typename Table<Comparator>::FilterStats
+Table<Comparator>::filterStats() const {
+  FilterStats ret;
+  ret.numChecks = numChecks_.load();
+  ret.numRejected = numRejected_.load();
+  ret.numFalsePositives = numFalsePositives_.load();
+  return ret;
+}
+
+template <class Comparator>
+bool Table<Comparator>::block(
+  const BlockHandle& handle, Range& contents) const {
+  uint64_t end = file_.size() - TableFooter::kSize;
+  if (handle.offset > end || handle.size > end - handle.offset) {
+    return false;
+  }
+  auto p = const_cast<char*>(file_.begin()) + handle.offset;
+  contents = Range(p, p + handle.size);
+  return true;
+}
+
+template <class Comparator>
+Table<Comparator>::Iterator::Iterator(const Table* table)
+  : table_(table),
+    topIter_(&table->index_),
+    partition_(Range(), table->cmp_),
+    partIter_(&partition_),
+    data_(Range(), table->cmp_),
+    dataIter_(&data_),
+    partitionOffset_(kNone),
+    dataOffset_(kNone),
+    corrupted_(false) {
+}
+
+template <class Comparator>
+void Table<Comparator>::Iterator::load(
+  const typename Block::Iterator& iter, Block& block, uint64_t& offset) {
+  BlockHandle handle{kNone, 0};
+  if (iter.valid()) {
+    Range value = iter.value();
+    Range contents;
+    if (!handle.decode(value) || !table_->block(handle, contents)) {
+      corrupted_ = true;
+      handle.offset = kNone;
+    } else if (handle.offset != offset) {
+      block = Block(contents, table_->cmp_);
+      corrupted_ |= !block.good();
+    }
+  }
+
+  if (handle.offset == kNone && offset != kNone) {
+    block = Block(Range(), table_->cmp_);
+  }
+  offset = handle.offset;
+}
+
+template <class Comparator>
+void Table<Comparator>::Iterator::skipPartitionsForward() {
+  while (!partIter_.valid() && topIter_.valid()) {
+    topIter_.next();
+    load(topIter_, partition_, partitionOffset_);
+    partIter_.seekToFirst();
+  }
+}
+
+template <class Comparator>
+void Table<Comparator>::Iterator::skipPartitionsBackward() {
+  while (!partIter_.valid() && topIter_.valid()) {
+    topIter_.prev();
+    load(topIter_, partition_, partitionOffset_);
+    partIter_.seekToLast();
+  }
+}
+
+template <class Comparator>
+void Table<Comparator>::Iterator::indexNext() {
+  if (table_->partitioned()) {
+    partIter_.next();
+    skipPartitionsForward();
+  } else {
+    topIter_.next();
+  }
+}
+
+template <class Comparator>
+void Table<Comparator>::Iterator::indexPrev() {
+  if (table_->partitioned()) {
+    partIter_.prev();
+    skipPartitionsBackward();
+  } else {
+    topIter_.prev();
+  }
+}
+
+template <class Comparator>
+void Table<Comparator>::Iterator::skipForward() {
+  while (!dataIter_.valid() && indexIter().valid()) {
+    indexNext();
+    load(indexIter(), data_, dataOffset_);
+    dataIter_.seekToFirst();
+  }
+}
+
+template <class Comparator>
+void Table<Comparator>::Iterator::skipBackward() {
+  while (!dataIter_.valid() && indexIter().valid()) {
+    indexPrev();
+    load(indexIter(), data_, dataOffset_);
+    dataIter_.seekToLast();
+  }
+}
+
+template <class Comparator>
+void Table<Comparator>::Iterator::seekToFirst() {
+  topIter_.seekToFirst();
+  if (table_->partitioned()) {
+    load(topIter_, partition_, partitionOffset_);
+    partIter_.seekToFirst();
+    skipPartitionsForward();
+  }
+  load(indexIter(), data_, dataOffset_);
+  dataIter_.seekToFirst();
+  skipForward();
+}
+
+template <class Comparator>
+void Table<Comparator>::Iterator::seekToLast() {
+  topIter_.seekToLast();
+  if (table_->partitioned()) {
+    load(topIter_, partition_, partitionOffset_);
+    partIter_.seekToLast();
+    skipPartitionsBackward();
+  }
+  load(indexIter(), data_, dataOffset_);
+  dataIter_.seekToLast();
+  skipBackward();
+}
+
+template <class Comparator>
+void Table<Comparator>::Iterator::seek(const Range& key) {
+  // the first block whose last key is not before @key
+  topIter_.seek(key);
+  if (table_->partitioned()) {
+    load(topIter_, partition_, partitionOffset_);
+    partIter_.seek(key);
+    skipPartitionsForward();
+  }
+  load(indexIter(), data_, dataOffset_);
+  dataIter_.seek(key);
+  skipForward();
+}
+
+}
+
+#endif // DB_TABLE_H
@@ -0,0 +1,15 @@
+from defs import *
+
+cpp_library(
+  name = "libdb.a",
+  srcs = [
+    "Block.cpp",
+    "BlockCache.cpp",
+    "Filter.cpp",
+    "MemTable.cpp",
+    "Table.cpp",
+  ],
+  deps = [
+    "common:libbase.a",
+  ],
+)
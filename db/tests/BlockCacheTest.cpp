@@ -0,0 +1,259 @@
+#include "db/BlockCache.h"
+#include "common/Logging.h"
+#include "common/UnitTest.h"
+
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace sdb;
+using namespace std;
+using namespace std::chrono;
+
+// enable this if you want to print out perf info
+const bool printPerf = false;
+
+
+static atomic<int64_t> blockCacheTestFreed(0);
+
+static void blockCacheTestDelete(const CacheKey& key, void* value) {
+  ++blockCacheTestFreed;
+  delete (string*)value;
+}
+
+// insert a value of @charge bytes and release it
+static void blockCacheTestPut(BlockCache& cache, uint64_t offset,
+                              size_t charge, int priority = 0) {
+  auto value = new string(to_string(offset));
+  cache.release(cache.insert(CacheKey{1, offset}, value, charge,
+                             blockCacheTestDelete, priority));
+}
+
+static bool blockCacheTestHas(BlockCache& cache, uint64_t offset) {
+  auto h = cache.lookup(CacheKey{1, offset});
+  if (!h) {
+    return false;
+  }
+  ASSERT_EQ(*(string*)BlockCache::value(h), to_string(offset));
+  cache.release(h);
+  return true;
+}
+
+TEST(BlockCache, testLru) {
+  BlockCache cache(10 * 100, 0);
+  ASSERT_EQ(cache.numShards(), 1);
+  for (uint64_t i = 0; i < 10; ++i) {
+    blockCacheTestPut(cache, i, 100);
+  }
+  ASSERT_EQ(cache.stats().usage, 1000);
+
+  // a lookup makes 0 the most recently used, so 1 goes first
+  ASSERT_TRUE(blockCacheTestHas(cache, 0));
+  blockCacheTestPut(cache, 10, 100);
+  ASSERT_TRUE(blockCacheTestHas(cache, 0));
+  ASSERT_FALSE(blockCacheTestHas(cache, 1));
+  ASSERT_TRUE(blockCacheTestHas(cache, 2));
+
+  // a large entry takes the place of several
+  blockCacheTestPut(cache, 11, 300);
+  ASSERT_FALSE(blockCacheTestHas(cache, 3));
+  ASSERT_FALSE(blockCacheTestHas(cache, 4));
+  ASSERT_FALSE(blockCacheTestHas(cache, 5));
+  ASSERT_TRUE(blockCacheTestHas(cache, 6));
+  ASSERT_LE(cache.stats().usage, 1000);
+
+  // so does a value of the same key
+  blockCacheTestPut(cache, 11, 50);
+  ASSERT_EQ(cache.stats().usage, 750);
+  cache.erase(CacheKey{1, 11});
+  ASSERT_FALSE(blockCacheTestHas(cache, 11));
+  ASSERT_EQ(cache.stats().usage, 700);
+
+  // other files do not share keys
+  ASSERT_TRUE(cache.lookup(CacheKey{2, 6}) == nullptr);
+
+  auto stats = cache.stats();
+  ASSERT_EQ(stats.inserts, 13);
+  ASSERT_EQ(stats.evictions, 4);
+  ASSERT_EQ(stats.hits, 4);
+  ASSERT_EQ(stats.misses, 6);
+  ASSERT_EQ(stats.pinnedUsage, 0);
+}
+
+TEST(BlockCache, testPin) {
+  auto before = blockCacheTestFreed.load();
+  {
+    BlockCache cache(1000, 0);
+    auto value = new string("pinned");
+    auto h = cache.insert(CacheKey{1, 0}, value, 600, blockCacheTestDelete);
+    ASSERT_EQ(cache.stats().pinnedUsage, 600);
+
+    // pinned entries take the cache over its capacity, until released
+    auto other = cache.insert(
+      CacheKey{1, 1}, new string("1"), 600, blockCacheTestDelete);
+    ASSERT_EQ(cache.stats().usage, 1200);
+    ASSERT_EQ(cache.stats().pinnedUsage, 1200);
+    cache.release(other);
+    ASSERT_FALSE(blockCacheTestHas(cache, 1));
+    ASSERT_EQ(cache.stats().usage, 600);
+    blockCacheTestPut(cache, 2, 300);
+    ASSERT_TRUE(blockCacheTestHas(cache, 2));
+    ASSERT_EQ(BlockCache::value(h), value);
+
+    // erased while pinned, it is freed by the release
+    auto freed = blockCacheTestFreed.load();
+    cache.erase(CacheKey{1, 0});
+    ASSERT_TRUE(cache.lookup(CacheKey{1, 0}) == nullptr);
+    ASSERT_EQ(*(string*)BlockCache::value(h), "pinned");
+    ASSERT_EQ(blockCacheTestFreed.load(), freed);
+    cache.release(h);
+    ASSERT_EQ(blockCacheTestFreed.load(), freed + 1);
+
+    // too large to cache, but usable until released
+    value = new string("huge");
+    h = cache.insert(CacheKey{1, 3}, value, 2000, blockCacheTestDelete);
+    ASSERT_EQ(BlockCache::value(h), value);
+    ASSERT_TRUE(cache.lookup(CacheKey{1, 3}) == nullptr);
+    cache.release(h);
+  }
+  ASSERT_EQ(blockCacheTestFreed.load() - before, 4);
+}
+
+TEST(BlockCache, testPriority) {
+  BlockCache cache(1000, 0, false, 0.5);
+  for (uint64_t i = 0; i < 4; ++i) {
+    blockCacheTestPut(cache, i, 100, BlockCache::cache_high);
+  }
+
+  // low priority entries go first, even when more recently used
+  for (uint64_t i = 10; i < 30; ++i) {
+    blockCacheTestPut(cache, i, 100);
+  }
+  for (uint64_t i = 0; i < 4; ++i) {
+    ASSERT_TRUE(blockCacheTestHas(cache, i));
+  }
+
+  // but only up to half of the cache, the least recently used of them
+  // then age among the low priority ones
+  for (uint64_t i = 4; i < 10; ++i) {
+    blockCacheTestPut(cache, i, 100, BlockCache::cache_high);
+  }
+  for (uint64_t i = 30; i < 40; ++i) {
+    blockCacheTestPut(cache, i, 100);
+  }
+  for (uint64_t i = 0; i < 5; ++i) {
+    ASSERT_FALSE(blockCacheTestHas(cache, i));
+  }
+  for (uint64_t i = 5; i < 10; ++i) {
+    ASSERT_TRUE(blockCacheTestHas(cache, i));
+  }
+}
+
+// a scan of blocks read once, between lookups of a hot set
+static double blockCacheTestHitRate(bool admission) {
+  BlockCache cache(100 * 4096, 0, admission);
+  mt19937 gen(5);
+  int64_t hits = 0;
+  int64_t lookups = 0;
+  uint64_t scan = 1000;
+  for (int round = 0; round < 200; ++round) {
+    // 50 hot blocks, each read a few times
+    for (int i = 0; i < 200; ++i) {
+      uint64_t offset = gen() % 50;
+      ++lookups;
+      if (blockCacheTestHas(cache, offset)) {
+        ++hits;
+      } else {
+        blockCacheTestPut(cache, offset, 4096);
+      }
+    }
+    for (int i = 0; i < 100; ++i, ++scan) {
+      if (!blockCacheTestHas(cache, scan)) {
+        blockCacheTestPut(cache, scan, 4096);
+      }
+    }
+  }
+  return (double)hits / lookups;
+}
+
+TEST(BlockCache, testAdmission) {
+  auto lru = blockCacheTestHitRate(false);
+  auto admitted = blockCacheTestHitRate(true);
+  ASSERT_GT(admitted, 0.9);
+  ASSERT_GT(admitted, lru + 0.1);
+}
+
+TEST(BlockCache, testConcurrent) {
+  const int numThreads = 4;
+  BlockCache cache(64 * 100, 2, true);
+  vector<thread> threads;
+  for (int t = 0; t < numThreads; ++t) {
+    threads.emplace_back([&cache, t]() {
+      mt19937 gen(t);
+      for (int i = 0; i < 20000; ++i) {
+        uint64_t offset = gen() % 200;
+        auto h = cache.lookup(CacheKey{1, offset});
+        if (!h) {
+          h = cache.insert(CacheKey{1, offset},
+                           new string(to_string(offset)), 100,
+                           blockCacheTestDelete);
+        }
+        ASSERT_EQ(*(string*)BlockCache::value(h), to_string(offset));
+        cache.release(h);
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  auto stats = cache.stats();
+  ASSERT_EQ(stats.hits + stats.misses, numThreads * 20000);
+  ASSERT_LE(stats.usage, 64 * 100 + 4 * 100);
+  ASSERT_EQ(stats.pinnedUsage, 0);
+  for (int i = 0; i < cache.numShards(); ++i) {
+    ASSERT_GT(cache.shardStats(i).hits, 0);
+  }
+}
+
+// lookups of cached blocks from several threads, by number of shards
+TEST(BlockCache, testPerf) {
+  const int numOps = printPerf ? 2000000 : 1000;
+  const int numKeys = 10000;
+
+  for (int shardBits : {0, 4}) {
+    for (int numThreads : {1, 4}) {
+      // room to spare, as keys do not spread evenly over shards
+      BlockCache cache(2 * numKeys * 4096, shardBits);
+      for (uint64_t i = 0; i < numKeys; ++i) {
+        blockCacheTestPut(cache, i, 4096);
+      }
+
+      auto beg = steady_clock::now();
+      vector<thread> threads;
+      for (int t = 0; t < numThreads; ++t) {
+        threads.emplace_back([&cache, numOps, numThreads, t]() {
+          mt19937 gen(t);
+          for (int i = 0; i < numOps / numThreads; ++i) {
+            auto h = cache.lookup(CacheKey{1, gen() % numKeys});
+            ASSERT_TRUE(h != nullptr);
+            cache.release(h);
+          }
+        });
+      }
+      for (auto& t : threads) {
+        t.join();
+      }
+      auto ns = duration_cast<nanoseconds>(steady_clock::now() - beg);
+
+      if (printPerf) {
+        cout << (1 << shardBits) << " shards, " << numThreads
+             << " threads: " << (double)ns.count() / numOps
+             << " ns per lookup and release" << endl;
+      }
+    }
+  }
+}
@@ -0,0 +1,244 @@
+#include "db/Block.h"
+#include "common/Logging.h"
+#include "common/UnitTest.h"
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+
+using namespace sdb;
+using namespace std;
+using namespace std::chrono;
+
+// enable this if you want to print out perf info
+const bool printPerf = false;
+
+
+// fixed width keys with a long common prefix
+static string blockTestKey(int64_t i) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "user%012lld", (long long)i);
+  return buf;
+}
+
+struct BlockTestReverse {
+  int operator()(const Range& a, const Range& b) const {
+    return b.compare(a);
+  }
+};
+
+static void blockTestBuild(BlockBuilder& builder, int numKeys, int step) {
+  for (int i = 0; i < numKeys; ++i) {
+    auto key = blockTestKey(i * step);
+    auto value = "value " + to_string(i * step);
+    builder.add(Range(key), Range(value));
+  }
+}
+
+TEST(Block, testSeek) {
+  for (int interval : {1, 2, 16, 1000}) {
+    BlockBuilder builder(interval);
+    blockTestBuild(builder, 500, 2);
+    ASSERT_EQ(builder.numEntries(), 500);
+    auto size = builder.currentSize();
+    auto contents = builder.finish();
+    ASSERT_EQ(contents.size(), size);
+
+    BlockReader<> block(contents);
+    ASSERT_TRUE(block.good());
+    BlockReader<>::Iterator it(&block);
+    for (int i = 0; i < 999; ++i) {
+      auto key = blockTestKey(i);
+      it.seek(Range(key));
+      ASSERT_TRUE(it.valid());
+
+      // odd keys are not there, seek stops at the one after
+      int found = (i + 1) / 2 * 2;
+      ASSERT_EQ(it.key().toString(), blockTestKey(found));
+      ASSERT_EQ(it.value().toString(), "value " + to_string(found));
+    }
+
+    auto last = blockTestKey(999);
+    it.seek(Range(last));
+    ASSERT_FALSE(it.valid());
+    string first;
+    it.seek(Range(first));
+    ASSERT_EQ(it.key().toString(), blockTestKey(0));
+    ASSERT_FALSE(it.corrupted());
+  }
+}
+
+TEST(Block, testIterate) {
+  for (int interval : {1, 3, 16}) {
+    BlockBuilder builder(interval);
+    blockTestBuild(builder, 100, 1);
+    BlockReader<> block(builder.finish());
+    BlockReader<>::Iterator it(&block);
+
+    it.seekToFirst();
+    for (int i = 0; i < 100; ++i) {
+      ASSERT_TRUE(it.valid());
+      ASSERT_EQ(it.key().toString(), blockTestKey(i));
+      it.next();
+    }
+    ASSERT_FALSE(it.valid());
+
+    // backwards all the way past the first key
+    it.seekToLast();
+    for (int i = 99; i >= 0; --i) {
+      ASSERT_TRUE(it.valid());
+      ASSERT_EQ(it.key().toString(), blockTestKey(i));
+      ASSERT_EQ(it.value().toString(), "value " + to_string(i));
+      it.prev();
+    }
+    ASSERT_FALSE(it.valid());
+
+    // and back and forth from the middle
+    auto key = blockTestKey(50);
+    it.seek(Range(key));
+    it.prev();
+    ASSERT_EQ(it.key().toString(), blockTestKey(49));
+    it.next();
+    it.next();
+    ASSERT_EQ(it.key().toString(), blockTestKey(51));
+  }
+}
+
+TEST(Block, testEncoding) {
+  BlockBuilder builder(4);
+
+  // an empty block
+  BlockReader<> empty(builder.finish());
+  ASSERT_TRUE(empty.good());
+  BlockReader<>::Iterator it(&empty);
+  it.seekToFirst();
+  ASSERT_FALSE(it.valid());
+  it.seekToLast();
+  ASSERT_FALSE(it.valid());
+
+  // keys and values too long for one byte lengths, and an empty key
+  builder.reset();
+  vector<string> keys = {"", "a", string(300, 'b'), string(301, 'b'), "c"};
+  string value(1000, 'v');
+  for (auto& key : keys) {
+    builder.add(Range(key), Range(value));
+  }
+  BlockReader<> block(builder.finish());
+  BlockReader<>::Iterator iter(&block);
+  iter.seekToFirst();
+  for (auto& key : keys) {
+    ASSERT_EQ(iter.key().toString(), key);
+    ASSERT_EQ(iter.value().size(), 1000);
+    iter.next();
+  }
+  ASSERT_FALSE(iter.valid());
+  iter.seek(Range(keys[3]));
+  ASSERT_EQ(iter.key().toString(), keys[3]);
+
+  // shared prefixes keep the block small
+  BlockBuilder compressed(16);
+  BlockBuilder plain(1);
+  blockTestBuild(compressed, 100, 1);
+  blockTestBuild(plain, 100, 1);
+  ASSERT_LT(compressed.currentSize() + 100 * 8, plain.currentSize());
+}
+
+TEST(Block, testComparator) {
+  BlockBuilder builder(4);
+  for (int i = 99; i >= 0; --i) {
+    auto key = blockTestKey(i);
+    builder.add(Range(key), Range(key));
+  }
+  BlockReader<BlockTestReverse> block(builder.finish());
+  BlockReader<BlockTestReverse>::Iterator it(&block);
+
+  auto key = blockTestKey(50);
+  it.seek(Range(key));
+  ASSERT_EQ(it.key().toString(), key);
+  it.next();
+  ASSERT_EQ(it.key().toString(), blockTestKey(49));
+}
+
+TEST(Block, testCorrupted) {
+  BlockBuilder builder(4);
+  blockTestBuild(builder, 20, 1);
+  auto contents = builder.finish();
+  string data = contents.toString();
+
+  // too many restarts for the size
+  string bad = data;
+  bad[bad.size() - 4] = 0x7f;
+  BlockReader<> badRestarts((Range(bad)));
+  ASSERT_FALSE(badRestarts.good());
+  BlockReader<>::Iterator it(&badRestarts);
+  it.seekToFirst();
+  ASSERT_FALSE(it.valid());
+  it.seek(Range(data));
+  ASSERT_FALSE(it.valid());
+
+  // the first key shares a prefix with nothing
+  bad = data;
+  bad[0] = 5;
+  BlockReader<> badEntry((Range(bad)));
+  ASSERT_TRUE(badEntry.good());
+  BlockReader<>::Iterator iter(&badEntry);
+  iter.seekToFirst();
+  ASSERT_FALSE(iter.valid());
+  ASSERT_TRUE(iter.corrupted());
+
+  string tiny = "abc";
+  BlockReader<> tooSmall((Range(tiny)));
+  ASSERT_FALSE(tooSmall.good());
+}
+
+// point lookups of random keys in 4KB blocks, for a few restart
+// intervals
+TEST(Block, testPerf) {
+  const int numBlocks = printPerf ? 10000 : 10;
+  const int numLookups = printPerf ? 10000000 : 1000;
+
+  for (int interval : {1, 4, 16, 64}) {
+    vector<string> blocks;
+    vector<string> keys;
+    vector<int> blockOfKey;
+    string value(40, 'v');
+    for (int b = 0; b < numBlocks; ++b) {
+      BlockBuilder builder(interval);
+      while (builder.currentSize() < 4096 - 80) {
+        keys.push_back(blockTestKey(keys.size()));
+        blockOfKey.push_back(b);
+        builder.add(Range(keys.back()), Range(value));
+      }
+      blocks.push_back(builder.finish().toString());
+    }
+
+    // one iterator per block, so that lookups do not allocate
+    vector<BlockReader<>> readers;
+    for (auto& b : blocks) {
+      readers.emplace_back(Range(b));
+    }
+    vector<BlockReader<>::Iterator> iters;
+    for (auto& r : readers) {
+      iters.emplace_back(&r);
+    }
+
+    mt19937 gen(3);
+    auto beg = steady_clock::now();
+    for (int i = 0; i < numLookups; ++i) {
+      auto k = gen() % keys.size();
+      auto& it = iters[blockOfKey[k]];
+      it.seek(Range(keys[k]));
+      ASSERT_TRUE(it.valid());
+    }
+    auto ns = duration_cast<nanoseconds>(steady_clock::now() - beg).count();
+
+    if (printPerf) {
+      cout << "restart interval " << interval << ": "
+           << keys.size() / numBlocks << " keys per block, "
+           << (double)ns / numLookups << " ns per lookup" << endl;
+    }
+  }
+}
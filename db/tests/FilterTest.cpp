@@ -0,0 +1,174 @@
+#include "db/Filter.h"
+#include "common/Logging.h"
+#include "common/UnitTest.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+
+using namespace sdb;
+using namespace std;
+using namespace std::chrono;
+
+// enable this if you want to print out perf info
+const bool printPerf = false;
+
+
+static string filterTestKey(int64_t i) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "key%016lld", (long long)i);
+  return buf;
+}
+
+// a filter of keys 0 .. @numKeys - 1
+static string filterTestBuild(int type, int bitsPerKey, int64_t numKeys) {
+  FilterBuilder builder(type, bitsPerKey);
+  for (int64_t i = 0; i < numKeys; ++i) {
+    auto key = filterTestKey(i);
+    builder.add(Range(key));
+  }
+  string out;
+  builder.finish(out);
+  return out;
+}
+
+// the share of @num keys after @numKeys that pass @filter
+static double filterTestFalsePositives(
+  const FilterReader& filter, int64_t numKeys, int64_t num) {
+  int64_t passed = 0;
+  for (int64_t i = numKeys; i < numKeys + num; ++i) {
+    auto key = filterTestKey(i);
+    passed += filter.mayContain(Range(key));
+  }
+  return (double)passed / num;
+}
+
+TEST(Filter, testBloom) {
+  const int64_t numKeys = 10000;
+  for (int bitsPerKey : {4, 10, 16}) {
+    auto data = filterTestBuild(filter_bloom, bitsPerKey, numKeys);
+    ASSERT_LE(data.size(), numKeys * bitsPerKey / 8 + 64);
+    FilterReader filter((Range(data)));
+    ASSERT_EQ(filter.type(), filter_bloom);
+    for (int64_t i = 0; i < numKeys; ++i) {
+      auto key = filterTestKey(i);
+      ASSERT_TRUE(filter.mayContain(Range(key)));
+    }
+
+    // about 1% at 10 bits per key
+    auto rate = filterTestFalsePositives(filter, numKeys, 100000);
+    if (bitsPerKey == 10) {
+      ASSERT_LT(rate, 0.02);
+    }
+    if (bitsPerKey == 16) {
+      ASSERT_LT(rate, 0.002);
+    }
+  }
+}
+
+TEST(Filter, testXor) {
+  const int64_t numKeys = 10000;
+  for (int bitsPerKey : {8, 16}) {
+    auto data = filterTestBuild(filter_xor, bitsPerKey, numKeys);
+    ASSERT_LE(data.size(), numKeys * 1.24 * bitsPerKey / 8 + 64);
+    FilterReader filter((Range(data)));
+    ASSERT_EQ(filter.type(), filter_xor);
+    for (int64_t i = 0; i < numKeys; ++i) {
+      auto key = filterTestKey(i);
+      ASSERT_TRUE(filter.mayContain(Range(key)));
+    }
+
+    // 1/256 and 1/65536
+    auto rate = filterTestFalsePositives(filter, numKeys, 100000);
+    ASSERT_LT(rate, bitsPerKey == 8 ? 0.008 : 0.0002);
+  }
+
+  // repeated keys are filtered once
+  FilterBuilder builder(filter_xor, 8);
+  auto key = filterTestKey(1);
+  for (int i = 0; i < 3; ++i) {
+    builder.add(Range(key));
+  }
+  string data;
+  builder.finish(data);
+  ASSERT_TRUE(FilterReader(Range(data)).mayContain(Range(key)));
+}
+
+TEST(Filter, testEmpty) {
+  for (int type : {filter_bloom, filter_xor}) {
+    auto data = filterTestBuild(type, 10, 0);
+    FilterReader filter((Range(data)));
+    ASSERT_EQ(filter.type(), type);
+    ASSERT_LT(filterTestFalsePositives(filter, 0, 1000), 0.01);
+  }
+
+  // anything malformed lets every key through
+  string key = "a";
+  ASSERT_EQ(FilterReader().type(), filter_none);
+  ASSERT_TRUE(FilterReader().mayContain(Range(key)));
+  auto data = filterTestBuild(filter_bloom, 10, 100);
+  data.pop_back();
+  data.push_back(7);
+  ASSERT_EQ(FilterReader(Range(data)).type(), filter_none);
+  data = filterTestBuild(filter_xor, 8, 100);
+  data.erase(0, 1);
+  ASSERT_EQ(FilterReader(Range(data)).type(), filter_none);
+}
+
+// probes of filters too large for the cpu caches, with bits per key
+// and false positive rates
+TEST(Filter, testPerf) {
+  const int64_t numKeys = printPerf ? 10000000 : 1000;
+  const int64_t numProbes = printPerf ? 10000000 : 1000;
+
+  vector<uint64_t> hashes;
+  for (int64_t i = 0; i < numKeys; ++i) {
+    auto key = filterTestKey(i);
+    hashes.push_back(filterHash(Range(key)));
+  }
+  vector<uint64_t> probes;
+  for (int64_t i = 0; i < numProbes; ++i) {
+    auto key = filterTestKey(numKeys + i);
+    probes.push_back(filterHash(Range(key)));
+  }
+
+  struct {
+    const char* name;
+    int type;
+    int bitsPerKey;
+  } configs[] = {
+    {"bloom", filter_bloom, 10},
+    {"bloom", filter_bloom, 16},
+    {"xor8", filter_xor, 8},
+    {"xor16", filter_xor, 16},
+  };
+
+  for (auto& config : configs) {
+    FilterBuilder builder(config.type, config.bitsPerKey);
+    for (auto hash : hashes) {
+      builder.addHash(hash);
+    }
+    string data;
+    auto beg = steady_clock::now();
+    builder.finish(data);
+    auto buildNs = duration_cast<nanoseconds>(steady_clock::now() - beg);
+
+    FilterReader filter((Range(data)));
+    int64_t passed = 0;
+    beg = steady_clock::now();
+    for (auto hash : probes) {
+      passed += filter.mayContain(hash);
+    }
+    auto ns = duration_cast<nanoseconds>(steady_clock::now() - beg).count();
+
+    if (printPerf) {
+      cout << config.name << ": " << (double)data.size() * 8 / numKeys
+           << " bits per key, " << (double)passed * 100 / numProbes
+           << "% false positives, " << buildNs.count() / numKeys
+           << " ns per key to build, " << (double)ns / numProbes
+           << " ns per probe" << endl;
+    }
+  }
+}
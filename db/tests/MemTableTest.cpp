@@ -0,0 +1,271 @@
+#include "db/MemTable.h"
+#include "common/Logging.h"
+#include "common/UnitTest.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+
+using namespace sdb;
+using namespace std;
+using namespace std::chrono;
+
+// enable this if you want to print out perf info
+const bool printPerf = false;
+
+
+// fixed width keys, so that they sort as the numbers
+static string memTableTestKey(int64_t i) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "key%016lld", (long long)i);
+  return buf;
+}
+
+struct MemTableTestReverse {
+  int operator()(const Range& a, const Range& b) const {
+    return b.compare(a);
+  }
+};
+
+TEST(MemTable, testPutGet) {
+  MemTable<> table(4096);
+  Range value;
+  string missing = "a";
+  ASSERT_FALSE(table.get(Range(missing), value));
+
+  for (int i = 0; i < 1000; i += 2) {
+    auto key = memTableTestKey(i);
+    auto val = "value " + to_string(i);
+    ASSERT_TRUE(table.put(Range(key), Range(val)));
+  }
+  ASSERT_EQ(table.size(), 500);
+
+  for (int i = 0; i < 1000; ++i) {
+    auto key = memTableTestKey(i);
+    ASSERT_EQ(table.get(Range(key), value), i % 2 == 0);
+    if (i % 2 == 0) {
+      ASSERT_EQ(value.toString(), "value " + to_string(i));
+    }
+  }
+
+  // an existing key keeps its value
+  auto key = memTableTestKey(10);
+  string other = "other";
+  ASSERT_FALSE(table.put(Range(key), Range(other)));
+  ASSERT_TRUE(table.get(Range(key), value));
+  ASSERT_EQ(value.toString(), "value 10");
+  ASSERT_EQ(table.size(), 500);
+
+  // empty keys and values
+  ASSERT_TRUE(table.put(Range(), Range()));
+  ASSERT_TRUE(table.get(Range(), value));
+  ASSERT_EQ(value.size(), 0);
+}
+
+TEST(MemTable, testIterator) {
+  MemTable<> table;
+  vector<string> keys;
+  mt19937 gen(5);
+  for (int i = 0; i < 2000; ++i) {
+    keys.push_back(to_string(gen()));
+    table.put(Range(keys.back()), Range(keys.back()));
+  }
+  sort(keys.begin(), keys.end());
+  keys.erase(unique(keys.begin(), keys.end()), keys.end());
+  ASSERT_EQ(table.size(), keys.size());
+
+  MemTable<>::Iterator it(&table);
+  it.seekToFirst();
+  for (auto& key : keys) {
+    ASSERT_TRUE(it.valid());
+    ASSERT_EQ(it.key().toString(), key);
+    ASSERT_EQ(it.value().toString(), key);
+    it.next();
+  }
+  ASSERT_FALSE(it.valid());
+
+  it.seek(Range(keys[100]));
+  ASSERT_EQ(it.key().toString(), keys[100]);
+  auto between = keys[100] + "0";
+  it.seek(Range(between));
+  ASSERT_EQ(it.key().toString(), keys[101]);
+  auto last = keys.back() + "0";
+  it.seek(Range(last));
+  ASSERT_FALSE(it.valid());
+}
+
+TEST(MemTable, testComparator) {
+  MemTable<MemTableTestReverse> table;
+  for (int i = 0; i < 100; ++i) {
+    auto key = memTableTestKey(i);
+    table.put(Range(key), Range(key));
+  }
+
+  MemTable<MemTableTestReverse>::Iterator it(&table);
+  it.seekToFirst();
+  for (int i = 99; i >= 0; --i) {
+    ASSERT_EQ(it.key().toString(), memTableTestKey(i));
+    it.next();
+  }
+  ASSERT_FALSE(it.valid());
+}
+
+TEST(MemTable, testMemory) {
+  MemoryProvider provider;
+  {
+    MemTable<> table(4096, &provider);
+    string value(100, 'v');
+    for (int i = 0; i < 10000; ++i) {
+      auto key = memTableTestKey(i);
+      table.put(Range(key), Range(value));
+    }
+
+    // nodes, keys and values in the arena, mapped by the provider
+    ASSERT_GE(table.memoryUsage(), 10000 * (20 + 100));
+    ASSERT_EQ(provider.getStats().bytesMapped, table.memoryUsage());
+  }
+  ASSERT_EQ(provider.getStats().bytesMapped, 0);
+}
+
+// writers put overlapping keys while readers look up the keys already
+// known to be in the table
+TEST(MemTable, testConcurrentPut) {
+  const int numWriters = 4;
+  const int numKeys = 20000;
+  MemTable<> table;
+  atomic<int> numPut(0);
+  atomic<int64_t> published(-1);
+
+  vector<thread> threads;
+  for (int w = 0; w < numWriters; ++w) {
+    threads.emplace_back([&table, &numPut, &published, w]() {
+      for (int i = w; i < numKeys; i += numWriters / 2) {
+        auto key = memTableTestKey(i);
+        if (table.put(Range(key), Range(key))) {
+          ++numPut;
+        }
+        Range value;
+        ASSERT_TRUE(table.get(Range(key), value));
+        ASSERT_EQ(value.toString(), key);
+
+        auto last = published.load();
+        while (last < i && !published.compare_exchange_weak(last, i)) {
+        }
+      }
+    });
+  }
+
+  atomic<bool> done(false);
+  thread reader([&table, &published, &done]() {
+    mt19937 gen(7);
+    while (!done.load()) {
+      auto last = published.load();
+      if (last < 0) {
+        continue;
+      }
+
+      // a key put by another thread is visible once it is seen
+      auto key = memTableTestKey(last);
+      Range value;
+      ASSERT_TRUE(table.get(Range(key), value));
+
+      MemTable<>::Iterator it(&table);
+      auto before = memTableTestKey(gen() % (last + 1));
+      it.seek(Range(before));
+      ASSERT_TRUE(it.valid());
+    }
+  });
+
+  for (auto& t : threads) {
+    t.join();
+  }
+  done = true;
+  reader.join();
+
+  // every key went in exactly once
+  ASSERT_EQ(numPut.load(), numKeys);
+  ASSERT_EQ(table.size(), numKeys);
+  MemTable<>::Iterator it(&table);
+  it.seekToFirst();
+  for (int i = 0; i < numKeys; ++i) {
+    ASSERT_EQ(it.key().toString(), memTableTestKey(i));
+    it.next();
+  }
+  ASSERT_FALSE(it.valid());
+}
+
+// puts and lookups of random keys from several threads, against a
+// std::map behind a mutex
+TEST(MemTable, testPerf) {
+  const int numKeys = printPerf ? 1000000 : 1000;
+  vector<string> keys;
+  mt19937_64 gen(11);
+  for (int i = 0; i < numKeys; ++i) {
+    keys.push_back(memTableTestKey(gen()));
+  }
+  string value(100, 'v');
+
+  auto timeUs = [&keys](int numThreads, function<void(int)> fn) {
+    auto beg = steady_clock::now();
+    vector<thread> threads;
+    for (int t = 0; t < numThreads; ++t) {
+      threads.emplace_back([&keys, &fn, numThreads, t]() {
+        for (int i = t; i < keys.size(); i += numThreads) {
+          fn(i);
+        }
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    return duration_cast<microseconds>(steady_clock::now() - beg).count() + 1;
+  };
+
+  // on an arena from malloc, and on one mapped on huge pages
+  MemoryProvider provider;
+  for (int numThreads : {1, 2, 4}) {
+    int64_t putUs[2];
+    int64_t getUs[2];
+    for (int huge = 0; huge < 2; ++huge) {
+      MemTable<> table(1024 * 1024, huge ? &provider : nullptr);
+      putUs[huge] = timeUs(numThreads, [&table, &keys, &value](int i) {
+        table.put(Range(keys[i]), Range(value));
+      });
+      getUs[huge] = timeUs(numThreads, [&table, &keys](int i) {
+        Range ret;
+        ASSERT_TRUE(table.get(Range(keys[i]), ret));
+      });
+    }
+
+    mutex mt;
+    map<string, string> sorted;
+    auto mapPutUs = timeUs(numThreads, [&mt, &sorted, &keys, &value](int i) {
+      lock_guard<mutex> l(mt);
+      sorted.emplace(keys[i], value);
+    });
+    auto mapGetUs = timeUs(numThreads, [&mt, &sorted, &keys](int i) {
+      lock_guard<mutex> l(mt);
+      ASSERT_TRUE(sorted.find(keys[i]) != sorted.end());
+    });
+
+    if (printPerf) {
+      cout << numThreads << " threads, puts/s: memtable "
+           << (int64_t)numKeys * 1000000 / putUs[0] << ", on huge pages "
+           << (int64_t)numKeys * 1000000 / putUs[1] << ", std::map "
+           << (int64_t)numKeys * 1000000 / mapPutUs << endl;
+      cout << numThreads << " threads, gets/s: memtable "
+           << (int64_t)numKeys * 1000000 / getUs[0] << ", on huge pages "
+           << (int64_t)numKeys * 1000000 / getUs[1] << ", std::map "
+           << (int64_t)numKeys * 1000000 / mapGetUs << endl;
+    }
+  }
+}
@@ -0,0 +1,282 @@
+#include "db/Table.h"
+#include "common/Dir.h"
+#include "common/Logging.h"
+#include "common/UnitTest.h"
+
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+
+using namespace sdb;
+using namespace std;
+using namespace std::chrono;
+
+// enable this if you want to print out perf info
+const bool printPerf = false;
+
+
+static string tableTestKey(int64_t i) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "key%016lld", (long long)i);
+  return buf;
+}
+
+static string tableTestValue(int64_t i) {
+  return "value " + to_string(i);
+}
+
+// a table of @numKeys keys, every @step-th one
+static bool tableTestBuild(const string& path, const TableOptions& options,
+                           int64_t numKeys, int step) {
+  unique_ptr<TableBuilder> builder(TableBuilder::create(path, options));
+  if (!builder) {
+    return false;
+  }
+  for (int64_t i = 0; i < numKeys; ++i) {
+    auto key = tableTestKey(i * step);
+    auto value = tableTestValue(i * step);
+    builder->add(Range(key), Range(value));
+  }
+  return builder->finish();
+}
+
+// walk @table both ways and seek around, it holds keys 0, 2, 4, ...
+static void tableTestCheck(const Table<>& table, int64_t numKeys) {
+  ASSERT_EQ(table.numEntries(), numKeys);
+
+  Table<>::Iterator it(&table);
+  it.seekToFirst();
+  for (int64_t i = 0; i < numKeys; ++i) {
+    ASSERT_TRUE(it.valid());
+    ASSERT_EQ(it.key().toString(), tableTestKey(2 * i));
+    ASSERT_EQ(it.value().toString(), tableTestValue(2 * i));
+    it.next();
+  }
+  ASSERT_FALSE(it.valid());
+
+  it.seekToLast();
+  for (int64_t i = numKeys - 1; i >= 0; --i) {
+    ASSERT_TRUE(it.valid());
+    ASSERT_EQ(it.key().toString(), tableTestKey(2 * i));
+    it.prev();
+  }
+  ASSERT_FALSE(it.valid());
+
+  for (int64_t i = 0; i < 2 * numKeys - 1; ++i) {
+    auto key = tableTestKey(i);
+    Range value;
+    ASSERT_EQ(table.get(Range(key), value), i % 2 == 0);
+    if (i % 2 == 0) {
+      ASSERT_EQ(value.toString(), tableTestValue(i));
+    }
+
+    // missing keys seek to the one after
+    it.seek(Range(key));
+    ASSERT_EQ(it.key().toString(), tableTestKey((i + 1) / 2 * 2));
+  }
+
+  auto last = tableTestKey(2 * numKeys);
+  it.seek(Range(last));
+  ASSERT_FALSE(it.valid());
+  ASSERT_FALSE(it.corrupted());
+}
+
+TEST(Table, testGet) {
+  string dir = "/tmp/TableTest1";
+  ASSERT_TRUE(Dir::createDirectories(dir));
+  auto path = dir + "/table";
+
+  TableOptions options;
+  ASSERT_TRUE(tableTestBuild(path, options, 5000, 2));
+  unique_ptr<Table<>> table(Table<>::open(path));
+  ASSERT_TRUE(table != nullptr);
+  ASSERT_FALSE(table->partitioned());
+  tableTestCheck(*table, 5000);
+
+  // keys and values of about 30 bytes, less the shared prefixes
+  ASSERT_GT(table->fileSize(), 5000 * 10);
+  ASSERT_LT(table->fileSize(), 5000 * 20);
+  ASSERT_TRUE(Dir::removeDirectories(dir));
+}
+
+TEST(Table, testPartitioned) {
+  string dir = "/tmp/TableTest2";
+  ASSERT_TRUE(Dir::createDirectories(dir));
+  auto path = dir + "/table";
+
+  // small blocks and partitions, so that there are many of both
+  TableOptions options;
+  options.blockSize = 256;
+  options.restartInterval = 4;
+  options.partitionSize = 128;
+  ASSERT_TRUE(tableTestBuild(path, options, 3000, 2));
+  unique_ptr<Table<>> table(Table<>::open(path));
+  ASSERT_TRUE(table != nullptr);
+  ASSERT_TRUE(table->partitioned());
+  tableTestCheck(*table, 3000);
+  ASSERT_TRUE(Dir::removeDirectories(dir));
+}
+
+TEST(Table, testEmpty) {
+  string dir = "/tmp/TableTest3";
+  ASSERT_TRUE(Dir::createDirectories(dir));
+  auto path = dir + "/table";
+
+  for (size_t partitionSize : {0, 128}) {
+    TableOptions options;
+    options.partitionSize = partitionSize;
+    ASSERT_TRUE(tableTestBuild(path, options, 0, 1));
+    unique_ptr<Table<>> table(Table<>::open(path));
+    ASSERT_TRUE(table != nullptr);
+    ASSERT_EQ(table->numEntries(), 0);
+
+    Table<>::Iterator it(table.get());
+    it.seekToFirst();
+    ASSERT_FALSE(it.valid());
+    it.seekToLast();
+    ASSERT_FALSE(it.valid());
+    string key = "a";
+    Range value;
+    ASSERT_FALSE(table->get(Range(key), value));
+  }
+
+  // and a table of one key
+  TableOptions options;
+  ASSERT_TRUE(tableTestBuild(path, options, 1, 1));
+  unique_ptr<Table<>> table(Table<>::open(path));
+  tableTestCheck(*table, 1);
+  ASSERT_TRUE(Dir::removeDirectories(dir));
+}
+
+// lookups of missing keys are answered by the filters
+TEST(Table, testFilter) {
+  string dir = "/tmp/TableTest6";
+  ASSERT_TRUE(Dir::createDirectories(dir));
+  auto path = dir + "/table";
+
+  for (int type : {filter_bloom, filter_xor}) {
+    for (bool partitionFilters : {false, true}) {
+      TableOptions options;
+      options.blockSize = 256;
+      options.partitionSize = 512;
+      options.filterType = type;
+      options.partitionFilters = partitionFilters;
+      ASSERT_TRUE(tableTestBuild(path, options, 2000, 2));
+      unique_ptr<Table<>> table(Table<>::open(path));
+      ASSERT_TRUE(table != nullptr);
+      ASSERT_EQ(table->partitionFilters(), partitionFilters);
+      tableTestCheck(*table, 2000);
+
+      auto stats = table->filterStats();
+      ASSERT_EQ(stats.numChecks, 3999);
+      ASSERT_GT(stats.numRejected, 1900);
+      ASSERT_EQ(stats.numRejected + stats.numFalsePositives, 1999);
+    }
+  }
+  ASSERT_TRUE(Dir::removeDirectories(dir));
+}
+
+static void tableTestWriteFile(const string& path, const string& data) {
+  ofstream out(path, ios::binary | ios::trunc);
+  out << data;
+}
+
+TEST(Table, testBadFile) {
+  string dir = "/tmp/TableTest4";
+  ASSERT_TRUE(Dir::createDirectories(dir));
+  auto path = dir + "/table";
+
+  ASSERT_TRUE(Table<>::open(dir + "/missing") == nullptr);
+  ASSERT_TRUE(TableBuilder::create(dir + "/no/such/dir") == nullptr);
+
+  tableTestWriteFile(path, "short");
+  ASSERT_TRUE(Table<>::open(path) == nullptr);
+  tableTestWriteFile(path, string(100, 'x'));
+  ASSERT_TRUE(Table<>::open(path) == nullptr);
+
+  TableOptions options;
+  options.blockSize = 256;
+  ASSERT_TRUE(tableTestBuild(path, options, 100, 2));
+  string data;
+  {
+    ifstream in(path, ios::binary);
+    data.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+  }
+
+  // an index past the end of the file
+  string bad = data;
+  bad[bad.size() - TableFooter::kSize] = 0x7f;
+  tableTestWriteFile(path, bad);
+  ASSERT_TRUE(Table<>::open(path) == nullptr);
+
+  // a data block handle past the end, the block is skipped
+  bad = data;
+  TableFooter footer;
+  ASSERT_TRUE(footer.decode(Range(bad)));
+  bad[footer.index.offset + 3 + tableTestKey(0).size()] = 0xff;
+  tableTestWriteFile(path, bad);
+  unique_ptr<Table<>> table(Table<>::open(path));
+  ASSERT_TRUE(table != nullptr);
+  Table<>::Iterator it(table.get());
+  it.seekToFirst();
+  ASSERT_TRUE(it.corrupted());
+  ASSERT_TRUE(Dir::removeDirectories(dir));
+}
+
+// Open a large table and look up random keys in it, against reading the
+// whole file into memory as the go tables are recovered
+TEST(Table, testPerf) {
+  string dir = "/tmp/TableTest5";
+  ASSERT_TRUE(Dir::createDirectories(dir));
+  auto path = dir + "/table";
+
+  const int64_t numKeys = printPerf ? 10000000 : 10000;
+  const int numLookups = printPerf ? 1000000 : 1000;
+  TableOptions options;
+  options.partitionSize = 4096;
+  {
+    unique_ptr<TableBuilder> builder(TableBuilder::create(path, options));
+    string value(80, 'v');
+    for (int64_t i = 0; i < numKeys; ++i) {
+      auto key = tableTestKey(i);
+      builder->add(Range(key), Range(value));
+    }
+    ASSERT_TRUE(builder->finish());
+  }
+
+  auto beg = steady_clock::now();
+  unique_ptr<Table<>> table(Table<>::open(path));
+  auto openUs = duration_cast<microseconds>(steady_clock::now() - beg);
+  ASSERT_TRUE(table != nullptr);
+
+  beg = steady_clock::now();
+  string data(table->fileSize(), 0);
+  {
+    ifstream in(path, ios::binary);
+    in.read(&data[0], data.size());
+    ASSERT_EQ(in.gcount(), data.size());
+  }
+  auto readUs = duration_cast<microseconds>(steady_clock::now() - beg);
+
+  mt19937_64 gen(9);
+  Table<>::Iterator it(table.get());
+  beg = steady_clock::now();
+  for (int i = 0; i < numLookups; ++i) {
+    auto key = tableTestKey(gen() % numKeys);
+    it.seek(Range(key));
+    ASSERT_TRUE(it.valid());
+  }
+  auto ns = duration_cast<nanoseconds>(steady_clock::now() - beg).count();
+
+  if (printPerf) {
+    cout << "table of " << (table->fileSize() >> 20) << "MB: open "
+         << openUs.count() << "us, read file " << readUs.count()
+         << "us, " << ns / numLookups << " ns per random lookup" << endl;
+  }
+  ASSERT_TRUE(Dir::removeDirectories(dir));
+}
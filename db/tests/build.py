@@ -0,0 +1,62 @@
+from defs import *
+
+cpp_unittest(
+  name = "blockcache_test",
+  srcs = [
+    "BlockCacheTest.cpp",
+  ],
+  deps = [
+    "common:libbase.a",
+    "db:libdb.a",
+  ],
+  linkopt = [
+    "-pthread",
+  ],
+)
+
+cpp_unittest(
+  name = "block_test",
+  srcs = [
+    "BlockTest.cpp",
+  ],
+  deps = [
+    "common:libbase.a",
+    "db:libdb.a",
+  ],
+)
+
+cpp_unittest(
+  name = "filter_test",
+  srcs = [
+    "FilterTest.cpp",
+  ],
+  deps = [
+    "common:libbase.a",
+    "db:libdb.a",
+  ],
+)
+
+cpp_unittest(
+  name = "memtable_test",
+  srcs = [
+    "MemTableTest.cpp",
+  ],
+  deps = [
+    "common:libbase.a",
+    "db:libdb.a",
+  ],
+  linkopt = [
+    "-pthread",
+  ],
+)
+
+cpp_unittest(
+  name = "table_test",
+  srcs = [
+    "TableTest.cpp",
+  ],
+  deps = [
+    "common:libbase.a",
+    "db:libdb.a",
+  ],
+)
@@ -0,0 +1,177 @@
+#include "server/Acceptor.h"
+#include "server/AsyncConnection.h"
+#include "server/Socket.h"
+#include "common/Logging.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+using namespace std;
+
+
+namespace sdb {
+
+Acceptor::Acceptor(EventManager* em, int fd, Factory factory)
+  : em_(em),
+    eloop_(nullptr),
+    fd_(fd),
+    factory_(move(factory)),
+    started_(false),
+    numAccepted_(0) {
+  if (!Socket(fd).setNonblocking(true)) {
+    LOG(ERROR) << "Fails to make fd " << fd << " non-blocking";
+  }
+}
+
+Acceptor::Acceptor(EventLoop* eloop, int fd, Factory factory)
+  : em_(nullptr),
+    eloop_(eloop),
+    fd_(fd),
+    factory_(move(factory)),
+    started_(false),
+    numAccepted_(0) {
+  if (!Socket(fd).setNonblocking(true)) {
+    LOG(ERROR) << "Fails to make fd " << fd << " non-blocking";
+  }
+}
+
+Acceptor::~Acceptor() {
+  stop();
+}
+
+bool Acceptor::start() {
+  if (em_) {
+    eloop_ = em_->pickEventLoop();
+  }
+
+  started_ = eloop_->addEvent(this, EventLoop::handle_read);
+  return started_;
+}
+
+void Acceptor::stop() {
+  if (!started_) {
+    return;
+  }
+  started_ = false;
+
+  if (eloop_->inLoopThread()) {
+    eloop_->removeEvent(this);
+  } else {
+    // once the task has run, no event of this round can be pending
+    auto eloop = eloop_;
+    eloop->async([this, eloop]() { return eloop->removeEvent(this); }).get();
+  }
+}
+
+void Acceptor::handleRead() {
+  Socket listener(fd_);
+
+  for (int i = 0; i < kMaxAcceptBatch; ++i) {
+    int fd = listener.accept(SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        LOG(ERROR) << "Fails to accept " << strerror(errno);
+      }
+      break;
+    }
+
+    ++numAccepted_;
+    auto eloop = em_ ? em_->pickEventLoop() : eloop_;
+    auto conn = factory_(eloop, fd);
+    if (!conn) {
+      close(fd);
+      continue;
+    }
+
+    // runs right away when the connection stays on this loop
+    conn->start();
+  }
+}
+
+void Acceptor::handleError() {
+  LOG(ERROR) << "Error on listening socket " << fd_;
+}
+
+
+MultiAcceptor::MultiAcceptor(
+  EventManager* em, Acceptor::Factory factory, int opt)
+  : em_(em), factory_(move(factory)), opt_(opt) {
+}
+
+MultiAcceptor::~MultiAcceptor() {
+  stop();
+}
+
+int MultiAcceptor::listen(const std::string& ip, int port, int backlog) {
+  int numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (numCpus < 1) {
+    numCpus = 1;
+  }
+
+  int type = (ip.find(':') == string::npos) ? Socket::sock_v4
+                                            : Socket::sock_v6;
+
+  for (int i = 0; i < em_->getNumLoops(); ++i) {
+    Socket s(-1, type);
+    fds_.push_back(s.getFD());
+
+    if (!s.setReuseAddress() || !s.setReusePort()) {
+      LOG(ERROR) << "Fails to set SO_REUSEPORT " << strerror(errno);
+      return -1;
+    }
+
+    if (opt_ & accept_pin_cpu) {
+      int cpu = i % numCpus;
+      if (!em_->pinEventLoop(i, cpu) || !s.setIncomingCpu(cpu)) {
+        LOG(WARNING) << "Fails to pin loop " << i << " to cpu " << cpu;
+      }
+    }
+
+    // the first listener picks the port, the others join its group
+    if (!s.bind(ip, port) || (port == 0 && (port = s.getPort()) <= 0)) {
+      LOG(ERROR) << "Fails to bind " << ip << ":" << port << " "
+                 << strerror(errno);
+      return -1;
+    }
+
+    if (!s.listen(backlog)) {
+      LOG(ERROR) << "Fails to listen " << strerror(errno);
+      return -1;
+    }
+
+    auto acceptor = new Acceptor(em_->getEventLoop(i), s.getFD(), factory_);
+    acceptors_.emplace_back(acceptor);
+    if (!acceptor->start()) {
+      return -1;
+    }
+  }
+
+  return port;
+}
+
+void MultiAcceptor::stop() {
+  for (auto& p : acceptors_) {
+    p->stop();
+  }
+  acceptors_.clear();
+
+  for (auto fd : fds_) {
+    close(fd);
+  }
+  fds_.clear();
+}
+
+int64_t MultiAcceptor::getNumAccepted() const {
+  int64_t ret = 0;
+  for (auto& p : acceptors_) {
+    ret += p->getNumAccepted();
+  }
+  return ret;
+}
+
+}
@@ -0,0 +1,131 @@
+#ifndef SERVER_ACCEPTOR_H
+#define SERVER_ACCEPTOR_H
+
+#include "common/Event.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace sdb {
+
+class AsyncConnection;
+
+// Accepts connections on a listening socket, either spreading them
+// across the event loops of an EventManager or keeping them on the
+// acceptor's own loop.
+//
+// For each accepted socket @factory is called on the acceptor's loop to
+// create the connection for the picked loop; the connection is then
+// started on its own loop. Return nullptr from @factory to refuse a
+// connection, the socket is closed then.
+class Acceptor : public Event {
+ public:
+
+  typedef std::function<AsyncConnection*(EventLoop* eloop, int fd)> Factory;
+
+ public:
+
+  // @fd must be a listening socket, it is made non-blocking. The
+  // acceptor does not own it. Connections are spread across the loops
+  // of @em
+  Acceptor(EventManager* em, int fd, Factory factory);
+
+  // accept on @eloop and serve the connections there as well
+  Acceptor(EventLoop* eloop, int fd, Factory factory);
+
+  ~Acceptor() override;
+
+
+  // start accepting, on one of the manager's loops if there is one
+  bool start();
+
+  // stop accepting and wait until the loop has let go of the acceptor
+  void stop();
+
+  // number of connections accepted so far
+  int64_t getNumAccepted() const { return numAccepted_.load(); }
+
+  EventLoop* getEventLoop() const { return eloop_; }
+
+
+  int getFD() const override { return fd_; }
+
+  void handleRead() override;
+
+  void handleWrite() override {}
+
+  void handleError() override;
+
+ private:
+
+  // max number of connections accepted in one loop iteration
+  static const int kMaxAcceptBatch = 64;
+
+  // null if connections stay on eloop_
+  EventManager* em_;
+
+  EventLoop* eloop_;
+
+  int fd_;
+
+  Factory factory_;
+
+  bool started_;
+
+  std::atomic<int64_t> numAccepted_;
+
+};
+
+
+// Accepts connections with one SO_REUSEPORT listener per event loop of
+// an EventManager, all bound to the same port. The kernel spreads
+// incoming connections over the listeners and each connection is served
+// by the loop that accepted it, so connections never cross threads and
+// there is no single accept loop to become the bottleneck.
+class MultiAcceptor {
+ public:
+
+  // options
+  enum {
+    // pin loop i to cpu i (modulo the number of cpus) and set
+    // SO_INCOMING_CPU on its listener, so that a connection is accepted
+    // and served on the cpu that processes its packets
+    accept_pin_cpu = 1,
+  };
+
+ public:
+
+  MultiAcceptor(EventManager* em, Acceptor::Factory factory, int opt = 0);
+
+  ~MultiAcceptor();
+
+
+  // Listen on @ip:@port, a @port of 0 picks a free port. Return the
+  // port, or -1 if any of the listeners fails
+  int listen(const std::string& ip, int port, int backlog = 1024);
+
+  // stop accepting and close the listeners
+  void stop();
+
+  int64_t getNumAccepted() const;
+
+ private:
+
+  EventManager* em_;
+
+  Acceptor::Factory factory_;
+
+  int opt_;
+
+  std::vector<int> fds_;
+
+  std::vector<std::unique_ptr<Acceptor>> acceptors_;
+
+};
+
+}
+
+#endif // SERVER_ACCEPTOR_H
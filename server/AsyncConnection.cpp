@@ -0,0 +1,564 @@
+#include "server/AsyncConnection.h"
+#include "server/Socket.h"
+#include "common/Logging.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+using namespace std;
+
+
+namespace sdb {
+
+AsyncConnection::AsyncConnection(EventLoop* eloop, int fd)
+  : eloop_(eloop),
+    fd_(fd),
+    lowWatermark_(default_low_watermark),
+    highWatermark_(default_high_watermark),
+    numPopped_(0),
+    zcMinSize_(0),
+    zcNextSeq_(0),
+    zcCopied_(0),
+    pendingBytes_(0),
+    interest_(EventLoop::handle_none),
+    registered_(false),
+    throttled_(false),
+    shutdown_(false),
+    halfClosed_(false),
+    closed_(false),
+    refs_(1) {
+}
+
+AsyncConnection::~AsyncConnection() {
+  if (!closed_ && fd_ >= 0) {
+    ::close(fd_);
+  }
+
+  for (auto& r : files_) {
+    if (r.closeWhenDone) {
+      ::close(r.fd);
+    }
+  }
+}
+
+void AsyncConnection::runInLoop(Task&& fn) {
+  if (eloop_->inLoopThread()) {
+    fn();
+  } else {
+    // the connection may close, and drop the loop's reference, before
+    // the task runs
+    addRef();
+    eloop_->submit([this, f = move(fn)]() mutable {
+      f();
+      release();
+    });
+  }
+}
+
+void AsyncConnection::start() {
+  runInLoop([this]() {
+    interest_ = EventLoop::handle_read;
+    if (!eloop_->addEvent(this, interest_)) {
+      LOG(ERROR) << "Fails to register fd " << fd_ << " " << strerror(errno);
+      closeNow();
+      return;
+    }
+
+    registered_ = true;
+    onConnected();
+
+    // output sent before the connection was registered
+    if (!closed_ && hasOutput()) {
+      handleWrite();
+    }
+  });
+}
+
+bool AsyncConnection::send(IoRange&& data) {
+  if (closed_) {
+    return false;
+  }
+
+  int64_t size = data.getRange().size();
+  auto pending = pendingBytes_.fetch_add(size) + size;
+
+  if (eloop_->inLoopThread()) {
+    enqueue(move(data));
+  } else {
+    addRef();
+    eloop_->submit([this, d = move(data)]() mutable {
+      enqueue(move(d));
+      release();
+    });
+  }
+
+  return pending <= highWatermark_;
+}
+
+bool AsyncConnection::send(IoBuf&& data) {
+  if (closed_) {
+    return false;
+  }
+
+  int64_t size = data.size();
+  auto pending = pendingBytes_.fetch_add(size) + size;
+
+  if (eloop_->inLoopThread()) {
+    enqueue(move(data));
+  } else {
+    addRef();
+    eloop_->submit([this, d = move(data)]() mutable {
+      enqueue(move(d));
+      release();
+    });
+  }
+
+  return pending <= highWatermark_;
+}
+
+bool AsyncConnection::sendFile(
+  int fd, int64_t offset, int64_t len, bool closeWhenDone) {
+  if (closed_) {
+    if (closeWhenDone) {
+      ::close(fd);
+    }
+    return false;
+  }
+
+  struct stat st;
+  bool pipe = (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode));
+  FileRegion region{fd, offset, len, 0, pipe, closeWhenDone};
+
+  auto pending = pendingBytes_.fetch_add(len) + len;
+
+  if (eloop_->inLoopThread()) {
+    enqueueFile(region);
+  } else {
+    addRef();
+    eloop_->submit([this, region]() {
+      enqueueFile(region);
+      release();
+    });
+  }
+
+  return pending <= highWatermark_;
+}
+
+bool AsyncConnection::setZeroCopy(int64_t minSize) {
+  if (minSize > 0 && !Socket(fd_).setZeroCopy(true)) {
+    return false;
+  }
+
+  zcMinSize_ = minSize;
+  return true;
+}
+
+void AsyncConnection::shutdown() {
+  runInLoop([this]() {
+    shutdown_ = true;
+    if (!closed_ && !hasOutput()) {
+      finishShutdown();
+    }
+  });
+}
+
+void AsyncConnection::close() {
+  runInLoop([this]() { closeNow(); });
+}
+
+void AsyncConnection::enqueue(IoRange&& data) {
+  int64_t size = data.getRange().size();
+  if (closed_ || halfClosed_ || size == 0) {
+    pendingBytes_.fetch_sub(size);
+    return;
+  }
+
+  bool idle = !hasOutput();
+  output_.push_back(move(data));
+  afterEnqueue(idle);
+}
+
+void AsyncConnection::enqueue(IoBuf&& data) {
+  int64_t size = data.size();
+  if (closed_ || halfClosed_ || size == 0) {
+    pendingBytes_.fetch_sub(size);
+    return;
+  }
+
+  bool idle = !hasOutput();
+  while (data.getNumSegments() > 0) {
+    auto seg = data.popFront();
+    if (seg.begin() != seg.end()) {
+      output_.push_back(move(seg));
+    }
+  }
+  afterEnqueue(idle);
+}
+
+void AsyncConnection::enqueueFile(const FileRegion& region) {
+  if (closed_ || halfClosed_ || region.len <= 0) {
+    pendingBytes_.fetch_sub(region.len);
+    if (region.closeWhenDone) {
+      ::close(region.fd);
+    }
+    return;
+  }
+
+  bool idle = !hasOutput();
+  files_.push_back(region);
+  files_.back().after = numPopped_ + output_.size();
+  afterEnqueue(idle);
+}
+
+void AsyncConnection::afterEnqueue(bool wasIdle) {
+  // write right away unless earlier output is still waiting
+  if (wasIdle && registered_ && !flush()) {
+    closeNow();
+    return;
+  }
+
+  if (!throttled_ && pendingBytes_.load() > highWatermark_) {
+    throttled_ = true;
+  }
+  updateInterest();
+}
+
+bool AsyncConnection::flush() {
+  while (hasOutput()) {
+    bool full = false;
+    int64_t n = 0;
+
+    if (!files_.empty() && files_.front().after == numPopped_) {
+      n = writeFile(files_.front(), &full);
+    } else {
+      // buffers queued before the next file region
+      size_t maxBuffers = output_.size();
+      if (!files_.empty()) {
+        maxBuffers = files_.front().after - numPopped_;
+      }
+      n = writeBuffers(maxBuffers, &full);
+    }
+
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+
+    // the socket buffer is full
+    if (full) {
+      break;
+    }
+  }
+
+  return true;
+}
+
+int64_t AsyncConnection::writeBuffers(size_t maxBuffers, bool* full) {
+  struct iovec iov[kMaxIov];
+
+  // zero copy and copied buffers go in separate calls, so that only
+  // the large ones are pinned
+  bool zc = zeroCopy(output_.front());
+  size_t num = 0;
+  int64_t size = 0;
+  for (auto it = output_.begin();
+       it != output_.end() && num < maxBuffers && num < kMaxIov &&
+       zeroCopy(*it) == zc;
+       ++it, ++num) {
+    iov[num].iov_base = it->begin();
+    iov[num].iov_len = it->end() - it->begin();
+    size += iov[num].iov_len;
+  }
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = num;
+
+  auto n = sendmsg(fd_, &msg, MSG_NOSIGNAL | (zc ? MSG_ZEROCOPY : 0));
+  if (n < 0 && zc && errno == ENOBUFS) {
+    // out of memory for notifications, copy this time
+    n = sendmsg(fd_, &msg, MSG_NOSIGNAL);
+  } else if (n >= 0 && zc) {
+    // hold the buffers until the kernel reports this send as done
+    int64_t covered = 0;
+    for (size_t i = 0; i < num && covered < n; ++i) {
+      zcPins_.emplace_back(zcNextSeq_, output_[i]);
+      covered += iov[i].iov_len;
+    }
+    ++zcNextSeq_;
+  }
+
+  if (n < 0) {
+    return n;
+  }
+
+  *full = (n < size);
+  consume(n);
+  return n;
+}
+
+int64_t AsyncConnection::writeFile(FileRegion& region, bool* full) {
+  Socket sock(fd_);
+  auto n = region.pipe ? sock.spliceFrom(region.fd, region.len)
+                       : sock.sendFile(region.fd, &region.offset, region.len);
+  if (n < 0) {
+    return n;
+  }
+
+  if (n == 0) {
+    // the peer expects len more bytes, the stream is broken
+    LOG(ERROR) << "File region of fd " << region.fd << " ends "
+               << region.len << " bytes early";
+    errno = EIO;
+    return -1;
+  }
+
+  pendingBytes_.fetch_sub(n);
+  region.len -= n;
+  if (region.len > 0) {
+    *full = true;
+    return n;
+  }
+
+  if (region.closeWhenDone) {
+    ::close(region.fd);
+  }
+  files_.pop_front();
+  return n;
+}
+
+void AsyncConnection::consume(int64_t n) {
+  pendingBytes_.fetch_sub(n);
+  while (n > 0) {
+    auto& front = output_.front();
+    n -= front.skip(n);
+    if (front.begin() == front.end()) {
+      output_.pop_front();
+      ++numPopped_;
+    }
+  }
+}
+
+int AsyncConnection::readErrorQueue() {
+  int num = 0;
+
+  for (;;) {
+    char control[128];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    // never blocks, fails with EAGAIN once the queue is empty
+    if (recvmsg(fd_, &msg, MSG_ERRQUEUE) < 0) {
+      break;
+    }
+
+    for (auto cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+      bool recvErr = (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+        || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+      if (!recvErr) {
+        continue;
+      }
+
+      struct sock_extended_err ee;
+      memcpy(&ee, CMSG_DATA(cm), sizeof(ee));
+      if (ee.ee_errno != 0 || ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+        continue;
+      }
+
+      // sends ee_info to ee_data are done, notifications come in order
+      ++num;
+      uint32_t hi = ee.ee_data;
+      if (ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+        zcCopied_ += hi - ee.ee_info + 1;
+      }
+      while (!zcPins_.empty() && (int32_t)(zcPins_.front().seq - hi) <= 0) {
+        zcPins_.pop_front();
+      }
+    }
+  }
+
+  return num;
+}
+
+void AsyncConnection::updateInterest() {
+  if (closed_ || !registered_) {
+    return;
+  }
+
+  int interest = EventLoop::handle_none;
+  if (!throttled_) {
+    interest |= EventLoop::handle_read;
+  }
+  if (hasOutput()) {
+    interest |= EventLoop::handle_write;
+  }
+
+  if (interest != interest_) {
+    interest_ = interest;
+    eloop_->updateEvent(this, interest_);
+  }
+}
+
+void AsyncConnection::handleRead() {
+  // bound the work done for one connection in a loop iteration
+  for (int i = 0; i < 16 && !closed_ && !throttled_; ++i) {
+    if (input_.tailroom() < kMinRead) {
+      input_.forceRelocate();
+      input_.reserve(kMinRead);
+    }
+
+    int room = input_.tailroom();
+    auto n = ::read(fd_, input_.end(), room);
+    if (n > 0) {
+      input_.commit(n);
+      onData(input_);
+
+      // most likely drained the socket
+      if (n < room) {
+        break;
+      }
+    } else if (n == 0) {
+      closeNow();
+    } else if (errno == EINTR) {
+      continue;
+    } else {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        closeNow();
+      }
+      break;
+    }
+  }
+}
+
+void AsyncConnection::handleWrite() {
+  if (closed_) {
+    return;
+  }
+
+  if (!flush()) {
+    closeNow();
+    return;
+  }
+
+  if (!hasOutput() && shutdown_) {
+    finishShutdown();
+    return;
+  }
+
+  bool resumed = false;
+  if (throttled_ && pendingBytes_.load() <= lowWatermark_) {
+    throttled_ = false;
+    resumed = true;
+  }
+  updateInterest();
+
+  if (resumed) {
+    onWritable();
+  }
+}
+
+void AsyncConnection::handleError() {
+  if (closed_) {
+    // the socket is kept for zero copy sends still in flight
+    if (!zcPins_.empty()) {
+      readErrorQueue();
+      if (zcPins_.empty()) {
+        closeSocket();
+      }
+    }
+    return;
+  }
+
+  // zero copy completions show up as errors, only a real one closes
+  if (zcMinSize_ > 0 || !zcPins_.empty()) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    int num = readErrorQueue();
+    if (num > 0 && getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len) == 0 &&
+        err == 0) {
+      if (halfClosed_ && zcPins_.empty()) {
+        closeNow();
+      }
+      return;
+    }
+  }
+
+  closeNow();
+}
+
+void AsyncConnection::finishShutdown() {
+  if (!zcPins_.empty()) {
+    readErrorQueue();
+  }
+  if (zcPins_.empty()) {
+    closeNow();
+    return;
+  }
+
+  // the kernel may still send from the pinned buffers, and reports on
+  // the socket when it is done
+  if (!halfClosed_) {
+    halfClosed_ = true;
+    ::shutdown(fd_, SHUT_WR);
+  }
+}
+
+void AsyncConnection::closeNow() {
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+
+  for (auto& r : output_) {
+    pendingBytes_.fetch_sub(r.end() - r.begin());
+  }
+  output_.clear();
+
+  for (auto& r : files_) {
+    pendingBytes_.fetch_sub(r.len);
+    if (r.closeWhenDone) {
+      ::close(r.fd);
+    }
+  }
+  files_.clear();
+
+  if (!zcPins_.empty()) {
+    readErrorQueue();
+  }
+  if (zcPins_.empty()) {
+    closeSocket();
+  } else {
+    // Buffers the kernel may still send from are only released once it
+    // reports on the socket, keep it until then. Nothing is read or
+    // written any more, and edge triggered, a hang up is not reported
+    // over and over
+    ::shutdown(fd_, SHUT_RDWR);
+    eloop_->updateEvent(
+      this, EventLoop::handle_error | EventLoop::handle_edge);
+  }
+
+  onClose();
+}
+
+void AsyncConnection::closeSocket() {
+  if (registered_) {
+    eloop_->removeEvent(this);
+  }
+  ::close(fd_);
+
+  // the loop may still hold this object for the current dispatch
+  eloop_->submit([this]() { release(); });
+}
+
+}
@@ -0,0 +1,291 @@
+#ifndef SERVER_ASYNCCONNECTION_H
+#define SERVER_ASYNCCONNECTION_H
+
+#include "common/Event.h"
+#include "common/Range.h"
+#include "common/IoBuf.h"
+
+#include <deque>
+#include <atomic>
+
+
+namespace sdb {
+
+// A non-blocking TCP connection served by one EventLoop.
+//
+// Subclasses override
+//
+//   @onConnected(),
+//   @onData(),
+//   @onWritable(),
+//   @onClose()
+//
+// which are all called on the loop thread. Incoming bytes are read into
+// one reusable IoRange; outgoing IoRanges are queued and written with
+// gather writes, so the per-message path does not allocate.
+//
+// Large payloads can skip the copies: buffers of at least the size given
+// to @setZeroCopy() are sent with MSG_ZEROCOPY, and file regions queued
+// with @sendFile() go through sendfile(2) or splice(2). Unlike buffer
+// writes, those two raise SIGPIPE on a reset connection, servers using
+// @sendFile() should ignore it.
+//
+// Backpressure: once more than the high watermark is queued for output,
+// @send() returns false and the connection stops reading from the peer.
+// Reading resumes, and @onWritable() is called, when the queue drains
+// below the low watermark.
+//
+// A connection owns its descriptor and deletes itself after it is closed
+// and the last reference is dropped. The loop holds one reference until
+// the connection closes, and every task queued from another thread holds
+// one until it has run. Another thread that keeps a pointer to the
+// connection, to call @send() or @close() on it, holds a reference with
+// @addRef(), taken on the loop thread (e.g. in @onConnected()), and
+// drops it with @release().
+class AsyncConnection : public Event {
+ public:
+
+  // default watermarks of the output queue, in bytes
+  enum {
+    default_low_watermark = 256 * 1024,
+    default_high_watermark = 1024 * 1024,
+  };
+
+ public:
+
+  // @fd must be a connected non-blocking socket, e.g. one accepted
+  // with SOCK_NONBLOCK
+  AsyncConnection(EventLoop* eloop, int fd);
+
+  ~AsyncConnection() override;
+
+
+  // Register with the loop and call @onConnected(), may be called from
+  // any thread. Before this the object can be deleted directly
+  void start();
+
+  void addRef() { refs_.fetch_add(1, std::memory_order_relaxed); }
+
+  // drop a reference, deletes the connection if it was the last one
+  void release() {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete this;
+    }
+  }
+
+  // Queue @data for output. Return false if the queue is above the high
+  // watermark (the data is queued anyway) or the connection is closed.
+  // Safe to call from any thread that holds a reference, the data is
+  // handed to the loop then
+  bool send(IoRange&& data);
+
+  // Queue the segments of @data for output, without copying them
+  bool send(IoBuf&& data);
+
+  // Queue @len bytes of @fd from @offset for output, in order with the
+  // buffers given to @send(). A regular file is sent with sendfile(2)
+  // and @fd is left untouched; a pipe is spliced from its current
+  // position and @offset is ignored. @fd is closed once done if
+  // @closeWhenDone. Returns like @send()
+  bool sendFile(int fd, int64_t offset, int64_t len, bool closeWhenDone);
+
+  // Send buffers of at least @minSize bytes with MSG_ZEROCOPY, 0 turns
+  // it off. Each buffer is kept alive, through the reference count of
+  // its IoRange, until the kernel reports on the error queue that it is
+  // done with it. A closed connection keeps its socket open, and
+  // itself alive, until then. Return false if the socket does not
+  // support it. Must be called on the loop thread or before @start()
+  bool setZeroCopy(int64_t minSize);
+
+  // Close the connection once the queued output has been written, and
+  // the kernel is done with the buffers of zero copy sends: the peer
+  // sees the end of the stream as soon as the output is written. May
+  // be called from any thread
+  void shutdown();
+
+  // Close the connection now, dropping queued output. May be called
+  // from any thread
+  void close();
+
+  // Must be called before @start()
+  void setWatermarks(int64_t low, int64_t high) {
+    lowWatermark_ = low;
+    highWatermark_ = high;
+  }
+
+  // bytes queued for output but not written yet
+  int64_t getPendingBytes() const { return pendingBytes_.load(); }
+
+  bool isClosed() const { return closed_.load(); }
+
+  // zero copy sends the kernel has not released yet, loop thread only
+  size_t getNumZeroCopyPending() const { return zcPins_.size(); }
+
+  // zero copy sends, and those the kernel had to copy anyway (e.g. on
+  // loopback), loop thread only
+  int64_t getNumZeroCopySends() const { return zcNextSeq_; }
+
+  int64_t getNumZeroCopyCopied() const { return zcCopied_; }
+
+  EventLoop* getEventLoop() const { return eloop_; }
+
+
+  int getFD() const override { return fd_; }
+
+  void handleRead() override;
+
+  void handleWrite() override;
+
+  void handleError() override;
+
+ protected:
+
+  // called on the loop thread once the connection is registered
+  virtual void onConnected() {}
+
+  // New bytes have been appended to @input. Consume what can be
+  // processed with @input.read() or @input.skip(), the rest is kept for
+  // the next call
+  virtual void onData(IoRange& input) = 0;
+
+  // the output queue has drained below the low watermark after it went
+  // above the high watermark
+  virtual void onWritable() {}
+
+  // the peer closed, an error occurred or @close() was called. The
+  // object is deleted soon after this returns
+  virtual void onClose() {}
+
+ private:
+
+  // read at least this many bytes at a time
+  static const int kMinRead = 4096;
+
+  // max number of buffers handed to one gather write
+  static const int kMaxIov = 64;
+
+  struct FileRegion {
+    int fd;
+
+    int64_t offset;
+
+    int64_t len;
+
+    // position in the output, the number of buffers queued before it
+    uint64_t after;
+
+    bool pipe;
+
+    bool closeWhenDone;
+  };
+
+  // a buffer held for a zero copy send
+  struct ZeroCopyPin {
+    uint32_t seq;
+
+    IoRange data;
+
+    ZeroCopyPin(uint32_t s, IoRange& d) : seq(s), data(d) {}
+  };
+
+  EventLoop* eloop_;
+
+  int fd_;
+
+  int64_t lowWatermark_;
+
+  int64_t highWatermark_;
+
+  IoRange input_;
+
+  std::deque<IoRange> output_;
+
+  // number of buffers written and popped from output_ so far
+  uint64_t numPopped_;
+
+  std::deque<FileRegion> files_;
+
+  int64_t zcMinSize_;
+
+  // sequence number of the next zero copy send
+  uint32_t zcNextSeq_;
+
+  int64_t zcCopied_;
+
+  std::deque<ZeroCopyPin> zcPins_;
+
+  std::atomic<int64_t> pendingBytes_;
+
+  // interest registered with the loop
+  int interest_;
+
+  bool registered_;
+
+  // stopped reading because output went above the high watermark
+  bool throttled_;
+
+  bool shutdown_;
+
+  // the output is written after @shutdown(), waiting for zero copy
+  // sends to complete
+  bool halfClosed_;
+
+  std::atomic<bool> closed_;
+
+  std::atomic<int> refs_;
+
+
+  // run @fn now if called on the loop thread, otherwise queue it with
+  // a reference held
+  void runInLoop(Task&& fn);
+
+  // queue @data on the loop thread
+  void enqueue(IoRange&& data);
+
+  void enqueue(IoBuf&& data);
+
+  void enqueueFile(const FileRegion& region);
+
+  // write what was just queued if nothing was waiting before
+  // (@wasIdle), update throttling and interest
+  void afterEnqueue(bool wasIdle);
+
+  // write as much queued output as possible, false if it failed
+  bool flush();
+
+  // write at most @maxBuffers queued buffers, set @full if the socket
+  // took less than offered
+  int64_t writeBuffers(size_t maxBuffers, bool* full);
+
+  int64_t writeFile(FileRegion& region, bool* full);
+
+  // drop @n written bytes from the front of output_
+  void consume(int64_t n);
+
+  // release buffers of completed zero copy sends, return the number of
+  // notifications read
+  int readErrorQueue();
+
+  bool zeroCopy(const IoRange& data) const {
+    return zcMinSize_ > 0 && data.end() - data.begin() >= zcMinSize_;
+  }
+
+  bool hasOutput() const { return !output_.empty() || !files_.empty(); }
+
+  // update the interest registered with the loop
+  void updateInterest();
+
+  // the output is written after @shutdown(), close once the kernel has
+  // released the buffers of zero copy sends
+  void finishShutdown();
+
+  void closeNow();
+
+  // close the socket, and drop the loop's reference
+  void closeSocket();
+
+};
+
+}
+
+#endif // SERVER_ASYNCCONNECTION_H
@@ -2,6 +2,7 @@
 #include "common/Logging.h"
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
@@ -206,6 +207,36 @@ bool Socket::getReuseAddress() const {
   return (v > 0);
 }
 
+bool Socket::setReusePort() {
+  int val = 1;
+  return (-1 != setsockopt(fd_, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val)));
+}
+
+bool Socket::getReusePort() const {
+  int v = 0;
+  socklen_t len = sizeof(v);
+  if (-1 == getsockopt(fd_, SOL_SOCKET, SO_REUSEPORT, &v, &len)) {
+    return false;
+  }
+
+  return (v > 0);
+}
+
+bool Socket::setIncomingCpu(int cpu) {
+  return (-1 != setsockopt(
+    fd_, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)));
+}
+
+int Socket::getIncomingCpu() const {
+  int v = -1;
+  socklen_t len = sizeof(v);
+  if (-1 == getsockopt(fd_, SOL_SOCKET, SO_INCOMING_CPU, &v, &len)) {
+    return -1;
+  }
+
+  return v;
+}
+
 bool Socket::setLinger(int seconds) {
   struct linger l;
   if (seconds <= 0) {
@@ -233,7 +264,7 @@ int Socket::getLinger() const {
 
 bool Socket::setNoDelay(bool noDelay) {
   int v = noDelay ? 1 : 0;
-  return (-1 == setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &v, sizeof(v)));
+  return (-1 != setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &v, sizeof(v)));
 }
 
 bool Socket::getNoDelay() const {
@@ -285,6 +316,21 @@ bool Socket::getNonblocking() const {
   return (flags & O_NONBLOCK);
 }
 
+bool Socket::setZeroCopy(bool zeroCopy) {
+  int v = zeroCopy ? 1 : 0;
+  return (-1 != setsockopt(fd_, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v)));
+}
+
+bool Socket::getZeroCopy() const {
+  int v = 0;
+  socklen_t len = sizeof(v);
+  if (-1 == getsockopt(fd_, SOL_SOCKET, SO_ZEROCOPY, &v, &len)) {
+    return false;
+  }
+
+  return (v > 0);
+}
+
 int Socket::getFD() const {
   return fd_;
 }
@@ -360,6 +406,22 @@ int Socket::accept() {
   return ::accept(fd_, nullptr, nullptr);
 }
 
+int Socket::accept(int flags) {
+  return ::accept4(fd_, nullptr, nullptr, flags);
+}
+
+int64_t Socket::sendFile(int fd, int64_t* offset, int64_t len) {
+  off_t off = *offset;
+  auto ret = ::sendfile(fd_, fd, &off, len);
+  *offset = off;
+  return ret;
+}
+
+int64_t Socket::spliceFrom(int pipeFd, int64_t len) {
+  return ::splice(
+    pipeFd, nullptr, fd_, nullptr, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+}
+
 void Socket::close() {
   ::close(fd_);
   fd_ = -1;
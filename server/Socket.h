@@ -54,6 +54,20 @@ class Socket {
   bool getReuseAddress() const;
 
 
+  // let several sockets bind to the same address and port, the kernel
+  // spreads incoming connections over the listeners
+  bool setReusePort();
+
+  bool getReusePort() const;
+
+
+  // On a SO_REUSEPORT listener, prefer this listener for connections
+  // whose packets are processed on @cpu
+  bool setIncomingCpu(int cpu);
+
+  int getIncomingCpu() const;
+
+
   // A value 0 means no linger (close immediately)
   bool setLinger(int seconds);
 
@@ -70,6 +84,13 @@ class Socket {
   bool getNonblocking() const;
 
 
+  // allow sends with MSG_ZEROCOPY, whose completions are reported on
+  // the socket's error queue
+  bool setZeroCopy(bool zeroCopy);
+
+  bool getZeroCopy() const;
+
+
   int getFD() const;
 
 
@@ -87,6 +108,19 @@ class Socket {
   // accept a new connection, returns the new fd or -1 if error occurs
   int accept();
 
+  // accept with accept4(2) @flags, e.g. SOCK_NONBLOCK | SOCK_CLOEXEC so
+  // that the new socket needs no further fcntl calls
+  int accept(int flags);
+
+  // Send up to @len bytes of regular file @fd from @*offset without
+  // copying through user space, @*offset is advanced. Return the number
+  // of bytes sent or -1 on error
+  int64_t sendFile(int fd, int64_t* offset, int64_t len);
+
+  // Move up to @len bytes from pipe @pipeFd into the socket. Return the
+  // number of bytes moved or -1 on error
+  int64_t spliceFrom(int pipeFd, int64_t len);
+
   // close the socket. After this call the underlying fd_ becomes invalid
   void close();
 
@@ -4,6 +4,8 @@ cpp_library(
   name = "libserver.a",
   srcs = [
     "Socket.cpp",
+    "AsyncConnection.cpp",
+    "Acceptor.cpp",
   ],
   deps = [
     "common:libbase.a",
@@ -0,0 +1,242 @@
+#include "server/Acceptor.h"
+#include "server/AsyncConnection.h"
+#include "server/Socket.h"
+#include "common/ThreadPool.h"
+#include "common/Logging.h"
+#include "common/UnitTest.h"
+
+#include <sched.h>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+using namespace sdb;
+using namespace std;
+using namespace std::chrono;
+
+// enable this if you want to print out perf info
+const bool printPerf = false;
+
+
+// wait until @pred holds or @ms passes
+template <class Pred>
+static bool waitFor(Pred pred, int ms) {
+  for (int i = 0; i < ms && !pred(); ++i) {
+    this_thread::sleep_for(milliseconds(1));
+  }
+  return pred();
+}
+
+static atomic<int> numConnected(0);
+
+static atomic<int> numClosed(0);
+
+// connections served on another thread than the one that accepted them
+static atomic<int> numCrossed(0);
+
+// echo, and remember which thread accepted the connection
+class TrackedConnection : public AsyncConnection {
+ public:
+
+  TrackedConnection(EventLoop* eloop, int fd)
+    : AsyncConnection(eloop, fd), acceptedOn_(this_thread::get_id()) {}
+
+ protected:
+
+  void onConnected() override {
+    if (this_thread::get_id() != acceptedOn_) {
+      ++numCrossed;
+    }
+    ++numConnected;
+  }
+
+  void onData(IoRange& input) override {
+    IoRange out;
+    out.append(input.getRange());
+    input.skip(input.getRange().size());
+    send(move(out));
+  }
+
+  void onClose() override {
+    ++numClosed;
+  }
+
+ private:
+
+  thread::id acceptedOn_;
+};
+
+static AsyncConnection* newTracked(EventLoop* eloop, int fd) {
+  return new TrackedConnection(eloop, fd);
+}
+
+
+TEST(Acceptor, testReusePort) {
+  FORK {
+    auto em = new EventManager(3, 1);
+    MultiAcceptor acceptor(em, newTracked);
+    int port = acceptor.listen("127.0.0.1", 0);
+    ASSERT_GT(port, 0);
+
+    const int numClients = 30;
+    vector<Socket> clients(numClients);
+    for (auto& s : clients) {
+      ASSERT_TRUE(s.connect("127.0.0.1", port));
+      ASSERT_EQ(write(s.getFD(), "hi", 2), 2);
+    }
+
+    for (auto& s : clients) {
+      char buf[2];
+      ASSERT_EQ(read(s.getFD(), buf, 2), 2);
+      s.close();
+    }
+
+    ASSERT_TRUE(waitFor([]() { return numClosed == numClients; }, 2000));
+    ASSERT_EQ(acceptor.getNumAccepted(), numClients);
+    ASSERT_EQ(numConnected.load(), numClients);
+    ASSERT_EQ(numCrossed.load(), 0);
+
+    acceptor.stop();
+    em->drain();
+    delete em;
+  };
+}
+
+TEST(Acceptor, testPinCpu) {
+  FORK {
+    auto em = new EventManager(2, 1);
+    MultiAcceptor acceptor(em, newTracked, MultiAcceptor::accept_pin_cpu);
+    int port = acceptor.listen("127.0.0.1", 0);
+    ASSERT_GT(port, 0);
+
+    // loop i runs on cpu i modulo the number of cpus
+    int numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 0; i < em->getNumLoops(); ++i) {
+      auto cpu = em->getEventLoop(i)->async([]() {
+        return sched_getcpu();
+      }).get();
+      ASSERT_EQ(cpu, i % numCpus);
+    }
+
+    Socket client;
+    ASSERT_TRUE(client.connect("127.0.0.1", port));
+    ASSERT_TRUE(waitFor([]() { return numConnected == 1; }, 2000));
+    client.close();
+    ASSERT_TRUE(waitFor([]() { return numClosed == 1; }, 2000));
+
+    acceptor.stop();
+    em->drain();
+    delete em;
+  };
+}
+
+// a loop pins itself when the acceptor is set up from its thread
+TEST(Acceptor, testPinCpuFromLoop) {
+  FORK {
+    auto em = new EventManager(2, 1);
+    MultiAcceptor acceptor(em, newTracked, MultiAcceptor::accept_pin_cpu);
+    int port = em->getEventLoop(0)->async([&acceptor]() {
+      return acceptor.listen("127.0.0.1", 0);
+    }).get();
+    ASSERT_GT(port, 0);
+
+    int numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 0; i < em->getNumLoops(); ++i) {
+      auto cpu = em->getEventLoop(i)->async([]() {
+        return sched_getcpu();
+      }).get();
+      ASSERT_EQ(cpu, i % numCpus);
+    }
+
+    acceptor.stop();
+    em->drain();
+    delete em;
+  };
+}
+
+
+// accepting modes compared by testPerf
+enum {
+  mode_single = 0,
+  mode_reuse_port,
+  mode_reuse_port_pinned,
+};
+
+// connections per second for @numConns connect/close cycles from
+// @numClients threads
+static int64_t connectionRate(int mode, int numConns, int numClients) {
+  numClosed = 0;
+
+  auto em = new EventManager(4, 1);
+  Socket listener;
+  unique_ptr<Acceptor> single;
+  unique_ptr<MultiAcceptor> multi;
+  int port = 0;
+
+  if (mode == mode_single) {
+    ASSERT_TRUE(listener.bind("127.0.0.1", 0));
+    ASSERT_TRUE(listener.listen(1024));
+    port = listener.getPort();
+    single.reset(new Acceptor(em, listener.getFD(), newTracked));
+    ASSERT_TRUE(single->start());
+  } else {
+    int opt = (mode == mode_reuse_port_pinned) ? MultiAcceptor::accept_pin_cpu
+                                               : 0;
+    multi.reset(new MultiAcceptor(em, newTracked, opt));
+    port = multi->listen("127.0.0.1", 0);
+    ASSERT_GT(port, 0);
+  }
+
+  auto clients = new ThreadPool(numClients);
+  auto beg = steady_clock::now();
+
+  for (int c = 0; c < numClients; ++c) {
+    clients->submit([port, numConns, numClients]() {
+      for (int i = 0; i < numConns / numClients; ++i) {
+        Socket s;
+        ASSERT_TRUE(s.connect("127.0.0.1", port));
+
+        // reset instead of leaving the port in TIME_WAIT
+        s.setLinger(0);
+        s.close();
+      }
+    });
+  }
+
+  clients->drain();
+  int total = numConns / numClients * numClients;
+  ASSERT_TRUE(waitFor([total]() { return numClosed == total; }, 30000));
+  auto us = duration_cast<microseconds>(steady_clock::now() - beg).count();
+
+  if (single) {
+    single->stop();
+  } else {
+    multi->stop();
+  }
+  listener.close();
+  em->drain();
+  delete em;
+  delete clients;
+
+  return (int64_t)total * 1000000 / (us + 1);
+}
+
+TEST(Acceptor, testPerf) {
+  FORK {
+    const int numConns = printPerf ? 20000 : 200;
+    const int numClients = 4;
+
+    auto single = connectionRate(mode_single, numConns, numClients);
+    auto multi = connectionRate(mode_reuse_port, numConns, numClients);
+    auto pinned = connectionRate(mode_reuse_port_pinned, numConns, numClients);
+
+    if (printPerf) {
+      cout << "single acceptor: " << single << " connections/s, "
+           << "SO_REUSEPORT: " << multi << " connections/s, "
+           << "SO_REUSEPORT pinned: " << pinned << " connections/s" << endl;
+    }
+  };
+}
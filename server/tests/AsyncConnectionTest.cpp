@@ -0,0 +1,675 @@
+#include "server/AsyncConnection.h"
+#include "server/Acceptor.h"
+#include "server/Socket.h"
+#include "common/Logging.h"
+#include "common/UnitTest.h"
+
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+
+using namespace sdb;
+using namespace std;
+using namespace std::chrono;
+
+
+// wait until @pred holds or @ms passes
+template <class Pred>
+static bool waitFor(Pred pred, int ms) {
+  for (int i = 0; i < ms && !pred(); ++i) {
+    this_thread::sleep_for(milliseconds(1));
+  }
+  return pred();
+}
+
+// read exactly @size bytes from a blocking socket
+static string readAll(Socket& s, size_t size) {
+  string ret(size, 0);
+  size_t got = 0;
+  while (got < size) {
+    auto n = read(s.getFD(), &ret[got], size - got);
+    ASSERT_GT(n, 0);
+    got += n;
+  }
+  return ret;
+}
+
+static IoRange toIoRange(const string& s) {
+  IoRange ret;
+  ret.append(s);
+  return ret;
+}
+
+// a listening socket on a free port of the loopback address
+static Socket listenOnLoopback(int* port) {
+  Socket s;
+  s.setReuseAddress();
+  *port = s.bindToFreePort("127.0.0.1");
+  ASSERT_GE(*port, 0);
+  ASSERT_TRUE(s.listen(128));
+  return s;
+}
+
+
+static atomic<int> numClosed(0);
+
+static mutex loopsMutex;
+
+// loops that served echo connections
+static set<EventLoop*> loopsUsed;
+
+class EchoConnection : public AsyncConnection {
+ public:
+
+  EchoConnection(EventLoop* eloop, int fd) : AsyncConnection(eloop, fd) {}
+
+ protected:
+
+  void onConnected() override {
+    lock_guard<mutex> l(loopsMutex);
+    loopsUsed.insert(getEventLoop());
+  }
+
+  void onData(IoRange& input) override {
+    IoRange out;
+    out.append(input.getRange());
+    input.skip(input.getRange().size());
+    send(move(out));
+  }
+
+  void onClose() override {
+    ++numClosed;
+  }
+};
+
+static void runEcho(int backend) {
+  numClosed = 0;
+  loopsUsed.clear();
+
+  auto em = new EventManager(3, 1, backend);
+  int port = 0;
+  auto listener = listenOnLoopback(&port);
+
+  Acceptor acceptor(em, listener.getFD(), [](EventLoop* eloop, int fd) {
+    return new EchoConnection(eloop, fd);
+  });
+  ASSERT_TRUE(acceptor.start());
+
+  const int numClients = 6;
+  vector<Socket> clients(numClients);
+  for (auto& s : clients) {
+    ASSERT_TRUE(s.connect("127.0.0.1", port));
+  }
+
+  for (int r = 0; r < 20; ++r) {
+    for (int i = 0; i < numClients; ++i) {
+      auto msg = "client " + to_string(i) + " round " + to_string(r);
+      ASSERT_EQ(write(clients[i].getFD(), msg.data(), msg.size()),
+                (int)msg.size());
+      ASSERT_EQ(readAll(clients[i], msg.size()), msg);
+    }
+  }
+
+  ASSERT_EQ(acceptor.getNumAccepted(), numClients);
+  {
+    // connections are spread over all the loops, the acceptor's included
+    lock_guard<mutex> l(loopsMutex);
+    ASSERT_EQ(loopsUsed.size(), 3);
+  }
+
+  for (auto& s : clients) {
+    s.close();
+  }
+  ASSERT_TRUE(waitFor([]() { return numClosed == numClients; }, 2000));
+
+  acceptor.stop();
+  listener.close();
+  em->drain();
+  delete em;
+}
+
+TEST(AsyncConnection, testEcho) {
+  FORK {
+    runEcho(Poller::backend_epoll);
+  };
+}
+
+TEST(AsyncConnection, testEchoUring) {
+  FORK {
+    runEcho(Poller::backend_uring);
+  };
+}
+
+
+// sends @numMessages small messages when connected
+class BurstConnection : public AsyncConnection {
+ public:
+
+  BurstConnection(EventLoop* eloop, int fd, int numMessages, bool close)
+    : AsyncConnection(eloop, fd), numMessages_(numMessages), close_(close) {}
+
+ protected:
+
+  void onConnected() override {
+    for (int i = 0; i < numMessages_; ++i) {
+      send(toIoRange("message " + to_string(i) + "\n"));
+    }
+    if (close_) {
+      shutdown();
+    }
+  }
+
+  void onData(IoRange& input) override {}
+
+ private:
+
+  int numMessages_;
+
+  bool close_;
+};
+
+TEST(AsyncConnection, testGatherWriteAndShutdown) {
+  FORK {
+    auto em = new EventManager(2, 1);
+    int port = 0;
+    auto listener = listenOnLoopback(&port);
+
+    // more messages than one writev takes
+    const int numMessages = 500;
+    Acceptor acceptor(em, listener.getFD(), [](EventLoop* eloop, int fd) {
+      return new BurstConnection(eloop, fd, numMessages, true);
+    });
+    ASSERT_TRUE(acceptor.start());
+
+    Socket client;
+    ASSERT_TRUE(client.connect("127.0.0.1", port));
+
+    string expected;
+    for (int i = 0; i < numMessages; ++i) {
+      expected += "message " + to_string(i) + "\n";
+    }
+    ASSERT_EQ(readAll(client, expected.size()), expected);
+
+    // the server closes once everything is written
+    char c;
+    ASSERT_EQ(read(client.getFD(), &c, 1), 0);
+
+    client.close();
+    acceptor.stop();
+    listener.close();
+    em->drain();
+    delete em;
+  };
+}
+
+
+static atomic<int> numWritable(0);
+
+static atomic<int> bytesReceived(0);
+
+static atomic<int64_t> bytesQueued(0);
+
+// queue output until the high watermark is hit
+class FloodConnection : public AsyncConnection {
+ public:
+
+  FloodConnection(EventLoop* eloop, int fd) : AsyncConnection(eloop, fd) {
+    setWatermarks(64 * 1024, 256 * 1024);
+  }
+
+ protected:
+
+  void onConnected() override {
+    string chunk(16 * 1024, 'f');
+    do {
+      bytesQueued += chunk.size();
+    } while (send(toIoRange(chunk)));
+  }
+
+  void onData(IoRange& input) override {
+    bytesReceived += input.getRange().size();
+    input.skip(input.getRange().size());
+  }
+
+  void onWritable() override {
+    ++numWritable;
+  }
+};
+
+TEST(AsyncConnection, testWatermarks) {
+  FORK {
+    auto em = new EventManager(1, 1);
+    int port = 0;
+    auto listener = listenOnLoopback(&port);
+
+    atomic<AsyncConnection*> conn(nullptr);
+    auto factory = [&conn](EventLoop* eloop, int fd) {
+      conn = new FloodConnection(eloop, fd);
+      return conn.load();
+    };
+    Acceptor acceptor(em, listener.getFD(), factory);
+    ASSERT_TRUE(acceptor.start());
+
+    Socket client;
+    ASSERT_TRUE(client.connect("127.0.0.1", port));
+    ASSERT_TRUE(waitFor([&]() {
+      auto p = conn.load();
+      return p && p->getPendingBytes() > 256 * 1024;
+    }, 2000));
+
+    // the server does not read while its output is backed up
+    ASSERT_EQ(write(client.getFD(), "ping", 4), 4);
+    this_thread::sleep_for(milliseconds(50));
+    ASSERT_EQ(bytesReceived.load(), 0);
+    ASSERT_EQ(numWritable.load(), 0);
+
+    // drain the output, which resumes reading
+    readAll(client, bytesQueued.load());
+    ASSERT_TRUE(waitFor([]() { return bytesReceived == 4; }, 2000));
+    ASSERT_EQ(numWritable.load(), 1);
+    ASSERT_EQ(conn.load()->getPendingBytes(), 0);
+
+    client.close();
+    acceptor.stop();
+    listener.close();
+    em->drain();
+    delete em;
+  };
+}
+
+
+// payload of the zero copy test, large buffers mixed with small ones
+static vector<string> zeroCopyMessages() {
+  vector<string> ret;
+  for (int i = 0; i < 40; ++i) {
+    if (i % 4 == 0) {
+      ret.push_back("small " + to_string(i));
+    } else {
+      ret.push_back(string(64 * 1024, 'a' + i % 26));
+    }
+  }
+  return ret;
+}
+
+class ZeroCopyConnection : public AsyncConnection {
+ public:
+
+  ZeroCopyConnection(EventLoop* eloop, int fd) : AsyncConnection(eloop, fd) {}
+
+ protected:
+
+  void onConnected() override {
+    ASSERT_TRUE(setZeroCopy(32 * 1024));
+    for (auto& s : zeroCopyMessages()) {
+      send(toIoRange(s));
+    }
+  }
+
+  void onData(IoRange& input) override {}
+};
+
+TEST(AsyncConnection, testZeroCopy) {
+  FORK {
+    auto em = new EventManager(1, 1);
+    int port = 0;
+    auto listener = listenOnLoopback(&port);
+
+    atomic<AsyncConnection*> conn(nullptr);
+    auto factory = [&conn](EventLoop* eloop, int fd) {
+      conn = new ZeroCopyConnection(eloop, fd);
+      return conn.load();
+    };
+    Acceptor acceptor(em, listener.getFD(), factory);
+    ASSERT_TRUE(acceptor.start());
+
+    Socket client;
+    ASSERT_TRUE(client.connect("127.0.0.1", port));
+
+    string expected;
+    for (auto& s : zeroCopyMessages()) {
+      expected += s;
+    }
+    ASSERT_TRUE(readAll(client, expected.size()) == expected);
+
+    // every pinned buffer is released once the kernel reports back
+    auto p = conn.load();
+    auto eloop = p->getEventLoop();
+    ASSERT_TRUE(waitFor([p, eloop]() {
+      return eloop->async([p]() {
+        return p->getNumZeroCopyPending() == 0;
+      }).get();
+    }, 2000));
+
+    auto sends = eloop->async([p]() { return p->getNumZeroCopySends(); });
+    ASSERT_GT(sends.get(), 0);
+
+    client.close();
+    acceptor.stop();
+    listener.close();
+    em->drain();
+    delete em;
+  };
+}
+
+// large zero copy buffers, then shutdown(), or close() if @close, right
+// away
+class ZeroCopyShutdownConnection : public AsyncConnection {
+ public:
+
+  ZeroCopyShutdownConnection(EventLoop* eloop, int fd, bool close)
+    : AsyncConnection(eloop, fd), close_(close) {}
+
+ protected:
+
+  void onConnected() override {
+    // the test looks at the connection after it closes
+    addRef();
+
+    // room for all of the output, so that the queue drains right away
+    ASSERT_TRUE(Socket(getFD()).setSendBufSize(2 * 1024 * 1024));
+    ASSERT_TRUE(setZeroCopy(32 * 1024));
+    for (int i = 0; i < 4; ++i) {
+      send(toIoRange(string(64 * 1024, 'a' + i)));
+    }
+    if (close_) {
+      close();
+    } else {
+      shutdown();
+    }
+  }
+
+  void onData(IoRange& input) override {}
+
+ private:
+
+  bool close_;
+};
+
+static void runZeroCopyShutdown(bool close) {
+  auto em = new EventManager(1, 1);
+  int port = 0;
+  auto listener = listenOnLoopback(&port);
+
+  atomic<AsyncConnection*> conn(nullptr);
+  auto factory = [&conn, close](EventLoop* eloop, int fd) {
+    conn = new ZeroCopyShutdownConnection(eloop, fd, close);
+    return conn.load();
+  };
+  Acceptor acceptor(em, listener.getFD(), factory);
+  ASSERT_TRUE(acceptor.start());
+
+  // a small window keeps most of the output in the sender's queue
+  Socket client;
+  ASSERT_TRUE(client.setRecvBufSize(4096));
+  ASSERT_TRUE(client.connect("127.0.0.1", port));
+
+  ASSERT_TRUE(waitFor([&conn]() {
+    return conn.load() && conn.load()->getPendingBytes() == 0;
+  }, 2000));
+  auto p = conn.load();
+  auto eloop = p->getEventLoop();
+
+  // buffers released too early are handed out again, and overwritten
+  vector<unique_ptr<IoRange>> reused;
+  eloop->async([&reused]() {
+    for (int i = 0; i < 64; ++i) {
+      reused.emplace_back(new IoRange(64 * 1024));
+      memset(reused.back()->end(), 'x', reused.back()->tailroom());
+      reused.back()->commit(reused.back()->tailroom());
+    }
+  }).get();
+
+  // all of it, which the kernel had taken before the connection closed,
+  // then the end of the stream
+  string expected;
+  for (int i = 0; i < 4; ++i) {
+    expected += string(64 * 1024, 'a' + i);
+  }
+  ASSERT_TRUE(readAll(client, expected.size()) == expected);
+  char c;
+  ASSERT_EQ(read(client.getFD(), &c, 1), 0);
+
+  ASSERT_TRUE(waitFor([p]() { return p->isClosed(); }, 2000));
+  ASSERT_TRUE(waitFor([p, eloop]() {
+    return eloop->async([p]() {
+      return p->getNumZeroCopyPending() == 0;
+    }).get();
+  }, 2000));
+  eloop->async([p]() { p->release(); }).get();
+
+  client.close();
+  acceptor.stop();
+  listener.close();
+  em->drain();
+  delete em;
+}
+
+TEST(AsyncConnection, testZeroCopyShutdown) {
+  FORK {
+    runZeroCopyShutdown(false);
+  };
+}
+
+TEST(AsyncConnection, testZeroCopyClose) {
+  FORK {
+    runZeroCopyShutdown(true);
+  };
+}
+
+
+// read end of a pipe holding the piped part of the sendfile test
+static int pipeFd = -1;
+
+static int fileFd = -1;
+
+static const char pipedData[] = "piped data";
+
+// send a header, part of a file, a trailer and the content of a pipe
+class FileConnection : public AsyncConnection {
+ public:
+
+  FileConnection(EventLoop* eloop, int fd) : AsyncConnection(eloop, fd) {}
+
+ protected:
+
+  void onConnected() override {
+    send(toIoRange("header\n"));
+    sendFile(fileFd, 1000, 500000, true);
+    send(toIoRange("trailer\n"));
+    sendFile(pipeFd, 0, sizeof(pipedData) - 1, true);
+    shutdown();
+  }
+
+  void onData(IoRange& input) override {}
+};
+
+TEST(AsyncConnection, testSendFile) {
+  FORK {
+    auto em = new EventManager(1, 1);
+    int port = 0;
+    auto listener = listenOnLoopback(&port);
+
+    string content;
+    for (int i = 0; content.size() < 600000; ++i) {
+      content += to_string(i) + ",";
+    }
+
+    char path[] = "/tmp/asyncconnection_test_XXXXXX";
+    fileFd = mkstemp(path);
+    ASSERT_GE(fileFd, 0);
+    unlink(path);
+    ASSERT_EQ(write(fileFd, content.data(), content.size()),
+              (int)content.size());
+
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    ASSERT_EQ(write(fds[1], pipedData, sizeof(pipedData) - 1),
+              (int)sizeof(pipedData) - 1);
+    ::close(fds[1]);
+    pipeFd = fds[0];
+
+    Acceptor acceptor(em, listener.getFD(), [](EventLoop* eloop, int fd) {
+      return new FileConnection(eloop, fd);
+    });
+    ASSERT_TRUE(acceptor.start());
+
+    Socket client;
+    ASSERT_TRUE(client.connect("127.0.0.1", port));
+
+    auto expected = "header\n" + content.substr(1000, 500000) + "trailer\n" +
+      pipedData;
+    ASSERT_TRUE(readAll(client, expected.size()) == expected);
+
+    // the file descriptors are closed with the regions
+    char c;
+    ASSERT_EQ(read(client.getFD(), &c, 1), 0);
+    ASSERT_EQ(fcntl(fileFd, F_GETFD), -1);
+    ASSERT_EQ(fcntl(pipeFd, F_GETFD), -1);
+
+    client.close();
+    acceptor.stop();
+    listener.close();
+    em->drain();
+    delete em;
+  };
+}
+
+
+// a large message built in an IoBuf, with its length prepended
+static string chainedMessage() {
+  string ret;
+  for (int i = 0; ret.size() < 200000; ++i) {
+    ret += to_string(i) + ";";
+  }
+  return ret;
+}
+
+class ChainConnection : public AsyncConnection {
+ public:
+
+  ChainConnection(EventLoop* eloop, int fd) : AsyncConnection(eloop, fd) {}
+
+ protected:
+
+  void onConnected() override {
+    IoBuf buf;
+    buf.append(chainedMessage());
+    auto header = to_string(buf.size()) + "\n";
+    buf.prepend(Range(header));
+    send(move(buf));
+    shutdown();
+  }
+
+  void onData(IoRange& input) override {}
+};
+
+TEST(AsyncConnection, testSendIoBuf) {
+  FORK {
+    auto em = new EventManager(1, 1);
+    int port = 0;
+    auto listener = listenOnLoopback(&port);
+
+    Acceptor acceptor(em, listener.getFD(), [](EventLoop* eloop, int fd) {
+      return new ChainConnection(eloop, fd);
+    });
+    ASSERT_TRUE(acceptor.start());
+
+    Socket client;
+    ASSERT_TRUE(client.connect("127.0.0.1", port));
+
+    auto body = chainedMessage();
+    auto expected = to_string(body.size()) + "\n" + body;
+    ASSERT_TRUE(readAll(client, expected.size()) == expected);
+
+    char c;
+    ASSERT_EQ(read(client.getFD(), &c, 1), 0);
+
+    client.close();
+    acceptor.stop();
+    listener.close();
+    em->drain();
+    delete em;
+  };
+}
+
+
+static atomic<int> numSharedDeleted(0);
+
+static atomic<AsyncConnection*> sharedConn(nullptr);
+
+// hands a reference of itself to another thread
+class SharedConnection : public AsyncConnection {
+ public:
+
+  SharedConnection(EventLoop* eloop, int fd) : AsyncConnection(eloop, fd) {}
+
+  ~SharedConnection() override { ++numSharedDeleted; }
+
+ protected:
+
+  void onConnected() override {
+    addRef();
+    sharedConn = this;
+  }
+
+  void onData(IoRange& input) override {
+    input.skip(input.getRange().size());
+  }
+};
+
+TEST(AsyncConnection, testSendWhilePeerCloses) {
+  FORK {
+    auto em = new EventManager(1, 1);
+    int port = 0;
+    auto listener = listenOnLoopback(&port);
+
+    Acceptor acceptor(em, listener.getFD(), [](EventLoop* eloop, int fd) {
+      return new SharedConnection(eloop, fd);
+    });
+    ASSERT_TRUE(acceptor.start());
+
+    Socket client;
+    ASSERT_TRUE(client.connect("127.0.0.1", port));
+    ASSERT_TRUE(waitFor([]() { return sharedConn != nullptr; }, 2000));
+    auto conn = sharedConn.load();
+
+    // sends race with the close, some are queued behind it
+    atomic<int64_t> numSent(0);
+    thread sender([conn, &numSent]() {
+      while (!conn->isClosed()) {
+        if (!conn->send(toIoRange("message\n"))) {
+          this_thread::sleep_for(milliseconds(1));
+        }
+        ++numSent;
+      }
+    });
+
+    ASSERT_TRUE(waitFor([&]() { return numSent > 1000; }, 2000));
+    client.close();
+    sender.join();
+
+    // the reference keeps the closed connection alive
+    this_thread::sleep_for(milliseconds(50));
+    ASSERT_EQ(numSharedDeleted.load(), 0);
+    ASSERT_TRUE(conn->isClosed());
+    ASSERT_FALSE(conn->send(toIoRange("late\n")));
+    ASSERT_EQ(conn->getPendingBytes(), 0);
+
+    conn->release();
+    ASSERT_TRUE(waitFor([]() { return numSharedDeleted == 1; }, 2000));
+
+    acceptor.stop();
+    listener.close();
+    em->drain();
+    delete em;
+  };
+}
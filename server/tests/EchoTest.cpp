@@ -0,0 +1,317 @@
+#include "server/Socket.h"
+#include "common/Event.h"
+#include "common/ThreadPool.h"
+#include "common/Logging.h"
+#include "common/UnitTest.h"
+
+#include <sys/socket.h>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <string.h>
+#include <unistd.h>
+
+using namespace sdb;
+using namespace std;
+using namespace std::chrono;
+
+// enable this if you want to print out perf info
+const bool printPerf = false;
+
+
+// number of connections the echo servers have not closed yet
+static atomic<int> numLive(0);
+
+// syscalls made by the handlers of the epoll server
+static int64_t numHandlerSyscalls = 0;
+
+
+// echo server on readiness: read what is there and write it back
+class EchoConn : public Event {
+ public:
+
+  EchoConn(EventLoop* eloop, int fd) : eloop_(eloop), fd_(fd) {
+    ++numLive;
+  }
+
+  ~EchoConn() override {
+    close(fd_);
+    --numLive;
+  }
+
+  int getFD() const override { return fd_; }
+
+  void handleRead() override {
+    char buf[4096];
+    ++numHandlerSyscalls;
+    int n = read(fd_, buf, sizeof(buf));
+    if (n == 0 || (n < 0 && errno != EAGAIN)) {
+      eloop_->removeEvent(this);
+      delete this;
+      return;
+    }
+
+    for (int off = 0; off < n;) {
+      ++numHandlerSyscalls;
+      int w = write(fd_, buf + off, n - off);
+      if (w <= 0) {
+        break;
+      }
+      off += w;
+    }
+  }
+
+  void handleWrite() override {}
+
+  void handleError() override {}
+
+ private:
+
+  EventLoop* eloop_;
+
+  int fd_;
+};
+
+class EchoAcceptor : public Event {
+ public:
+
+  EchoAcceptor(EventLoop* eloop, int fd) : eloop_(eloop), fd_(fd) {}
+
+  int getFD() const override { return fd_; }
+
+  void handleRead() override {
+    while (true) {
+      ++numHandlerSyscalls;
+      int fd = accept4(fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) {
+        break;
+      }
+      eloop_->addEvent(new EchoConn(eloop_, fd), EventLoop::handle_read);
+    }
+  }
+
+  void handleWrite() override {}
+
+  void handleError() override {}
+
+ private:
+
+  EventLoop* eloop_;
+
+  int fd_;
+};
+
+
+// echo server on completions: a recv completes with the data, which is
+// sent back before the next recv is issued
+class UringEchoConn : public IoCompletion {
+ public:
+
+  UringEchoConn(EventLoop* eloop, int fd)
+    : eloop_(eloop), fd_(fd), sending_(false), sent_(0), size_(0) {
+    ++numLive;
+  }
+
+  ~UringEchoConn() override {
+    close(fd_);
+    --numLive;
+  }
+
+  void start() {
+    sending_ = false;
+    IoRequest req(IoRequest::io_recv, fd_, buf_, sizeof(buf_));
+    eloop_->submitIo(req, this);
+  }
+
+  void handleCompletion(int res, uint32_t flags) override {
+    if (res <= 0) {
+      delete this;
+      return;
+    }
+
+    if (sending_) {
+      sent_ += res;
+    } else {
+      sending_ = true;
+      sent_ = 0;
+      size_ = res;
+    }
+
+    if (sent_ == size_) {
+      start();
+      return;
+    }
+
+    IoRequest req(IoRequest::io_send, fd_, buf_ + sent_, size_ - sent_);
+    eloop_->submitIo(req, this);
+  }
+
+ private:
+
+  EventLoop* eloop_;
+
+  int fd_;
+
+  bool sending_;
+
+  int sent_;
+
+  int size_;
+
+  char buf_[4096];
+};
+
+class UringEchoAcceptor : public IoCompletion {
+ public:
+
+  explicit UringEchoAcceptor(EventLoop* eloop) : eloop_(eloop) {}
+
+  void handleCompletion(int res, uint32_t flags) override {
+    if (res >= 0) {
+      (new UringEchoConn(eloop_, res))->start();
+    }
+  }
+
+ private:
+
+  EventLoop* eloop_;
+};
+
+
+// wait until the servers have @num connections open
+static bool waitForLive(int num) {
+  for (int i = 0; i < 2000 && numLive != num; ++i) {
+    this_thread::sleep_for(milliseconds(1));
+  }
+  return numLive == num;
+}
+
+struct EchoResult {
+  int64_t requests;
+
+  int64_t syscalls;
+
+  int64_t micros;
+};
+
+// @numClients connections send a message of @size bytes each and wait
+// for all the replies, @rounds times
+static EchoResult runEcho(int backend, int numClients, int rounds, int size) {
+  numHandlerSyscalls = 0;
+
+  auto eloop = new EventLoop(1024, backend);
+  auto tp = new ThreadPool(1);
+
+  Socket listener;
+  int port = listener.bindToFreePort("127.0.0.1");
+  ASSERT_GE(port, 0);
+  ASSERT_TRUE(listener.setNonblocking(true));
+  ASSERT_TRUE(listener.listen(128));
+
+  EchoAcceptor acceptor(eloop, listener.getFD());
+  UringEchoAcceptor uringAcceptor(eloop);
+  if (eloop->getBackend() == Poller::backend_uring) {
+    // fine from this thread as long as the loop is not running yet
+    IoRequest req(IoRequest::io_accept, listener.getFD());
+    req.opt = IoRequest::io_multishot;
+    ASSERT_TRUE(eloop->submitIo(req, &uringAcceptor));
+  } else {
+    ASSERT_TRUE(eloop->addEvent(&acceptor, EventLoop::handle_read));
+  }
+  tp->submit([eloop]() { eloop->loop(); });
+
+  vector<Socket> clients(numClients);
+  for (auto& s : clients) {
+    ASSERT_TRUE(s.connect("127.0.0.1", port));
+    s.setNoDelay(true);
+  }
+  ASSERT_TRUE(waitForLive(numClients));
+
+  auto before = eloop->async([eloop]() {
+    return eloop->getNumSyscalls() + numHandlerSyscalls;
+  }).get();
+
+  string msg(size, 'e');
+  vector<char> reply(size);
+  auto beg = steady_clock::now();
+
+  for (int r = 0; r < rounds; ++r) {
+    for (auto& s : clients) {
+      ASSERT_EQ(write(s.getFD(), msg.data(), size), size);
+    }
+    for (auto& s : clients) {
+      int got = 0;
+      while (got < size) {
+        int n = read(s.getFD(), &reply[got], size - got);
+        ASSERT_GT(n, 0);
+        got += n;
+      }
+      ASSERT_EQ(memcmp(&reply[0], msg.data(), size), 0);
+    }
+  }
+
+  EchoResult ret;
+  ret.micros = duration_cast<microseconds>(steady_clock::now() - beg).count();
+  ret.requests = (int64_t)numClients * rounds;
+  ret.syscalls = eloop->async([eloop]() {
+    return eloop->getNumSyscalls() + numHandlerSyscalls;
+  }).get() - before;
+
+  for (auto& s : clients) {
+    s.close();
+  }
+  ASSERT_TRUE(waitForLive(0));
+
+  if (eloop->getBackend() == Poller::backend_epoll) {
+    eloop->async([eloop, &acceptor]() {
+      return eloop->removeEvent(&acceptor);
+    }).get();
+  }
+  eloop->quitLoopSoon();
+  tp->drain();
+
+  delete eloop;
+  delete tp;
+  listener.close();
+  return ret;
+}
+
+
+TEST(Echo, testEpoll) {
+  FORK {
+    auto ret = runEcho(Poller::backend_epoll, 4, 50, 64);
+    ASSERT_EQ(ret.requests, 200);
+    ASSERT_GT(ret.syscalls, 0);
+  };
+}
+
+TEST(Echo, testUring) {
+  FORK {
+    auto ret = runEcho(Poller::backend_uring, 4, 50, 64);
+    ASSERT_EQ(ret.requests, 200);
+    ASSERT_GT(ret.syscalls, 0);
+  };
+}
+
+// syscalls per request and throughput of the two backends
+TEST(Echo, testPerf) {
+  FORK {
+    const int numClients = printPerf ? 32 : 4;
+    const int rounds = printPerf ? 5000 : 20;
+
+    for (int backend : {Poller::backend_epoll, Poller::backend_uring}) {
+      auto ret = runEcho(backend, numClients, rounds, 64);
+
+      if (printPerf) {
+        const char* name =
+          (backend == Poller::backend_epoll) ? "epoll" : "io_uring";
+        cout << name << ": "
+             << (double)ret.syscalls / ret.requests << " syscalls/request, "
+             << ret.requests * 1000000 / (ret.micros + 1) << " requests/s"
+             << endl;
+      }
+    }
+  };
+}
@@ -2,6 +2,11 @@
 #include "common/ThreadPool.cpp"
 #include "common/UnitTest.cpp"
 
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
 using namespace std;
 using namespace sdb;
 
@@ -105,3 +110,85 @@ TEST(Socket, testNonblocking) {
   };
 }
 
+
+TEST(Socket, testReusePort) {
+  Socket a;
+  ASSERT_FALSE(a.getReusePort());
+  ASSERT_TRUE(a.setReusePort());
+  ASSERT_TRUE(a.getReusePort());
+  ASSERT_TRUE(a.bind("127.0.0.1", 0));
+  ASSERT_TRUE(a.listen(10));
+
+  // a second listener joins the same port
+  Socket b;
+  ASSERT_TRUE(b.setReusePort());
+  ASSERT_TRUE(b.setIncomingCpu(0));
+  ASSERT_EQ(b.getIncomingCpu(), 0);
+  ASSERT_TRUE(b.bind("127.0.0.1", a.getPort()));
+  ASSERT_TRUE(b.listen(10));
+
+  a.close();
+  b.close();
+}
+
+TEST(Socket, testAcceptFlags) {
+  Socket s;
+  ASSERT_TRUE(s.bind("127.0.0.1", 0));
+  ASSERT_TRUE(s.listen(10));
+
+  Socket cli;
+  ASSERT_TRUE(cli.connect("127.0.0.1", s.getPort()));
+
+  Socket conn(s.accept(SOCK_NONBLOCK | SOCK_CLOEXEC));
+  ASSERT_GE(conn.getFD(), 0);
+  ASSERT_TRUE(conn.getNonblocking());
+  ASSERT_TRUE(fcntl(conn.getFD(), F_GETFD) & FD_CLOEXEC);
+
+  conn.close();
+  cli.close();
+  s.close();
+}
+
+TEST(Socket, testSendFile) {
+  Socket s;
+  ASSERT_TRUE(s.bind("127.0.0.1", 0));
+  ASSERT_TRUE(s.listen(10));
+
+  Socket cli;
+  ASSERT_TRUE(cli.connect("127.0.0.1", s.getPort()));
+  Socket conn(s.accept(0));
+  ASSERT_FALSE(conn.getZeroCopy());
+  ASSERT_TRUE(conn.setZeroCopy(true));
+  ASSERT_TRUE(conn.getZeroCopy());
+
+  char path[] = "/tmp/socket_test_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  unlink(path);
+  ASSERT_EQ(write(fd, "0123456789", 10), 10);
+
+  int64_t offset = 2;
+  ASSERT_EQ(conn.sendFile(fd, &offset, 5), 5);
+  ASSERT_EQ(offset, 7);
+
+  int pipeFds[2];
+  ASSERT_EQ(pipe(pipeFds), 0);
+  ASSERT_EQ(write(pipeFds[1], "abc", 3), 3);
+  ASSERT_EQ(conn.spliceFrom(pipeFds[0], 3), 3);
+
+  char buf[8];
+  int got = 0;
+  while (got < 8) {
+    auto n = read(cli.getFD(), buf + got, 8 - got);
+    ASSERT_GT(n, 0);
+    got += n;
+  }
+  ASSERT_TRUE(string(buf, 8) == "23456abc");
+
+  close(pipeFds[0]);
+  close(pipeFds[1]);
+  close(fd);
+  conn.close();
+  cli.close();
+  s.close();
+}
@@ -13,3 +13,45 @@ cpp_unittest(
     "-pthread",
   ],
 )
+
+cpp_unittest(
+  name = "asyncconnection_test",
+  srcs = [
+    "AsyncConnectionTest.cpp",
+  ],
+  deps = [
+    "common:libbase.a",
+    "server:libserver.a",
+  ],
+  linkopt = [
+    "-pthread",
+  ],
+)
+
+cpp_unittest(
+  name = "acceptor_test",
+  srcs = [
+    "AcceptorTest.cpp",
+  ],
+  deps = [
+    "common:libbase.a",
+    "server:libserver.a",
+  ],
+  linkopt = [
+    "-pthread",
+  ],
+)
+
+cpp_unittest(
+  name = "echo_test",
+  srcs = [
+    "EchoTest.cpp",
+  ],
+  deps = [
+    "common:libbase.a",
+    "server:libserver.a",
+  ],
+  linkopt = [
+    "-pthread",
+  ],
+)